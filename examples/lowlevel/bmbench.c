@@ -0,0 +1,246 @@
+/********************************************************************\
+
+  Name:         bmbench.c
+
+  Contents:     Buffer manager benchmark. One producer sends a fixed
+                number of events to a buffer which are received by
+                one or more GET_ALL consumers. The test is done with
+                a locked and with a lock-free buffer and reports
+                events/s and ns/event for both.
+
+  $Id$
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "midas.h"
+#include "msystem.h"
+
+/*------------------------------------------------------------------*/
+
+char host_name[HOST_NAME_LENGTH];
+char expt_name[NAME_LENGTH];
+int event_size = 100;
+int num_events = 1000000;
+int num_consumers = 1;
+int buffer_size = 10 * 1024 * 1024;
+int write_cache_size = 100000;
+int read_cache_size = 100000;
+int batch_size = 0;
+
+/*------------------------------------------------------------------*/
+
+static int consumer(const char *buffer_name)
+{
+   INT status, hBuf, request_id, size, n, mismatches;
+   DWORD last_serial;
+   char *event;
+
+   status = cm_connect_experiment(host_name, expt_name, "BMConsumer", NULL);
+   if (status != CM_SUCCESS)
+      return 1;
+
+   bm_open_buffer(buffer_name, buffer_size, &hBuf);
+   bm_set_cache_size(hBuf, read_cache_size, 0);
+   bm_request_event(hBuf, EVENTID_ALL, TRIGGER_ALL, GET_ALL, &request_id, NULL);
+
+   event = (char *) malloc(event_size + sizeof(EVENT_HEADER));
+
+   last_serial = 0;
+   mismatches = 0;
+   for (n = 0; n < num_events; n++) {
+      size = event_size + sizeof(EVENT_HEADER);
+      status = bm_receive_event(hBuf, event, &size, BM_WAIT);
+      if (status != BM_SUCCESS) {
+         printf("bm_receive_event returned error %d\n", status);
+         break;
+      }
+
+      /* check for lost events and overwritten data */
+      if (((EVENT_HEADER *) event)->serial_number != last_serial + 1 ||
+          *(DWORD *) (event + sizeof(EVENT_HEADER)) != ((EVENT_HEADER *) event)->serial_number)
+         mismatches++;
+      last_serial = ((EVENT_HEADER *) event)->serial_number;
+   }
+
+   if (mismatches)
+      printf("Consumer on \"%s\": %d serial number mismatches\n", buffer_name, mismatches);
+
+   free(event);
+   cm_disconnect_experiment();
+   return mismatches > 0 || n < num_events;
+}
+
+/*------------------------------------------------------------------*/
+
+static int benchmark(const char *buffer_name, BOOL lockfree)
+{
+   INT status, hBuf, i, n;
+   HNDLE hDB;
+   DWORD start, stop;
+   double seconds;
+   char str[256], *event;
+   const EVENT_HEADER **batch;
+   BUFFER_HEADER buffer_header;
+   int fd[2], failed = 0;
+
+   /* consumers have to be forked before we connect, they wait
+      until the buffer has been created in the requested mode */
+   if (pipe(fd) < 0)
+      return 1;
+
+   for (i = 0; i < num_consumers; i++)
+      if (fork() == 0) {
+         close(fd[1]);
+         if (read(fd[0], str, 1) != 1)
+            exit(1);
+         exit(consumer(buffer_name));
+      }
+
+   close(fd[0]);
+
+   status = cm_connect_experiment(host_name, expt_name, "BMProducer", NULL);
+   if (status != CM_SUCCESS)
+      return 1;
+
+   cm_get_experiment_database(&hDB, NULL);
+
+   /* buffer mode and size are taken from the ODB when the buffer gets created */
+   sprintf(str, "/Experiment/Lock-free buffers/%s", buffer_name);
+   db_set_value(hDB, 0, str, &lockfree, sizeof(BOOL), 1, TID_BOOL);
+   sprintf(str, "/Experiment/Buffer sizes/%s", buffer_name);
+   db_set_value(hDB, 0, str, &buffer_size, sizeof(INT), 1, TID_DWORD);
+
+   bm_open_buffer(buffer_name, buffer_size, &hBuf);
+   bm_set_cache_size(hBuf, 0, write_cache_size);
+
+   /* start consumers */
+   for (i = 0; i < num_consumers; i++)
+      if (write(fd[1], "x", 1) != 1)
+         return 1;
+   close(fd[1]);
+
+   /* wait until all consumers are attached */
+   for (i = 0; i < 1000; i++) {
+      bm_get_buffer_info(hBuf, &buffer_header);
+      if (buffer_header.num_clients == num_consumers + 1)
+         break;
+      ss_sleep(10);
+   }
+
+   if (buffer_header.lockfree != lockfree)
+      printf("Buffer \"%s\" already existed with different mode, please stop all its clients\n", buffer_name);
+
+   /* with -B, events are composed in a batch area and sent with bm_send_events() */
+   event = (char *) calloc(batch_size > 0 ? batch_size : 1, ALIGN8(event_size + sizeof(EVENT_HEADER)));
+   batch = (const EVENT_HEADER **) calloc(batch_size > 0 ? batch_size : 1, sizeof(EVENT_HEADER *));
+
+   start = ss_millitime();
+
+   for (n = 1; n <= num_events; n++) {
+      if (batch_size > 0) {
+         i = (n - 1) % batch_size;
+         batch[i] = (EVENT_HEADER *) (event + i * ALIGN8(event_size + sizeof(EVENT_HEADER)));
+         bm_compose_event((EVENT_HEADER *) batch[i], 1, 1, event_size, n);
+         *(DWORD *) (batch[i] + 1) = n;
+
+         if (i + 1 < batch_size && n < num_events)
+            continue;
+
+         status = bm_send_events(hBuf, batch, i + 1, BM_WAIT);
+      } else {
+         bm_compose_event((EVENT_HEADER *) event, 1, 1, event_size, n);
+         *(DWORD *) (event + sizeof(EVENT_HEADER)) = n;
+
+         status = bm_send_event(hBuf, event, event_size + sizeof(EVENT_HEADER), BM_WAIT);
+      }
+
+      if (status != BM_SUCCESS) {
+         printf("bm_send_event returned error %d\n", status);
+         break;
+      }
+   }
+
+   bm_flush_cache(hBuf, BM_WAIT);
+
+   /* wait for consumers to receive all events */
+   for (i = 0; i < num_consumers; i++) {
+      wait(&status);
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+         failed++;
+   }
+
+   stop = ss_millitime();
+   seconds = (stop - start) / 1000.0;
+   if (seconds <= 0)
+      seconds = 0.001;
+
+   printf("%-10s %8d events of %6d bytes, %d consumer(s): %10.0lf events/s, %8.1lf ns/event, %8.1lf MB/s%s\n",
+          lockfree ? "lock-free" : "locked", num_events, event_size, num_consumers,
+          num_events / seconds, seconds * 1E9 / num_events,
+          num_events * (double) (event_size + sizeof(EVENT_HEADER)) / seconds / 1024 / 1024,
+          failed ? ", ERROR" : "");
+
+   free(batch);
+   free(event);
+   cm_disconnect_experiment();
+
+   return failed;
+}
+
+/*------------------------------------------------------------------*/
+
+int main(int argc, char *argv[])
+{
+   int i, status;
+
+   setbuf(stdout, NULL);
+   setbuf(stderr, NULL);
+
+   /* get default from environment */
+   cm_get_environment(host_name, sizeof(host_name), expt_name, sizeof(expt_name));
+
+   /* parse command line parameters */
+   for (i = 1; i < argc; i++) {
+      if (argv[i][0] == '-' && i + 1 < argc) {
+         if (argv[i][1] == 'h')
+            strlcpy(host_name, argv[++i], sizeof(host_name));
+         else if (argv[i][1] == 'e')
+            strlcpy(expt_name, argv[++i], sizeof(expt_name));
+         else if (argv[i][1] == 's')
+            event_size = ALIGN8(atoi(argv[++i]));
+         else if (argv[i][1] == 'n')
+            num_events = atoi(argv[++i]);
+         else if (argv[i][1] == 'c')
+            num_consumers = atoi(argv[++i]);
+         else if (argv[i][1] == 'b')
+            buffer_size = atoi(argv[++i]);
+         else if (argv[i][1] == 'w')
+            write_cache_size = atoi(argv[++i]);
+         else if (argv[i][1] == 'r')
+            read_cache_size = atoi(argv[++i]);
+         else if (argv[i][1] == 'B')
+            batch_size = atoi(argv[++i]);
+         else
+            goto usage;
+      } else {
+       usage:
+         printf("usage: bmbench [-h Hostname] [-e Experiment] [-s event size] [-n number of events]\n");
+         printf("               [-c number of consumers] [-b buffer size] [-w write cache] [-r read cache]\n");
+         printf("               [-B number of events per bm_send_events() call]\n");
+         return 1;
+      }
+   }
+
+   if (event_size < (int) sizeof(DWORD))
+      event_size = 8;
+
+   status = benchmark("BMBENCH", FALSE);
+   status |= benchmark("BMBENCHLF", TRUE);
+
+   return status;
+}
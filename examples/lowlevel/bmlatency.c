@@ -0,0 +1,307 @@
+/********************************************************************\
+
+  Name:         bmlatency.c
+
+  Contents:     Buffer manager wake-up latency test. Measures how long
+                a producer blocked on a full buffer needs to continue
+                after a consumer has freed enough space, and how long
+                a consumer waiting on an empty buffer needs to receive
+                a new event. Results are printed as histograms.
+
+  $Id$
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "midas.h"
+#include "msystem.h"
+
+/*------------------------------------------------------------------*/
+
+char host_name[HOST_NAME_LENGTH];
+char expt_name[NAME_LENGTH];
+int event_size = 1000;
+int buffer_size = 1000000;
+int num_cycles = 200;
+int num_wakeups = 1000;
+int pause_ms = 5;
+BOOL lockfree = FALSE;
+
+const char *buffer_name = "BMLATENCY";
+
+/* time at which the consumer starts to read a given event, shared with the producer */
+double *read_time;
+
+#define N_BINS 22
+
+/*------------------------------------------------------------------*/
+
+static double now_us()
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1E6 + ts.tv_nsec / 1E3;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+   double x = *(const double *) a, y = *(const double *) b;
+
+   return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static void print_histogram(const char *title, double *latency, int n)
+{
+   int i, bin, count[N_BINS], max_count;
+   double sum;
+
+   if (n == 0) {
+      printf("%s: no measurements\n", title);
+      return;
+   }
+
+   /* bins are powers of two in microseconds */
+   memset(count, 0, sizeof(count));
+   for (i = 0, sum = 0; i < n; i++) {
+      for (bin = 0; bin < N_BINS - 1 && latency[i] >= (1 << bin); bin++);
+      count[bin]++;
+      sum += latency[i];
+   }
+
+   qsort(latency, n, sizeof(double), compare_double);
+
+   printf("\n%s, %d measurements:\n", title, n);
+   printf("min %1.1lf us, mean %1.1lf us, median %1.1lf us, 99%% %1.1lf us, max %1.1lf us\n\n",
+          latency[0], sum / n, latency[n / 2], latency[(int) (n * 0.99)], latency[n - 1]);
+
+   for (i = 0, max_count = 1; i < N_BINS; i++)
+      if (count[i] > max_count)
+         max_count = count[i];
+
+   for (bin = 0; bin < N_BINS; bin++) {
+      if (bin < N_BINS - 1)
+         printf("  < %8d us %8d ", 1 << bin, count[bin]);
+      else
+         printf(" >= %8d us %8d ", 1 << (bin - 1), count[bin]);
+      for (i = 0; i < count[bin] * 50 / max_count; i++)
+         printf("#");
+      printf("\n");
+   }
+}
+
+/*------------------------------------------------------------------*/
+
+static int consumer(int events_per_buffer)
+{
+   INT status, hBuf, request_id, size, n, num_full_events;
+   char *event;
+   double *latency;
+
+   status = cm_connect_experiment(host_name, expt_name, "BMLatencyConsumer", NULL);
+   if (status != CM_SUCCESS)
+      return 1;
+
+   bm_open_buffer(buffer_name, buffer_size, &hBuf);
+   bm_request_event(hBuf, EVENTID_ALL, TRIGGER_ALL, GET_ALL, &request_id, NULL);
+
+   event = (char *) malloc(event_size + sizeof(EVENT_HEADER));
+   latency = (double *) malloc(num_wakeups * sizeof(double));
+   num_full_events = num_cycles * events_per_buffer;
+
+   /* let the producer fill the buffer before each cycle */
+   for (n = 1; n <= num_full_events; n++) {
+      if (n % events_per_buffer == 1)
+         ss_sleep(pause_ms);
+
+      read_time[n] = now_us();
+      size = event_size + sizeof(EVENT_HEADER);
+      status = bm_receive_event(hBuf, event, &size, BM_WAIT);
+      if (status != BM_SUCCESS || ((EVENT_HEADER *) event)->serial_number != (DWORD) n) {
+         printf("bm_receive_event returned status %d for event %d\n", status, n);
+         return 1;
+      }
+   }
+
+   /* producer sends single events to the empty buffer */
+   for (n = 0; n < num_wakeups; n++) {
+      size = event_size + sizeof(EVENT_HEADER);
+      status = bm_receive_event(hBuf, event, &size, BM_WAIT);
+      if (status != BM_SUCCESS) {
+         printf("bm_receive_event returned status %d\n", status);
+         return 1;
+      }
+      latency[n] = now_us() - *(double *) (event + sizeof(EVENT_HEADER));
+   }
+
+   print_histogram("Consumer wake-up on empty buffer", latency, num_wakeups);
+
+   free(latency);
+   free(event);
+   cm_disconnect_experiment();
+   return 0;
+}
+
+/*------------------------------------------------------------------*/
+
+static int producer(int start_fd, int events_per_buffer, int total_size)
+{
+   INT status, hBuf, i, n, m, num_full_events, num_blocked;
+   HNDLE hDB;
+   char str[256], *event;
+   double *latency;
+
+   status = cm_connect_experiment(host_name, expt_name, "BMLatencyProducer", NULL);
+   if (status != CM_SUCCESS)
+      return 1;
+
+   cm_get_experiment_database(&hDB, NULL);
+
+   /* buffer mode and size are taken from the ODB when the buffer gets created */
+   sprintf(str, "/Experiment/Lock-free buffers/%s", buffer_name);
+   db_set_value(hDB, 0, str, &lockfree, sizeof(BOOL), 1, TID_BOOL);
+   sprintf(str, "/Experiment/Buffer sizes/%s", buffer_name);
+   db_set_value(hDB, 0, str, &buffer_size, sizeof(INT), 1, TID_DWORD);
+
+   bm_open_buffer(buffer_name, buffer_size, &hBuf);
+
+   /* start consumer */
+   if (write(start_fd, "x", 1) != 1)
+      return 1;
+   close(start_fd);
+
+   event = (char *) calloc(1, event_size + sizeof(EVENT_HEADER));
+   num_full_events = num_cycles * events_per_buffer;
+   latency = (double *) malloc(num_full_events * sizeof(double));
+   num_blocked = 0;
+
+   /* wait for consumer */
+   for (i = 0; i < 1000; i++) {
+      BUFFER_HEADER buffer_header;
+      bm_get_buffer_info(hBuf, &buffer_header);
+      if (buffer_header.num_clients == 2)
+         break;
+      ss_sleep(10);
+   }
+
+   for (n = 1; n <= num_full_events; n++) {
+      bm_compose_event((EVENT_HEADER *) event, 1, 1, event_size, n);
+
+      status = bm_send_event(hBuf, event, event_size + sizeof(EVENT_HEADER), BM_NO_WAIT);
+      if (status == BM_ASYNC_RETURN) {
+         /* buffer is full, producers get woken up when half of the buffer is free */
+         status = bm_send_event(hBuf, event, event_size + sizeof(EVENT_HEADER), BM_WAIT);
+
+         m = n - 1 - (buffer_size / 2) / total_size;
+         if (m > 0)
+            latency[num_blocked++] = now_us() - read_time[m];
+      }
+
+      if (status != BM_SUCCESS) {
+         printf("bm_send_event returned error %d\n", status);
+         return 1;
+      }
+   }
+
+   for (n = 0; n < num_wakeups; n++) {
+      ss_sleep(1);
+      bm_compose_event((EVENT_HEADER *) event, 1, 1, event_size, num_full_events + n + 1);
+      *(double *) (event + sizeof(EVENT_HEADER)) = now_us();
+      bm_send_event(hBuf, event, event_size + sizeof(EVENT_HEADER), BM_WAIT);
+   }
+
+   print_histogram("Producer recovery from full buffer", latency, num_blocked);
+
+   free(latency);
+   free(event);
+   cm_disconnect_experiment();
+   return 0;
+}
+
+/*------------------------------------------------------------------*/
+
+int main(int argc, char *argv[])
+{
+   int i, fd[2], status, events_per_buffer, total_size;
+   pid_t pid;
+   char c;
+
+   setbuf(stdout, NULL);
+   setbuf(stderr, NULL);
+
+   /* get default from environment */
+   cm_get_environment(host_name, sizeof(host_name), expt_name, sizeof(expt_name));
+
+   /* parse command line parameters */
+   for (i = 1; i < argc; i++) {
+      if (argv[i][0] == '-' && argv[i][1] == 'l')
+         lockfree = TRUE;
+      else if (argv[i][0] == '-' && i + 1 < argc) {
+         if (argv[i][1] == 'h')
+            strlcpy(host_name, argv[++i], sizeof(host_name));
+         else if (argv[i][1] == 'e')
+            strlcpy(expt_name, argv[++i], sizeof(expt_name));
+         else if (argv[i][1] == 's')
+            event_size = ALIGN8(atoi(argv[++i]));
+         else if (argv[i][1] == 'b')
+            buffer_size = atoi(argv[++i]);
+         else if (argv[i][1] == 'c')
+            num_cycles = atoi(argv[++i]);
+         else if (argv[i][1] == 'n')
+            num_wakeups = atoi(argv[++i]);
+         else if (argv[i][1] == 'p')
+            pause_ms = atoi(argv[++i]);
+         else
+            goto usage;
+      } else {
+       usage:
+         printf("usage: bmlatency [-h Hostname] [-e Experiment] [-s event size] [-b buffer size]\n");
+         printf("                 [-c number of buffer-full cycles] [-n number of wake-ups]\n");
+         printf("                 [-p consumer pause in ms] [-l use lock-free buffer]\n");
+         return 1;
+      }
+   }
+
+   if (event_size < (int) sizeof(double))
+      event_size = sizeof(double);
+
+   if (lockfree)
+      buffer_name = "BMLATENCYLF";
+
+   total_size = ALIGN8(event_size + sizeof(EVENT_HEADER));
+   events_per_buffer = buffer_size / total_size;
+
+   read_time = (double *) mmap(NULL, (num_cycles * events_per_buffer + 1) * sizeof(double),
+                               PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if (read_time == MAP_FAILED) {
+      printf("Cannot allocate shared memory\n");
+      return 1;
+   }
+
+   /* consumer waits until the producer has created the buffer */
+   if (pipe(fd) < 0)
+      return 1;
+
+   pid = fork();
+   if (pid == 0) {
+      close(fd[1]);
+      if (read(fd[0], &c, 1) != 1)
+         exit(1);
+      exit(consumer(events_per_buffer));
+   }
+   close(fd[0]);
+
+   status = producer(fd[1], events_per_buffer, total_size);
+
+   waitpid(pid, &i, 0);
+   if (!WIFEXITED(i) || WEXITSTATUS(i) != 0)
+      status = 1;
+
+   return status;
+}
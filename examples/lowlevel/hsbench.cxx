@@ -0,0 +1,304 @@
+/********************************************************************\
+
+  Name:         hsbench.cxx
+
+  Contents:     FileHistory read benchmark. Writes a synthetic history
+                event with one large FLOAT array and a few variables of
+                other types through hs_write_event(), then reads a
+                selection of them back with hs_read() and
+                hs_read_binned(). Reports records/s and MB/s scanned
+                and checks every value read. With "-s", the data is
+                spread over many files which are read with "-t"
+                threads. With one record per second and 1000 bins,
+                hs_read_binned() uses the rollup files from about
+                2.4 million records on.
+
+  $Id$
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+#include "midas.h"
+#include "history.h"
+
+/*------------------------------------------------------------------*/
+
+const char *dir_name = "/tmp/hsbench";
+int num_records = 2000000;
+int num_floats = 250;
+int num_reads = 3;
+int num_threads = 1;
+int define_period = 0;
+BOOL write_data = TRUE;
+
+const time_t first_time = 1400000000;
+
+#define EVENT_NAME "hsbench"
+
+/* record layout: FLOAT f[num_floats], DWORD d[4], DOUBLE x[2], WORD w[2] */
+
+static double expected(int ivar, int irec)
+{
+   switch (ivar) {
+   case 0:
+      return (float) ((irec * 7) % 1000000);
+   case 1:
+      return (float) ((irec * 7 + num_floats - 1) % 1000000);
+   case 2:
+      return (DWORD) (irec * 4 + 3);
+   case 3:
+      return irec * 0.5 + 1;
+   default:
+      return (WORD) (irec + 1);
+   }
+}
+
+/*------------------------------------------------------------------*/
+
+static int write_history(MidasHistoryInterface *mh)
+{
+   int i, k, status, size;
+   TAG tags[4];
+   char *buf;
+   float *f;
+   DWORD *d, start, stop;
+   double *x, seconds;
+   WORD *w;
+
+   memset(tags, 0, sizeof(tags));
+   strlcpy(tags[0].name, "f", sizeof(tags[0].name));
+   tags[0].type = TID_FLOAT;
+   tags[0].n_data = num_floats;
+   strlcpy(tags[1].name, "d", sizeof(tags[1].name));
+   tags[1].type = TID_DWORD;
+   tags[1].n_data = 4;
+   strlcpy(tags[2].name, "x", sizeof(tags[2].name));
+   tags[2].type = TID_DOUBLE;
+   tags[2].n_data = 2;
+   strlcpy(tags[3].name, "w", sizeof(tags[3].name));
+   tags[3].type = TID_WORD;
+   tags[3].n_data = 2;
+
+   size = num_floats * sizeof(float) + 4 * sizeof(DWORD) + 2 * sizeof(double) + 2 * sizeof(WORD);
+   buf = (char *) malloc(size);
+   f = (float *) buf;
+   d = (DWORD *) (f + num_floats);
+   x = (double *) (d + 4);
+   w = (WORD *) (x + 2);
+
+   start = ss_millitime();
+
+   for (i = 0; i < num_records; i++) {
+      /* redefining the event starts a new file once the current one exceeds 100 MiB */
+      if (i == 0 || (define_period > 0 && i % define_period == 0)) {
+         status = mh->hs_define_event(EVENT_NAME, first_time + i, 4, tags);
+         if (status != HS_SUCCESS) {
+            printf("hs_define_event() returned status %d\n", status);
+            free(buf);
+            return 1;
+         }
+      }
+
+      for (k = 0; k < num_floats; k++)
+         f[k] = (float) ((i * 7 + k) % 1000000);
+      for (k = 0; k < 4; k++)
+         d[k] = i * 4 + k;
+      for (k = 0; k < 2; k++)
+         x[k] = i * 0.5 + k;
+      for (k = 0; k < 2; k++)
+         w[k] = i + k;
+
+      status = mh->hs_write_event(EVENT_NAME, first_time + i, size, buf);
+      if (status != HS_SUCCESS) {
+         printf("hs_write_event() returned status %d at record %d\n", status, i);
+         free(buf);
+         return 1;
+      }
+   }
+
+   mh->hs_flush_buffers();
+
+   stop = ss_millitime();
+   seconds = (stop - start) / 1000.0;
+   if (seconds <= 0)
+      seconds = 0.001;
+
+   printf("Wrote %d records of %d bytes: %10.0lf records/s, %8.1lf MB/s\n",
+          num_records, size + 4, num_records / seconds, num_records * (double) (size + 4) / seconds / 1024 / 1024);
+
+   free(buf);
+   return 0;
+}
+
+/*------------------------------------------------------------------*/
+
+static int read_history(MidasHistoryInterface *mh, BOOL binned)
+{
+   int i, j, status, errors;
+   const int num_var = 5;
+   const int num_bins = 1000;
+   const char *event_name[num_var];
+   const char *var_name[num_var] = { "f", "f", "d", "x", "w" };
+   int var_index[num_var] = { 0, num_floats - 1, 3, 1, 1 };
+   int num_entries[num_var], st[num_var];
+   time_t *time_buffer[num_var];
+   double *data_buffer[num_var];
+   int *count_bins[num_var];
+   double *mean_bins[num_var];
+   DWORD start, stop;
+   double seconds, record_size, sum, expected_sum;
+
+   for (i = 0; i < num_var; i++) {
+      event_name[i] = EVENT_NAME;
+      time_buffer[i] = NULL;
+      data_buffer[i] = NULL;
+      count_bins[i] = (int *) calloc(num_bins, sizeof(int));
+      mean_bins[i] = (double *) calloc(num_bins, sizeof(double));
+   }
+
+   /* make sure the schema is not cached from the previous pass */
+   mh->hs_clear_cache();
+
+   start = ss_millitime();
+
+   if (binned)
+      status = mh->hs_read_binned(first_time, first_time + num_records - 1, num_bins,
+                                  num_var, event_name, var_name, var_index,
+                                  num_entries, count_bins, mean_bins, NULL, NULL, NULL, NULL, NULL, st);
+   else
+      status = mh->hs_read(first_time, first_time + num_records - 1, 0,
+                           num_var, event_name, var_name, var_index,
+                           num_entries, time_buffer, data_buffer, st);
+
+   stop = ss_millitime();
+   seconds = (stop - start) / 1000.0;
+   if (seconds <= 0)
+      seconds = 0.001;
+
+   errors = 0;
+   if (status != HS_SUCCESS) {
+      printf("hs_read() returned status %d\n", status);
+      errors++;
+   }
+
+   for (i = 0; i < num_var; i++) {
+      if (binned) {
+         /* the bins may come from the rollups, check the sum of all values */
+         sum = expected_sum = 0;
+         for (j = 0, num_entries[i] = 0; j < num_bins; j++) {
+            num_entries[i] += count_bins[i][j];
+            if (count_bins[i][j] > 0)
+               sum += mean_bins[i][j] * count_bins[i][j];
+         }
+         for (j = 0; j < num_records; j++)
+            expected_sum += expected(i, j);
+         if (fabs(sum - expected_sum) > 1E-9 * fabs(expected_sum)) {
+            printf("Variable %s[%d]: sum of binned values %.1lf, expected %.1lf\n", var_name[i], var_index[i], sum, expected_sum);
+            errors++;
+         }
+      } else {
+         for (j = 0; j < num_entries[i]; j++)
+            if (time_buffer[i][j] != first_time + j || data_buffer[i][j] != expected(i, j)) {
+               if (errors++ < 10)
+                  printf("Variable %s[%d], entry %d: got %.1lf at time %d, expected %.1lf\n",
+                         var_name[i], var_index[i], j, data_buffer[i][j], (int) time_buffer[i][j], expected(i, j));
+            }
+      }
+
+      if (num_entries[i] != num_records) {
+         printf("Variable %s[%d]: got %d entries, expected %d\n", var_name[i], var_index[i], num_entries[i], num_records);
+         errors++;
+      }
+
+      free(time_buffer[i]);
+      free(data_buffer[i]);
+      free(count_bins[i]);
+      free(mean_bins[i]);
+   }
+
+   record_size = 4 + num_floats * sizeof(float) + 4 * sizeof(DWORD) + 2 * sizeof(double) + 2 * sizeof(WORD);
+
+   printf("%-14s %d records, %d variables, %d thread(s): %10.0lf records/s, %8.1lf ns/value, %8.1lf MB/s scanned, %d error(s)\n",
+          binned ? "hs_read_binned" : "hs_read", num_records, num_var, num_threads, num_records / seconds,
+          seconds * 1E9 / num_records / num_var, num_records * record_size / seconds / 1024 / 1024, errors);
+
+   return errors > 0;
+}
+
+/*------------------------------------------------------------------*/
+
+int main(int argc, char *argv[])
+{
+   int i, status;
+   char str[256];
+   MidasHistoryInterface *mh;
+
+   setbuf(stdout, NULL);
+   setbuf(stderr, NULL);
+
+   /* parse command line parameters */
+   for (i = 1; i < argc; i++) {
+      if (argv[i][0] == '-' && argv[i][1] == 'r')
+         write_data = FALSE;
+      else if (argv[i][0] == '-' && i + 1 < argc) {
+         if (argv[i][1] == 'd')
+            dir_name = argv[++i];
+         else if (argv[i][1] == 'n')
+            num_records = atoi(argv[++i]);
+         else if (argv[i][1] == 'f')
+            num_floats = atoi(argv[++i]);
+         else if (argv[i][1] == 'l')
+            num_reads = atoi(argv[++i]);
+         else if (argv[i][1] == 't')
+            num_threads = atoi(argv[++i]);
+         else if (argv[i][1] == 's')
+            define_period = atoi(argv[++i]);
+         else
+            goto usage;
+      } else {
+       usage:
+         printf("usage: hsbench [-d history directory] [-n number of records] [-f number of floats per record]\n");
+         printf("               [-l number of read loops] [-t number of read threads]\n");
+         printf("               [-s records between hs_define_event() calls] [-r (read existing data only)]\n");
+         return 1;
+      }
+   }
+
+   if (num_floats < 1)
+      num_floats = 1;
+
+   if (write_data) {
+      /* remove data from previous runs */
+      mkdir(dir_name, 0755);
+      sprintf(str, "rm -f %s/mhf_*_%s.dat*", dir_name, EVENT_NAME);
+      if (system(str) != 0)
+         printf("Cannot remove old data: \"%s\"\n", str);
+   }
+
+   mh = MakeMidasHistoryFile();
+   status = mh->hs_connect(dir_name);
+   if (status != HS_SUCCESS) {
+      printf("hs_connect(\"%s\") returned status %d\n", dir_name, status);
+      return 1;
+   }
+
+   mh->hs_set_read_threads(num_threads);
+
+   status = 0;
+   if (write_data)
+      status = write_history(mh);
+
+   for (i = 0; i < num_reads && status == 0; i++) {
+      status |= read_history(mh, FALSE);
+      status |= read_history(mh, TRUE);
+   }
+
+   mh->hs_disconnect();
+   delete mh;
+
+   return status;
+}
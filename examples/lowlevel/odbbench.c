@@ -0,0 +1,816 @@
+/********************************************************************\
+
+  Name:         odbbench.c
+
+  Contents:     ODB key lookup benchmark. Creates a scratch database
+                with a number of keys spread over directories of a
+                given size, then looks up random keys by their full
+                path and relative to their directory with db_find_key()
+                and reports keys/s and lookups/s. Every handle found
+                is checked against the one returned at creation.
+                With -p, reader processes read random keys with
+                db_get_data() while this process writes to the same
+                keys, to measure concurrent access to the database.
+                With -w, the keys of the first directory are written
+                one by one while the directory is open as a hot-link,
+                to count the record updates each sweep causes.
+                With -u, single elements of an array in an open record
+                are changed, to measure the update latency and the
+                bytes sent over the loopback interface per update.
+                With -c, string keys are resized, deleted and created
+                at random to measure the allocator of the database,
+                which is compacted afterwards.
+                With -b, the keys are saved in the ASCII, XML, JSON and
+                binary snapshot formats and restored from all but JSON,
+                and a pasted binary snapshot is compared with the
+                original.
+                With -j, /Bench is written as JSON into a reused buffer
+                and streamed into a file with db_save_json(), and the
+                two are compared.
+
+  $Id$
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "midas.h"
+#include "msystem.h"
+
+/*------------------------------------------------------------------*/
+
+char host_name[HOST_NAME_LENGTH];
+char expt_name[NAME_LENGTH];
+int num_keys = 100000;
+int dir_size = 10000;
+int num_lookups = 1000000;
+int database_size = 64 * 1024 * 1024;
+int num_readers = 0;
+BOOL reader = FALSE;
+int num_sweeps = 0;
+int array_size = 0;
+int num_churn = 0;
+int num_snapshots = 0;
+int num_json = 0;
+int record_updates, watch_updates;
+
+#define DATABASE_NAME "ODBBENCH"
+
+/*------------------------------------------------------------------*/
+
+static double seconds_since(DWORD start)
+{
+   double seconds = (ss_millitime() - start) / 1000.0;
+
+   if (seconds <= 0)
+      seconds = 0.001;
+   return seconds;
+}
+
+/*------------------------------------------------------------------*/
+
+static int read_keys(HNDLE hDB, int id)
+/* reader process: read random keys which have been created by the main process */
+{
+   INT i, n, size, data, status, errors;
+   HNDLE hKey;
+   DWORD start;
+   char str[256];
+   double seconds;
+
+   errors = 0;
+   srand(id + 2);
+   start = ss_millitime();
+   for (n = 0; n < num_lookups; n++) {
+      i = rand() % num_keys;
+      sprintf(str, "/Bench/Dir%d/Key%d", i / dir_size, i);
+      status = db_find_key(hDB, 0, str, &hKey);
+      if (status == DB_SUCCESS) {
+         size = sizeof(data);
+         status = db_get_data(hDB, hKey, &data, &size, TID_INT);
+      }
+      if (status != DB_SUCCESS)
+         errors++;
+   }
+   seconds = seconds_since(start);
+   printf("Reader %d: %d reads: %10.0lf reads/s, %d error(s)\n", id, num_lookups, num_lookups / seconds, errors);
+
+   return errors > 0;
+}
+
+/*------------------------------------------------------------------*/
+
+static int run_readers(HNDLE hDB, const char *program)
+/* start reader processes and write to the keys until they are done */
+{
+   INT i, n, data, status, errors, running;
+   pid_t *pids;
+   DWORD start;
+   char str[256], arg[5][32];
+   char *args[16];
+   double seconds;
+
+   pids = (pid_t *) calloc(num_readers, sizeof(pid_t));
+
+   start = ss_millitime();
+   for (i = 0; i < num_readers; i++) {
+      sprintf(arg[0], "%d", num_keys);
+      sprintf(arg[1], "%d", dir_size);
+      sprintf(arg[2], "%d", num_lookups);
+      sprintf(arg[3], "%d", database_size / 1024 / 1024);
+      sprintf(arg[4], "%d", i);
+      n = 0;
+      args[n++] = (char *) program;
+      args[n++] = (char *) "-n";
+      args[n++] = arg[0];
+      args[n++] = (char *) "-d";
+      args[n++] = arg[1];
+      args[n++] = (char *) "-l";
+      args[n++] = arg[2];
+      args[n++] = (char *) "-s";
+      args[n++] = arg[3];
+      args[n++] = (char *) "-r";
+      args[n++] = arg[4];
+      args[n++] = (char *) "-e";
+      args[n++] = expt_name;
+      args[n++] = (char *) "-h";
+      args[n++] = host_name;
+      args[n] = NULL;
+
+      pids[i] = fork();
+      if (pids[i] == 0) {
+         execvp(program, args);
+         perror("execvp");
+         _exit(1);
+      }
+   }
+
+   /* write until all readers are done */
+   errors = 0;
+   running = num_readers;
+   for (n = 0; running > 0; n++) {
+      i = rand() % num_keys;
+      sprintf(str, "/Bench/Dir%d/Key%d", i / dir_size, i);
+      data = n;
+      status = db_set_value(hDB, 0, str, &data, sizeof(data), 1, TID_INT);
+      if (status != DB_SUCCESS)
+         errors++;
+
+      if ((n % 100) == 0) {
+         for (i = 0; i < num_readers; i++)
+            if (pids[i] > 0 && waitpid(pids[i], &status, WNOHANG) == pids[i]) {
+               if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                  errors++;
+               pids[i] = 0;
+               running--;
+            }
+         if (running > 0)
+            ss_sleep(1);
+      }
+   }
+   seconds = seconds_since(start);
+   printf("%d readers: %10.0lf reads/s in total, writer: %10.0lf writes/s, %d error(s)\n",
+          num_readers, num_readers * num_lookups / seconds, n / seconds, errors);
+
+   free(pids);
+   return errors;
+}
+
+/*------------------------------------------------------------------*/
+
+static void record_update(INT hDB, INT hKey, void *info)
+{
+   record_updates++;
+}
+
+static void watch_update(INT hDB, INT hKey, INT index, void *info)
+{
+   watch_updates++;
+}
+
+static int run_hotlink(HNDLE hDB, HNDLE hDir, HNDLE * hkeys, int num_channels)
+/* write all channels of one directory in a number of sweeps, once per
+   notify mode, and count the notifications received for the directory */
+{
+   INT mode, sweep, i, n, size, data, status, errors;
+   DWORD start;
+   void *record;
+   double seconds;
+   static const char *mode_name[] = { "no window", "20 ms window", "batch" };
+
+   errors = 0;
+   status = db_get_record_size(hDB, hDir, 0, &size);
+   if (status != DB_SUCCESS)
+      return 1;
+   record = malloc(size);
+
+   for (mode = 0; mode < 3; mode++) {
+      db_set_notify_window(mode == 1 ? 20 : 0);
+
+      status = db_open_record(hDB, hDir, record, size, MODE_READ, record_update, NULL);
+      if (status == DB_SUCCESS)
+         status = db_watch(hDB, hDir, watch_update, NULL);
+      if (status != DB_SUCCESS) {
+         printf("Cannot open hot-link, status %d\n", status);
+         errors++;
+         break;
+      }
+
+      record_updates = watch_updates = 0;
+      start = ss_millitime();
+      for (sweep = 0; sweep < num_sweeps; sweep++) {
+         if (mode == 2)
+            db_begin_batch(hDB);
+         for (i = 0; i < num_channels; i++) {
+            data = sweep;
+            if (db_set_data(hDB, hkeys[i], &data, sizeof(data), 1, TID_INT) != DB_SUCCESS)
+               errors++;
+         }
+         if (mode == 2)
+            db_end_batch(hDB);
+         cm_yield(0);
+      }
+      seconds = seconds_since(start);
+
+      /* receive remaining notifications */
+      for (i = 0; i < 2;) {
+         n = record_updates + watch_updates;
+         cm_yield(100);
+         i = (n == record_updates + watch_updates) ? i + 1 : 0;
+      }
+
+      printf("Hot-link, %-12s: %d sweeps of %d channels in %6.3lf s, %8.1lf record updates/sweep, %8.1lf watch calls/sweep\n",
+             mode_name[mode], num_sweeps, num_channels, seconds,
+             (double) record_updates / num_sweeps, (double) watch_updates / num_sweeps);
+
+      db_unwatch(hDB, hDir);
+      db_close_record(hDB, hDir);
+   }
+
+   db_set_notify_window(0);
+   free(record);
+   return errors;
+}
+
+/*------------------------------------------------------------------*/
+
+static double loopback_bytes(void)
+/* bytes sent over the loopback interface, by UDP notifications and RPC */
+{
+   FILE *f;
+   char line[256];
+   double n = 0;
+
+   f = fopen("/proc/net/dev", "r");
+   if (f == NULL)
+      return 0;
+   while (fgets(line, sizeof(line), f))
+      if (strstr(line, "lo:"))
+         n = atof(strstr(line, "lo:") + 3);
+   fclose(f);
+   return n;
+}
+
+static int run_update(HNDLE hDB)
+/* change single elements of an array in an open record */
+{
+   INT i, n, size, status, errors, updates;
+   HNDLE hRec, hArray;
+   float value;
+   char *record, *copy;
+   DWORD start, t0;
+   double bytes;
+   INT count = 0;
+   double time = 0;
+   char name[32] = "bench";
+
+   /* record with a large array followed by some scalars */
+   db_create_key(hDB, 0, "/Bench/Record", TID_KEY);
+   db_find_key(hDB, 0, "/Bench/Record", &hRec);
+   db_create_key(hDB, hRec, "Demand", TID_FLOAT);
+   db_find_key(hDB, hRec, "Demand", &hArray);
+   value = 0;
+   db_set_data_index(hDB, hArray, &value, sizeof(value), array_size - 1, TID_FLOAT);
+   db_set_value(hDB, hRec, "Count", &count, sizeof(count), 1, TID_INT);
+   db_set_value(hDB, hRec, "Name", name, sizeof(name), 1, TID_STRING);
+   db_set_value(hDB, hRec, "Time", &time, sizeof(time), 1, TID_DOUBLE);
+
+   db_get_record_size(hDB, hRec, 0, &size);
+   record = (char *) malloc(size);
+   copy = (char *) malloc(size);
+
+   /* measure the latency of single notifications */
+   db_set_notify_window(0);
+   status = db_open_record(hDB, hRec, record, size, MODE_READ, record_update, NULL);
+   if (status != DB_SUCCESS) {
+      printf("Cannot open record, status %d\n", status);
+      return 1;
+   }
+
+   errors = 0;
+   record_updates = 0;
+   bytes = loopback_bytes();
+   start = ss_millitime();
+   for (n = 0; n < num_lookups; n++) {
+      i = rand() % array_size;
+      value = (float) n;
+      updates = record_updates;
+      db_set_data_index(hDB, hArray, &value, sizeof(value), i, TID_FLOAT);
+
+      /* wait for the update */
+      t0 = ss_millitime();
+      while (record_updates == updates && ss_millitime() - t0 < 1000)
+         cm_yield(0);
+      if (record_updates == updates)
+         errors++;
+   }
+   printf("Record of %d bytes, %d updates: %8.1lf us/update, %10.0lf loopback bytes/update, %d error(s)\n",
+          size, num_lookups, seconds_since(start) * 1E6 / num_lookups,
+          (loopback_bytes() - bytes) / num_lookups, errors);
+
+   /* the local copy of the array has to match the ODB */
+   db_get_record(hDB, hRec, copy, &size, 0);
+   if (memcmp(record, copy, array_size * sizeof(float)) != 0) {
+      printf("Record differs from ODB\n");
+      errors++;
+   }
+
+   db_close_record(hDB, hRec);
+   db_set_notify_window(0);
+   free(record);
+   free(copy);
+
+   return errors;
+}
+
+/*------------------------------------------------------------------*/
+
+static void churn_string(char *str, int i, int len)
+{
+   memset(str, 'a' + i % 26, len);
+   str[len] = 0;
+}
+
+static int run_churn(HNDLE hDB)
+/* resize, delete and create string keys of 1 to 1000 characters */
+{
+   INT i, n, size, status, errors, moved, nk;
+   INT *len;
+   HNDLE hDir, hKey;
+   DWORD start;
+   char name[32], str[1024], value[1024];
+   double seconds;
+
+   nk = num_keys < 10000 ? num_keys : 10000;
+   len = (INT *) malloc(nk * sizeof(INT));
+
+   db_create_key(hDB, 0, "/Bench/Churn", TID_KEY);
+   db_find_key(hDB, 0, "/Bench/Churn", &hDir);
+   for (i = 0; i < nk; i++) {
+      sprintf(name, "S%d", i);
+      len[i] = 1 + rand() % 1000;
+      churn_string(str, i, len[i]);
+      db_set_value(hDB, hDir, name, str, len[i] + 1, 1, TID_STRING);
+   }
+
+   errors = 0;
+   start = ss_millitime();
+   for (n = 0; n < num_churn; n++) {
+      i = rand() % nk;
+      sprintf(name, "S%d", i);
+      if (rand() % 4 == 0) {
+         db_find_key(hDB, hDir, name, &hKey);
+         db_delete_key(hDB, hKey, FALSE);
+      }
+      len[i] = 1 + rand() % 1000;
+      churn_string(str, i, len[i]);
+      status = db_set_value(hDB, hDir, name, str, len[i] + 1, 1, TID_STRING);
+      if (status != DB_SUCCESS)
+         errors++;
+   }
+   seconds = seconds_since(start);
+   printf("Churn of %d string keys, %d changes: %10.0lf changes/s, %8.1lf us/change, %d error(s)\n",
+          nk, num_churn, num_churn / seconds, seconds * 1E6 / num_churn, errors);
+
+   if (!rpc_is_remote()) {
+      start = ss_millitime();
+      status = db_compact(hDB, &moved);
+      printf("db_compact: status %d, moved %d bytes in %1.3lf s\n", status, moved, seconds_since(start));
+      if (status != DB_SUCCESS)
+         errors++;
+   }
+
+   /* all values have to survive the churn and the compaction */
+   for (i = 0; i < nk; i++) {
+      sprintf(name, "S%d", i);
+      size = sizeof(value);
+      churn_string(str, i, len[i]);
+      status = db_get_value(hDB, hDir, name, value, &size, TID_STRING, FALSE);
+      if (status != DB_SUCCESS || size != len[i] + 1 || strcmp(value, str) != 0)
+         errors++;
+   }
+   if (errors)
+      printf("Churn: %d error(s)\n", errors);
+
+   free(len);
+   return errors;
+}
+
+/*------------------------------------------------------------------*/
+
+static int compare_snapshots(const char *a, const char *b)
+/* compare two binary snapshots, except path, name of first key and times */
+{
+   const ODB_SNAPSHOT_HEADER *ha, *hb;
+   const ODB_SNAPSHOT_KEY *ka, *kb;
+   const char *sa, *sb;
+   int i;
+
+   ha = (const ODB_SNAPSHOT_HEADER *) a;
+   hb = (const ODB_SNAPSHOT_HEADER *) b;
+   if (ha->num_keys != hb->num_keys || ha->data_size != hb->data_size)
+      return 1;
+
+   ka = (const ODB_SNAPSHOT_KEY *) (ha + 1);
+   kb = (const ODB_SNAPSHOT_KEY *) (hb + 1);
+   sa = (const char *) (ka + ha->num_keys);
+   sb = (const char *) (kb + hb->num_keys);
+   for (i = 0; i < ha->num_keys; i++) {
+      if (ka[i].parent != kb[i].parent || ka[i].type != kb[i].type || ka[i].num_values != kb[i].num_values ||
+          ka[i].item_size != kb[i].item_size || ka[i].data != kb[i].data || ka[i].access_mode != kb[i].access_mode)
+         return 1;
+      if (i > 0 && strcmp(sa + ka[i].name, sb + kb[i].name) != 0)
+         return 1;
+   }
+
+   return memcmp(sa + ha->strings_size, sb + hb->strings_size, ha->data_size) != 0;
+}
+
+static int run_snapshot(HNDLE hDB)
+/* save and restore /Bench in all formats */
+{
+   INT i, n, size, status, errors, text_size, xml_size, json_size, json_end, bin_size;
+   HNDLE hBench, hCopy;
+   float values[100];
+   char name[32], str[32];
+   char *text, *xml, *json, *bin, *copy;
+   DWORD start;
+   double t_text[2], t_xml[2], t_json, t_bin[2];
+
+   /* add arrays and strings next to the scalars */
+   for (i = 0; i < 100; i++)
+      values[i] = (float) i / 7;
+   for (i = 0; i < num_keys / 100; i++) {
+      sprintf(name, "/Bench/Arrays/F%d", i);
+      db_set_value(hDB, 0, name, values, sizeof(values), 100, TID_FLOAT);
+      sprintf(name, "/Bench/Strings/S%d", i);
+      sprintf(str, "string %d", i);
+      db_set_value(hDB, 0, name, str, sizeof(str), 1, TID_STRING);
+   }
+   db_find_key(hDB, 0, "/Bench", &hBench);
+
+   size = 1024 * 1024;
+   do {
+      size *= 2;
+      text_size = xml_size = bin_size = size;
+      text = (char *) malloc(size);
+      xml = (char *) calloc(size, 1);
+      bin = (char *) malloc(size);
+      copy = (char *) malloc(size);
+      if (db_copy(hDB, hBench, text, &text_size, "") != DB_TRUNCATED &&
+          db_copy_xml(hDB, hBench, xml, &xml_size) != DB_TRUNCATED &&
+          db_copy_binary(hDB, hBench, bin, &bin_size) != DB_TRUNCATED)
+         break;
+      free(text);
+      free(xml);
+      free(bin);
+      free(copy);
+   } while (1);
+   json = NULL;
+   json_size = json_end = 0;
+   errors = 0;
+
+   /* save */
+   start = ss_millitime();
+   for (n = 0; n < num_snapshots; n++) {
+      text_size = size;
+      db_copy(hDB, hBench, text, &text_size, "");
+   }
+   t_text[0] = seconds_since(start) / num_snapshots;
+   start = ss_millitime();
+   for (n = 0; n < num_snapshots; n++) {
+      xml_size = size;
+      status = db_copy_xml(hDB, hBench, xml, &xml_size);
+      if (status != DB_SUCCESS) {
+         printf("Cannot save snapshot as XML, status %d\n", status);
+         errors++;
+         break;
+      }
+   }
+   t_xml[0] = seconds_since(start) / num_snapshots;
+   start = ss_millitime();
+   for (n = 0; n < num_snapshots; n++) {
+      json_end = 0;
+      db_copy_json_save(hDB, hBench, &json, &json_size, &json_end);
+   }
+   t_json = seconds_since(start) / num_snapshots;
+   start = ss_millitime();
+   for (n = 0; n < num_snapshots; n++) {
+      bin_size = size;
+      db_copy_binary(hDB, hBench, bin, &bin_size);
+   }
+   t_bin[0] = seconds_since(start) / num_snapshots;
+
+   /* restore, overwriting the existing keys */
+   start = ss_millitime();
+   for (n = 0; n < num_snapshots; n++)
+      db_paste(hDB, 0, text);
+   t_text[1] = seconds_since(start) / num_snapshots;
+   start = ss_millitime();
+   for (n = 0; n < num_snapshots; n++)
+      db_paste_xml(hDB, hBench, xml);
+   t_xml[1] = seconds_since(start) / num_snapshots;
+   start = ss_millitime();
+   for (n = 0; n < num_snapshots; n++)
+      db_paste_binary(hDB, 0, bin, bin_size);
+   t_bin[1] = seconds_since(start) / num_snapshots;
+
+   printf("Snapshot of %d keys, save/restore in ms:\n", num_keys + 2 * (num_keys / 100));
+   printf("  ASCII  %10d bytes: %8.1lf %8.1lf\n", size - text_size, t_text[0] * 1E3, t_text[1] * 1E3);
+   printf("  XML    %10d bytes: %8.1lf %8.1lf\n", size - xml_size, t_xml[0] * 1E3, t_xml[1] * 1E3);
+   /* db_paste_json() is C++ and not available here */
+   printf("  JSON   %10d bytes: %8.1lf        -\n", json_end, t_json * 1E3);
+   printf("  binary %10d bytes: %8.1lf %8.1lf\n", bin_size, t_bin[0] * 1E3, t_bin[1] * 1E3);
+
+   /* restore below an empty directory, which has to give an exact copy in /Copy/Bench */
+   db_create_key(hDB, 0, "/Copy", TID_KEY);
+   db_find_key(hDB, 0, "/Copy", &hCopy);
+   status = db_paste_binary(hDB, hCopy, bin, bin_size);
+   i = size;
+   if (status == DB_SUCCESS)
+      status = db_find_key(hDB, hCopy, "Bench", &hBench);
+   if (status != DB_SUCCESS || db_copy_binary(hDB, hBench, copy, &i) != DB_SUCCESS || compare_snapshots(bin, copy)) {
+      printf("Restored snapshot differs from original\n");
+      errors++;
+   }
+   db_delete_key(hDB, hCopy, FALSE);
+
+   free(text);
+   free(xml);
+   free(json);
+   free(bin);
+   free(copy);
+
+   return errors;
+}
+
+/*------------------------------------------------------------------*/
+
+static int run_json(HNDLE hDB)
+/* write /Bench as JSON into a buffer and into a file */
+{
+   INT n, status, errors, buffer_size, buffer_end, values_size, file_size;
+   HNDLE hBench;
+   char *buffer, *file;
+   const char *escaped = "quote \" backslash \\ tab \t newline \n";
+   char filename[] = "odbbench.json";
+   DWORD start;
+   FILE *fp;
+   double t_save, t_values, t_file;
+
+   db_set_value(hDB, 0, "/Bench/Escaped", escaped, strlen(escaped) + 1, 1, TID_STRING);
+   db_find_key(hDB, 0, "/Bench", &hBench);
+
+   /* the buffer is reused between calls, as mhttpd does */
+   buffer = NULL;
+   buffer_size = 0;
+   errors = 0;
+
+   start = ss_millitime();
+   for (n = 0; n < num_json; n++) {
+      buffer_end = 0;
+      db_copy_json_values(hDB, hBench, &buffer, &buffer_size, &buffer_end, FALSE, FALSE, 0);
+   }
+   t_values = seconds_since(start) / num_json;
+   values_size = buffer_end;
+
+   start = ss_millitime();
+   for (n = 0; n < num_json; n++) {
+      buffer_end = 0;
+      db_copy_json_save(hDB, hBench, &buffer, &buffer_size, &buffer_end);
+   }
+   t_save = seconds_since(start) / num_json;
+
+   start = ss_millitime();
+   for (n = 0; n < num_json; n++)
+      db_save_json(hDB, hBench, filename);
+   t_file = seconds_since(start) / num_json;
+
+   printf("JSON of %d keys in ms:\n", num_keys);
+   printf("  db_copy_json_values %10d bytes: %8.1lf\n", values_size, t_values * 1E3);
+   printf("  db_copy_json_save   %10d bytes: %8.1lf\n", buffer_end, t_save * 1E3);
+
+   /* the file holds a header, then the same text as db_copy_json_save()
+      without the opening brace, plus a final newline */
+   fp = fopen(filename, "r");
+   file = (char *) malloc(buffer_end + 1024 * 1024);
+   file_size = fp ? fread(file, 1, buffer_end + 1024 * 1024, fp) : 0;
+   if (fp)
+      fclose(fp);
+   remove(filename);
+   printf("  db_save_json        %10d bytes: %8.1lf\n", file_size, t_file * 1E3);
+
+   if (file_size < buffer_end || memcmp(file + file_size - buffer_end, buffer + 1, buffer_end - 1) != 0) {
+      printf("JSON file differs from db_copy_json_save()\n");
+      errors++;
+   }
+   if (strstr(buffer, "\"quote \\\" backslash \\\\ tab \\t newline \\n\"") == NULL) {
+      printf("JSON string escapes are wrong\n");
+      errors++;
+   }
+
+   status = db_find_key(hDB, 0, "/Bench/Escaped", &hBench);
+   if (status == DB_SUCCESS)
+      db_delete_key(hDB, hBench, FALSE);
+
+   free(file);
+   free(buffer);
+
+   return errors;
+}
+
+/*------------------------------------------------------------------*/
+
+int main(int argc, char *argv[])
+{
+   INT i, n, status, errors, num_dirs, id = 0;
+   HNDLE hDB, hKey, *hkeys, *hdirs;
+   DWORD start;
+   char str[256];
+   double seconds;
+
+   setbuf(stdout, NULL);
+   setbuf(stderr, NULL);
+
+   /* get default from environment */
+   cm_get_environment(host_name, sizeof(host_name), expt_name, sizeof(expt_name));
+
+   /* parse command line parameters */
+   for (i = 1; i < argc; i++) {
+      if (argv[i][0] == '-' && i + 1 < argc) {
+         if (argv[i][1] == 'e')
+            strlcpy(expt_name, argv[++i], sizeof(expt_name));
+         else if (argv[i][1] == 'h')
+            strlcpy(host_name, argv[++i], sizeof(host_name));
+         else if (argv[i][1] == 'n')
+            num_keys = atoi(argv[++i]);
+         else if (argv[i][1] == 'd')
+            dir_size = atoi(argv[++i]);
+         else if (argv[i][1] == 'l')
+            num_lookups = atoi(argv[++i]);
+         else if (argv[i][1] == 's')
+            database_size = atoi(argv[++i]) * 1024 * 1024;
+         else if (argv[i][1] == 'p')
+            num_readers = atoi(argv[++i]);
+         else if (argv[i][1] == 'w')
+            num_sweeps = atoi(argv[++i]);
+         else if (argv[i][1] == 'u')
+            array_size = atoi(argv[++i]);
+         else if (argv[i][1] == 'c')
+            num_churn = atoi(argv[++i]);
+         else if (argv[i][1] == 'b')
+            num_snapshots = atoi(argv[++i]);
+         else if (argv[i][1] == 'j')
+            num_json = atoi(argv[++i]);
+         else if (argv[i][1] == 'r') {
+            reader = TRUE;
+            id = atoi(argv[++i]);
+         }
+         else
+            goto usage;
+      } else {
+       usage:
+         printf("usage: odbbench [-h Hostname] [-e Experiment] [-n number of keys]\n");
+         printf("                [-d keys per directory] [-l number of lookups]\n");
+         printf("                [-s database size in MB] [-p number of reader processes]\n");
+         printf("                [-w number of hot-link sweeps] [-u array size]\n");
+         printf("                [-c number of key changes] [-b number of snapshots]\n");
+         printf("                [-j number of JSON copies]\n");
+         return 1;
+      }
+   }
+
+   if (num_keys < 1)
+      num_keys = 1;
+   if (dir_size < 1)
+      dir_size = 1;
+   num_dirs = (num_keys + dir_size - 1) / dir_size;
+
+   status = cm_connect_experiment(host_name, expt_name, reader ? "ODBBenchReader" : "ODBBench", NULL);
+   if (status != CM_SUCCESS)
+      return 1;
+
+   /* use a scratch database, the experiment ODB is usually too small */
+   status = db_open_database(DATABASE_NAME, database_size, &hDB, "ODBBench");
+   if (status != DB_SUCCESS && status != DB_CREATED) {
+      printf("db_open_database returned status %d\n", status);
+      cm_disconnect_experiment();
+      return 1;
+   }
+
+   if (reader) {
+      status = read_keys(hDB, id);
+      cm_disconnect_experiment();
+      return status;
+   }
+
+   hkeys = (HNDLE *) malloc(num_keys * sizeof(HNDLE));
+   hdirs = (HNDLE *) malloc(num_dirs * sizeof(HNDLE));
+
+   /* create keys */
+   start = ss_millitime();
+   for (i = 0; i < num_keys; i++) {
+      sprintf(str, "/Bench/Dir%d/Key%d", i / dir_size, i);
+      status = db_create_key(hDB, 0, str, TID_INT);
+      if (status == DB_SUCCESS)
+         status = db_find_key(hDB, 0, str, &hkeys[i]);
+      if (status != DB_SUCCESS) {
+         printf("Cannot create key \"%s\", status %d\n", str, status);
+         num_keys = i;
+         num_dirs = (num_keys + dir_size - 1) / dir_size;
+         break;
+      }
+   }
+   seconds = seconds_since(start);
+   printf("Created %d keys in %d directories: %10.0lf keys/s\n", num_keys, num_dirs, num_keys / seconds);
+
+   for (i = 0; i < num_dirs; i++) {
+      sprintf(str, "/Bench/Dir%d", i);
+      db_find_key(hDB, 0, str, &hdirs[i]);
+   }
+
+   errors = 0;
+
+   /* look up random keys by full path */
+   srand(1);
+   start = ss_millitime();
+   for (n = 0; n < num_lookups && num_keys > 0; n++) {
+      i = rand() % num_keys;
+      sprintf(str, "/Bench/Dir%d/Key%d", i / dir_size, i);
+      status = db_find_key(hDB, 0, str, &hKey);
+      if (status != DB_SUCCESS || hKey != hkeys[i])
+         errors++;
+   }
+   seconds = seconds_since(start);
+   printf("db_find_key, full path:     %d lookups: %10.0lf lookups/s, %8.1lf ns/lookup, %d error(s)\n",
+          num_lookups, num_lookups / seconds, seconds * 1E9 / num_lookups, errors);
+
+   /* look up random keys relative to their directory */
+   start = ss_millitime();
+   for (n = 0; n < num_lookups && num_keys > 0; n++) {
+      i = rand() % num_keys;
+      sprintf(str, "Key%d", i);
+      status = db_find_key(hDB, hdirs[i / dir_size], str, &hKey);
+      if (status != DB_SUCCESS || hKey != hkeys[i])
+         errors++;
+   }
+   seconds = seconds_since(start);
+   printf("db_find_key, relative path: %d lookups: %10.0lf lookups/s, %8.1lf ns/lookup, %d error(s)\n",
+          num_lookups, num_lookups / seconds, seconds * 1E9 / num_lookups, errors);
+
+   if (num_readers > 0 && num_keys > 0)
+      errors += run_readers(hDB, argv[0]);
+
+   if (num_sweeps > 0 && num_keys > 0)
+      errors += run_hotlink(hDB, hdirs[0], hkeys, num_keys < dir_size ? num_keys : dir_size);
+
+   if (array_size > 0)
+      errors += run_update(hDB);
+
+   if (num_churn > 0 && num_keys > 0)
+      errors += run_churn(hDB);
+
+   if (num_snapshots > 0)
+      errors += run_snapshot(hDB);
+
+   if (num_json > 0)
+      errors += run_json(hDB);
+
+   /* delete keys */
+   start = ss_millitime();
+   db_find_key(hDB, 0, "/Bench", &hKey);
+   db_delete_key(hDB, hKey, FALSE);
+   seconds = seconds_since(start);
+   printf("Deleted %d keys: %10.0lf keys/s\n", num_keys, num_keys / seconds);
+
+   free(hkeys);
+   free(hdirs);
+
+   /* closes the scratch database as well */
+   cm_disconnect_experiment();
+
+   return errors > 0;
+}
@@ -0,0 +1,153 @@
+/********************************************************************\
+
+  Name:         rbstress.c
+
+  Contents:     Stress test for the rb_xxx ring buffer functions. A
+                producer thread writes events of varying size as fast
+                as it can, while the main thread reads them back and
+                checks serial numbers, sizes and contents. Reports
+                events/s and the number of corrupted events.
+
+  $Id$
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "midas.h"
+#include "msystem.h"
+
+/*------------------------------------------------------------------*/
+
+int num_events = 10000000;
+int max_event_size = 1000;
+int buffer_size = 100000;
+int timeout = 10000;
+
+int rb_handle;
+volatile int producer_status = 0;
+
+/*------------------------------------------------------------------*/
+
+static int data_size(DWORD serial)
+{
+   /* vary the size to exercise the wrap-around in all positions */
+   return ((serial * 7919) % (max_event_size - sizeof(EVENT_HEADER))) & ~3;
+}
+
+static INT producer(void *param)
+{
+   int n, i, status, size;
+   void *p;
+   EVENT_HEADER *pevent;
+   DWORD *pdata;
+
+   for (n = 1; n <= num_events; n++) {
+      status = rb_get_wp(rb_handle, &p, timeout);
+      if (status != DB_SUCCESS) {
+         printf("rb_get_wp returned status %d for event %d\n", status, n);
+         producer_status = status;
+         return status;
+      }
+
+      size = data_size(n);
+      pevent = (EVENT_HEADER *) p;
+      bm_compose_event(pevent, 1, 1, size, n);
+
+      pdata = (DWORD *) (pevent + 1);
+      for (i = 0; i < size / 4; i++)
+         pdata[i] = n ^ i;
+
+      rb_increment_wp(rb_handle, ALIGN8(sizeof(EVENT_HEADER) + size));
+   }
+
+   return SUCCESS;
+}
+
+/*------------------------------------------------------------------*/
+
+int main(int argc, char *argv[])
+{
+   int i, n, status, errors;
+   void *p;
+   EVENT_HEADER *pevent;
+   DWORD *pdata, start, stop;
+   double seconds, bytes;
+
+   setbuf(stdout, NULL);
+   setbuf(stderr, NULL);
+
+   /* parse command line parameters */
+   for (i = 1; i < argc; i++) {
+      if (argv[i][0] == '-' && i + 1 < argc) {
+         if (argv[i][1] == 'n')
+            num_events = atoi(argv[++i]);
+         else if (argv[i][1] == 's')
+            max_event_size = ALIGN8(atoi(argv[++i]));
+         else if (argv[i][1] == 'b')
+            buffer_size = atoi(argv[++i]);
+         else if (argv[i][1] == 't')
+            timeout = atoi(argv[++i]);
+         else
+            goto usage;
+      } else {
+       usage:
+         printf("usage: rbstress [-n number of events] [-s max event size] [-b buffer size]\n");
+         printf("                [-t timeout in ms]\n");
+         return 1;
+      }
+   }
+
+   if (max_event_size < (int) sizeof(EVENT_HEADER) + 8)
+      max_event_size = sizeof(EVENT_HEADER) + 8;
+
+   status = rb_create(buffer_size, max_event_size, &rb_handle);
+   if (status != DB_SUCCESS) {
+      printf("rb_create returned status %d\n", status);
+      return 1;
+   }
+
+   start = ss_millitime();
+   ss_thread_create(producer, NULL);
+
+   errors = 0;
+   bytes = 0;
+   for (n = 1; n <= num_events; n++) {
+      status = rb_get_rp(rb_handle, &p, timeout);
+      if (status != DB_SUCCESS) {
+         printf("rb_get_rp returned status %d for event %d\n", status, n);
+         return 1;
+      }
+
+      pevent = (EVENT_HEADER *) p;
+      if (pevent->serial_number != (DWORD) n || (int) pevent->data_size != data_size(n)) {
+         printf("Event %d: got serial number %d with %d bytes\n", n, pevent->serial_number,
+                pevent->data_size);
+         return 1;
+      }
+
+      pdata = (DWORD *) (pevent + 1);
+      for (i = 0; i < (int) pevent->data_size / 4; i++)
+         if (pdata[i] != (DWORD) (n ^ i)) {
+            errors++;
+            break;
+         }
+
+      bytes += ALIGN8(sizeof(EVENT_HEADER) + pevent->data_size);
+      rb_increment_rp(rb_handle, ALIGN8(sizeof(EVENT_HEADER) + pevent->data_size));
+   }
+
+   stop = ss_millitime();
+   seconds = (stop - start) / 1000.0;
+   if (seconds <= 0)
+      seconds = 0.001;
+
+   printf("%d events up to %d bytes: %10.0lf events/s, %8.1lf ns/event, %8.1lf MB/s, %d corrupted event(s)\n",
+          num_events, max_event_size, num_events / seconds, seconds * 1E9 / num_events,
+          bytes / seconds / 1024 / 1024, errors);
+
+   rb_delete(rb_handle);
+
+   return errors > 0 || producer_status != 0;
+}
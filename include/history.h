@@ -57,6 +57,12 @@ class MidasHistoryBufferInterface
    virtual ~MidasHistoryBufferInterface() { }; // dtor
  public:
    virtual void Add(time_t time, double value) = 0;
+   virtual void AddChunk(int n, const time_t time[], const double value[]) { for (int i=0; i<n; i++) Add(time[i], value[i]); }; // add "n" values at once
+   virtual time_t GetBinWidth() const { return 0; }; // >0 if this buffer only needs statistics of bins this wide, see AddBin()
+   virtual bool SameBin(time_t t1, time_t t2) const { return false; }; // true if times t1 and t2 fall into the same bin, see GetBinWidth()
+   virtual void AddBin(time_t time, int count, double sum, double sum2, double min, double max, time_t last_time, double last_value) { Add(time, sum/count); }; // add pre-binned statistics of "count" values
+   virtual MidasHistoryBufferInterface* Clone() const { return NULL; }; // new empty buffer with the same settings for parallel reads, NULL if not supported
+   virtual void Merge(MidasHistoryBufferInterface* buffer) { }; // add the data of a buffer created by Clone(), called in time order
 };
 
 // MIDAS history interface class
@@ -82,6 +88,8 @@ class MidasHistoryInterface
 
   virtual int hs_set_debug(int debug) = 0;          ///< set debug level, returns previous debug level
 
+  virtual int hs_set_read_threads(int num_threads) { return 0; }; ///< set number of threads used to read data, returns previous value
+
   virtual int hs_clear_cache() = 0; ///< clear internal cache, returns HS_SUCCESS
 
   // functions for writing into the history, used by mlogger
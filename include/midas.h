@@ -38,7 +38,12 @@ The main include file
  *  @{  */
 
 /* has to be changed whenever binary ODB format changes */
-#define DATABASE_VERSION 3
+#define DATABASE_VERSION 4
+
+/* has to be changed whenever binary event buffer format changes. Buffers
+   of older libraries have num_clients at this place, so it is kept above
+   MAX_CLIENTS */
+#define BUFFER_VERSION 101
 
 /* MIDAS version number which will be incremented for every release */
 #define MIDAS_VERSION "2.1"
@@ -302,6 +307,7 @@ Event Sampling type */
 #define GET_ALL   (1<<0)      /**< get all events (consume)           */
 #define GET_NONBLOCKING (1<<1)/**< get as much as possible without blocking producer */
 #define GET_RECENT (1<<2)     /**< get recent event (not older than 1 s)*/
+#define GET_IN_PLACE (1<<3)   /**< callback gets event in shared memory, ORed with the above */
 
 /**
 Data types Definition                         min      max    */
@@ -387,6 +393,7 @@ Equipment types */
 #define EQ_FRAGMENTED  (1<<6)   /**< Fragmented Event */
 #define EQ_EB          (1<<7)   /**< Event run through the event builder */
 #define EQ_USER        (1<<8)   /**< Polling handled in user part */
+#define EQ_IN_PLACE    (1<<9)   /**< Readout writes into the event buffer */
 
 /**
 Read - On flags */
@@ -584,6 +591,7 @@ System message types */
 #define BM_MORE_EVENTS              216   /**< - */
 #define BM_INVALID_MIXING           217   /**< - */
 #define BM_NO_SHM                   218   /**< - */
+#define BM_VERSION_MISMATCH         219   /**< - */
 /**dox***************************************************************/
           /** @} *//* end of group 22 */
 
@@ -883,11 +891,18 @@ typedef struct {
    INT sampling_type;            /**< GET_ALL, GET_NONBLOCKING, GET_RECENT */
 } EVENT_REQUEST;
 
+typedef struct {
+   short int event_id;           /**< event ID                        */
+   short int trigger_mask;       /**< trigger mask                    */
+   INT client_index;             /**< client owning the request       */
+   INT id;                       /**< request id                      */
+} GET_ALL_REQUEST;
+
 typedef struct {
    char name[NAME_LENGTH];            /**< name of client             */
    INT pid;                           /**< process ID                 */
-   INT unused0;                       /**< was thread ID              */
-   INT unused;                        /**< was thread handle          */
+   INT wake_count;                    /**< futex word for wake up     */
+   BOOL futex_wait;                   /**< waits on wake_count        */
    INT port;                          /**< UDP port for wake up       */
    INT read_pointer;                  /**< read pointer to buffer     */
    INT max_request_index;             /**< index of last request      */
@@ -908,6 +923,7 @@ typedef struct {
 
 typedef struct {
    char name[NAME_LENGTH];            /**< name of buffer             */
+   INT version;                       /**< BUFFER_VERSION             */
    INT num_clients;                   /**< no of active clients       */
    INT max_client_index;              /**< index of last client       */
    INT size;                          /**< size of data area in bytes */
@@ -917,6 +933,13 @@ typedef struct {
    INT num_out_events;                /**< no of distributed events   */
 
    BUFFER_CLIENT client[MAX_CLIENTS]; /**< entries for clients        */
+   BOOL lockfree;                     /**< readers do not lock buffer */
+   INT num_get_all_clients;           /**< clients with GET_ALL requests */
+   INT num_get_all_requests;          /**< entries in get_all_request */
+   GET_ALL_REQUEST get_all_request[MAX_CLIENTS * MAX_EVENT_REQUESTS]; /**< GET_ALL requests of all clients,
+                                         kept by every client, so changes need a new BUFFER_VERSION */
+   INT reserved_client;               /**< client index + 1 of bm_reserve_event() */
+   INT reserved_size;                 /**< space reserved at write pointer */
 
 } BUFFER_HEADER;
 
@@ -939,6 +962,10 @@ typedef struct {
    INT shm_handle;                  /**< handle to shared memory      */
    INT index;                       /**< connection index / tid       */
    BOOL callback;                   /**< callback defined for this buffer */
+   INT peek_size;                   /**< size of event from bm_peek_event, 0 if none */
+   INT peek_read_pointer;           /**< read pointer of event held in buffer, -1 if copied */
+   char *peek_buffer;               /**< copy of event from bm_peek_event */
+   INT peek_buffer_size;            /**< size of peek buffer          */
 
 } BUFFER;
 
@@ -960,6 +987,7 @@ typedef struct {
    INT parent;                        /**< Address of parent key      */
    INT num_keys;                      /**< number of keys             */
    INT first_key;                     /**< Address of first key       */
+   INT hash;                          /**< Address of name hash index, 0 if none */
 } KEYLIST;
 
 /**dox***************************************************************/
@@ -1750,9 +1778,14 @@ extern "C" {
                                   INT request_id);
    INT EXPRT bm_delete_request(INT request_id);
    INT EXPRT bm_send_event(INT buffer_handle, const void *event, INT buf_size, INT async_flag);
+   INT EXPRT bm_send_events(INT buffer_handle, const EVENT_HEADER * events[], INT n_events, INT async_flag);
+   INT EXPRT bm_reserve_event(INT buffer_handle, INT max_size, void **ppevent);
+   INT EXPRT bm_commit_event(INT buffer_handle, void *pevent, INT buf_size);
    INT EXPRT bm_receive_event(INT buffer_handle, void *destination,
                               INT * buf_size, INT async_flag);
    INT EXPRT bm_skip_event(INT buffer_handle);
+   INT EXPRT bm_peek_event(INT buffer_handle, const EVENT_HEADER ** ppevent, INT async_flag);
+   INT EXPRT bm_release_event(INT buffer_handle);
    INT EXPRT bm_flush_cache(INT buffer_handle, INT async_flag);
    INT EXPRT bm_poll_event(INT flag);
    INT EXPRT bm_empty_buffers(void);
@@ -1820,6 +1853,8 @@ extern "C" {
    INT EXPRT db_watch(HNDLE hDB, HNDLE hKey, void (*dispatcher) (INT, INT, INT, void *info), void *info);
    INT EXPRT db_unwatch(HNDLE hDB, HNDLE hKey);
    INT EXPRT db_unwatch_all();
+   INT EXPRT db_begin_batch(HNDLE hDB);
+   INT EXPRT db_end_batch(HNDLE hDB);
    
    INT EXPRT db_load(HNDLE hdb, HNDLE key_handle, const char *filename, BOOL bRemote);
    INT EXPRT db_save(HNDLE hdb, HNDLE key_handle, const char *filename, BOOL bRemote);
@@ -1830,6 +1865,8 @@ extern "C" {
    INT EXPRT db_save_string(HNDLE hDB, HNDLE hKey, const char *file_name, const char *string_name, BOOL append);
    INT EXPRT db_save_xml(HNDLE hDB, HNDLE hKey, const char *file_name);
    INT EXPRT db_copy_xml(HNDLE hDB, HNDLE hKey, char *buffer, INT * buffer_size);
+   INT EXPRT db_copy_binary(HNDLE hDB, HNDLE hKey, char *buffer, INT * buffer_size);
+   INT EXPRT db_paste_binary(HNDLE hDB, HNDLE hKeyRoot, const char *buffer, INT buffer_size);
 
    INT EXPRT db_save_json(HNDLE hDB, HNDLE hKey, const char *file_name);
    INT EXPRT db_load_json(HNDLE hdb, HNDLE key_handle, const char *filename);
@@ -134,6 +134,10 @@
 #include <sys/mtio.h>
 #endif
 
+#if defined(OS_LINUX)
+#include <linux/futex.h>
+#endif
+
 #include <sys/syscall.h>
 #include <dirent.h>
 #include <pthread.h>
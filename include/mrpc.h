@@ -65,6 +65,7 @@ routine IDs for RPC calls
 #define RPC_BM_MARK_READ_WAITING        11112 /**< - */
 #define RPC_BM_EMPTY_BUFFERS            11113 /**< - */
 #define RPC_BM_SKIP_EVENT               11114 /**< - */
+#define RPC_BM_SEND_EVENTS              11115 /**< - */
 
 #define RPC_DB_OPEN_DATABASE            11200 /**< - */
 #define RPC_DB_CLOSE_DATABASE           11201 /**< - */
@@ -109,6 +110,9 @@ routine IDs for RPC calls
 #define RPC_DB_GET_LINK_DATA            11243 /**< - */
 #define RPC_DB_SET_LINK_DATA            11244 /**< - */
 #define RPC_DB_SET_LINK_DATA_INDEX      11245 /**< - */
+#define RPC_DB_BEGIN_BATCH              11246 /**< - */
+#define RPC_DB_END_BATCH                11247 /**< - */
+#define RPC_DB_COPY_BINARY              11248 /**< - */
 
 #define RPC_HS_SET_PATH                 11300 /**< - */
 #define RPC_HS_DEFINE_EVENT             11301 /**< - */
@@ -102,6 +102,32 @@ SWAP QWORD macro */
                        *(((BYTE *)(x))+4) = _tmp; }
 #endif
 
+/**
+Atomic access to variables in shared memory. Loads have acquire,
+stores have release semantics. Without compiler support, the lock-free
+buffer manager mode is not available and plain accesses are used. */
+#if defined(__GNUC__)
+#define HAVE_SS_ATOMIC 1
+#define SS_ATOMIC_LOAD(p)       __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define SS_ATOMIC_STORE(p, v)   __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define SS_ATOMIC_ADD(p, v)     __atomic_add_fetch((p), (v), __ATOMIC_ACQ_REL)
+#define SS_ATOMIC_CAS(p, o, n)  __sync_bool_compare_and_swap((p), (o), (n))
+#define SS_ATOMIC_FENCE()       __sync_synchronize()
+#else
+#define SS_ATOMIC_LOAD(p)       (*(p))
+#define SS_ATOMIC_STORE(p, v)   (*(p) = (v))
+#define SS_ATOMIC_ADD(p, v)     (*(p) += (v))
+#define SS_ATOMIC_CAS(p, o, n)  ((*(p) == (o)) ? (*(p) = (n), TRUE) : FALSE)
+#define SS_ATOMIC_FENCE()
+#endif
+
+/**
+Processes on the same host can wait on a word in shared memory and
+get woken up by other processes via ss_futex_wait/ss_futex_wake. */
+#if defined(OS_LINUX) && defined(HAVE_SS_ATOMIC)
+#define HAVE_SS_FUTEX 1
+#endif
+
 /**dox***************************************************************/
           /** @} *//* end of msmacroh */
 
@@ -317,6 +343,7 @@ typedef struct {
    INT remote_hw_type;          /*  remote hardware type    */
    INT transport;               /*  RPC_TCP/RPC_FTCP        */
    INT rpc_timeout;             /*  in milliseconds         */
+   BOOL send_events;            /*  server knows RPC_BM_SEND_EVENTS */
 
 } RPC_SERVER_CONNECTION;
 
@@ -355,6 +382,52 @@ typedef struct {
    INT next_free;                     /**< Address of next free block */
 } FREE_DESCRIP;
 
+#define ODB_SLAB_CLASSES 64           /**< free lists for blocks of 8, 16, ... 512 bytes */
+#define ODB_SLAB_MAX (8*ODB_SLAB_CLASSES) /**< largest block of exact size class */
+#define ODB_FREE_SUBBINS 8            /**< bins per power of two above ODB_SLAB_MAX */
+#define ODB_FREE_BINS (12*ODB_FREE_SUBBINS) /**< bins for blocks up to 2 MB */
+#define ODB_FREE_CLASSES (ODB_SLAB_CLASSES+ODB_FREE_BINS)
+
+/* Binary ODB snapshot written by db_copy_binary(): header, array of
+   keys in pre-order, string table and data section. Offsets are
+   relative to the start of their section, so snapshots can be loaded
+   into any database at any place. */
+
+#define ODB_SNAPSHOT_MAGIC   "MIDASODB"
+#define ODB_SNAPSHOT_VERSION 1
+#define ODB_SNAPSHOT_ORDER   0x01020304
+
+typedef struct {
+   char magic[8];                     /**< ODB_SNAPSHOT_MAGIC, not terminated */
+   INT version;                       /**< ODB_SNAPSHOT_VERSION          */
+   DWORD byte_order;                  /**< ODB_SNAPSHOT_ORDER of writer  */
+   INT total_size;                    /**< size of snapshot in bytes     */
+   INT num_keys;                      /**< number of keys                */
+   INT strings_size;                  /**< size of string table          */
+   INT data_size;                     /**< size of data section          */
+   INT path;                          /**< string offset of path of first key */
+   INT reserved;                      /**< zero                          */
+} ODB_SNAPSHOT_HEADER;
+
+typedef struct {
+   INT parent;                        /**< index of parent, -1 for first key */
+   DWORD type;                        /**< TID_xxx type                  */
+   INT num_values;                    /**< number of values              */
+   INT item_size;                     /**< size of single data item      */
+   INT name;                          /**< string offset of key name     */
+   INT data;                          /**< offset in data section        */
+   WORD access_mode;                  /**< access mode                   */
+   WORD reserved;                     /**< zero                          */
+   DWORD last_written;                /**< time of last write action     */
+} ODB_SNAPSHOT_KEY;
+
+typedef struct {
+   INT size;                          /**< number of slots, power of two */
+   INT num_used;                      /**< number of used and deleted slots */
+   INT last_key;                      /**< Address of last key in keylist */
+   INT slot[1];                       /**< Addresses of keys, 0 if empty, -1 if deleted */
+} KEYHASH;
+
 typedef struct {
    INT handle;                        /**< Handle of record base key  */
    WORD access_mode;                  /**< R/W flags                  */
@@ -365,7 +438,7 @@ typedef struct {
 typedef struct {
    char name[NAME_LENGTH];      /* name of client             */
    INT pid;                     /* process ID                 */
-   INT unused0;                 /* was thread ID              */
+   INT read_locks;              /* number of read locks held  */
    INT unused;                  /* was thread handle          */
    INT port;                    /* UDP port for wake up       */
    INT num_open_records;        /* number of open records     */
@@ -387,11 +460,36 @@ typedef struct {
    INT root_key;                /* root key offset            */
    INT first_free_key;          /* first free key memory      */
    INT first_free_data;         /* first free data memory     */
+   INT num_readers;             /* number of read locks held  */
+   INT writer;                  /* TRUE while a writer holds or waits for the lock */
+   INT open_record_serial;      /* incremented when a record is opened */
+   INT free_key_class[ODB_FREE_CLASSES];  /* free key blocks by size  */
+   INT free_data_class[ODB_FREE_CLASSES]; /* free data blocks by size */
 
    DATABASE_CLIENT client[MAX_CLIENTS]; /* entries for clients        */
 
 } DATABASE_HEADER;
 
+/* Per-process index of open records and pending hot-link notifications */
+
+#define NOTIFY_MAX_KEYS 64      /* changed keys sent in one notification */
+#define IPC_MSG_SIZE    2048    /* maximum size of ss_resume() messages */
+
+typedef struct {
+   HNDLE handle;                /* key of open record           */
+   INT client;                  /* index of client in header    */
+   INT slot;                    /* index in client open_record  */
+} NOTIFY_ENTRY;
+
+typedef struct {
+   HNDLE handle;                /* key of open record           */
+   INT port;                    /* UDP port of client           */
+   DWORD last_sent;             /* time of last notification    */
+   INT num_keys;                /* number of pending keys       */
+   HNDLE key[NOTIFY_MAX_KEYS];  /* changed keys                 */
+   INT index[NOTIFY_MAX_KEYS];  /* changed array index, or -1   */
+} NOTIFY_PENDING;
+
 /* Per-process buffer access structure (descriptor) */
 
 typedef struct {
@@ -402,16 +500,34 @@ typedef struct {
    void *database_data;         /* pointer to database data     */
    HNDLE semaphore;             /* semaphore handle             */
    INT lock_cnt;                /* flag to avoid multiple locks */
+   BOOL read_lock;              /* lock is held for reading only */
+   double num_locks;            /* number of times the semaphore was obtained */
    HNDLE shm_handle;            /* handle (id) to shared memory */
    INT index;                   /* connection index / tid       */
    BOOL protect;                /* read/write protection        */
    MUTEX_T *mutex;              /* mutex for multi-thread access */
    MUTEX_T *am;                 /* temporary access mutex       */
+   INT notify_serial;           /* open_record_serial of index  */
+   INT num_notify;              /* number of entries in index   */
+   NOTIFY_ENTRY *notify;        /* open records sorted by key   */
+   INT num_pending;             /* entries in pending list      */
+   INT max_pending;             /* allocated pending entries    */
+   INT pending_keys;            /* keys waiting to be sent      */
+   NOTIFY_PENDING *pending;     /* pending notifications        */
+   INT batch_cnt;               /* db_begin_batch() nesting     */
 
 } DATABASE;
 
 /* Open record descriptor */
 
+typedef struct {
+   HNDLE handle;                /* Handle of key in record    */
+   INT offset;                  /* Offset of data in record   */
+   INT item_size;               /* Size of one element        */
+   INT num_values;              /* Number of elements         */
+   DWORD type;                  /* TID_xxx type               */
+} RECORD_ITEM;
+
 typedef struct {
    HNDLE handle;                /* Handle of record base key  */
    HNDLE hDB;                   /* Handle of record's database */
@@ -421,6 +537,8 @@ typedef struct {
    INT buf_size;                /* Record size in bytes       */
    void (*dispatcher) (INT, INT, void *);       /* Pointer to dispatcher func. */
    void *info;                  /* addtl. info for dispatcher */
+   INT num_items;               /* Number of keys in items    */
+   RECORD_ITEM *items;          /* Keys sorted by handle, NULL if record is always copied */
 
 } RECORD_LIST;
 
@@ -440,6 +558,7 @@ typedef struct {
    short int event_id;          /* same as in EVENT_HEADER */
    short int trigger_mask;
    void (*dispatcher) (HNDLE, HNDLE, EVENT_HEADER *, void *);   /* Dispatcher func. */
+   BOOL in_place;               /* dispatch events in shared memory */
 
 } REQUEST_LIST;
 
@@ -498,6 +617,7 @@ extern "C" {
    INT bm_push_event(char *buffer_name);
    INT bm_check_buffers(void);
    INT EXPRT bm_remove_event_request(INT buffer_handle, INT request_id);
+   INT bm_send_packed_events(INT buffer_handle, char *data, INT size, INT async_flag, INT convert_flags);
    void EXPRT bm_defragment_event(HNDLE buffer_handle, HNDLE request_id,
                                   EVENT_HEADER * pevent, void *pdata,
                                   void (*dispatcher) (HNDLE, HNDLE,
@@ -505,15 +625,21 @@ extern "C" {
 
    /*---- online database ----*/
    INT EXPRT db_lock_database(HNDLE database_handle);
+   INT EXPRT db_lock_database_read(HNDLE database_handle);
    INT EXPRT db_unlock_database(HNDLE database_handle);
    INT EXPRT db_get_lock_cnt(HNDLE database_handle);
+   double EXPRT db_get_num_locks(HNDLE database_handle);
    INT db_update_record(INT hDB, INT hKeyRoot, INT hKey, int index, int s);
    INT db_close_all_records(void);
    INT EXPRT db_flush_database(HNDLE hDB);
    INT EXPRT db_notify_clients(HNDLE hDB, HNDLE hKey, int index, BOOL bWalk);
+   INT db_update_record_list(INT hDB, INT hKeyRoot, INT num_keys, const INT *hKey, const INT *index, int s);
+   INT EXPRT db_flush_notify(INT * millisec);
+   INT EXPRT db_set_notify_window(INT millisec);
    INT EXPRT db_set_client_name(HNDLE hDB, const char *client_name);
    INT db_delete_key1(HNDLE hDB, HNDLE hKey, INT level, BOOL follow_links);
    INT EXPRT db_show_mem(HNDLE hDB, char *result, INT buf_size, BOOL verbose);
+   INT EXPRT db_compact(HNDLE hDB, INT * moved);
 
    /*---- rpc functions -----*/
    RPC_LIST EXPRT *rpc_get_internal_list(INT flag);
@@ -564,12 +690,15 @@ extern "C" {
    INT ss_suspend_get_port(INT * port);
    INT ss_suspend_set_dispatch(INT channel, void *connection, INT(*dispatch) ());
    INT ss_resume(INT port, const char *message);
+   INT ss_futex_wait(INT * address, INT value, INT millisec);
+   INT ss_futex_wake(INT * address);
    INT ss_suspend_exit(void);
    INT ss_exception_handler(void (*func) ());
    void EXPRT ss_force_single_thread();
    INT EXPRT ss_suspend(INT millisec, INT msg);
    midas_thread_t EXPRT ss_thread_create(INT(*func) (void *), void *param);
    INT EXPRT ss_thread_kill(midas_thread_t thread_id);
+   INT EXPRT ss_thread_set_affinity(midas_thread_t thread_id, INT cpu);
    INT EXPRT ss_get_struct_align(void);
    INT EXPRT ss_get_struct_padding(void);
    INT EXPRT ss_timezone(void);
@@ -233,6 +233,14 @@ int hs_get_history(HNDLE hDB, HNDLE hKey, int flags, int debug_flag, MidasHistor
             return status;
          }
          
+         // files of different schema are read in parallel by this many threads
+         int read_threads = 4;
+         size = sizeof(read_threads);
+         status = db_get_value(hDB, hKey, "Read threads", &read_threads, &size, TID_INT, TRUE);
+         assert(status == DB_SUCCESS);
+
+         (*mh)->hs_set_read_threads(read_threads);
+
          if (debug_flag)
             cm_msg(MINFO, "hs_get_history", "Connected history channel \'%s\' type FILE in \'%s\'", key.name, path.c_str());
       }
@@ -14,6 +14,7 @@
 #include "msystem.h"
 
 #include <math.h>
+#include <sys/mman.h>
 
 #include <vector>
 #include <list>
@@ -390,6 +391,7 @@ struct HsSchema
    virtual int close() = 0;
    virtual int write_event(const time_t t, const char* data, const int data_size) = 0;
    virtual int match_event_var(const char* event_name, const char* var_name, const int var_index);
+   virtual bool parallel_read() const { return false; } // read_data() may run concurrently for different schema
    virtual int read_last_written(const time_t timestamp,
                                  const int debug,
                                  time_t* last_written) = 0;
@@ -648,6 +650,59 @@ struct HsSqlSchema : public HsSchema {
                  MidasHistoryBufferInterface* buffer[]);
 };
 
+// FileHistory keeps downsampled copies of each data file in sidecar
+// files "<file_name>.r<width>", one record per bin of "width" seconds with
+// the count, sum, sum of squares, minimum, maximum and last value of
+// every array element. Only complete bins are written, the bin in
+// progress is rebuilt from the data file when the writer reopens it.
+
+static const int kRollupWidth[] = { 600, 3600, 86400 };
+static const int kNumRollups = sizeof(kRollupWidth)/sizeof(kRollupWidth[0]);
+
+// use a rollup only if each requested bin spans at least this many rollup bins
+static const int kRollupMinBins = 4;
+
+struct HsRollupHeader {
+   DWORD bin_time;  // start of the bin
+   DWORD count;     // number of records in the bin
+   DWORD last_time; // time of the last record in the bin
+   DWORD reserved;
+};
+
+struct HsRollupStats {
+   double sum;
+   double sum2;
+   double min;
+   double max;
+   double last;
+};
+
+struct HsFileRollup {
+   int width;
+   std::string file_name;
+   time_t done_time; // end of the last bin written to the file
+   HsRollupHeader hdr; // bin in progress, empty if hdr.count == 0
+   std::vector<HsRollupStats> stats;
+};
+
+// records written by write_event() are collected in a per-file buffer
+// and written out when it holds kWriteBufferSize bytes, when the oldest
+// record in it is kWriteBufferAge seconds old or by flush_buffers() and
+// close(). mlogger calls hs_flush_buffers() every 10 seconds, readers
+// in other processes see new data with at most this delay.
+
+static const int kWriteBufferSize = 64*1024;
+static const int kWriteBufferAge = 10;
+
+// the sidecar file "<file_name>.idx" holds the time of every
+// kIndexStride-th record of the data file as an array of DWORD. It is
+// appended by the writer together with the data and rebuilt from the
+// data file when the writer reopens it. Readers keep a copy of it and
+// use it to find a time with one read of at most kIndexStride records.
+
+static const int kIndexStride = 64;
+static const int kIndexMaxRead = 64*1024;
+
 struct HsFileSchema : public HsSchema {
    std::string file_name;
    int record_size;
@@ -655,12 +710,40 @@ struct HsFileSchema : public HsSchema {
    int last_size;
    int writer_fd;
 
+   // write buffer
+   std::vector<char> write_buffer;
+   time_t write_buffer_time; // when the oldest record was added to the buffer
+
+   // time index
+   bool index_ok;                    // writer: the index file is in step with the data file
+   int writer_nrec;                  // number of records written, including the write buffer
+   std::vector<DWORD> index_buffer;  // index entries not yet written
+   std::vector<DWORD> index;         // reader copy of the index file
+   off_t index_data_size;            // size of the data file when the index was last loaded
+
+   // cached result of read_last_written()
+   off_t last_written_size;          // size of the data file when last_written_time was read
+   time_t last_written_time;         // time of the last record
+
+   // rollup data
+   int n_elements; // total number of array elements in a record
+   std::vector<int> first_element; // index of the first array element of each variable
+   std::vector<HsFileRollup> rollups;
+   std::vector<double> rollup_values;
+
    HsFileSchema() // ctor
    {
       record_size = 0;
       data_offset = 0;
       last_size = 0;
       writer_fd = -1;
+      write_buffer_time = 0;
+      index_ok = false;
+      writer_nrec = 0;
+      index_data_size = 0;
+      last_written_size = 0;
+      last_written_time = 0;
+      n_elements = 0;
    }
 
    ~HsFileSchema() // dtor
@@ -673,9 +756,10 @@ struct HsFileSchema : public HsSchema {
    }
 
    void print(bool print_tags = true) const;
-   int flush_buffers() { return HS_SUCCESS; };
+   int flush_buffers();
    int close();
    int write_event(const time_t t, const char* data, const int data_size);
+   bool parallel_read() const { return true; }
    int read_last_written(const time_t timestamp,
                          const int debug,
                          time_t* last_written);
@@ -684,6 +768,28 @@ struct HsFileSchema : public HsSchema {
                  const int num_var, const int var_schema_index[], const int var_index[],
                  const int debug,
                  MidasHistoryBufferInterface* buffer[]);
+
+protected:
+   int index_open();
+   void index_load(const off_t file_size);
+   int find_time(const int fd, const off_t file_size, const int nrec, const time_t timestamp, int* irecp, time_t* trecp, time_t* trecp2);
+   int read_records(const time_t start_time,
+                    const time_t end_time,
+                    const int num_var, const int var_schema_index[], const int var_index[],
+                    const int debug,
+                    MidasHistoryBufferInterface* buffer[]);
+   int read_rollup(const int width,
+                   const time_t start_time,
+                   const time_t end_time,
+                   const int num_var, const int var_schema_index[], const int var_index[],
+                   const int debug,
+                   MidasHistoryBufferInterface* buffer[],
+                   time_t* from, time_t* to);
+   void rollup_init();
+   int rollup_open();
+   int rollup_add(const time_t t, const char* data);
+   int rollup_write(HsFileRollup* r);
+   int sidecar_append(const std::string& name, const void* data, int size);
 };
 
 ////////////////////////////////////////////
@@ -1803,6 +1909,59 @@ int Sqlite::ExecDisconnected(const char* table_name, const char* sql)
 //    Methods of HsFileSchema     //
 ////////////////////////////////////
 
+template <typename T>
+static void DecodeColumn(const char* ptr, int ii, size_t stride, int n, double* v)
+{
+   ptr += ii*sizeof(T);
+   for (int j=0; j<n; j++) {
+      T x;
+      memcpy(&x, ptr + j*stride, sizeof(T));
+      v[j] = x;
+   }
+}
+
+// decode array element "ii" of type "tid" from "n" records spaced
+// "stride" bytes apart into "v", returns false for unsupported types
+
+static bool DecodeColumn(int tid, const char* ptr, int ii, size_t stride, int n, double* v)
+{
+   switch (tid) {
+   default:
+      return false;
+   case TID_BYTE:
+      DecodeColumn<unsigned char>(ptr, ii, stride, n, v);
+      break;
+   case TID_SBYTE:
+      DecodeColumn<signed char>(ptr, ii, stride, n, v);
+      break;
+   case TID_CHAR:
+      DecodeColumn<char>(ptr, ii, stride, n, v);
+      break;
+   case TID_WORD:
+      DecodeColumn<unsigned short>(ptr, ii, stride, n, v);
+      break;
+   case TID_SHORT:
+      DecodeColumn<signed short>(ptr, ii, stride, n, v);
+      break;
+   case TID_DWORD:
+      DecodeColumn<unsigned int>(ptr, ii, stride, n, v);
+      break;
+   case TID_INT:
+      DecodeColumn<int>(ptr, ii, stride, n, v);
+      break;
+   case TID_BOOL:
+      DecodeColumn<unsigned int>(ptr, ii, stride, n, v);
+      break;
+   case TID_FLOAT:
+      DecodeColumn<float>(ptr, ii, stride, n, v);
+      break;
+   case TID_DOUBLE:
+      DecodeColumn<double>(ptr, ii, stride, n, v);
+      break;
+   }
+   return true;
+}
+
 int HsFileSchema::write_event(const time_t t, const char* data, const int data_size)
 {
    HsFileSchema* s = this;
@@ -1816,30 +1975,35 @@ int HsFileSchema::write_event(const time_t t, const char* data, const int data_s
          return HS_FILE_ERROR;
       }
 
-      int file_size = lseek(s->writer_fd, 0, SEEK_END);
+      off_t file_size = lseek(s->writer_fd, 0, SEEK_END);
 
-      int nrec = (file_size - s->data_offset)/s->record_size;
+      off_t nrec = (file_size - s->data_offset)/s->record_size;
       if (nrec < 0)
          nrec = 0;
-      int data_end = s->data_offset + nrec*s->record_size;
+      off_t data_end = s->data_offset + nrec*s->record_size;
 
-      //printf("file_size %d, nrec %d, data_end %d\n", file_size, nrec, data_end);
+      //printf("file_size %lld, nrec %lld, data_end %lld\n", (long long)file_size, (long long)nrec, (long long)data_end);
 
       if (data_end != file_size) {
          if (nrec > 0)
-            cm_msg(MERROR, "FileHistory::write_event", "File \'%s\' may be truncated, data offset %d, record size %d, file size: %d, should be %d, truncating the file", s->file_name.c_str(), s->data_offset, s->record_size, file_size, data_end);
+            cm_msg(MERROR, "FileHistory::write_event", "File \'%s\' may be truncated, data offset %d, record size %d, file size: %lld, should be %lld, truncating the file", s->file_name.c_str(), s->data_offset, s->record_size, (long long)file_size, (long long)data_end);
 
-         status = lseek(s->writer_fd, data_end, SEEK_SET);
-         if (status < 0) {
-            cm_msg(MERROR, "FileHistory::write_event", "Cannot seek \'%s\' to offset %d, lseek() errno %d (%s)", s->file_name.c_str(), data_end, errno, strerror(errno));
+         if (lseek(s->writer_fd, data_end, SEEK_SET) < 0) {
+            cm_msg(MERROR, "FileHistory::write_event", "Cannot seek \'%s\' to offset %lld, lseek() errno %d (%s)", s->file_name.c_str(), (long long)data_end, errno, strerror(errno));
             return HS_FILE_ERROR;
          }
          status = ftruncate(s->writer_fd, data_end);
          if (status < 0) {
-            cm_msg(MERROR, "FileHistory::write_event", "Cannot truncate \'%s\' to size %d, ftruncate() errno %d (%s)", s->file_name.c_str(), data_end, errno, strerror(errno));
+            cm_msg(MERROR, "FileHistory::write_event", "Cannot truncate \'%s\' to size %lld, ftruncate() errno %d (%s)", s->file_name.c_str(), (long long)data_end, errno, strerror(errno));
             return HS_FILE_ERROR;
          }
       }
+
+      s->writer_nrec = nrec;
+
+      // errors are reported by index_open() and rollup_open(), readers fall back to the data file
+      s->index_open();
+      s->rollup_open();
    }
 
    int expected_size = s->record_size - 4;
@@ -1863,38 +2027,82 @@ int HsFileSchema::write_event(const time_t t, const char* data, const int data_s
       s->last_size = data_size;
    }
 
-   status = write(s->writer_fd, &t, 4);
-   if (status != 4) {
-      cm_msg(MERROR, "FileHistory::write_event", "Cannot write to \'%s\', write(timestamp) errno %d (%s)", s->file_name.c_str(), errno, strerror(errno));
-      return HS_FILE_ERROR;
+   time_t now = time(NULL);
+
+   if (s->write_buffer.size() == 0) {
+      s->write_buffer.reserve(kWriteBufferSize + s->record_size);
+      s->write_buffer_time = now;
    }
 
-   status = write(s->writer_fd, data, expected_size);
-   if (status != expected_size) {
-      cm_msg(MERROR, "FileHistory::write_event", "Cannot write to \'%s\', write(%d) errno %d (%s)", s->file_name.c_str(), data_size, errno, strerror(errno));
+   DWORD t32 = t;
+   s->write_buffer.insert(s->write_buffer.end(), (const char*)&t32, (const char*)&t32 + 4);
+   s->write_buffer.insert(s->write_buffer.end(), data, data + expected_size);
+
+   if (s->writer_nrec % kIndexStride == 0)
+      s->index_buffer.push_back(t32);
+   s->writer_nrec++;
+
+   s->rollup_add(t, data);
+
+   if (s->write_buffer.size() >= (unsigned)kWriteBufferSize || now >= s->write_buffer_time + kWriteBufferAge)
+      return s->flush_buffers();
+
+   return HS_SUCCESS;
+}
+
+int HsFileSchema::flush_buffers()
+{
+   if (write_buffer.size() == 0)
+      return HS_SUCCESS;
+
+   int size = write_buffer.size();
+   int status = write(writer_fd, &write_buffer[0], size);
+
+   write_buffer.clear();
+
+   if (status != size) {
+      cm_msg(MERROR, "FileHistory::flush_buffers", "Cannot write to \'%s\', write(%d) errno %d (%s)", file_name.c_str(), size, errno, strerror(errno));
+      // the index is out of step with the data now, index_open() fixes it on the next open
+      index_buffer.clear();
+      index_ok = false;
       return HS_FILE_ERROR;
    }
 
+   // the index is written after the data, readers never see entries past the end of the data
+   if (index_ok && index_buffer.size() > 0) {
+      status = sidecar_append(file_name + ".idx", &index_buffer[0], index_buffer.size()*sizeof(DWORD));
+      if (status != HS_SUCCESS)
+         index_ok = false;
+   }
+   index_buffer.clear();
+
    return HS_SUCCESS;
 }
 
 int HsFileSchema::close()
 {
    if (writer_fd >= 0) {
+      flush_buffers();
       ::close(writer_fd);
       writer_fd = -1;
    }
+
+   index_ok = false;
+   index_buffer.clear();
+
+   // the bins in progress are dropped, rollup_open() rebuilds them
+   rollups.clear();
+
    return HS_SUCCESS;
 }
 
-static int ReadRecord(const char* file_name, int fd, int offset, int recsize, int irec, char* rec)
+static int ReadRecord(const char* file_name, int fd, off_t offset, int recsize, int irec, char* rec)
 {
    int status;
-   int fpos = offset + irec*recsize;
+   off_t fpos = offset + (off_t)irec*recsize;
 
-   status = ::lseek(fd, fpos, SEEK_SET);
-   if (status == -1) {
-      cm_msg(MERROR, "FileHistory::ReadRecord", "Cannot read \'%s\', lseek(%d) errno %d (%s)", file_name, fpos, errno, strerror(errno));
+   if (::lseek(fd, fpos, SEEK_SET) == -1) {
+      cm_msg(MERROR, "FileHistory::ReadRecord", "Cannot read \'%s\', lseek(%lld) errno %d (%s)", file_name, (long long)fpos, errno, strerror(errno));
       return -1;
    }
 
@@ -1910,7 +2118,7 @@ static int ReadRecord(const char* file_name, int fd, int offset, int recsize, in
    return HS_SUCCESS;
 }
 
-static int FindTime(const char* file_name, int fd, int offset, int recsize, int nrec, time_t timestamp, int* irecp, time_t* trecp, time_t* trecp2, int debug)
+static int FindTime(const char* file_name, int fd, off_t offset, int recsize, int nrec, time_t timestamp, int* irecp, time_t* trecp, time_t* trecp2, int debug)
 {
    int status;
    char* buf = new char[recsize];
@@ -2002,6 +2210,421 @@ static int FindTime(const char* file_name, int fd, int offset, int recsize, int
    return HS_SUCCESS;
 }
 
+int HsFileSchema::index_open()
+{
+   std::string name = file_name + ".idx";
+
+   // the index file is closed after the check, flush_buffers() appends to it
+   index_ok = false;
+
+   int index_fd = open(name.c_str(), O_RDWR|O_CREAT, 0644);
+   if (index_fd < 0) {
+      cm_msg(MERROR, "FileHistory::index_open", "Cannot open \'%s\', open() errno %d (%s)", name.c_str(), errno, strerror(errno));
+      return HS_FILE_ERROR;
+   }
+
+   off_t size = lseek(index_fd, 0, SEEK_END);
+   int have = size/sizeof(DWORD);
+   int want = (writer_nrec + kIndexStride - 1)/kIndexStride;
+
+   // drop entries for records that are no longer in the data file
+   if (have > want || (off_t)(have*sizeof(DWORD)) != size) {
+      if (have > want)
+         have = want;
+      if (ftruncate(index_fd, have*sizeof(DWORD)) < 0 || lseek(index_fd, 0, SEEK_END) < 0) {
+         cm_msg(MERROR, "FileHistory::index_open", "Cannot truncate \'%s\', errno %d (%s)", name.c_str(), errno, strerror(errno));
+         ::close(index_fd);
+         return HS_FILE_ERROR;
+      }
+   }
+
+   // add the entries missing from an old or damaged index
+   std::vector<DWORD> entries;
+   for (int k=have; k<want; k++) {
+      DWORD t;
+      off_t fpos = data_offset + (off_t)k*kIndexStride*record_size;
+      if (pread(writer_fd, &t, sizeof(t), fpos) != sizeof(t)) {
+         cm_msg(MERROR, "FileHistory::index_open", "Cannot read \'%s\', pread(%lld) errno %d (%s)", file_name.c_str(), (long long)fpos, errno, strerror(errno));
+         ::close(index_fd);
+         return HS_FILE_ERROR;
+      }
+      entries.push_back(t);
+   }
+
+   if (entries.size() > 0) {
+      int size = entries.size()*sizeof(DWORD);
+      if (write(index_fd, &entries[0], size) != size) {
+         cm_msg(MERROR, "FileHistory::index_open", "Cannot write to \'%s\', write(%d) errno %d (%s)", name.c_str(), size, errno, strerror(errno));
+         ::close(index_fd);
+         return HS_FILE_ERROR;
+      }
+   }
+
+   ::close(index_fd);
+   index_ok = true;
+
+   return HS_SUCCESS;
+}
+
+void HsFileSchema::index_load(const off_t file_size)
+{
+   // the index only grows with the data file
+   if (file_size == index_data_size)
+      return;
+
+   std::string name = file_name + ".idx";
+
+   // without an index file, find_time() falls back to FindTime()
+   int fd = open(name.c_str(), O_RDONLY);
+   if (fd < 0)
+      return;
+
+   off_t size = lseek(fd, 0, SEEK_END);
+   unsigned n = size/sizeof(DWORD);
+   unsigned have = index.size();
+
+   // the data file was replaced
+   if (n < have || file_size < index_data_size) {
+      index.clear();
+      have = 0;
+   }
+
+   if (n > have) {
+      index.resize(n);
+      ssize_t rd = pread(fd, &index[have], (n - have)*sizeof(DWORD), (off_t)have*sizeof(DWORD));
+      if (rd != (ssize_t)((n - have)*sizeof(DWORD))) {
+         index.resize(have);
+         ::close(fd);
+         return;
+      }
+   }
+
+   ::close(fd);
+   index_data_size = file_size;
+}
+
+// same as FindTime(), but uses the time index to narrow the search
+// down to at most kIndexStride records, which are read in one go
+
+int HsFileSchema::find_time(const int fd, const off_t file_size, const int nrec, const time_t timestamp, int* irecp, time_t* trecp, time_t* trecp2)
+{
+   index_load(file_size);
+
+   // use only the entries for records already in the file
+   int nindex = index.size();
+   int maxindex = (nrec + kIndexStride - 1)/kIndexStride;
+   if (nindex > maxindex)
+      nindex = maxindex;
+
+   if (nindex < 1)
+      return FindTime(file_name.c_str(), fd, data_offset, record_size, nrec, timestamp, irecp, trecp, trecp2, 0);
+
+   // timestamp is older than any data in this file
+   if (timestamp <= (time_t)index[0]) {
+      *irecp = -1;
+      *trecp = 0;
+      *trecp2 = index[0];
+      return HS_SUCCESS;
+   }
+
+   // first index entry not older than timestamp
+   int lo = 0;
+   int hi = nindex;
+   while (lo < hi) {
+      int mid = (lo + hi)/2;
+      if ((time_t)index[mid] < timestamp)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   // the result is between the two index entries, or after the last one
+   int first = (lo - 1)*kIndexStride;
+   int last = nrec - 1;
+   if (lo < nindex)
+      last = lo*kIndexStride;
+
+   int n = last - first + 1;
+
+   if ((off_t)n*record_size > kIndexMaxRead) {
+      // incomplete index or very large records
+      int irec;
+      int status = FindTime(file_name.c_str(), fd, data_offset + (off_t)first*record_size, record_size, n, timestamp, &irec, trecp, trecp2, 0);
+      if (status != HS_SUCCESS)
+         return status;
+      assert(irec >= 0);
+      if (irec >= n)
+         *irecp = nrec;
+      else
+         *irecp = first + irec;
+      return HS_SUCCESS;
+   }
+
+   std::vector<char> buf(n*record_size);
+   off_t fpos = data_offset + (off_t)first*record_size;
+   ssize_t rd = pread(fd, &buf[0], buf.size(), fpos);
+   if (rd != (ssize_t)buf.size()) {
+      cm_msg(MERROR, "FileHistory::find_time", "Cannot read \'%s\', pread(%lld) errno %d (%s)", file_name.c_str(), (long long)fpos, errno, strerror(errno));
+      return HS_FILE_ERROR;
+   }
+
+   // first record in the block not older than timestamp, the first record is older
+   lo = 1;
+   hi = n;
+   while (lo < hi) {
+      int mid = (lo + hi)/2;
+      if ((time_t)*(DWORD*)&buf[mid*record_size] < timestamp)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   // timestamp is newer than any data in this file
+   if (lo >= n) {
+      assert(last == nrec - 1);
+      *irecp = nrec;
+      *trecp = 0;
+      *trecp2 = 0;
+      return HS_SUCCESS;
+   }
+
+   *irecp = first + lo - 1;
+   *trecp = *(DWORD*)&buf[(lo - 1)*record_size];
+   *trecp2 = *(DWORD*)&buf[lo*record_size];
+
+   return HS_SUCCESS;
+}
+
+void HsFileSchema::rollup_init()
+{
+   if (n_elements > 0)
+      return;
+
+   first_element.clear();
+   for (unsigned i=0; i<variables.size(); i++) {
+      first_element.push_back(n_elements);
+      n_elements += variables[i].n_data;
+   }
+}
+
+int HsFileSchema::rollup_open()
+{
+   rollup_init();
+
+   rollups.clear();
+
+   rollup_values.resize(n_elements);
+
+   off_t recsize = sizeof(HsRollupHeader) + n_elements*sizeof(HsRollupStats);
+   time_t replay_time = 0;
+
+   for (int k=0; k<kNumRollups; k++) {
+      HsFileRollup r;
+      char suffix[32];
+
+      sprintf(suffix, ".r%d", kRollupWidth[k]);
+      r.width = kRollupWidth[k];
+      r.file_name = file_name + suffix;
+      r.done_time = 0;
+      memset(&r.hdr, 0, sizeof(r.hdr));
+      r.stats.resize(n_elements);
+
+      // the rollup file is closed after the check, rollup_write() appends to it
+      int fd = open(r.file_name.c_str(), O_RDWR|O_CREAT, 0644);
+      if (fd < 0) {
+         cm_msg(MERROR, "FileHistory::rollup_open", "Cannot write to \'%s\', open() errno %d (%s)", r.file_name.c_str(), errno, strerror(errno));
+         break;
+      }
+
+      // drop partially written records
+      off_t file_size = lseek(fd, 0, SEEK_END);
+      off_t nrec = file_size/recsize;
+
+      if (nrec*recsize != file_size) {
+         if (ftruncate(fd, nrec*recsize) < 0) {
+            cm_msg(MERROR, "FileHistory::rollup_open", "Cannot truncate \'%s\' to size %lld, errno %d (%s)", r.file_name.c_str(), (long long)(nrec*recsize), errno, strerror(errno));
+            ::close(fd);
+            break;
+         }
+      }
+
+      if (nrec > 0) {
+         HsRollupHeader h;
+         if (pread(fd, &h, sizeof(h), (nrec-1)*recsize) != sizeof(h)) {
+            cm_msg(MERROR, "FileHistory::rollup_open", "Cannot read \'%s\', pread() errno %d (%s)", r.file_name.c_str(), errno, strerror(errno));
+            ::close(fd);
+            break;
+         }
+         r.done_time = h.bin_time + r.width;
+      }
+
+      ::close(fd);
+
+      rollups.push_back(r);
+
+      if (k == 0 || rollups.back().done_time < replay_time)
+         replay_time = rollups.back().done_time;
+   }
+
+   if (rollups.size() != (unsigned)kNumRollups) {
+      rollups.clear();
+      return HS_FILE_ERROR;
+   }
+
+   // feed the records newer than the last complete bin back into the
+   // rollups. This rebuilds the bins in progress and creates the rollups
+   // for data files written before rollups existed.
+
+   off_t file_size = lseek(writer_fd, 0, SEEK_END);
+   int nrec = (file_size - data_offset)/record_size;
+
+   int irec = 0;
+   if (replay_time > 0 && nrec > 0) {
+      time_t trec = 0;
+      time_t trec2 = 0;
+      int status = FindTime(file_name.c_str(), writer_fd, data_offset, record_size, nrec, replay_time, &irec, &trec, &trec2, 0);
+      if (status != HS_SUCCESS)
+         return HS_FILE_ERROR;
+      if (irec < 0)
+         irec = 0;
+   }
+
+   const int kReadChunk = 1024;
+   char* buf = new char[kReadChunk*record_size];
+
+   while (irec < nrec && rollups.size() > 0) {
+      int n = nrec - irec;
+      if (n > kReadChunk)
+         n = kReadChunk;
+
+      ssize_t rd = ::pread(writer_fd, buf, n*record_size, data_offset + (off_t)irec*record_size);
+      if (rd != n*record_size) {
+         cm_msg(MERROR, "FileHistory::rollup_open", "Cannot read \'%s\', pread() errno %d (%s)", file_name.c_str(), errno, strerror(errno));
+         break;
+      }
+
+      for (int j=0; j<n; j++) {
+         DWORD t;
+         memcpy(&t, buf + j*record_size, sizeof(t));
+         rollup_add(t, buf + j*record_size + 4);
+      }
+
+      irec += n;
+   }
+
+   delete[] buf;
+
+   // the replay moved the write position
+   lseek(writer_fd, 0, SEEK_END);
+
+   return HS_SUCCESS;
+}
+
+int HsFileSchema::rollup_add(const time_t t, const char* data)
+{
+   if (rollups.size() == 0)
+      return HS_SUCCESS;
+
+   double* v = &rollup_values[0];
+
+   for (unsigned i=0; i<variables.size(); i++) {
+      int n = variables[i].n_data;
+      if (!DecodeColumn(variables[i].type, data + offsets[i], 0, variables[i].n_bytes/n, n, v + first_element[i]))
+         for (int e=0; e<n; e++)
+            v[first_element[i] + e] = 0;
+   }
+
+   for (unsigned k=0; k<rollups.size(); k++) {
+      HsFileRollup* r = &rollups[k];
+
+      // already in the rollup file
+      if (t < r->done_time)
+         continue;
+
+      time_t bin_time = t - t % r->width;
+
+      // if the clock goes backwards, keep adding to the bin in progress
+      if (r->hdr.count > 0 && bin_time > (time_t)r->hdr.bin_time) {
+         int status = rollup_write(r);
+         if (status != HS_SUCCESS) {
+            rollups.clear();
+            return status;
+         }
+      }
+
+      HsRollupStats* st = &r->stats[0];
+
+      if (r->hdr.count == 0) {
+         r->hdr.bin_time = bin_time;
+         for (int e=0; e<n_elements; e++) {
+            st[e].sum = 0;
+            st[e].sum2 = 0;
+            st[e].min = v[e];
+            st[e].max = v[e];
+         }
+      }
+
+      r->hdr.count++;
+      r->hdr.last_time = t;
+
+      for (int e=0; e<n_elements; e++) {
+         st[e].sum += v[e];
+         st[e].sum2 += v[e]*v[e];
+         if (v[e] < st[e].min)
+            st[e].min = v[e];
+         if (v[e] > st[e].max)
+            st[e].max = v[e];
+         st[e].last = v[e];
+      }
+   }
+
+   return HS_SUCCESS;
+}
+
+int HsFileSchema::rollup_write(HsFileRollup* r)
+{
+   // the data file should never be behind its rollups
+   int status = flush_buffers();
+   if (status != HS_SUCCESS)
+      return status;
+
+   // one record per write, readers never see a partial record
+   std::vector<char> rec(sizeof(r->hdr) + n_elements*sizeof(HsRollupStats));
+   memcpy(&rec[0], &r->hdr, sizeof(r->hdr));
+   memcpy(&rec[sizeof(r->hdr)], &r->stats[0], n_elements*sizeof(HsRollupStats));
+
+   status = sidecar_append(r->file_name, &rec[0], rec.size());
+   if (status != HS_SUCCESS)
+      return status;
+
+   r->done_time = r->hdr.bin_time + r->width;
+   r->hdr.count = 0;
+
+   return HS_SUCCESS;
+}
+
+int HsFileSchema::sidecar_append(const std::string& name, const void* data, int size)
+{
+   // sidecar files are opened for each write, so that they do not keep
+   // file descriptors open in the writer
+
+   int fd = open(name.c_str(), O_WRONLY|O_APPEND);
+   if (fd < 0) {
+      cm_msg(MERROR, "FileHistory::sidecar_append", "Cannot open \'%s\', open() errno %d (%s)", name.c_str(), errno, strerror(errno));
+      return HS_FILE_ERROR;
+   }
+
+   if (write(fd, data, size) != size) {
+      cm_msg(MERROR, "FileHistory::sidecar_append", "Cannot write to \'%s\', write(%d) errno %d (%s)", name.c_str(), size, errno, strerror(errno));
+      ::close(fd);
+      return HS_FILE_ERROR;
+   }
+
+   ::close(fd);
+
+   return HS_SUCCESS;
+}
+
 int HsFileSchema::read_last_written(const time_t timestamp,
                                     const int debug,
                                     time_t* last_written)
@@ -2012,30 +2635,43 @@ int HsFileSchema::read_last_written(const time_t timestamp,
    if (debug)
       printf("FileHistory::read_last_written: file %s, schema time %s..%s, timestamp %s\n", s->file_name.c_str(), TimeToString(s->time_from).c_str(), TimeToString(s->time_to).c_str(), TimeToString(timestamp).c_str());
 
-   int fd = open(s->file_name.c_str(), O_RDONLY);
-   if (fd < 0) {
-      cm_msg(MERROR, "FileHistory::read_last_written", "Cannot read \'%s\', open() errno %d (%s)", s->file_name.c_str(), errno, strerror(errno));
+   struct stat st;
+   if (stat(s->file_name.c_str(), &st) != 0) {
+      cm_msg(MERROR, "FileHistory::read_last_written", "Cannot read \'%s\', stat() errno %d (%s)", s->file_name.c_str(), errno, strerror(errno));
       return HS_FILE_ERROR;
    }
 
-   int file_size = ::lseek(fd, 0, SEEK_END);
+   off_t file_size = st.st_size;
 
    int nrec = (file_size - s->data_offset)/s->record_size;
    if (nrec < 0)
       nrec = 0;
 
    if (nrec < 1) {
-      ::close(fd);
       if (last_written)
          *last_written = 0;
       return HS_SUCCESS;
    }
 
-   time_t lw = 0;
+   // the time of the last record is cached until the file grows
+
+   if (file_size == s->last_written_size && s->last_written_time < timestamp) {
+      if (last_written)
+         *last_written = s->last_written_time;
+      return HS_SUCCESS;
+   }
+
+   int fd = open(s->file_name.c_str(), O_RDONLY);
+   if (fd < 0) {
+      cm_msg(MERROR, "FileHistory::read_last_written", "Cannot read \'%s\', open() errno %d (%s)", s->file_name.c_str(), errno, strerror(errno));
+      return HS_FILE_ERROR;
+   }
+
+   time_t lw = s->last_written_time;
 
    // read last record to check if desired time is inside or outside of the file
 
-   if (1) {
+   if (file_size != s->last_written_size) {
       char* buf = new char[s->record_size];
 
       status = ReadRecord(s->file_name.c_str(), fd, s->data_offset, s->record_size, nrec - 1, buf);
@@ -2048,6 +2684,9 @@ int HsFileSchema::read_last_written(const time_t timestamp,
       lw = *(DWORD*)buf;
 
       delete[] buf;
+
+      s->last_written_size = file_size;
+      s->last_written_time = lw;
    }
 
    if (lw >= timestamp) {
@@ -2055,7 +2694,7 @@ int HsFileSchema::read_last_written(const time_t timestamp,
       time_t trec = 0;
       time_t trec2 = 0;
 
-      status = FindTime(s->file_name.c_str(), fd, s->data_offset, s->record_size, nrec, timestamp, &irec, &trec, &trec2, 0*debug);
+      status = s->find_time(fd, file_size, nrec, timestamp, &irec, &trec, &trec2);
       if (status != HS_SUCCESS) {
          ::close(fd);
          return HS_FILE_ERROR;
@@ -2082,6 +2721,169 @@ int HsFileSchema::read_data(const time_t start_time,
                             const int num_var, const int var_schema_index[], const int var_index[],
                             const int debug,
                             MidasHistoryBufferInterface* buffer[])
+{
+   // if all buffers only want binned statistics, use the coarsest
+   // rollup that still has enough bins per requested bin. Rollup bins
+   // which straddle a requested bin boundary are read from the data file.
+
+   bool binned = true;
+   time_t bin_width = 0;
+
+   for (int i=0; i<num_var; i++) {
+      if (var_schema_index[i] < 0)
+         continue;
+      time_t w = buffer[i]->GetBinWidth();
+      if (w <= 0)
+         binned = false;
+      else if (bin_width == 0 || w < bin_width)
+         bin_width = w;
+   }
+
+   if (binned && bin_width > 0) {
+      for (int k=kNumRollups-1; k>=0; k--) {
+         if (kRollupWidth[k]*kRollupMinBins > bin_width)
+            continue;
+
+         time_t from = 0;
+         time_t to = 0;
+
+         int status = read_rollup(kRollupWidth[k], start_time, end_time, num_var, var_schema_index, var_index, debug, buffer, &from, &to);
+         if (status != HS_SUCCESS || from >= to)
+            continue; // no rollup or no complete bins, try a finer one
+
+         // data before the first and after the last complete bin
+         status = HS_SUCCESS;
+         if (start_time < from)
+            status = read_records(start_time, from-1, num_var, var_schema_index, var_index, debug, buffer);
+         if (status == HS_SUCCESS && to <= end_time)
+            status = read_records(to, end_time, num_var, var_schema_index, var_index, debug, buffer);
+         return status;
+      }
+   }
+
+   return read_records(start_time, end_time, num_var, var_schema_index, var_index, debug, buffer);
+}
+
+int HsFileSchema::read_rollup(const int width,
+                              const time_t start_time,
+                              const time_t end_time,
+                              const int num_var, const int var_schema_index[], const int var_index[],
+                              const int debug,
+                              MidasHistoryBufferInterface* buffer[],
+                              time_t* from, time_t* to)
+{
+   char suffix[32];
+   sprintf(suffix, ".r%d", width);
+   std::string rollup_name = file_name + suffix;
+
+   *from = 0;
+   *to = 0;
+
+   int fd = open(rollup_name.c_str(), O_RDONLY);
+   if (fd < 0)
+      return HS_FILE_ERROR; // no rollup for this file, read the data file
+
+   rollup_init();
+
+   size_t recsize = sizeof(HsRollupHeader) + n_elements*sizeof(HsRollupStats);
+   off_t file_size = ::lseek(fd, 0, SEEK_END);
+   int nrec = file_size/recsize;
+
+   if (nrec < 1) {
+      ::close(fd);
+      return HS_FILE_ERROR;
+   }
+
+   char* map = (char*)::mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+   if (map == MAP_FAILED) {
+      cm_msg(MERROR, "FileHistory::read_rollup", "Cannot read \'%s\', mmap() errno %d (%s)", rollup_name.c_str(), errno, strerror(errno));
+      ::close(fd);
+      return HS_FILE_ERROR;
+   }
+
+   // complete bins inside the requested time range
+   time_t done_time = ((HsRollupHeader*)(map + (nrec-1)*recsize))->bin_time + width;
+   time_t f = ((start_time + width - 1)/width)*width;
+   time_t t = ((end_time + 1)/width)*width;
+   if (t > done_time)
+      t = done_time;
+
+   int count = 0;
+
+   // rollup bins which do not fall into a single requested bin
+   std::vector<time_t> split_from;
+   std::vector<time_t> split_to;
+
+   if (f < t) {
+      // find the first bin
+      int lo = 0;
+      int hi = nrec;
+      while (lo < hi) {
+         int mid = (lo + hi)/2;
+         if ((time_t)((HsRollupHeader*)(map + mid*recsize))->bin_time < f)
+            lo = mid + 1;
+         else
+            hi = mid;
+      }
+
+      for (int irec=lo; irec<nrec; irec++) {
+         const HsRollupHeader* h = (const HsRollupHeader*)(map + irec*recsize);
+         if ((time_t)h->bin_time >= t)
+            break;
+
+         bool split = false;
+         for (int i=0; i<num_var; i++)
+            if (var_schema_index[i] >= 0 && !buffer[i]->SameBin(h->bin_time, h->bin_time + width - 1))
+               split = true;
+
+         if (split) {
+            if (split_to.size() > 0 && split_to.back() + 1 == (time_t)h->bin_time)
+               split_to.back() = h->bin_time + width - 1;
+            else {
+               split_from.push_back(h->bin_time);
+               split_to.push_back(h->bin_time + width - 1);
+            }
+            continue;
+         }
+
+         const HsRollupStats* st = (const HsRollupStats*)(h + 1);
+
+         for (int i=0; i<num_var; i++) {
+            int si = var_schema_index[i];
+            if (si < 0)
+               continue;
+
+            const HsRollupStats* e = st + first_element[si] + var_index[i];
+            buffer[i]->AddBin(h->bin_time + width/2, h->count, e->sum, e->sum2, e->min, e->max, h->last_time, e->last);
+         }
+
+         count++;
+      }
+
+      *from = f;
+      *to = t;
+   }
+
+   ::munmap(map, file_size);
+   ::close(fd);
+
+   if (debug)
+      printf("FileHistory::read_rollup: file %s, read time %s..%s, %d vars, read %d bins of %d sec, %d ranges from the data file\n", rollup_name.c_str(), TimeToString(f).c_str(), TimeToString(t).c_str(), num_var, count, width, (int)split_from.size());
+
+   for (unsigned j=0; j<split_from.size(); j++) {
+      int status = read_records(split_from[j], split_to[j], num_var, var_schema_index, var_index, debug, buffer);
+      if (status != HS_SUCCESS)
+         return status;
+   }
+
+   return HS_SUCCESS;
+}
+
+int HsFileSchema::read_records(const time_t start_time,
+                               const time_t end_time,
+                               const int num_var, const int var_schema_index[], const int var_index[],
+                               const int debug,
+                               MidasHistoryBufferInterface* buffer[])
 {
    int status;
    HsFileSchema* s = this;
@@ -2095,7 +2897,7 @@ int HsFileSchema::read_data(const time_t start_time,
       return HS_FILE_ERROR;
    }
 
-   int file_size = ::lseek(fd, 0, SEEK_END);
+   off_t file_size = ::lseek(fd, 0, SEEK_END);
 
    int nrec = (file_size - s->data_offset)/s->record_size;
    if (nrec < 0)
@@ -2110,7 +2912,7 @@ int HsFileSchema::read_data(const time_t start_time,
    time_t trec = 0;
    time_t trec2 = 0;
 
-   status = FindTime(s->file_name.c_str(), fd, s->data_offset, s->record_size, nrec, start_time, &irec, &trec, &trec2, 0*debug);
+   status = s->find_time(fd, file_size, nrec, start_time, &irec, &trec, &trec2);
    if (status != HS_SUCCESS) {
       ::close(fd);
       return HS_FILE_ERROR;
@@ -2130,89 +2932,95 @@ int HsFileSchema::read_data(const time_t start_time,
          assert(trec < start_time);
       assert(trec2 >= start_time);
 
-      int fpos = s->data_offset + irec*s->record_size;
+      // map the whole file and decode it in place. If mmap() is not
+      // possible (i.e. address space exhausted on 32-bit systems), fall back
+      // to reading blocks of kReadChunk records at a time.
 
-      status = ::lseek(fd, fpos, SEEK_SET);
-      if (status == -1) {
-         cm_msg(MERROR, "FileHistory::read_data", "Cannot read \'%s\', lseek(%d) errno %d (%s)", s->file_name.c_str(), fpos, errno, strerror(errno));
-         ::close(fd);
-         return HS_FILE_ERROR;
-      }
+      char* map = (char*)::mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (map == MAP_FAILED)
+         map = NULL;
+      else
+         ::madvise(map, file_size, MADV_SEQUENTIAL);
 
-      char* buf = new char[s->record_size];
+      const int kReadChunk = 1024;
+      const size_t stride = s->record_size;
 
-      while (1) {
-         status = ::read(fd, buf, s->record_size);
-         if (status == 0) // EOF
-            break;
-         if (status != s->record_size) {
-            cm_msg(MERROR, "FileHistory::read_data", "Cannot read \'%s\', read() errno %d (%s)", s->file_name.c_str(), errno, strerror(errno));
-            break;
+      char* buf = NULL;
+      if (!map)
+         buf = new char[kReadChunk*stride];
+
+      std::vector<time_t> tbuf(kReadChunk);
+      std::vector<double> vbuf(kReadChunk);
+
+      while (irec < nrec) {
+         int n = nrec - irec;
+         if (n > kReadChunk)
+            n = kReadChunk;
+
+         off_t fpos = s->data_offset + (off_t)irec*stride;
+         const char* rec;
+
+         if (map) {
+            rec = map + fpos;
+         } else {
+            ssize_t rd = ::pread(fd, buf, n*stride, fpos);
+            if (rd < 0) {
+               cm_msg(MERROR, "FileHistory::read_data", "Cannot read \'%s\', pread() errno %d (%s)", s->file_name.c_str(), errno, strerror(errno));
+               break;
+            }
+            n = rd/stride;
+            if (n == 0) // EOF
+               break;
+            rec = buf;
          }
 
-         time_t t = *(DWORD*)buf;
+         // collect the timestamps of this chunk, stop at "end_time"
 
-         assert(t >= start_time);
-         if (t > end_time)
-            break;
+         bool done = false;
+         for (int j=0; j<n; j++) {
+            DWORD t;
+            memcpy(&t, rec + j*stride, sizeof(t));
+            assert((time_t)t >= start_time);
+            if ((time_t)t > end_time) {
+               n = j;
+               done = true;
+               break;
+            }
+            tbuf[j] = t;
+         }
 
-         char* data = buf + 4;
+         // decode each requested variable as a strided column
 
+         const char* data = rec + 4;
 
-         count++;
          for (int i=0; i<num_var; i++) {
             int si = var_schema_index[i];
             if (si < 0)
                continue;
-            double v = 0;
-            void* ptr = data + s->offsets[si];
 
             int ii = var_index[i];
             assert(ii >= 0);
             assert(ii < s->variables[si].n_data);
 
-            switch (s->variables[si].type) {
-            default:
+            if (!DecodeColumn(s->variables[si].type, data + s->offsets[si], ii, stride, n, &vbuf[0])) {
                // FIXME!!!
                abort();
-               break;
-            case TID_BYTE:
-               v = ((unsigned char*)ptr)[ii];
-               break;
-            case TID_SBYTE:
-               v = ((signed char *)ptr)[ii];
-               break;
-            case TID_CHAR:
-               v = ((char*)ptr)[ii];
-               break;
-            case TID_WORD:
-               v = ((unsigned short *)ptr)[ii];
-               break;
-            case TID_SHORT:
-               v = ((signed short *)ptr)[ii];
-               break;
-            case TID_DWORD:
-               v = ((unsigned int *)ptr)[ii];
-               break;
-            case TID_INT:
-               v = ((int *)ptr)[ii];
-               break;
-            case TID_BOOL:
-               v = ((unsigned int *)ptr)[ii];
-               break;
-            case TID_FLOAT:
-               v = ((float*)ptr)[ii];
-               break;
-            case TID_DOUBLE:
-               v = ((double*)ptr)[ii];
-               break;
             }
 
-            buffer[i]->Add(t, v);
+            buffer[i]->AddChunk(n, &tbuf[0], &vbuf[0]);
          }
+
+         count += n;
+         irec += n;
+
+         if (done)
+            break;
       }
 
-      delete[] buf;
+      if (map)
+         ::munmap(map, file_size);
+      if (buf)
+         delete[] buf;
    }
 
    ::close(fd);
@@ -2223,6 +3031,136 @@ int HsFileSchema::read_data(const time_t start_time,
    return HS_SUCCESS;
 }
 
+////////////////////////////////////////////////////////
+//        Thread pool for reading history data        //
+////////////////////////////////////////////////////////
+
+// the pool threads wait on futexes, without them the data is read serially
+
+#ifdef HAVE_SS_FUTEX
+
+class HsReadPool
+{
+public:
+   HsReadPool(int num_threads) // ctor
+   {
+      fNumThreads = 0;
+      fFunc = NULL;
+      fArg = NULL;
+      fNumJobs = 0;
+      fNextJob = 0;
+      fPending = 0;
+      fGeneration = 0;
+      fRunning = 0;
+      fStop = 0;
+
+      ss_mutex_create(&fMutex);
+
+      for (int i=0; i<num_threads; i++) {
+         SS_ATOMIC_ADD(&fRunning, 1);
+         if (ss_thread_create(Thread, this) == 0) {
+            SS_ATOMIC_ADD(&fRunning, -1);
+            cm_msg(MERROR, "HsReadPool", "Cannot create history read thread %d of %d", i + 1, num_threads);
+            break;
+         }
+         fNumThreads++;
+      }
+   }
+
+   ~HsReadPool() // dtor
+   {
+      SS_ATOMIC_STORE(&fStop, 1);
+      SS_ATOMIC_ADD(&fGeneration, 1);
+      ss_futex_wake(&fGeneration);
+
+      INT running;
+      while ((running = SS_ATOMIC_LOAD(&fRunning)) > 0)
+         ss_futex_wait(&fRunning, running, 100);
+
+      ss_mutex_delete(fMutex);
+   }
+
+   int fNumThreads;
+
+   // call func(arg, job) for job = 0..num_jobs-1 on the pool threads
+   // and the calling thread, return when all calls have finished
+   void Run(int num_jobs, void (*func)(void* arg, int job), void* arg)
+   {
+      ss_mutex_wait_for(fMutex, 0);
+      fFunc = func;
+      fArg = arg;
+      fNumJobs = num_jobs;
+      fNextJob = 0;
+      SS_ATOMIC_STORE(&fPending, num_jobs);
+      ss_mutex_release(fMutex);
+
+      SS_ATOMIC_ADD(&fGeneration, 1);
+      ss_futex_wake(&fGeneration);
+
+      while (RunOne()) {
+      }
+
+      INT pending;
+      while ((pending = SS_ATOMIC_LOAD(&fPending)) > 0)
+         ss_futex_wait(&fPending, pending, 100);
+   }
+
+protected:
+   MUTEX_T* fMutex;
+   void (*fFunc)(void* arg, int job);
+   void* fArg;
+   int fNumJobs;
+   int fNextJob;
+   INT fPending;    // jobs not yet finished
+   INT fGeneration; // incremented for each Run() and at shutdown
+   INT fRunning;    // number of running threads
+   INT fStop;
+
+   // run the next job, return false if there is none
+   bool RunOne()
+   {
+      int job = -1;
+      void (*func)(void* arg, int job) = NULL;
+      void* arg = NULL;
+
+      ss_mutex_wait_for(fMutex, 0);
+      if (fNextJob < fNumJobs) {
+         job = fNextJob++;
+         func = fFunc;
+         arg = fArg;
+      }
+      ss_mutex_release(fMutex);
+
+      if (job < 0)
+         return false;
+
+      (*func)(arg, job);
+
+      if (SS_ATOMIC_ADD(&fPending, -1) == 0)
+         ss_futex_wake(&fPending);
+
+      return true;
+   }
+
+   static INT Thread(void* param)
+   {
+      HsReadPool* p = (HsReadPool*)param;
+
+      while (!SS_ATOMIC_LOAD(&p->fStop)) {
+         INT generation = SS_ATOMIC_LOAD(&p->fGeneration);
+         if (!p->RunOne())
+            ss_futex_wait(&p->fGeneration, generation, 1000);
+      }
+
+      SS_ATOMIC_ADD(&p->fRunning, -1);
+      ss_futex_wake(&p->fRunning);
+
+      return 0;
+   }
+};
+
+#endif // HAVE_SS_FUTEX
+
 ////////////////////////////////////////////////////////
 //    Implementation of the MidasHistoryInterface     //
 ////////////////////////////////////////////////////////
@@ -2239,11 +3177,19 @@ protected:
 
    // reader data
    HsSchemaVector fSchema;
+   int fReadThreads;
+#ifdef HAVE_SS_FUTEX
+   HsReadPool* fReadPool;
+#endif
 
 public:
    SchemaHistoryBase()
    {
       fDebug = 0;
+      fReadThreads = 1;
+#ifdef HAVE_SS_FUTEX
+      fReadPool = NULL;
+#endif
    }
 
    virtual ~SchemaHistoryBase()
@@ -2254,6 +3200,11 @@ public:
             fEvents[i] = NULL;
          }
       fEvents.clear();
+
+#ifdef HAVE_SS_FUTEX
+      if (fReadPool)
+         delete fReadPool;
+#endif
    }
 
    virtual int hs_set_debug(int debug)
@@ -2263,6 +3214,13 @@ public:
       return old;
    }
 
+   virtual int hs_set_read_threads(int num_threads)
+   {
+      int old = fReadThreads;
+      fReadThreads = num_threads;
+      return old;
+   }
+
    virtual int hs_connect(const char* connect_string) = 0;
    virtual int hs_disconnect() = 0;
 
@@ -2317,6 +3275,11 @@ public:
 
       time_t   fPrevTime;
 
+      // storage of buffers created by Clone()
+      int      fOwnNumEntries;
+      time_t  *fOwnTimeBuffer;
+      double  *fOwnDataBuffer;
+
       ReadBuffer(time_t first_time, time_t last_time, time_t interval) // ctor
       {
          fNumAdded = 0;
@@ -2331,10 +3294,33 @@ public:
          fDataBuffer = NULL;
 
          fPrevTime = 0;
+
+         fOwnNumEntries = 0;
+         fOwnTimeBuffer = NULL;
+         fOwnDataBuffer = NULL;
       }
 
       ~ReadBuffer() // dtor
       {
+         if (fOwnTimeBuffer)
+            free(fOwnTimeBuffer);
+         if (fOwnDataBuffer)
+            free(fOwnDataBuffer);
+      }
+
+      MidasHistoryBufferInterface* Clone() const
+      {
+         ReadBuffer* b = new ReadBuffer(fFirstTime, fLastTime, fInterval);
+         b->fNumEntries = &b->fOwnNumEntries;
+         b->fTimeBuffer = &b->fOwnTimeBuffer;
+         b->fDataBuffer = &b->fOwnDataBuffer;
+         return b;
+      }
+
+      void Merge(MidasHistoryBufferInterface* buffer)
+      {
+         ReadBuffer* b = (ReadBuffer*)buffer;
+         ReadBuffer::AddChunk(b->fOwnNumEntries, b->fOwnTimeBuffer, b->fOwnDataBuffer);
       }
 
       void Realloc(int wantalloc)
@@ -2381,6 +3367,12 @@ public:
          }
       }
 
+      void AddChunk(int n, const time_t t[], const double v[])
+      {
+         for (int i=0; i<n; i++)
+            ReadBuffer::Add(t[i], v[i]);
+      }
+
       void Finish()
       {
 
@@ -2418,6 +3410,12 @@ public:
       time_t *fLastTimePtr;
       double *fLastValuePtr;
 
+      // storage of buffers created by Clone()
+      double *fOwnMin;
+      double *fOwnMax;
+      time_t  fOwnLastTime;
+      double  fOwnLastValue;
+
       BinnedBuffer(time_t first_time, time_t last_time, int num_bins) // ctor
       {
          fNumEntries = 0;
@@ -2436,30 +3434,84 @@ public:
             fSum2[i] = 0;
          }
 
+         fCount = NULL;
          fMean = NULL;
          fRms = NULL;
          fMin = NULL;
          fMax = NULL;
          fLastTimePtr = NULL;
          fLastValuePtr = NULL;
+
+         fOwnMin = NULL;
+         fOwnMax = NULL;
+         fOwnLastTime = 0;
+         fOwnLastValue = 0;
       }
 
       ~BinnedBuffer() // dtor
       {
-         delete fSum0;
-         delete fSum1;
-         delete fSum2;
+         delete[] fSum0;
+         delete[] fSum1;
+         delete[] fSum2;
+         delete[] fOwnMin;
+         delete[] fOwnMax;
+      }
+
+      MidasHistoryBufferInterface* Clone() const
+      {
+         BinnedBuffer* b = new BinnedBuffer(fFirstTime, fLastTime, fNumBins);
+         if (fMin)
+            b->fMin = b->fOwnMin = new double[fNumBins];
+         if (fMax)
+            b->fMax = b->fOwnMax = new double[fNumBins];
+         b->fLastTimePtr = &b->fOwnLastTime;
+         b->fLastValuePtr = &b->fOwnLastValue;
+         return b;
+      }
+
+      void Merge(MidasHistoryBufferInterface* buffer)
+      {
+         BinnedBuffer* b = (BinnedBuffer*)buffer;
+
+         fNumEntries += b->fNumEntries;
+
+         for (int i=0; i<fNumBins; i++) {
+            if (b->fSum0[i] == 0)
+               continue;
+
+            if (fMin)
+               if (fSum0[i] == 0 || b->fMin[i] < fMin[i])
+                  fMin[i] = b->fMin[i];
+
+            if (fMax)
+               if (fSum0[i] == 0 || b->fMax[i] > fMax[i])
+                  fMax[i] = b->fMax[i];
+
+            fSum0[i] += b->fSum0[i];
+            fSum1[i] += b->fSum1[i];
+            fSum2[i] += b->fSum2[i];
+         }
+
+         if (fLastTimePtr && b->fNumEntries > 0)
+            if (b->fOwnLastTime >= *fLastTimePtr) {
+               *fLastTimePtr = b->fOwnLastTime;
+               if (fLastValuePtr)
+                  *fLastValuePtr = b->fOwnLastValue;
+            }
       }
 
       void Add(time_t t, double v)
       {
-         if (t < fFirstTime)
-            return;
-         if (t > fLastTime)
-            return;
+         BinnedBuffer::AddBin(t, 1, v, v*v, v, v, t, v);
+      }
 
-         fNumEntries++;
+      time_t GetBinWidth() const
+      {
+         return (fLastTime - fFirstTime)/fNumBins;
+      }
 
+      int GetBin(time_t t) const
+      {
          double a = (double)(t - fFirstTime);
          double b = (double)(fLastTime - fFirstTime);
          double fbin = fNumBins*a/b;
@@ -2469,39 +3521,66 @@ public:
          if (ibin < 0)
             ibin = 0;
          else if (ibin >= fNumBins)
-            ibin = fNumBins;
+            ibin = fNumBins-1;
+
+         return ibin;
+      }
+
+      bool SameBin(time_t t1, time_t t2) const
+      {
+         if (t1 < fFirstTime || t2 > fLastTime)
+            return false;
+         return GetBin(t1) == GetBin(t2);
+      }
+
+      void AddBin(time_t t, int count, double sum, double sum2, double min, double max, time_t last_time, double last_value)
+      {
+         if (t < fFirstTime)
+            return;
+         if (t > fLastTime)
+            return;
+
+         fNumEntries += count;
+
+         int ibin = GetBin(t);
 
          if (fSum0[ibin] == 0) {
             if (fMin)
-               fMin[ibin] = v;
+               fMin[ibin] = min;
             if (fMax)
-               fMax[ibin] = v;
+               fMax[ibin] = max;
             if (fLastTimePtr)
-               *fLastTimePtr = t;
+               *fLastTimePtr = last_time;
             if (fLastValuePtr)
-               *fLastValuePtr = v;
+               *fLastValuePtr = last_value;
          }
 
-         fSum0[ibin] += 1.0;
-         fSum1[ibin] += v;
-         fSum2[ibin] += v*v;
+         fSum0[ibin] += count;
+         fSum1[ibin] += sum;
+         fSum2[ibin] += sum2;
 
          if (fMin)
-            if (v < fMin[ibin])
-               fMin[ibin] = v;
+            if (min < fMin[ibin])
+               fMin[ibin] = min;
 
          if (fMax)
-            if (v > fMax[ibin])
-               fMax[ibin] = v;
+            if (max > fMax[ibin])
+               fMax[ibin] = max;
 
          if (fLastTimePtr)
-            if (t > *fLastTimePtr) {
-               *fLastTimePtr = t;
+            if (last_time > *fLastTimePtr) {
+               *fLastTimePtr = last_time;
                if (fLastValuePtr)
-                  *fLastValuePtr = v;
+                  *fLastValuePtr = last_value;
             }
       }
 
+      void AddChunk(int n, const time_t t[], const double v[])
+      {
+         for (int i=0; i<n; i++)
+            BinnedBuffer::Add(t[i], v[i]);
+      }
+
       void Finish()
       {
          for (int i=0; i<fNumBins; i++) {
@@ -2861,6 +3940,31 @@ int SchemaHistoryBase::hs_get_last_written(time_t timestamp, int num_var, const
    return HS_SUCCESS;
 }
 
+#ifdef HAVE_SS_FUTEX
+
+struct HsReadJobs
+{
+   time_t start_time;
+   time_t end_time;
+   int num_var;
+   const int* var_index;
+   int debug;
+   std::vector<HsSchema*>* slist;
+   std::vector<int*> var_schema_index;
+   std::vector<MidasHistoryBufferInterface**>* buffer;
+   std::vector<int>* status;
+};
+
+static void HsReadJob(void* arg, int job)
+{
+   HsReadJobs* j = (HsReadJobs*)arg;
+   HsSchema* s = (*j->slist)[job];
+
+   (*j->status)[job] = s->read_data(j->start_time, j->end_time, j->num_var, j->var_schema_index[job], j->var_index, j->debug, (*j->buffer)[job]);
+}
+
+#endif // HAVE_SS_FUTEX
+
 int SchemaHistoryBase::hs_read_buffer(time_t start_time, time_t end_time,
                                       int num_var, const char* const event_name[], const char* const var_name[], const int var_index[],
                                       MidasHistoryBufferInterface* buffer[],
@@ -2936,10 +4040,73 @@ int SchemaHistoryBase::hs_read_buffer(time_t start_time, time_t end_time,
       }
    }
 
+   // read the data of each schema into its own copy of the buffers on
+   // the thread pool, then merge them in time order
+
+   std::vector<MidasHistoryBufferInterface**> xbuffer;
+   std::vector<int> xstatus;
+
+#ifdef HAVE_SS_FUTEX
+   bool parallel = (fReadThreads > 1) && (slist.size() > 1);
+#else
+   bool parallel = false;
+#endif
+
+   for (unsigned i=0; parallel && i<slist.size(); i++)
+      if (!slist[i]->parallel_read())
+         parallel = false;
+
+   for (unsigned i=0; parallel && i<slist.size(); i++) {
+      MidasHistoryBufferInterface** xb = new MidasHistoryBufferInterface*[num_var];
+      xbuffer.push_back(xb);
+      for (int j=0; j<num_var; j++) {
+         xb[j] = buffer[j]->Clone();
+         if (!xb[j])
+            parallel = false;
+      }
+   }
+
+#ifdef HAVE_SS_FUTEX
+   if (parallel) {
+      if (fReadPool && fReadPool->fNumThreads != fReadThreads-1) {
+         delete fReadPool;
+         fReadPool = NULL;
+      }
+
+      if (!fReadPool)
+         fReadPool = new HsReadPool(fReadThreads-1);
+
+      HsReadJobs jobs;
+      jobs.start_time = start_time;
+      jobs.end_time = end_time;
+      jobs.num_var = num_var;
+      jobs.var_index = var_index;
+      jobs.debug = fDebug;
+      jobs.slist = &slist;
+      for (unsigned i=0; i<slist.size(); i++)
+         jobs.var_schema_index.push_back(smap[slist[i]]);
+      jobs.buffer = &xbuffer;
+      jobs.status = &xstatus;
+
+      xstatus.resize(slist.size());
+
+      fReadPool->Run(slist.size(), HsReadJob, &jobs);
+   }
+#endif
+
    for (int i=slist.size()-1; i>=0; i--) {
       HsSchema* s = slist[i];
 
-      int status = s->read_data(start_time, end_time, num_var, smap[s], var_index, fDebug, buffer);
+      int status;
+
+      if (parallel) {
+         status = xstatus[i];
+         for (int j=0; j<num_var; j++)
+            if (smap[s][j] >= 0)
+               buffer[j]->Merge(xbuffer[i][j]);
+      } else {
+         status = s->read_data(start_time, end_time, num_var, smap[s], var_index, fDebug, buffer);
+      }
 
       if (status == HS_SUCCESS)
          for (int j=0; j<num_var; j++) {
@@ -2953,6 +4120,12 @@ int SchemaHistoryBase::hs_read_buffer(time_t start_time, time_t end_time,
       smap[s] = NULL;
    }
 
+   for (unsigned i=0; i<xbuffer.size(); i++) {
+      for (int j=0; j<num_var; j++)
+         delete xbuffer[i][j];
+      delete[] xbuffer[i];
+   }
+
    return HS_SUCCESS;
 }
 
@@ -4737,6 +5910,7 @@ public:
 
    int hs_connect(const char* connect_string);
    int hs_disconnect();
+   int hs_clear_cache();
    int read_schema(HsSchemaVector* sv, const char* event_name, const time_t timestamp);
    HsSchema* new_event(const char* event_name, time_t timestamp, int ntags, const TAG tags[]);
 
@@ -4775,6 +5949,14 @@ int FileHistory::hs_disconnect()
    return HS_SUCCESS;
 }
 
+int FileHistory::hs_clear_cache()
+{
+   // force read_schema() to rescan the history directory
+   fPathLastMtime = 0;
+
+   return SchemaHistoryBase::hs_clear_cache();
+}
+
 int FileHistory::read_schema(HsSchemaVector* sv, const char* event_name, const time_t timestamp)
 {
    int status;
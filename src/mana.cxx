@@ -21,6 +21,10 @@
 #include "zlib.h"
 #endif
 
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
 /*------------------------------------------------------------------*/
 
 /* cernlib includes */
@@ -3776,7 +3780,9 @@ void odb_load(EVENT_HEADER * pevent)
       /* close open records to parameters */
       init_module_parameters(TRUE);
 
-      if (strncmp((char *) (pevent + 1), "<?xml version=\"1.0\"", 19) == 0)
+      if (strncmp((char *) (pevent + 1), ODB_SNAPSHOT_MAGIC, 8) == 0)
+         db_paste_binary(hDB, 0, (char *) (pevent + 1), pevent->data_size);
+      else if (strncmp((char *) (pevent + 1), "<?xml version=\"1.0\"", 19) == 0)
          db_paste_xml(hDB, 0, (char *) (pevent + 1));
       else
          db_paste(hDB, 0, (char *) (pevent + 1));
@@ -3817,6 +3823,11 @@ typedef struct {
    gzFile gzfile;
 #else
    FILE *file;
+#endif
+#ifdef HAVE_ZSTD
+   FILE *zstd_file;             /* .zst file, read through zstd_dctx */
+   ZSTD_DCtx *zstd_dctx;
+   ZSTD_inBuffer zstd_in;
 #endif
    char *buffer;
    int wp, rp;
@@ -3829,6 +3840,9 @@ MA_FILE *ma_open(char *file_name)
 {
    char *ext_str;
    MA_FILE *file;
+#ifdef HAVE_ZSTD
+   BOOL zstd = FALSE;
+#endif
 
    /* allocate MA_FILE structure */
    file = (MA_FILE *) calloc(sizeof(MA_FILE), 1);
@@ -3870,6 +3884,19 @@ MA_FILE *ma_open(char *file_name)
 #endif
    }
 
+   if (strncmp(ext_str, ".zst", 4) == 0) {
+#ifdef HAVE_ZSTD
+      zstd = TRUE;
+      ext_str--;
+      while (*ext_str != '.' && ext_str > file_name)
+         ext_str--;
+#else
+      cm_msg(MERROR, "ma_open",
+             ".zst extension not possible because zstd support is not compiled in.\n");
+      return NULL;
+#endif
+   }
+
    if (strncmp(file_name, "/dev/", 4) == 0)     /* assume MIDAS tape */
       file->format = MA_FORMAT_MIDAS;
    else if (strncmp(ext_str, ".mid", 4) == 0)
@@ -3878,7 +3905,7 @@ MA_FILE *ma_open(char *file_name)
      assert(!"YBOS not supported anymore");
    else {
       printf
-          ("Unknown input data format \"%s\". Please use file extension .mid or mid.gz.\n",
+          ("Unknown input data format \"%s\". Please use file extension .mid, .mid.gz or .mid.zst.\n",
            ext_str);
       return NULL;
    }
@@ -3886,6 +3913,14 @@ MA_FILE *ma_open(char *file_name)
    if (file->device == MA_DEVICE_DISK) {
       if (file->format == MA_FORMAT_YBOS) {
 	assert(!"YBOS not supported anymore");
+#ifdef HAVE_ZSTD
+      } else if (zstd) {
+         file->zstd_file = fopen(file_name, "rb");
+         if (file->zstd_file == NULL)
+            return NULL;
+         file->zstd_dctx = ZSTD_createDCtx();
+         file->zstd_in.src = malloc(ZSTD_DStreamInSize());
+#endif
       } else {
 #ifdef HAVE_ZLIB
          file->gzfile = gzopen(file_name, "rb");
@@ -3908,6 +3943,13 @@ int ma_close(MA_FILE * file)
 {
    if (file->format == MA_FORMAT_YBOS)
      assert(!"YBOS not supported anymore");
+#ifdef HAVE_ZSTD
+   else if (file->zstd_dctx) {
+      fclose(file->zstd_file);
+      ZSTD_freeDCtx(file->zstd_dctx);
+      free((void *) file->zstd_in.src);
+   }
+#endif
    else
 #ifdef HAVE_ZLIB
       gzclose((gzFile)file->gzfile);
@@ -3921,6 +3963,43 @@ int ma_close(MA_FILE * file)
 
 /*------------------------------------------------------------------*/
 
+/* read size bytes from a disk file, returns number of bytes read */
+static int ma_read(MA_FILE * file, void *data, int size)
+{
+#ifdef HAVE_ZSTD
+   if (file->zstd_dctx) {
+      ZSTD_outBuffer out = { data, (size_t) size, 0 };
+
+      while (out.pos < out.size) {
+         size_t r = ZSTD_decompressStream(file->zstd_dctx, &out, &file->zstd_in);
+         if (ZSTD_isError(r)) {
+            cm_msg(MERROR, "ma_read", "Cannot decompress %s: %s", file->file_name, ZSTD_getErrorName(r));
+            return -1;
+         }
+
+         if (out.pos == out.size)
+            break;
+
+         /* decompressor has used up its input */
+         if (file->zstd_in.pos == file->zstd_in.size) {
+            file->zstd_in.size = fread((void *) file->zstd_in.src, 1, ZSTD_DStreamInSize(), file->zstd_file);
+            file->zstd_in.pos = 0;
+            if (file->zstd_in.size == 0)
+               break;
+         }
+      }
+
+      return out.pos;
+   }
+#endif
+
+#ifdef HAVE_ZLIB
+   return gzread(file->gzfile, data, size);
+#else
+   return size * fread(data, size, 1, file->file);
+#endif
+}
+
 int ma_read_event(MA_FILE * file, EVENT_HEADER * pevent, int size)
 {
    int n;
@@ -3933,11 +4012,7 @@ int ma_read_event(MA_FILE * file, EVENT_HEADER * pevent, int size)
          }
 
          /* read event header */
-#ifdef HAVE_ZLIB
-         n = gzread(file->gzfile, pevent, sizeof(EVENT_HEADER));
-#else
-         n = sizeof(EVENT_HEADER)*fread(pevent, sizeof(EVENT_HEADER), 1, file->file);
-#endif
+         n = ma_read(file, pevent, sizeof(EVENT_HEADER));
 
          if (n < (int) sizeof(EVENT_HEADER)) {
             if (n > 0)
@@ -3961,11 +4036,7 @@ int ma_read_event(MA_FILE * file, EVENT_HEADER * pevent, int size)
                cm_msg(MERROR, "ma_read_event", "Buffer size too small");
                return -1;
             }
-#ifdef HAVE_ZLIB
-            n = gzread(file->gzfile, pevent + 1, pevent->data_size);
-#else
-            n = pevent->data_size*fread(pevent + 1, pevent->data_size, 1, file->file);
-#endif
+            n = ma_read(file, pevent + 1, pevent->data_size);
             if (n != (INT) pevent->data_size) {
                printf("Unexpected end of file %s, last event skipped\n", file->file_name);
                return -1;
@@ -42,6 +42,10 @@ FTP_CON *ftp_con;
 #include "zlib.h"
 #endif
 
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
 #include "mdsupport.h"
 
 INT  md_dev_os_read(INT handle, INT type, void *prec, DWORD nbytes, DWORD * nread);
@@ -63,6 +67,11 @@ char *ptopmrd;
 gzFile filegz;
 #endif
 
+#ifdef HAVE_ZSTD
+ZSTD_DCtx *zstd_dctx;
+ZSTD_inBuffer zstd_in;
+#endif
+
 /* General MIDAS struct for util */
 typedef struct {
    INT handle;                  /* file handle */
@@ -82,6 +91,7 @@ typedef struct {
    INT type;                    /* Device type (tape, disk, ...) */
    DWORD runn;                  /* run number */
    BOOL zipfile;
+   BOOL zstdfile;
 } MY;
 
 MY my;
@@ -190,6 +200,7 @@ status : from lower function
 
    /* find out what dev it is ? : check on /dev */
    my.zipfile = FALSE;
+   my.zstdfile = FALSE;
    if ((strncmp(my.name, "/dev", 4) == 0) || (strncmp(my.name, "\\\\.\\", 4) == 0)) {
       /* tape device */
       my.type = LOG_TYPE_TAPE;
@@ -202,6 +213,15 @@ status : from lower function
 	if (openzip == 0) my.zipfile = FALSE; // ignore zip, copy blindly blocks
 	else my.zipfile = TRUE; // Open Zip file
       }
+      if (strncmp(infile + strlen(infile) - 4, ".zst", 4) == 0 && openzip) {
+#ifdef HAVE_ZSTD
+         /* file is opened normally and decompressed in midas_physrec_get() */
+         my.zstdfile = TRUE;
+#else
+         cm_msg(MERROR, "mdsupport", "Zstd not included ... zst file not supported");
+         return (SS_FILE_ERROR);
+#endif
+      }
    }
 
    /* open file */
@@ -212,6 +232,16 @@ status : from lower function
          printf("dev name :%s Handle:%d \n", my.name, my.handle);
          return (SS_FILE_ERROR);
       }
+#ifdef HAVE_ZSTD
+      if (my.zstdfile) {
+         if (zstd_dctx == NULL)
+            zstd_dctx = ZSTD_createDCtx();
+         ZSTD_DCtx_reset(zstd_dctx, ZSTD_reset_session_only);
+         if (zstd_in.src == NULL)
+            zstd_in.src = malloc(ZSTD_DStreamInSize());
+         zstd_in.size = zstd_in.pos = 0;
+      }
+#endif
    } else {
 #ifdef HAVE_ZLIB
       if (my.type == LOG_TYPE_TAPE) {
@@ -1096,6 +1126,49 @@ MD_SUCCESS        Ok
    return MD_SUCCESS;
 }
 
+#ifdef HAVE_ZSTD
+/*------------------------------------------------------------------*/
+static INT zstd_physrec_get(void *prec, DWORD * readn)
+/********************************************************************\
+Routine: zstd_physrec_get
+Purpose: read one physical record of my.size bytes from a zstd
+compressed file, reading more compressed data as needed.
+Input:
+void * prec        pointer to the record
+Output:
+DWORD *readn       retrieve number of bytes
+Function value:
+SS_SUCCESS         Ok
+SS_FILE_ERROR      End of file or corrupted data
+\********************************************************************/
+{
+   ZSTD_outBuffer out = { prec, my.size, 0 };
+
+   while (out.pos < out.size) {
+      size_t r = ZSTD_decompressStream(zstd_dctx, &out, &zstd_in);
+      if (ZSTD_isError(r)) {
+         cm_msg(MERROR, "zstd_physrec_get", "Cannot decompress \"%s\": %s", my.name, ZSTD_getErrorName(r));
+         return SS_FILE_ERROR;
+      }
+
+      if (out.pos == out.size)
+         break;
+
+      /* decompressor has used up its input */
+      if (zstd_in.pos == zstd_in.size) {
+         int n = read(my.handle, (void *) zstd_in.src, ZSTD_DStreamInSize());
+         if (n <= 0)
+            break;
+         zstd_in.size = n;
+         zstd_in.pos = 0;
+      }
+   }
+
+   *readn = out.pos;
+   return out.pos > 0 ? SS_SUCCESS : SS_FILE_ERROR;
+}
+#endif
+
 /*------------------------------------------------------------------*/
 INT midas_physrec_get(void *prec, DWORD * readn)
 /********************************************************************\
@@ -1119,7 +1192,11 @@ MD_SUCCESS         Ok
    INT status = 0;
 
    /* read one block of data */
-   if (!my.zipfile) {
+   if (my.zstdfile) {
+#ifdef HAVE_ZSTD
+      status = zstd_physrec_get(prec, readn);
+#endif
+   } else if (!my.zipfile) {
       status = md_dev_os_read(my.handle, my.type, prec, my.size, readn);
    } else {
 #ifdef HAVE_ZLIB
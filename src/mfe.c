@@ -80,7 +80,6 @@ HNDLE hClient;
 extern EQUIPMENT equipment[];
 
 EQUIPMENT *interrupt_eq = NULL;
-EQUIPMENT *multithread_eq = NULL;
 BOOL slowcont_eq = FALSE;
 void *event_buffer;
 void *frag_buffer = NULL;
@@ -89,9 +88,26 @@ int *n_events;
 
 /* inter-thread communication */
 int rbh[MAX_N_THREADS];
+EQUIPMENT *rb_equipment[MAX_N_THREADS]; /* equipment sending events from a ring buffer, NULL for user threads */
 volatile int stop_all_threads = 0;
 int _readout_thread(void *param);
 volatile int readout_thread_active[MAX_N_THREADS];
+
+/* one framework readout thread per EQ_MULTITHREAD equipment */
+typedef struct {
+   EQUIPMENT *eq;               /* equipment read out by this thread */
+   INT index;                   /* index of thread and its ring buffer */
+   INT cpu;                     /* CPU the thread is bound to, -1 for none */
+   HNDLE hkey;                  /* key of /Equipment/<name>/Readout thread */
+   double events_read;          /* statistics, updated by the thread */
+   double ring_buffer_full;
+   double last_events_read;
+} READOUT_THREAD;
+
+READOUT_THREAD readout_thread[MAX_N_THREADS];
+INT n_readout_threads = 0;
+INT start_readout_thread(EQUIPMENT *eq, INT index);
+void update_readout_thread_statistics(double seconds);
 void mfe_error_check(void);
 
 int send_event(INT idx, BOOL manual_trig);
@@ -139,6 +155,11 @@ INT tr_start(INT rn, char *error)
       equipment[i].odb_in = equipment[i].odb_out = 0;
       n_events[i] = 0;
    }
+   for (i = 0; i < n_readout_threads; i++) {
+      readout_thread[i].events_read = 0;
+      readout_thread[i].last_events_read = 0;
+      readout_thread[i].ring_buffer_full = 0;
+   }
    db_send_changed_records();
 
    status = begin_of_run(rn, error);
@@ -835,6 +856,7 @@ INT initialize_equipment(void)
                
                /* create ring buffer for inter-thread data transfer */
                create_event_rb(0);
+               rb_equipment[0] = interrupt_eq;
                
                /* establish interrupt handler */
                interrupt_configure(CMD_INTERRUPT_ATTACH, idx,
@@ -907,19 +929,14 @@ INT initialize_equipment(void)
 
          if (equipment[idx].status != FE_ERR_DISABLED) {
             if (eq_info->enabled) {
-               if (multithread_eq) {
+               for (i = 0; i < MAX_N_THREADS && get_event_rbh(i); i++);
+               if (i == MAX_N_THREADS) {
                   equipment[idx].status = FE_ERR_DISABLED;
-                  cm_msg(MINFO, "initialize_equipment",
-                         "Defined more than one equipment with multi-threaded readout for equipment \'%s\'", equipment[i].name);
+                  cm_msg(MERROR, "initialize_equipment",
+                         "Too many readout threads, cannot start thread for equipment \'%s\'", equipment[idx].name);
                } else {
-                  multithread_eq = &equipment[idx];
-
-                  /* create ring buffer for inter-thread data transfer */
-                  create_event_rb(0);
-
-                  /* create hardware reading thread */
-                  readout_enable(FALSE);
-                  ss_thread_create(_readout_thread, multithread_eq);
+                  if (start_readout_thread(&equipment[idx], i) != SUCCESS)
+                     equipment[idx].status = FE_ERR_DISABLED;
                }
             } else {
                equipment[idx].status = FE_ERR_DISABLED;
@@ -1156,11 +1173,24 @@ int send_event(INT idx, BOOL manual_trig)
    unsigned char *pd;
    INT i, status;
    DWORD sent, size;
+   BOOL in_place;
 
    eq_info = &equipment[idx].info;
 
+   /* EQ_IN_PLACE equipment compose their events directly in a local event
+      buffer. The buffer is not locked meanwhile, but other producers of
+      the buffer wait until the event is committed */
+   in_place = (eq_info->eq_type & EQ_IN_PLACE) && !(eq_info->eq_type & EQ_FRAGMENTED) &&
+       equipment[idx].buffer_handle && !rpc_is_remote();
+
    /* check for fragmented event */
-   if (eq_info->eq_type & EQ_FRAGMENTED)
+   if (in_place) {
+      status = bm_reserve_event(equipment[idx].buffer_handle, max_event_size, (void **) &pevent);
+      if (status != BM_SUCCESS) {
+         cm_msg(MERROR, "send_event", "bm_reserve_event() error %d", status);
+         return status;
+      }
+   } else if (eq_info->eq_type & EQ_FRAGMENTED)
       pevent = frag_buffer;
    else
       pevent = (EVENT_HEADER *)event_buffer;
@@ -1250,17 +1280,38 @@ int send_event(INT idx, BOOL manual_trig)
                return status;
             }
          }
+
+         size = pevent->data_size + sizeof(EVENT_HEADER);
       } else {
          /* send unfragmented event */
 
          if (pevent->data_size + sizeof(EVENT_HEADER) > (DWORD) max_event_size) {
             cm_msg(MERROR, "send_event", "Event size %ld larger than maximum size %d",
                    (long) (pevent->data_size + sizeof(EVENT_HEADER)), max_event_size);
+            if (in_place)
+               bm_commit_event(equipment[idx].buffer_handle, pevent, 0);
             return SS_NO_MEMORY;
          }
 
+         /* send event to ODB if RO_ODB flag is set or history is on. Do not
+            send SLOW events since the class driver does that. Events composed
+            in place have to go to the ODB before they are committed */
+         if ((eq_info->read_on & RO_ODB) ||
+             (eq_info->history > 0 && (eq_info->eq_type & ~EQ_SLOW))) {
+            update_odb(pevent, equipment[idx].hkey_variables, equipment[idx].format);
+            equipment[idx].odb_out++;
+         }
+
+         size = pevent->data_size + sizeof(EVENT_HEADER);
+
          /* send event to buffer */
-         if (equipment[idx].buffer_handle) {
+         if (in_place) {
+            status = bm_commit_event(equipment[idx].buffer_handle, pevent, size);
+            if (status != BM_SUCCESS) {
+               cm_msg(MERROR, "send_event", "bm_commit_event() error %d", status);
+               return status;
+            }
+         } else if (equipment[idx].buffer_handle) {
             status = rpc_send_event(equipment[idx].buffer_handle, pevent,
                                     pevent->data_size + sizeof(EVENT_HEADER), BM_WAIT, rpc_mode);
             if (status != BM_SUCCESS) {
@@ -1274,21 +1325,18 @@ int send_event(INT idx, BOOL manual_trig)
                return status;
             }
          }
-
-         /* send event to ODB if RO_ODB flag is set or history is on. Do not
-            send SLOW events since the class driver does that */
-         if ((eq_info->read_on & RO_ODB) ||
-             (eq_info->history > 0 && (eq_info->eq_type & ~EQ_SLOW))) {
-            update_odb(pevent, equipment[idx].hkey_variables, equipment[idx].format);
-            equipment[idx].odb_out++;
-         }
       }
 
-      equipment[idx].bytes_sent += pevent->data_size + sizeof(EVENT_HEADER);
+      equipment[idx].bytes_sent += size;
       equipment[idx].events_sent++;
-   } else
+   } else {
       equipment[idx].serial_number--;
 
+      /* drop the space reserved for an empty event */
+      if (in_place)
+         bm_commit_event(equipment[idx].buffer_handle, pevent, 0);
+   }
+
    for (i = 0; equipment[i].name[0]; i++)
       if (equipment[i].buffer_handle) {
          status = bm_flush_cache(equipment[i].buffer_handle, BM_WAIT);
@@ -1430,34 +1478,115 @@ void signal_readout_thread_active(int index, int flag)
 
 /*------------------------------------------------------------------*/
 
+INT start_readout_thread(EQUIPMENT *eq, INT index)
+/* create ring buffer and readout thread for an EQ_MULTITHREAD equipment */
+{
+   INT size, status;
+   char str[256];
+   READOUT_THREAD *rt;
+   midas_thread_t thread_id;
+
+   rt = &readout_thread[n_readout_threads];
+   memset(rt, 0, sizeof(READOUT_THREAD));
+   rt->eq = eq;
+   rt->index = index;
+
+   /* optional CPU binding and per-thread statistics are kept in the ODB */
+   rt->cpu = -1;
+   size = sizeof(INT);
+   sprintf(str, "/Equipment/%s/Readout thread/CPU", eq->name);
+   db_get_value(hDB, 0, str, &rt->cpu, &size, TID_INT, TRUE);
+   sprintf(str, "/Equipment/%s/Readout thread", eq->name);
+   db_find_key(hDB, 0, str, &rt->hkey);
+
+   /* create ring buffer for inter-thread data transfer */
+   create_event_rb(index);
+   rb_equipment[index] = eq;
+
+   /* create hardware reading thread */
+   readout_enable(FALSE);
+   thread_id = ss_thread_create(_readout_thread, rt);
+   if (thread_id == 0) {
+      cm_msg(MERROR, "start_readout_thread", "Cannot create readout thread for equipment \'%s\'", eq->name);
+      return FE_ERR_HW;
+   }
+
+   if (rt->cpu >= 0) {
+      status = ss_thread_set_affinity(thread_id, rt->cpu);
+      if (status != SS_SUCCESS)
+         cm_msg(MERROR, "start_readout_thread", "Cannot bind readout thread for equipment \'%s\' to CPU %d",
+                eq->name, rt->cpu);
+   }
+
+   n_readout_threads++;
+   return SUCCESS;
+}
+
+/*------------------------------------------------------------------*/
+
+void update_readout_thread_statistics(double seconds)
+/* copy readout thread statistics to the ODB, called from main thread */
+{
+   INT i, n_bytes;
+   double d;
+   READOUT_THREAD *rt;
+
+   for (i = 0; i < n_readout_threads; i++) {
+      rt = &readout_thread[i];
+      if (!rt->hkey)
+         continue;
+
+      d = rt->events_read;
+      db_set_value(hDB, rt->hkey, "Events read", &d, sizeof(double), 1, TID_DOUBLE);
+      d = seconds > 0 ? (rt->events_read - rt->last_events_read) / seconds : 0;
+      db_set_value(hDB, rt->hkey, "Events per sec.", &d, sizeof(double), 1, TID_DOUBLE);
+      rt->last_events_read = rt->events_read;
+      d = rt->ring_buffer_full;
+      db_set_value(hDB, rt->hkey, "Ring buffer full", &d, sizeof(double), 1, TID_DOUBLE);
+      rb_get_buffer_level(get_event_rbh(rt->index), &n_bytes);
+      d = 100.0 * n_bytes / event_buffer_size;
+      db_set_value(hDB, rt->hkey, "Ring buffer level", &d, sizeof(double), 1, TID_DOUBLE);
+   }
+}
+
+/*------------------------------------------------------------------*/
+
 int _readout_thread(void *param)
 {
-   int status, source;
+   int status, source, index, rbh;
+   READOUT_THREAD *rt;
+   EQUIPMENT *eq;
    EVENT_HEADER *pevent;
    void *p;
 
+   rt = (READOUT_THREAD *) param;
+   eq = rt->eq;
+   index = rt->index;
+   rbh = get_event_rbh(index);
+
    /* indicate activity to framework */
-   signal_readout_thread_active(0, 1);
+   signal_readout_thread_active(index, 1);
 
-   p = param; /* avoid compiler warning */
    while (!stop_all_threads) {
       /* obtain buffer space */
 
-      status = rb_get_wp(get_event_rbh(0), &p, 0);
+      status = rb_get_wp(rbh, &p, 0);
+      if (status == DB_TIMEOUT) {
+         /* ring buffer is full, wait until sender has made some space */
+         rt->ring_buffer_full++;
+         status = rb_get_wp(rbh, &p, 100);
+      }
       if (stop_all_threads)
          break;
-      if (status == DB_TIMEOUT) {
-         // printf("readout_thread: Ring buffer is full, waiting for space!\n");
-         ss_sleep(10);
+      if (status == DB_TIMEOUT)
          continue;
-      }
       if (status != DB_SUCCESS)
          break;
 
       if (readout_enabled()) {
         
          /* check for new event */
-         source = poll_event(multithread_eq->info.source, multithread_eq->poll_count, FALSE);
+         source = poll_event(eq->info.source, eq->poll_count, FALSE);
 
          if (source > 0) {
 
@@ -1471,14 +1600,14 @@ int _readout_thread(void *param)
             *(INT *) (pevent + 1) = source;
             
             /* compose MIDAS event header */
-            pevent->event_id = multithread_eq->info.event_id;
-            pevent->trigger_mask = multithread_eq->info.trigger_mask;
+            pevent->event_id = eq->info.event_id;
+            pevent->trigger_mask = eq->info.trigger_mask;
             pevent->data_size = 0;
             pevent->time_stamp = actual_time;
-            pevent->serial_number = multithread_eq->serial_number++;
+            pevent->serial_number = eq->serial_number++;
 
             /* call user readout routine */
-            pevent->data_size = multithread_eq->readout((char *) (pevent + 1), 0);
+            pevent->data_size = eq->readout((char *) (pevent + 1), 0);
 
             /* check event size */
             if (pevent->data_size + sizeof(EVENT_HEADER) > (DWORD) max_event_size) {
@@ -1491,9 +1620,10 @@ int _readout_thread(void *param)
 
             if (pevent->data_size > 0) {
                /* put event into ring buffer */
-               rb_increment_wp(get_event_rbh(0), sizeof(EVENT_HEADER) + pevent->data_size);
+               rb_increment_wp(rbh, sizeof(EVENT_HEADER) + pevent->data_size);
+               rt->events_read++;
             } else
-               multithread_eq->serial_number--;
+               eq->serial_number--;
          }
 
       } else // readout_enabled
@@ -1501,7 +1631,7 @@ int _readout_thread(void *param)
 
    }
 
-   signal_readout_thread_active(0, 0);
+   signal_readout_thread_active(index, 0);
 
    return 0;
 }
@@ -1510,9 +1640,10 @@ int _readout_thread(void *param)
 
 int receive_trigger_event(EQUIPMENT *eq)
 {
-   int i, status;
+   int i, j, n, status, index, size;
    EVENT_HEADER *prb = NULL, *pevent;
    void *p;
+   static int wait_index = 0;
 
 #if 0
    int nbytes;
@@ -1524,54 +1655,79 @@ int receive_trigger_event(EQUIPMENT *eq)
    }
 #endif
    
-   for (i=0 ; get_event_rbh(i) ; i++) {
-      status = rb_get_rp(get_event_rbh(i), &p, 10);
-      prb = (EVENT_HEADER *)p;
-      if (status == DB_TIMEOUT)
+   /* events of one equipment can come from several ring buffers, for
+      example one readout thread per board, so send the one with the
+      lowest serial number first */
+   index = -1;
+   for (n = 0; n < MAX_N_THREADS && get_event_rbh(n); n++) {
+      if (rb_equipment[n] != NULL && rb_equipment[n] != eq)
+         continue;
+      if (rb_get_rp(get_event_rbh(n), &p, 0) != DB_SUCCESS)
+         continue;
+      pevent = (EVENT_HEADER *) p;
+      if (prb == NULL || (INT) (pevent->serial_number - prb->serial_number) < 0) {
+         prb = pevent;
+         index = n;
+      }
+   }
+
+   /* if all are empty, wait a bit on one of them, taking turns */
+   if (prb == NULL) {
+      for (i = 1; i <= n; i++) {
+         j = (wait_index + i) % n;
+         if (rb_equipment[j] == NULL || rb_equipment[j] == eq)
+            break;
+      }
+      if (i > n)
          return 0;
-      
-      pevent = prb;
-      
-      /* send event */
-      if (pevent->data_size) {
-         if (eq->buffer_handle) {
-            
-            /* save event in temporary buffer to push it to the ODB later */
-            if (eq->info.read_on & RO_ODB)
-               memcpy(event_buffer, pevent, pevent->data_size + sizeof(EVENT_HEADER));
-            
-            /* send first event to ODB if logger writes in root format */
-            if (pevent->serial_number == 0)
-               if (logger_root())
-                  update_odb(pevent, eq->hkey_variables, eq->format);
-            
-            status = rpc_send_event(eq->buffer_handle, pevent,
-                                    pevent->data_size + sizeof(EVENT_HEADER),
-                                    BM_WAIT, rpc_mode);
-            
-            if (status != SUCCESS) {
-               cm_msg(MERROR, "receive_trigger_event", "rpc_send_event error %d", status);
-               return -1;
-            }
-            
-            eq->bytes_sent += pevent->data_size + sizeof(EVENT_HEADER);
-            
-            if (eq->info.num_subevents)
-               eq->events_sent += eq->subevent_number;
-            else
-               eq->events_sent++;
-            
-            rotate_wheel();
+
+      wait_index = j;
+      status = rb_get_rp(get_event_rbh(j), &p, 10);
+      if (status != DB_SUCCESS)
+         return 0;
+      prb = (EVENT_HEADER *) p;
+      index = j;
+   }
+
+   pevent = prb;
+   size = prb->data_size;
+
+   /* send event */
+   if (pevent->data_size) {
+      if (eq->buffer_handle) {
+         
+         /* save event in temporary buffer to push it to the ODB later */
+         if (eq->info.read_on & RO_ODB)
+            memcpy(event_buffer, pevent, pevent->data_size + sizeof(EVENT_HEADER));
+         
+         /* send first event to ODB if logger writes in root format */
+         if (pevent->serial_number == 0)
+            if (logger_root())
+               update_odb(pevent, eq->hkey_variables, eq->format);
+         
+         status = rpc_send_event(eq->buffer_handle, pevent,
+                                 pevent->data_size + sizeof(EVENT_HEADER),
+                                 BM_WAIT, rpc_mode);
+         
+         if (status != SUCCESS) {
+            cm_msg(MERROR, "receive_trigger_event", "rpc_send_event error %d", status);
+            return -1;
          }
+         
+         eq->bytes_sent += pevent->data_size + sizeof(EVENT_HEADER);
+         
+         if (eq->info.num_subevents)
+            eq->events_sent += eq->subevent_number;
+         else
+            eq->events_sent++;
+         
+         rotate_wheel();
       }
-      
-      rb_increment_rp(get_event_rbh(i), sizeof(EVENT_HEADER) + prb->data_size);
-   } // for rbh[]
-
-   if (prb == NULL)
-      return 0;
+   }
    
-   return prb->data_size;
+   rb_increment_rp(get_event_rbh(index), sizeof(EVENT_HEADER) + size);
+
+   return size;
 }
 
 /*------------------------------------------------------------------*/
@@ -2385,6 +2541,8 @@ INT scheduler(void)
                 ((double) max_bytes_per_sec /
                  ((actual_millitime - last_time_rate) / 1000.0));
 
+            update_readout_thread_statistics((actual_millitime - last_time_rate) / 1000.0);
+
             last_time_rate = actual_millitime;
          }
 
@@ -353,6 +353,20 @@ void rmemcpy(const void *buf, int len)
 
 /*------------------------------------------------------------------*/
 
+void rsjson(HNDLE hDB, HNDLE hkey, int save_keys, int follow_links, int recurse)
+{
+   /* let the JSON writer grow the return buffer directly, instead of
+      copying the JSON text from a temporary buffer */
+   int size = return_size;
+   int end = strlen_retbuf;
+   db_copy_json_obsolete(hDB, hkey, &return_buffer, &size, &end, save_keys, follow_links, recurse);
+   return_size = size;
+   strlen_retbuf = end;
+   return_length = strlen_retbuf;
+}
+
+/*------------------------------------------------------------------*/
+
 void rread(const char* filename, int fh, int len)
 {
    return_grow(len);
@@ -7266,19 +7280,20 @@ void javascript_commands(const char *cookie_cpwd)
                rsputs("(");
             }
 
-            int end = 0;
-            int bufsize = WEB_BUFFER_SIZE;
-            char* buf = (char *)malloc(bufsize);
+            if (fmt_json)
+               rsjson(hDB, hkey, save_keys, follow_links, recurse);
+            else {
+               int bufsize = WEB_BUFFER_SIZE;
+               char* buf = (char *)malloc(bufsize);
 
-            if (fmt_xml)
-               db_copy_xml(hDB, hkey, buf, &bufsize);
-            else if (fmt_json)
-               db_copy_json_obsolete(hDB, hkey, &buf, &bufsize, &end, save_keys, follow_links, recurse);
-            else
-               db_copy(hDB, hkey, buf, &bufsize, (char *)"");
+               if (fmt_xml)
+                  db_copy_xml(hDB, hkey, buf, &bufsize);
+               else
+                  db_copy(hDB, hkey, buf, &bufsize, (char *)"");
 
-            rsputs(buf);
-            free(buf);
+               rsputs(buf);
+               free(buf);
+            }
 
             if (fmt_jsonp) {
                rsputs(");\n");
@@ -7333,7 +7348,11 @@ void javascript_commands(const char *cookie_cpwd)
                continue;
             }
 
-            int end = 0;
+            if (fmt_json) {
+               rsjson(hDB, hkey, save_keys, follow_links, recurse);
+               continue;
+            }
+
             int bufsize = WEB_BUFFER_SIZE;
             char* buf = (char *)malloc(bufsize);
 
@@ -7345,9 +7364,6 @@ void javascript_commands(const char *cookie_cpwd)
                else
                   s = buf;
                rsputs(s);
-            } else if (fmt_json) {
-               db_copy_json_obsolete(hDB, hkey, &buf, &bufsize, &end, save_keys, follow_links, recurse);
-               rsputs(buf);
             } else {
                db_copy(hDB, hkey, buf, &bufsize, (char *)"");
                rsputs(buf);
@@ -156,9 +156,13 @@ static char *_net_recv_buffer;
 static INT _net_recv_buffer_size = 0;
 static INT _net_recv_buffer_size_odb = 0;
 
+static char *_event_batch = NULL;
+static INT _event_batch_size = 0;
+
 static char *_tcp_buffer = NULL;
 static INT _tcp_wp = 0;
 static INT _tcp_rp = 0;
+static INT _tcp_batch = -1;             /* offset of RPC_BM_SEND_EVENTS command still open for more events */
 static INT _rpc_sock = 0;
 static MUTEX_T *_mutex_rpc = NULL;
 
@@ -2126,6 +2130,7 @@ INT cm_connect_experiment1(const char *host_name, const char *exp_name,
    char xclient_name[NAME_LENGTH];
    HNDLE hDB, hKeyClient;
    BOOL call_watchdog;
+   INT notify_window = 20;
 
    if (_hKeyClient)
       cm_disconnect_experiment();
@@ -2228,6 +2233,11 @@ INT cm_connect_experiment1(const char *host_name, const char *exp_name,
    status = db_get_value(hDB, 0, "/Experiment/Security/Enable non-localhost RPC", &disable_bind_rpc_to_localhost, &size, TID_BOOL, TRUE);
    assert(status == DB_SUCCESS);
 
+   /* collect hot-link notifications of further changes within this time */
+   size = sizeof(notify_window);
+   db_get_value(hDB, 0, "/Experiment/Notify window", &notify_window, &size, TID_INT, TRUE);
+   db_set_notify_window(notify_window);
+
    /* now setup client info */
    if (!disable_bind_rpc_to_localhost)
       strlcpy(local_host_name, "localhost", sizeof(local_host_name));
@@ -2637,6 +2647,12 @@ INT cm_disconnect_experiment(void)
       _net_recv_buffer_size_odb = 0;
    }
 
+   if (_event_batch_size > 0) {
+      free(_event_batch);
+      _event_batch = NULL;
+      _event_batch_size = 0;
+   }
+
    if (_tcp_buffer != NULL) {
       M_FREE(_tcp_buffer);
       _tcp_buffer = NULL;
@@ -2777,6 +2793,7 @@ INT cm_get_experiment_semaphore(INT * semaphore_alarm, INT * semaphore_elog, INT
 #endif                          /* DOXYGEN_SHOULD_SKIP_THIS */
 
 static int bm_validate_client_index(const BUFFER * buf, BOOL abort_if_invalid);
+static void bm_wakeup_client(BUFFER_CLIENT * pc, const char *message);
 
 /********************************************************************/
 /**
@@ -5022,11 +5039,26 @@ INT cm_dispatch_ipc(const char *message, int s)
 \********************************************************************/
 {
    if (message[0] == 'O') {
-      HNDLE hDB, hKey, hKeyRoot;
-      INT index;
-      index = 0;
-      sscanf(message + 2, "%d %d %d %d", &hDB, &hKeyRoot, &hKey, &index);
-      return db_update_record(hDB, hKeyRoot, hKey, index, s);
+      HNDLE hDB, hKeyRoot, hKey[NOTIFY_MAX_KEYS];
+      INT index[NOTIFY_MAX_KEYS], n, len;
+      const char *p;
+
+      /* "O hDB hKeyRoot hKey index [hKey index ...]" */
+      hDB = hKeyRoot = 0;
+      len = 0;
+      sscanf(message + 2, "%d %d%n", &hDB, &hKeyRoot, &len);
+      p = message + 2 + len;
+      for (n = 0; n < NOTIFY_MAX_KEYS; n++) {
+         index[n] = 0;
+         if (sscanf(p, "%d %d%n", &hKey[n], &index[n], &len) != 2)
+            break;
+         p += len;
+      }
+      if (n == 0) {
+         hKey[0] = hKeyRoot;
+         n = 1;
+      }
+      return db_update_record_list(hDB, hKeyRoot, n, hKey, index, s);
    }
 
    /* message == "B" means "resume event sender" */
@@ -5104,6 +5136,10 @@ INT cm_yield(INT millisec)
    /* flush the cm_msg buffer */
    cm_msg_flush_buffer();
 
+   /* send hot-link notifications held back by the notify window,
+      and return in time to send the remaining ones */
+   db_flush_notify(&millisec);
+
    /* check for available events */
    if (rpc_is_remote()) {
       bMore = bm_poll_event(TRUE);
@@ -5139,6 +5175,9 @@ INT cm_yield(INT millisec)
    /* flush the cm_msg buffer */
    cm_msg_flush_buffer();
 
+   /* send hot-link notifications which became due while waiting */
+   db_flush_notify(NULL);
+
    return status;
 }
 
@@ -5349,6 +5388,34 @@ INT bm_match_event(short int event_id, short int trigger_mask, EVENT_HEADER * pe
                                               || (trigger_mask & pevent->trigger_mask)));
 }
 
+static void bm_update_get_all_index(BUFFER_HEADER * pheader)
+{
+   /* rebuild the table of GET_ALL requests of all clients, which is used
+      by producers to find blocking clients without looking at every request
+      of every client. Has to be called with the buffer locked whenever a
+      request or a client gets added or removed. */
+   int i, j, n, nc;
+   const BUFFER_CLIENT *pc;
+
+   for (i = n = nc = 0, pc = pheader->client; i < pheader->max_client_index; i++, pc++) {
+      if (!pc->pid || !pc->all_flag)
+         continue;
+
+      nc++;
+      for (j = 0; j < pc->max_request_index; j++)
+         if (pc->event_request[j].valid && (pc->event_request[j].sampling_type & GET_ALL)) {
+            pheader->get_all_request[n].event_id = pc->event_request[j].event_id;
+            pheader->get_all_request[n].trigger_mask = pc->event_request[j].trigger_mask;
+            pheader->get_all_request[n].client_index = i;
+            pheader->get_all_request[n].id = pc->event_request[j].id;
+            n++;
+         }
+   }
+
+   pheader->num_get_all_requests = n;
+   pheader->num_get_all_clients = nc;
+}
+
 /********************************************************************/
 /**
 Called to forcibly disconnect given client from a data buffer
@@ -5367,6 +5434,8 @@ void bm_remove_client_locked(BUFFER_HEADER * pheader, int j)
          break;
    pheader->max_client_index = k + 1;
 
+   bm_update_get_all_index(pheader);
+
    /* count new number of clients */
    for (k = MAX_CLIENTS - 1, nc = 0; k >= 0; k--)
       if (pheader->client[k].pid != 0)
@@ -5378,7 +5447,7 @@ void bm_remove_client_locked(BUFFER_HEADER * pheader, int j)
 
    for (k = 0; k < pheader->max_client_index; k++, pbctmp++)
       if (pbctmp->pid && (pbctmp->write_wait || pbctmp->read_wait))
-         ss_resume(pbctmp->port, "B  ");
+         bm_wakeup_client(pbctmp, "B  ");
 }
 
 /********************************************************************/
@@ -5495,6 +5564,13 @@ The "SYSTEM" buffer is used to
 exchange events and the "SYSMSG" buffer is used to exchange system messages.
 The name and size of the event buffers is defined in midas.h as
 EVENT_BUFFER_NAME and DEFAULT_BUFFER_SIZE.
+
+If "/Experiment/Lock-free buffers/<name>" is set in the ODB when the
+buffer is created, consumers read events without locking the buffer.
+They advance their own read pointer with atomic operations, while
+producers publish the write pointer atomically and only lock the buffer
+against other producers. Client attach/detach and request changes
+still lock the buffer.
 Following example opens the "SYSTEM" buffer, requests events with ID 1 and
 enters a main loop. Events are then received in process_event()
 \code
@@ -5532,6 +5608,8 @@ BM_NO_SEMAPHORE Semaphore cannot be created <br>
 BM_NO_MEMORY Not enough memory to create buffer descriptor <br>
 BM_MEMSIZE_MISMATCH Buffer size conflicts with an existing buffer of
 different size <br>
+BM_VERSION_MISMATCH Existing buffer was created by a MIDAS library with a
+different buffer format <br>
 BM_INVALID_PARAM Invalid parameter
 */
 INT bm_open_buffer(const char *buffer_name, INT buffer_size, INT * buffer_handle)
@@ -5554,6 +5632,7 @@ INT bm_open_buffer(const char *buffer_name, INT buffer_size, INT * buffer_handle
       char odb_path[256];
       void *p;
       int max_buffer_size = 2 * 1000 * 1024 * 1024;
+      BOOL lockfree = FALSE;
 
       bm_cleanup("bm_open_buffer", ss_millitime(), FALSE);
 
@@ -5581,6 +5660,13 @@ INT bm_open_buffer(const char *buffer_name, INT buffer_size, INT * buffer_handle
       size = sizeof(INT);
       status = db_get_value(hDB, 0, odb_path, &buffer_size, &size, TID_DWORD, TRUE);
 
+      /* get lock-free reader mode from ODB, only used if buffer gets created */
+      strlcpy(odb_path, "/Experiment/Lock-free buffers/", sizeof(odb_path));
+      strlcat(odb_path, buffer_name, sizeof(odb_path));
+
+      size = sizeof(BOOL);
+      status = db_get_value(hDB, 0, odb_path, &lockfree, &size, TID_BOOL, TRUE);
+
       if (buffer_size <= 0 || buffer_size > max_buffer_size) {
          cm_msg(MERROR, "bm_open_buffer", "cannot open buffer \'%s\' - buffer size %d exceeds maximum size %d", buffer_name, buffer_size, max_buffer_size);
          return BM_INVALID_PARAM;
@@ -5660,8 +5746,22 @@ INT bm_open_buffer(const char *buffer_name, INT buffer_size, INT * buffer_handle
          memset(pheader, 0, sizeof(BUFFER_HEADER) + buffer_size);
 
          strcpy(pheader->name, buffer_name);
+         pheader->version = BUFFER_VERSION;
          pheader->size = buffer_size;
+#ifdef HAVE_SS_ATOMIC
+         pheader->lockfree = lockfree;
+#endif
       } else {
+         /* check buffer format, older clients do not know lock-free mode, futex wake-up
+            and the GET_ALL table, producers would overwrite events they have not read */
+         if (pheader->version != BUFFER_VERSION) {
+            cm_msg(MERROR, "bm_open_buffer", "Cannot open buffer \"%s\": different buffer format: shared memory is %d, program is %d",
+                   buffer_name, pheader->version, BUFFER_VERSION);
+            *buffer_handle = 0;
+            _buffer_entries--;
+            return BM_VERSION_MISMATCH;
+         }
+
          /* check if buffer size is identical */
          if (pheader->size != buffer_size) {
             cm_msg(MERROR, "bm_open_buffer", "Cannot open buffer \"%s\": requested buffer size (%d) differs from existing size (%d)",
@@ -5837,6 +5937,8 @@ INT bm_close_buffer(INT buffer_handle)
             break;
       pheader->max_client_index = i + 1;
 
+      bm_update_get_all_index(pheader);
+
       /* count new number of clients */
       for (i = MAX_CLIENTS - 1, j = 0; i >= 0; i--)
          if (pheader->client[i].pid != 0)
@@ -5854,13 +5956,19 @@ INT bm_close_buffer(INT buffer_handle)
          M_FREE(_buffer[buffer_handle - 1].write_cache);
          _buffer[buffer_handle - 1].write_cache = NULL;
       }
+      if (_buffer[buffer_handle - 1].peek_buffer_size > 0) {
+         free(_buffer[buffer_handle - 1].peek_buffer);
+         _buffer[buffer_handle - 1].peek_buffer = NULL;
+         _buffer[buffer_handle - 1].peek_buffer_size = 0;
+      }
+      _buffer[buffer_handle - 1].peek_size = 0;
 
       /* check if anyone is waiting and wake him up */
       pclient = pheader->client;
 
       for (i = 0; i < pheader->max_client_index; i++, pclient++)
          if (pclient->pid && (pclient->write_wait || pclient->read_wait))
-            ss_resume(pclient->port, "B  ");
+            bm_wakeup_client(pclient, "B  ");
 
       strlcpy(xname, pheader->name, sizeof(xname));
 
@@ -6992,6 +7100,8 @@ INT bm_add_event_request(INT buffer_handle, short int event_id,
       if (i + 1 > pclient->max_request_index)
          pclient->max_request_index = i + 1;
 
+      bm_update_get_all_index(_buffer[buffer_handle - 1].buffer_header);
+
       bm_unlock_buffer(buffer_handle);
    }
 #endif                          /* LOCAL_ROUTINES */
@@ -7021,6 +7131,9 @@ match the specified event ID and trigger mask. If the events are consumed slower
 than produced, the producer is automatically slowed down. A value of GET_NONBLOCKING
 receives as much events as possible without slowing down the producer. GET_ALL is
 typically used by the logger, while GET_NONBLOCKING is typically used by analyzers.
+GET_IN_PLACE can be ORed to the sampling type of local clients to pass the event
+to the callback routine directly in the shared memory of the buffer, see
+bm_peek_event(). The callback must not modify the event in that case.
 @param request_id request ID returned by the function.
 This ID is passed to the callback routine and must
 be used in the bm_delete_request() routine.
@@ -7074,11 +7187,12 @@ INT bm_request_event(HNDLE buffer_handle, short int event_id,
    _request_list[idx].event_id = event_id;
    _request_list[idx].trigger_mask = trigger_mask;
    _request_list[idx].dispatcher = func;
+   _request_list[idx].in_place = (sampling_type & GET_IN_PLACE) != 0;
 
    *request_id = idx;
 
    /* add request in buffer structure */
-   status = bm_add_event_request(buffer_handle, event_id, trigger_mask, sampling_type, func, idx);
+   status = bm_add_event_request(buffer_handle, event_id, trigger_mask, sampling_type & ~GET_IN_PLACE, func, idx);
    if (status != BM_SUCCESS)
       return status;
 
@@ -7144,6 +7258,8 @@ INT bm_remove_event_request(INT buffer_handle, INT request_id)
             break;
          }
 
+      bm_update_get_all_index(_buffer[buffer_handle - 1].buffer_header);
+
       bm_unlock_buffer(buffer_handle);
 
       if (!deleted)
@@ -7197,53 +7313,39 @@ static void bm_show_pointers(const BUFFER_HEADER * pheader)
 
 static void bm_validate_client_pointers(BUFFER_HEADER * pheader, BUFFER_CLIENT * pclient)
 {
+   /* in lock-free mode the client may move its read pointer
+    * while we look at it, so work on a copy and use an
+    * atomic compare-and-swap to correct it */
+   int rp = SS_ATOMIC_LOAD(&pclient->read_pointer);
+   int new_rp = rp;
+
    assert(pheader->read_pointer >= 0 && pheader->read_pointer <= pheader->size);
-   assert(pclient->read_pointer >= 0 && pclient->read_pointer <= pheader->size);
+   assert(rp >= 0 && rp <= pheader->size);
 
    if (pheader->read_pointer <= pheader->write_pointer) {
 
-      if (pclient->read_pointer < pheader->read_pointer) {
-         cm_msg(MINFO, "bm_validate_client_pointers",
-                "Corrected read pointer for client \'%s\' on buffer \'%s\' from %d to %d", pclient->name,
-                pheader->name, pclient->read_pointer, pheader->read_pointer);
+      if (rp < pheader->read_pointer)
+         new_rp = pheader->read_pointer;
 
-         pclient->read_pointer = pheader->read_pointer;
-      }
-
-      if (pclient->read_pointer > pheader->write_pointer) {
-         cm_msg(MINFO, "bm_validate_client_pointers",
-                "Corrected read pointer for client \'%s\' on buffer \'%s\' from %d to %d", pclient->name,
-                pheader->name, pclient->read_pointer, pheader->write_pointer);
-
-         pclient->read_pointer = pheader->write_pointer;
-      }
+      if (rp > pheader->write_pointer)
+         new_rp = pheader->write_pointer;
 
    } else {
 
-      if (pclient->read_pointer < 0) {
-         cm_msg(MINFO, "bm_validate_client_pointers",
-                "Corrected read pointer for client \'%s\' on buffer \'%s\' from %d to %d", pclient->name,
-                pheader->name, pclient->read_pointer, pheader->read_pointer);
-
-         pclient->read_pointer = pheader->read_pointer;
-      }
-
-      if (pclient->read_pointer >= pheader->size) {
-         cm_msg(MINFO, "bm_validate_client_pointers",
-                "Corrected read pointer for client \'%s\' on buffer \'%s\' from %d to %d", pclient->name,
-                pheader->name, pclient->read_pointer, pheader->read_pointer);
-
-         pclient->read_pointer = pheader->read_pointer;
-      }
+      if (rp < 0)
+         new_rp = pheader->read_pointer;
 
-      if (pclient->read_pointer > pheader->write_pointer && pclient->read_pointer < pheader->read_pointer) {
-         cm_msg(MINFO, "bm_validate_client_pointers",
-                "Corrected read pointer for client \'%s\' on buffer \'%s\' from %d to %d", pclient->name,
-                pheader->name, pclient->read_pointer, pheader->read_pointer);
+      if (rp >= pheader->size)
+         new_rp = pheader->read_pointer;
 
-         pclient->read_pointer = pheader->read_pointer;
-      }
+      if (rp > pheader->write_pointer && rp < pheader->read_pointer)
+         new_rp = pheader->read_pointer;
    }
+
+   if (new_rp != rp && SS_ATOMIC_CAS(&pclient->read_pointer, rp, new_rp))
+      cm_msg(MINFO, "bm_validate_client_pointers",
+             "Corrected read pointer for client \'%s\' on buffer \'%s\' from %d to %d", pclient->name,
+             pheader->name, rp, new_rp);
 }
 
 #if 0                           // currently not used
@@ -7274,20 +7376,23 @@ static BOOL bm_update_read_pointer(const char *caller_name, BUFFER_HEADER * phea
 
    for (i = 0; i < pheader->max_client_index; i++)
       if (pclient[i].pid) {
+         int rp;
 #ifdef DEBUG_MSG
          cm_msg(MDEBUG, caller_name, "bm_update_read_pointer: client %d rp=%d", i, pclient[i].read_pointer);
 #endif
          bm_validate_client_pointers(pheader, &pclient[i]);
 
+         rp = SS_ATOMIC_LOAD(&pclient[i].read_pointer);
+
          if (pheader->read_pointer <= pheader->write_pointer) {
-            if (pclient[i].read_pointer < min_rp)
-               min_rp = pclient[i].read_pointer;
+            if (rp < min_rp)
+               min_rp = rp;
          } else {
-            if (pclient[i].read_pointer <= pheader->write_pointer) {
-               if (pclient[i].read_pointer < min_rp)
-                  min_rp = pclient[i].read_pointer;
+            if (rp <= pheader->write_pointer) {
+               if (rp < min_rp)
+                  min_rp = rp;
             } else {
-               int xptr = pclient[i].read_pointer - pheader->size;
+               int xptr = rp - pheader->size;
                if (xptr < min_rp)
                   min_rp = xptr;
             }
@@ -7315,19 +7420,77 @@ static BOOL bm_update_read_pointer(const char *caller_name, BUFFER_HEADER * phea
    return did_move;
 }
 
-static void bm_wakeup_producers(const BUFFER_HEADER * pheader, const BUFFER_CLIENT * pc)
+static void bm_reader_moved(const char *caller_name, BUFFER_HEADER * pheader, int old_read_pointer)
+{
+   /* a reader has moved on from old_read_pointer, the "minimum" of the
+      client read pointers can only change if it was the slowest one */
+   if (old_read_pointer == pheader->read_pointer)
+      bm_update_read_pointer(caller_name, pheader);
+}
+
+static BOOL bm_can_futex_wait()
+{
+#ifdef HAVE_SS_FUTEX
+   /* the mserver has to keep watching its sockets while waiting for a buffer */
+   int server_type = rpc_get_server_option(RPC_OSERVER_TYPE);
+
+   return server_type == ST_REMOTE || server_type == ST_NONE;
+#else
+   return FALSE;
+#endif
+}
+
+static int bm_prepare_wait(BUFFER_CLIENT * pc)
+{
+   /*
+      Tell the other clients how to wake us up. Has to be called before
+      read_wait or write_wait gets set and before the wait condition is
+      checked for the last time. The returned value is passed to
+      bm_wait_for_wakeup().
+    */
+
+   SS_ATOMIC_STORE(&pc->futex_wait, bm_can_futex_wait());
+   return SS_ATOMIC_LOAD(&pc->wake_count);
+}
+
+static int bm_wait_for_wakeup(BUFFER_CLIENT * pc, int wake_count)
+{
+#ifdef HAVE_SS_FUTEX
+   if (pc->futex_wait) {
+      if (ss_futex_wait(&pc->wake_count, wake_count, 100) == SS_SUCCESS)
+         return SS_SUCCESS;
+
+      /* serve RPC requests and drain UDP wake-ups while we are blocked */
+      return ss_suspend(0, MSG_BM);
+   }
+#endif
+
+   return ss_suspend(1000, MSG_BM);
+}
+
+static void bm_wakeup_client(BUFFER_CLIENT * pc, const char *message)
+{
+#ifdef HAVE_SS_FUTEX
+   /* local clients sleeping in bm_wait_for_wakeup() */
+   if (SS_ATOMIC_LOAD(&pc->futex_wait)) {
+      SS_ATOMIC_ADD(&pc->wake_count, 1);
+      ss_futex_wake(&pc->wake_count);
+      return;
+   }
+#endif
+
+   /* clients sleeping in ss_suspend(), like the mserver */
+   ss_resume(pc->port, message);
+}
+
+static void bm_wakeup_producers(BUFFER_HEADER * pheader, const BUFFER_CLIENT * pc)
 {
    int i;
    int size;
-   const BUFFER_CLIENT *pctmp = pheader->client;
-   int have_get_all_requests = 0;
+   BUFFER_CLIENT *pctmp = pheader->client;
 
-   for (i = 0; i < pc->max_request_index; i++)
-      if (pc->event_request[i].valid)
-         have_get_all_requests |= (pc->event_request[i].sampling_type == GET_ALL);
-   
    /* only GET_ALL requests actually free space in the event buffer */
-   if (!have_get_all_requests)
+   if (!pc->all_flag)
       return;
 
    /*
@@ -7343,23 +7506,40 @@ static void bm_wakeup_producers(const BUFFER_HEADER * pheader, const BUFFER_CLIE
    if (size >= pheader->size * 0.5)
       for (i = 0; i < pheader->max_client_index; i++, pctmp++)
 	if (pctmp->pid)
-           if (pctmp->write_wait < size) {
+           if (pctmp->write_wait && pctmp->write_wait < size) {
 #ifdef DEBUG_MSG
             cm_msg(MDEBUG, "Receive wake: rp=%d, wp=%d, level=%1.1lf",
                    pheader->read_pointer, pheader->write_pointer, 100 - 100.0 * size / pheader->size);
 #endif
-            ss_resume(pctmp->port, "B  ");
+            bm_wakeup_client(pctmp, "B  ");
             }
 }
 
-static void bm_dispatch_event(int buffer_handle, EVENT_HEADER * pevent)
+static void bm_dispatch_event(int buffer_handle, EVENT_HEADER * pevent, BOOL in_shm)
 {
-   int i;
+   int i, size;
+   EVENT_HEADER *pcopy = NULL;
 
    /* call dispatcher */
    for (i = 0; i < _request_list_entries; i++)
       if (_request_list[i].buffer_handle == buffer_handle &&
           bm_match_event(_request_list[i].event_id, _request_list[i].trigger_mask, pevent)) {
+
+         /* requests without GET_IN_PLACE get a private copy of events in shared memory */
+         if (in_shm && !_request_list[i].in_place) {
+            if (pcopy == NULL) {
+               size = pevent->data_size + sizeof(EVENT_HEADER);
+               if (size > _event_buffer_size) {
+                  _event_buffer = (EVENT_HEADER *) realloc(_event_buffer, size);
+                  _event_buffer_size = size;
+               }
+               memcpy(_event_buffer, pevent, size);
+               pcopy = _event_buffer;
+            }
+            pevent = pcopy;
+            in_shm = FALSE;
+         }
+
          /* if event is fragmented, call defragmenter */
          if ((pevent->event_id & 0xF000) == EVENTID_FRAG1 || (pevent->event_id & 0xF000) == EVENTID_FRAG)
             bm_defragment_event(buffer_handle, i, pevent, (void *) (pevent + 1), _request_list[i].dispatcher);
@@ -7385,7 +7565,7 @@ static void bm_dispatch_from_cache(BUFFER * pbuf, int buffer_handle)
    if (pbuf->read_cache_rp == pbuf->read_cache_wp)
       pbuf->read_cache_rp = pbuf->read_cache_wp = 0;
 
-   bm_dispatch_event(buffer_handle, pevent);
+   bm_dispatch_event(buffer_handle, pevent, FALSE);
 }
 
 static void bm_convert_event_header(EVENT_HEADER * pevent, int convert_flags)
@@ -7434,6 +7614,47 @@ static int bm_copy_from_cache(BUFFER * pbuf, void *destination, int max_size, in
    return status;
 }
 
+static int bm_copy_to_buffer(const BUFFER_HEADER * pheader, int write_pointer, const void *source, int total_size)
+{
+   /* copy event to the data area at write_pointer, splitting it at the
+      end of the buffer, and return the new write pointer */
+   char *pdata = (char *) (pheader + 1);
+
+   if (write_pointer + total_size <= pheader->size) {
+      /* events reserved with bm_reserve_event() are already in place */
+      if (source != pdata + write_pointer)
+         memcpy(pdata + write_pointer, source, total_size);
+      write_pointer = (write_pointer + total_size) % pheader->size;
+      if (write_pointer > pheader->size - (int) sizeof(EVENT_HEADER))
+         write_pointer = 0;
+   } else {
+      /* split event */
+      int size = pheader->size - write_pointer;
+
+      memcpy(pdata + write_pointer, source, size);
+      memcpy(pdata, (const char *) source + size, total_size - size);
+
+      write_pointer = total_size - size;
+   }
+
+   return write_pointer;
+}
+
+static void bm_copy_from_buffer(const BUFFER_HEADER * pheader, int read_pointer, void *destination, int size)
+{
+   /* copy size bytes starting at read_pointer, joining events split at the end of the buffer */
+   const char *pdata = (const char *) (pheader + 1);
+
+   if (read_pointer + size <= pheader->size) {
+      memcpy(destination, pdata + read_pointer, size);
+   } else {
+      int first = pheader->size - read_pointer;
+
+      memcpy(destination, pdata + read_pointer, first);
+      memcpy((char *) destination + first, pdata, size - first);
+   }
+}
+
 static int bm_read_cache_has_events(const BUFFER * pbuf)
 {
    if (pbuf->read_cache_size == 0)
@@ -7445,232 +7666,631 @@ static int bm_read_cache_has_events(const BUFFER * pbuf)
    return 1;
 }
 
-static int bm_wait_for_free_space(int buffer_handle, BUFFER * pbuf, int async_flag, int requested_space)
+static BOOL bm_read_events(BUFFER * pbuf, BUFFER_CLIENT * pc, void **pdest, int *pdest_size, BOOL grow_dest,
+                           int *pevent_size, int *pstatus)
 {
-   int status;
+   /* Loop over the events at the client read pointer. Matching events are
+      copied to the read cache. An event which does not fit into the read
+      cache is copied to *pdest, which is enlarged if grow_dest is set and
+      truncated otherwise. Returns TRUE if an event was copied to *pdest.
+
+      Called with the buffer locked, or without lock for a lock-free buffer.
+      In the latter case a producer may skip our read pointer over an event
+      we do not wait for and overwrite it while we copy it, which is detected
+      by the failing compare-and-swap of the read pointer. */
+
    BUFFER_HEADER *pheader = pbuf->buffer_header;
-   char *pdata = (char *) (pheader + 1);
+   BOOL cache_is_full = FALSE;
+   BOOL use_event_buffer = FALSE;
+   int write_pointer = SS_ATOMIC_LOAD(&pheader->write_pointer);
+   int read_pointer;
+   int cycle = 0;
+   int i;
+   BOOL wrapped;
 
-   /* make sure the buffer never completely full:
-    * read pointer and write pointer would coincide
-    * and the code cannot tell if it means the
-    * buffer is 100% full or 100% empty. It will explode
-    * or lose events */
-   requested_space += 100;
+   while ((read_pointer = SS_ATOMIC_LOAD(&pc->read_pointer)) != write_pointer) {
+      int new_read_pointer;
+      int total_size;           /* size of the event */
+      int read_cache_wp = pbuf->read_cache_wp;
+      BOOL found = FALSE;
+      EVENT_REQUEST *prequest;
+      EVENT_HEADER *pevent = (EVENT_HEADER *) ((char *) (pheader + 1) + read_pointer);
 
-   if (requested_space >= pheader->size)
-      return BM_NO_MEMORY;
+      assert(read_pointer >= 0);
+      assert(read_pointer <= pheader->size);
 
-   while (1) {
+      total_size = pevent->data_size + sizeof(EVENT_HEADER);
+      total_size = ALIGN8(total_size);
 
-      BUFFER_CLIENT *pc;
-      int n_blocking;
-      int i;
-      int size;
-      int idx;
+      /* a lock-free reader can see a header which is being overwritten,
+         since the producer skips our read pointer at the same time. Start
+         again from the current read pointer, until the producer is done */
+      if (total_size <= 0 || total_size > pheader->size) {
+         if (pheader->lockfree) {
+            write_pointer = SS_ATOMIC_LOAD(&pheader->write_pointer);
+            continue;
+         }
 
-      /* check if enough space in buffer */
+         assert(total_size > 0);
+         assert(total_size <= pheader->size);
+      }
 
-      size = pheader->read_pointer - pheader->write_pointer;
-      if (size <= 0)
-         size += pheader->size;
+      prequest = pc->event_request;
 
-#if 0
-      printf
-          ("bm_send_event: buffer pointers: read: %d, write: %d, free space: %d, bufsize: %d, event size: %d\n",
-           pheader->read_pointer, pheader->write_pointer, size, pheader->size, requested_space);
-#endif
+      /* loop over all requests: if this event matches a request,
+       * copy it to the read cache */
 
-      if (requested_space < size)       /* note the '<' to avoid 100% filling */
-         return BM_SUCCESS;
+      for (i = 0; i < pc->max_request_index; i++, prequest++)
+         if (prequest->valid && bm_match_event(prequest->event_id, prequest->trigger_mask, pevent)) {
 
-      /* if not enough space, find out who's blocking */
-      n_blocking = 0;
-
-      for (i = 0, pc = pheader->client; i < pheader->max_client_index; i++, pc++)
-         if (pc->pid) {
-            if (pc->read_pointer == pheader->read_pointer) {
-               /*
-                  First assume that the client with the "minimum" read pointer
-                  is not really blocking due to a GET_ALL request.
-                */
-               BOOL blocking = FALSE;
-               int blocking_request_id = 0;
-               int j;
-
-               /* check if this request blocks */
-
-               EVENT_REQUEST *prequest = pc->event_request;
-               EVENT_HEADER *pevent_test = (EVENT_HEADER *) (pdata + pc->read_pointer);
-
-               assert(pc->read_pointer >= 0);
-               assert(pc->read_pointer <= pheader->size);
-
-               for (j = 0; j < pc->max_request_index; j++, prequest++)
-                  if (prequest->valid
-                      && bm_match_event(prequest->event_id, prequest->trigger_mask, pevent_test)) {
-                     if (prequest->sampling_type & GET_ALL) {
-                        blocking = TRUE;
-                        blocking_request_id = prequest->id;
-                        break;
-                     }
-                  }
+            /* check if this is a recent event */
+            if (prequest->sampling_type == GET_RECENT) {
+               if (ss_time() - pevent->time_stamp > 1) {
+                  /* skip that event */
+                  continue;
+               }
+            }
 
-               if (blocking) {
-                  n_blocking++;
+            /* we found a request for this event, so copy it */
 
-                  if (pc->read_wait) {
-                     char str[80];
-#ifdef DEBUG_MSG
-                     cm_msg(MDEBUG, "Send wake: rp=%d, wp=%d", pheader->read_pointer, pheader->write_pointer);
-#endif
-                     sprintf(str, "B %s %d", pheader->name, blocking_request_id);
-                     ss_resume(pc->port, str);
-                  }
+            if (pbuf->read_cache_size > 0 && total_size < pbuf->read_cache_size) {
 
-               } else {
-                  /*
-                     The blocking guy has no GET_ALL request for this event
-                     -> shift its read pointer.
-                   */
+               /* copy event to cache, if there is room */
 
-                  int new_read_pointer;
-                  int increment =
-                      sizeof(EVENT_HEADER) + ((EVENT_HEADER *) (pdata + pc->read_pointer))->data_size;
+               if (pbuf->read_cache_wp + total_size >= pbuf->read_cache_size) {
+                  cache_is_full = TRUE;
+                  break;        /* exit loop over requests */
+               }
 
-                  /* correct increment for DWORD boundary */
-                  increment = ALIGN8(increment);
+               bm_copy_from_buffer(pheader, read_pointer, pbuf->read_cache + pbuf->read_cache_wp, total_size);
 
-                  assert(increment > 0);
-                  assert(increment <= pheader->size);
+               pbuf->read_cache_wp += total_size;
 
-                  new_read_pointer = (pc->read_pointer + increment) % pheader->size;
+            } else {
+               int copy_size = total_size;
 
-                  if (new_read_pointer > pheader->size - (int) sizeof(EVENT_HEADER))
-                     new_read_pointer = 0;
+               /* if there are events in the read cache,
+                * we should dispatch them before we
+                * despatch this oversize event */
 
-                  pc->read_pointer = new_read_pointer;
+               if (pbuf->read_cache_wp > pbuf->read_cache_rp) {
+                  cache_is_full = TRUE;
+                  break;        /* exit loop over requests */
                }
-            }
-         }
-      /* client loop */
-      if (n_blocking == 0) {
 
-         BOOL moved;
-         /*
-            calculate new global read pointer as "minimum" of
-            client read pointers
-          */
+               use_event_buffer = TRUE;
 
-         moved = bm_update_read_pointer("bm_send_event", pheader);
+               if (copy_size > *pdest_size) {
+                  if (grow_dest) {
+                     //printf("realloc event buffer %d -> %d\n", *pdest_size, total_size);
+                     *pdest = realloc(*pdest, total_size);
+                     *pdest_size = total_size;
+                  } else {
+                     copy_size = *pdest_size;
+                  }
+               }
 
-         if (!moved) {
-            cm_msg(MERROR, "bm_wait_for_free_space",
-                   "BUG: read pointer did not move while waiting for %d bytes, bytes available: %d, buffer size: %d",
-                   requested_space, size, pheader->size);
-            return BM_NO_MEMORY;
+               bm_copy_from_buffer(pheader, read_pointer, *pdest, copy_size);
+            }
+
+            found = TRUE;
+            break;              /* stop looping over requests */
          }
 
-         continue;
-      }
+      if (cache_is_full)
+         break;                 /* exit from loop over events in data buffer, leaving the current event untouched */
 
-      /* at least one client is blocking */
+      /* shift read pointer */
 
-      bm_unlock_buffer(buffer_handle);
+      new_read_pointer = read_pointer + total_size;
+      wrapped = new_read_pointer >= pheader->size;
+      if (wrapped)
+         new_read_pointer = new_read_pointer % pheader->size;
 
-      /* return now in ASYNC mode */
-      if (async_flag == BM_NO_WAIT)
-         return BM_ASYNC_RETURN;
+      /* make sure we do not split the event header at the end of the buffer */
+      if (new_read_pointer > pheader->size - (int) sizeof(EVENT_HEADER))
+         new_read_pointer = 0;
 
 #ifdef DEBUG_MSG
-      cm_msg(MDEBUG, "Send sleep: rp=%d, wp=%d, level=%1.1lf",
-             pheader->read_pointer, pheader->write_pointer, 100 - 100.0 * size / pheader->size);
+      cm_msg(MDEBUG, "bm_read_events -> wp=%d, rp %d -> %d (found=%d,size=%d)",
+             pheader->write_pointer, read_pointer, new_read_pointer, found, total_size);
 #endif
 
-      /* signal other clients wait mode */
-      idx = bm_validate_client_index(pbuf, FALSE);
-      if (idx >= 0)
-         pheader->client[idx].write_wait = requested_space;
+      if (!SS_ATOMIC_CAS(&pc->read_pointer, read_pointer, new_read_pointer)) {
+         /* event was skipped by a producer while we copied it, discard the copy */
+         pbuf->read_cache_wp = read_cache_wp;
+         use_event_buffer = FALSE;
+         write_pointer = SS_ATOMIC_LOAD(&pheader->write_pointer);
+         cycle = 0;
+         continue;
+      }
 
-      bm_cleanup("bm_wait_for_free_space", ss_millitime(), FALSE);
+      /* make sure we loop over the data buffer no more than once */
+      if (wrapped) {
+         cycle++;
+         assert(cycle < 2);
+      }
 
-      status = ss_suspend(1000, MSG_BM);
+      /* the copy is valid, report it */
+      if (use_event_buffer) {
+         *pstatus = BM_SUCCESS;
+         *pevent_size = total_size;
+         if (total_size > *pdest_size) {
+            *pevent_size = *pdest_size;
+            cm_msg(MERROR, "bm_receive_event", "event size %d larger than buffer size %d", total_size, *pdest_size);
+            *pstatus = BM_TRUNCATED;
+         }
+      }
 
-      /* make sure we do sleep in this loop:
-       * if we are the mserver receiving data on the event
-       * socket and the data buffer is full, ss_suspend() will
-       * never sleep: it will detect data on the event channel,
-       * call rpc_server_receive() (recursively, we already *are* in
-       * rpc_server_receive()) and return without sleeping. Result
-       * is a busy loop waiting for free space in data buffer */
-      if (status != SS_TIMEOUT)
-         ss_sleep(10);
+      /* update statistics */
+      if (found)
+         SS_ATOMIC_ADD(&pheader->num_out_events, 1);
 
-      /* validate client index: we could have been removed from the buffer */
-      idx = bm_validate_client_index(pbuf, FALSE);
-      if (idx >= 0)
-         pheader->client[idx].write_wait = 0;
-      else {
-         cm_msg(MERROR, "bm_wait_for_free_space", "our client index is no longer valid, exiting...");
-         status = SS_ABORT;
-      }
+      if (use_event_buffer)
+         break;                 /* exit from loop over events in data buffer */
+   }
 
-      /* return if TCP connection broken */
-      if (status == SS_ABORT)
-         return SS_ABORT;
+   return use_event_buffer;
+}
+
+static void bm_notify_events(const char *who, BUFFER_HEADER * pheader, int my_client_index,
+                             const EVENT_HEADER * const events[], int n_events, int old_write_pointer)
+{
+   /* called with the buffer locked after n_events events have been written starting at old_write_pointer */
+   BUFFER_CLIENT *pclient = pheader->client;
+   const EVENT_REQUEST *prequest;
+   int i, j, k, num_requests_client, request_id;
+
+   /* write pointer was incremented, but there should
+    * always be some free space in the buffer and the
+    * write pointer should never cacth up to the read pointer:
+    * the rest of the code gets confused this happens (buffer 100% full)
+    * as it is write_pointer == read_pointer can be either
+    * 100% full or 100% empty. My solution: never fill
+    * the buffer to 100% */
+   assert(pheader->write_pointer != pheader->read_pointer);
+
+   /* check which clients have a request for these events */
+   for (i = 0; i < pheader->max_client_index; i++)
+      if (pclient[i].pid) {
+         num_requests_client = 0;
+         request_id = -1;
 
+         for (k = 0; k < n_events; k++)
+            for (j = 0, prequest = pclient[i].event_request; j < pclient[i].max_request_index; j++, prequest++)
+               if (prequest->valid
+                   && bm_match_event(prequest->event_id, prequest->trigger_mask, (EVENT_HEADER *) events[k])) {
+                  if (prequest->sampling_type & GET_ALL)
+                     pclient[i].num_waiting_events++;
+
+                  num_requests_client++;
+                  request_id = prequest->id;
+               }
+
+         /* if that client has a request and is suspended, wake it up */
+         if (num_requests_client && pclient[i].read_wait) {
+            char str[80];
 #ifdef DEBUG_MSG
-      cm_msg(MDEBUG, "Send woke up: rp=%d, wp=%d, level=%1.1lf",
-             pheader->read_pointer, pheader->write_pointer, 100 - 100.0 * size / pheader->size);
+            cm_msg(MDEBUG, "Send wake: rp=%d, wp=%d", pheader->read_pointer, pheader->write_pointer);
 #endif
+            sprintf(str, "B %s %d", pheader->name, request_id);
+            bm_wakeup_client(pclient + i, str);
+         }
 
-      bm_lock_buffer(buffer_handle);
-   }
+         /* if that client has no request, shift its read pointer */
+         if (num_requests_client == 0)
+            SS_ATOMIC_CAS(&pclient[i].read_pointer, old_write_pointer, pheader->write_pointer);
+      }
+
+   /* shift read pointer of own client */
+   SS_ATOMIC_CAS(&pclient[my_client_index].read_pointer, old_write_pointer, pheader->write_pointer);
+
+   /* calculate global read pointer as "minimum" of client read pointers,
+      only the read pointers of clients at the old write pointer have moved */
+
+   if (pheader->read_pointer == old_write_pointer)
+      bm_update_read_pointer(who, pheader);
+
+   /* update statistics */
+   pheader->num_in_events += n_events;
 }
 
-/********************************************************************/
-/**
-Sends an event to a buffer.
-This function check if the buffer has enough space for the
-event, then copies the event to the buffer in shared memory.
-If clients have requests for the event, they are notified via an UDP packet.
-\code
-char event[1000];
-// create event with ID 1, trigger mask 0, size 100 bytes and serial number 1
-bm_compose_event((EVENT_HEADER *) event, 1, 0, 100, 1);
+static void bm_notify_event(const char *who, BUFFER_HEADER * pheader, int my_client_index,
+                            const EVENT_HEADER * pevent, int old_write_pointer)
+{
+   /* called with the buffer locked after a single event has been written to old_write_pointer */
+   bm_notify_events(who, pheader, my_client_index, &pevent, 1, old_write_pointer);
+}
 
-// set first byte of event
-*(event+sizeof(EVENT_HEADER)) = <...>
-#include <stdio.h>
-#include "midas.h"
-main()
+static BOOL bm_match_requests(const BUFFER_CLIENT * pc, EVENT_HEADER * pevent, BOOL * pget_all)
 {
- INT status, i;
- HNDLE hbuf;
- char event[1000];
- status = cm_connect_experiment("", "Sample", "Producer", NULL);
- if (status != CM_SUCCESS)
- return 1;
- bm_open_buffer(EVENT_BUFFER_NAME, DEFAULT_BUFFER_SIZE, &hbuf);
+   /* check if any request of the client matches the event and if one of
+      them is a GET_ALL request, which keeps producers from overwriting it */
+   const EVENT_REQUEST *prequest = pc->event_request;
+   BOOL found = FALSE;
+   int i;
 
- // create event with ID 1, trigger mask 0, size 100 bytes and serial number 1
- bm_compose_event((EVENT_HEADER *) event, 1, 0, 100, 1);
+   *pget_all = FALSE;
 
- // set event data
- for (i=0 ; i<100 ; i++)
- *(event+sizeof(EVENT_HEADER)+i) = i;
- // send event
- bm_send_event(hbuf, event, 100+sizeof(EVENT_HEADER), BM_WAIT);
- cm_disconnect_experiment();
- return 0;
+   for (i = 0; i < pc->max_request_index; i++, prequest++)
+      if (prequest->valid && bm_match_event(prequest->event_id, prequest->trigger_mask, pevent)) {
+         /* skip old events for GET_RECENT requests */
+         if (prequest->sampling_type == GET_RECENT && ss_time() - pevent->time_stamp > 1)
+            continue;
+
+         found = TRUE;
+         if (prequest->sampling_type & GET_ALL)
+            *pget_all = TRUE;
+      }
+
+   return found;
 }
-\endcode
-@param buffer_handle Buffer handle obtained via bm_open_buffer()
-@param source Address of event buffer
-@param buf_size Size of event including event header in bytes
-@param async_flag Synchronous/asynchronous flag. If BM_WAIT, the function
-blocks if the buffer has not enough free space to receive the event.
-If BM_NO_WAIT, the function returns immediately with a
+
+static int bm_next_read_pointer(const BUFFER_HEADER * pheader, int read_pointer, int total_size)
+{
+   /* read pointer after an event of total_size bytes */
+   read_pointer = (read_pointer + total_size) % pheader->size;
+
+   /* event headers are never split at the end of the buffer */
+   if (read_pointer > pheader->size - (int) sizeof(EVENT_HEADER))
+      read_pointer = 0;
+
+   return read_pointer;
+}
+
+static int bm_wait_for_more_events(int buffer_handle, BUFFER * pbuf, BUFFER_CLIENT * pc, int async_flag)
+{
+   /* Wait until there are events at the client read pointer. Returns BM_SUCCESS
+      with the buffer locked, unless it is lock-free, or BM_ASYNC_RETURN and
+      SS_ABORT with the buffer unlocked. */
+
+   BUFFER_HEADER *pheader = pbuf->buffer_header;
+   int status, wake_count;
+
+   /* first do a quick check without locking the buffer */
+   if (async_flag == BM_NO_WAIT && SS_ATOMIC_LOAD(&pheader->write_pointer) == SS_ATOMIC_LOAD(&pc->read_pointer))
+      return BM_ASYNC_RETURN;
+
+   /* lock the buffer, lock-free readers only use the atomic read and write pointers */
+   if (!pheader->lockfree)
+      bm_lock_buffer(buffer_handle);
+
+   while (SS_ATOMIC_LOAD(&pheader->write_pointer) == SS_ATOMIC_LOAD(&pc->read_pointer)) {
+
+      if (!pheader->lockfree)
+         bm_unlock_buffer(buffer_handle);
+
+      /* return now in ASYNC mode */
+      if (async_flag == BM_NO_WAIT)
+         return BM_ASYNC_RETURN;
+
+      wake_count = bm_prepare_wait(pc);
+      pc->read_wait = TRUE;
+
+      /* producers check read_wait after publishing the write pointer */
+      SS_ATOMIC_FENCE();
+
+      /* check again pointers (may have moved in between) */
+      if (SS_ATOMIC_LOAD(&pheader->write_pointer) == SS_ATOMIC_LOAD(&pc->read_pointer)) {
+#ifdef DEBUG_MSG
+         cm_msg(MDEBUG, "Receive sleep: grp=%d, rp=%d wp=%d",
+                pheader->read_pointer, pc->read_pointer, pheader->write_pointer);
+#endif
+
+         status = bm_wait_for_wakeup(pc, wake_count);
+
+#ifdef DEBUG_MSG
+         cm_msg(MDEBUG, "Receive woke up: rp=%d, wp=%d", pheader->read_pointer, pheader->write_pointer);
+#endif
+
+         /* return if TCP connection broken */
+         if (status == SS_ABORT)
+            return SS_ABORT;
+      }
+
+      pc->read_wait = FALSE;
+      pc->futex_wait = FALSE;
+
+      /* validate client_index: somebody may have disconnected us from the buffer */
+      bm_validate_client_index(pbuf, TRUE);
+
+      if (!pheader->lockfree)
+         bm_lock_buffer(buffer_handle);
+   }
+
+   return BM_SUCCESS;
+}
+
+static int bm_skip_events(BUFFER_HEADER * pheader, int requested_space)
+{
+   /*
+      Walk the events from the global read pointer until requested_space
+      bytes are free or an event is reached which a client still has to
+      read because of a GET_ALL request. Only the GET_ALL table in the
+      buffer header is consulted for each event, the read pointers of all
+      other clients behind the skipped events are moved in a single pass
+      afterwards, which also gives the new global read pointer. Returns
+      the number of clients blocking at the new read pointer and wakes
+      them up if they are waiting.
+    */
+
+   char *pdata = (char *) (pheader + 1);
+   int old_rp = pheader->read_pointer;
+   int rp = old_rp;
+   int i, distance, n_blocking, free_space, last_client;
+   BUFFER_CLIENT *pc;
+
+   free_space = rp - pheader->write_pointer;
+   if (free_space <= 0)
+      free_space += pheader->size;
+
+   n_blocking = 0;
+
+   while (rp != SS_ATOMIC_LOAD(&pheader->write_pointer) && requested_space >= free_space) {
+      EVENT_HEADER *pevent = (EVENT_HEADER *) (pdata + rp);
+      int increment;
+
+      distance = rp - old_rp;
+      if (distance < 0)
+         distance += pheader->size;
+
+      /* clients which have not yet read this event block if they requested it with GET_ALL */
+      for (i = 0, last_client = -1; i < pheader->num_get_all_requests; i++) {
+         const GET_ALL_REQUEST *prequest = pheader->get_all_request + i;
+         int client_distance;
+
+         if (prequest->client_index == last_client)
+            continue;
+
+         pc = pheader->client + prequest->client_index;
+
+         client_distance = SS_ATOMIC_LOAD(&pc->read_pointer) - old_rp;
+         if (client_distance < 0)
+            client_distance += pheader->size;
+
+         if (client_distance <= distance && bm_match_event(prequest->event_id, prequest->trigger_mask, pevent)) {
+            n_blocking++;
+            last_client = prequest->client_index;
+
+            if (pc->read_wait) {
+               char str[80];
+#ifdef DEBUG_MSG
+               cm_msg(MDEBUG, "Send wake: rp=%d, wp=%d", pheader->read_pointer, pheader->write_pointer);
+#endif
+               sprintf(str, "B %s %d", pheader->name, prequest->id);
+               bm_wakeup_client(pc, str);
+            }
+         }
+      }
+
+      if (n_blocking)
+         break;
+
+      increment = ALIGN8(sizeof(EVENT_HEADER) + pevent->data_size);
+
+      assert(increment > 0);
+      assert(increment <= pheader->size);
+
+      rp = bm_next_read_pointer(pheader, rp, increment);
+
+      free_space = rp - pheader->write_pointer;
+      if (free_space <= 0)
+         free_space += pheader->size;
+   }
+
+   if (rp == old_rp)
+      return n_blocking;
+
+   /* move all readers behind the skipped events, a lock-free reader may have moved on in the meantime */
+   distance = rp - old_rp;
+   if (distance < 0)
+      distance += pheader->size;
+
+   for (i = 0, pc = pheader->client; i < pheader->max_client_index; i++, pc++)
+      if (pc->pid) {
+         int client_rp = SS_ATOMIC_LOAD(&pc->read_pointer);
+         int client_distance = client_rp - old_rp;
+
+         if (client_distance < 0)
+            client_distance += pheader->size;
+
+         if (client_distance < distance)
+            SS_ATOMIC_CAS(&pc->read_pointer, client_rp, rp);
+      }
+
+   /* nobody is behind the skipped events, so this is the new "minimum" of the client read pointers */
+   pheader->read_pointer = rp;
+
+   return n_blocking;
+}
+
+static BOOL bm_reservation_pending(BUFFER_HEADER * pheader)
+{
+   /* check for an event reserved with bm_reserve_event(), and drop the
+      reservation if its client has been removed from the buffer */
+   if (pheader->reserved_client == 0)
+      return FALSE;
+
+   if (pheader->reserved_client > pheader->max_client_index ||
+       pheader->client[pheader->reserved_client - 1].pid == 0) {
+      pheader->reserved_client = 0;
+      pheader->reserved_size = 0;
+      return FALSE;
+   }
+
+   return TRUE;
+}
+
+static int bm_wait_for_free_space(int buffer_handle, BUFFER * pbuf, int async_flag, int requested_space)
+{
+   int status;
+   BUFFER_HEADER *pheader = pbuf->buffer_header;
+
+   /* make sure the buffer never completely full:
+    * read pointer and write pointer would coincide
+    * and the code cannot tell if it means the
+    * buffer is 100% full or 100% empty. It will explode
+    * or lose events */
+   requested_space += 100;
+
+   if (requested_space >= pheader->size)
+      return BM_NO_MEMORY;
+
+   while (1) {
+
+      int n_blocking;
+      int size;
+      int idx;
+      int wake_count = 0;
+
+      /* the space behind the write pointer belongs to an event which is
+         composed in place, wait until it got committed */
+      if (bm_reservation_pending(pheader)) {
+         size = 0;
+         n_blocking = 1;
+      } else {
+         /* check if enough space in buffer */
+
+         size = pheader->read_pointer - pheader->write_pointer;
+         if (size <= 0)
+            size += pheader->size;
+
+#if 0
+         printf
+             ("bm_send_event: buffer pointers: read: %d, write: %d, free space: %d, bufsize: %d, event size: %d\n",
+              pheader->read_pointer, pheader->write_pointer, size, pheader->size, requested_space);
+#endif
+
+         if (requested_space < size)    /* note the '<' to avoid 100% filling */
+            return BM_SUCCESS;
+
+         /* if not enough space, skip events nobody is waiting for */
+         n_blocking = bm_skip_events(pheader, requested_space);
+      }
+
+      if (n_blocking == 0) {
+
+         size = pheader->read_pointer - pheader->write_pointer;
+         if (size <= 0)
+            size += pheader->size;
+
+         if (requested_space >= size) {
+            cm_msg(MERROR, "bm_wait_for_free_space",
+                   "BUG: read pointer did not move while waiting for %d bytes, bytes available: %d, buffer size: %d",
+                   requested_space, size, pheader->size);
+            return BM_NO_MEMORY;
+         }
+
+         continue;
+      }
+
+      /* at least one client is blocking */
+
+      /* return now in ASYNC mode */
+      if (async_flag == BM_NO_WAIT) {
+         bm_unlock_buffer(buffer_handle);
+         return BM_ASYNC_RETURN;
+      }
+
+#ifdef DEBUG_MSG
+      cm_msg(MDEBUG, "Send sleep: rp=%d, wp=%d, level=%1.1lf",
+             pheader->read_pointer, pheader->write_pointer, 100 - 100.0 * size / pheader->size);
+#endif
+
+      /* signal other clients wait mode, this is done before unlocking
+         the buffer so that consumers which free space afterwards wake us up */
+      idx = bm_validate_client_index(pbuf, FALSE);
+      if (idx >= 0) {
+         wake_count = bm_prepare_wait(pheader->client + idx);
+         pheader->client[idx].write_wait = requested_space;
+      }
+
+      bm_unlock_buffer(buffer_handle);
+
+      bm_cleanup("bm_wait_for_free_space", ss_millitime(), FALSE);
+
+      if (idx >= 0 && pheader->client[idx].futex_wait)
+         status = bm_wait_for_wakeup(pheader->client + idx, wake_count);
+      else {
+         status = ss_suspend(1000, MSG_BM);
+
+         /* make sure we do sleep in this loop:
+          * if we are the mserver receiving data on the event
+          * socket and the data buffer is full, ss_suspend() will
+          * never sleep: it will detect data on the event channel,
+          * call rpc_server_receive() (recursively, we already *are* in
+          * rpc_server_receive()) and return without sleeping. Result
+          * is a busy loop waiting for free space in data buffer */
+         if (status != SS_TIMEOUT)
+            ss_sleep(10);
+      }
+
+      /* validate client index: we could have been removed from the buffer */
+      idx = bm_validate_client_index(pbuf, FALSE);
+      if (idx >= 0) {
+         pheader->client[idx].write_wait = 0;
+         pheader->client[idx].futex_wait = FALSE;
+      } else {
+         cm_msg(MERROR, "bm_wait_for_free_space", "our client index is no longer valid, exiting...");
+         status = SS_ABORT;
+      }
+
+      /* return if TCP connection broken */
+      if (status == SS_ABORT)
+         return SS_ABORT;
+
+#ifdef DEBUG_MSG
+      cm_msg(MDEBUG, "Send woke up: rp=%d, wp=%d, level=%1.1lf",
+             pheader->read_pointer, pheader->write_pointer, 100 - 100.0 * size / pheader->size);
+#endif
+
+      bm_lock_buffer(buffer_handle);
+   }
+}
+
+/********************************************************************/
+/**
+Sends an event to a buffer.
+This function check if the buffer has enough space for the
+event, then copies the event to the buffer in shared memory.
+If clients have requests for the event, they are notified via an UDP packet.
+\code
+char event[1000];
+// create event with ID 1, trigger mask 0, size 100 bytes and serial number 1
+bm_compose_event((EVENT_HEADER *) event, 1, 0, 100, 1);
+
+// set first byte of event
+*(event+sizeof(EVENT_HEADER)) = <...>
+#include <stdio.h>
+#include "midas.h"
+main()
+{
+ INT status, i;
+ HNDLE hbuf;
+ char event[1000];
+ status = cm_connect_experiment("", "Sample", "Producer", NULL);
+ if (status != CM_SUCCESS)
+ return 1;
+ bm_open_buffer(EVENT_BUFFER_NAME, DEFAULT_BUFFER_SIZE, &hbuf);
+
+ // create event with ID 1, trigger mask 0, size 100 bytes and serial number 1
+ bm_compose_event((EVENT_HEADER *) event, 1, 0, 100, 1);
+
+ // set event data
+ for (i=0 ; i<100 ; i++)
+ *(event+sizeof(EVENT_HEADER)+i) = i;
+ // send event
+ bm_send_event(hbuf, event, 100+sizeof(EVENT_HEADER), BM_WAIT);
+ cm_disconnect_experiment();
+ return 0;
+}
+\endcode
+@param buffer_handle Buffer handle obtained via bm_open_buffer()
+@param source Address of event buffer
+@param buf_size Size of event including event header in bytes
+@param async_flag Synchronous/asynchronous flag. If BM_WAIT, the function
+blocks if the buffer has not enough free space to receive the event.
+If BM_NO_WAIT, the function returns immediately with a
 value of BM_ASYNC_RETURN without writing the event to the buffer
 @return BM_SUCCESS, BM_INVALID_HANDLE, BM_INVALID_PARAM<br>
 BM_ASYNC_RETURN Routine called with async_flag == BM_NO_WAIT and
@@ -7703,14 +8323,9 @@ INT bm_send_event(INT buffer_handle, const void *source, INT buf_size, INT async
    {
       BUFFER *pbuf;
       BUFFER_HEADER *pheader;
-      BUFFER_CLIENT *pclient;
-      EVENT_REQUEST *prequest;
-      INT i, j, size, total_size, status;
+      INT total_size, status;
       INT my_client_index;
       INT old_write_pointer;
-      INT num_requests_client;
-      char *pdata;
-      INT request_id;
 
       pbuf = &_buffer[buffer_handle - 1];
 
@@ -7755,9 +8370,7 @@ INT bm_send_event(INT buffer_handle, const void *source, INT buf_size, INT async
 
       /* calculate some shorthands */
       pheader = pbuf->buffer_header;
-      pdata = (char *) (pheader + 1);
       my_client_index = bm_validate_client_index(pbuf, TRUE);
-      pclient = pheader->client;
 
       /* check if buffer is large enough */
       if (total_size >= pheader->size) {
@@ -7776,71 +8389,178 @@ INT bm_send_event(INT buffer_handle, const void *source, INT buf_size, INT async
       /* we have space, so let's copy the event */
       old_write_pointer = pheader->write_pointer;
 
-      if (pheader->write_pointer + total_size <= pheader->size) {
-         memcpy(pdata + pheader->write_pointer, pevent, total_size);
-         pheader->write_pointer = (pheader->write_pointer + total_size) % pheader->size;
-         if (pheader->write_pointer > pheader->size - (int) sizeof(EVENT_HEADER))
-            pheader->write_pointer = 0;
-      } else {
-         /* split event */
-         size = pheader->size - pheader->write_pointer;
+      /* publish the new write pointer to lock-free readers only after the event is complete */
+      SS_ATOMIC_STORE(&pheader->write_pointer, bm_copy_to_buffer(pheader, old_write_pointer, pevent, total_size));
+      SS_ATOMIC_FENCE();
+
+      bm_notify_event("bm_send_event", pheader, my_client_index, pevent, old_write_pointer);
+
+      /* unlock the buffer */
+      bm_unlock_buffer(buffer_handle);
+   }
+#endif                          /* LOCAL_ROUTINES */
+
+   return BM_SUCCESS;
+}
+
+/********************************************************************/
+/**
+Sends several events to a buffer at once.
+The buffer gets locked only once for all events, they are copied into
+the buffer in one go and the consumers are woken up once. Events in the
+write cache are flushed before. In BM_WAIT mode, batches which do not
+fit into half of the buffer are split into several parts. For remote buffers, all events are
+shipped to the server in a single network command. Servers which do not know
+this command get the events one by one, in BM_NO_WAIT mode the events before
+a BM_ASYNC_RETURN have then already been written.
+\code
+  const EVENT_HEADER *events[16];
+  ...
+  for (i = 0; i < 16; i++)
+    events[i] = read_my_event(i);
+  bm_send_events(hbuf, events, 16, BM_WAIT);
+\endcode
+@param buffer_handle Buffer handle obtained via bm_open_buffer()
+@param events Array of pointers to the events, each with a proper event header
+@param n_events Number of events in the array
+@param async_flag Synchronous/asynchronous flag. If BM_WAIT, the function
+blocks until all events have been written. If BM_NO_WAIT, either all events
+are written to the buffer or none of them.
+@return BM_SUCCESS, BM_INVALID_HANDLE, BM_INVALID_PARAM<br>
+BM_ASYNC_RETURN Routine called with async_flag == BM_NO_WAIT and
+buffer has not enough space to receive the events<br>
+BM_NO_MEMORY An event, or all events together in BM_NO_WAIT mode, are too
+large for the buffer
+*/
+INT bm_send_events(INT buffer_handle, const EVENT_HEADER * events[], INT n_events, INT async_flag)
+{
+   INT i, size, total_size;
+
+   if (n_events < 0) {
+      cm_msg(MERROR, "bm_send_events", "invalid number of events %d", n_events);
+      return BM_INVALID_PARAM;
+   }
 
-         memcpy(pdata + pheader->write_pointer, pevent, size);
-         memcpy(pdata, (char *) pevent + size, total_size - size);
+   for (i = 0, total_size = 0; i < n_events; i++) {
+      size = ALIGN8(events[i]->data_size + sizeof(EVENT_HEADER));
+      if (size <= 0 || total_size + size < total_size) {
+         cm_msg(MERROR, "bm_send_events", "invalid event size (%d) of event %d", (INT) events[i]->data_size, i);
+         return BM_INVALID_PARAM;
+      }
+      total_size += size;
+   }
+
+   if (n_events == 0)
+      return BM_SUCCESS;
+
+   if (rpc_is_remote()) {
+      char *packed, *p;
+      INT status;
+      extern RPC_SERVER_CONNECTION _server_connection;
 
-         pheader->write_pointer = total_size - size;
+      /* older servers reject RPC_BM_SEND_EVENTS, send the events one by one */
+      if (!_server_connection.send_events) {
+         for (i = 0; i < n_events; i++) {
+            status = rpc_call(RPC_BM_SEND_EVENT, buffer_handle, events[i],
+                              events[i]->data_size + sizeof(EVENT_HEADER), async_flag);
+            if (status != BM_SUCCESS)
+               return status;
+         }
+         return BM_SUCCESS;
       }
 
-      /* write pointer was incremented, but there should
-       * always be some free space in the buffer and the
-       * write pointer should never cacth up to the read pointer:
-       * the rest of the code gets confused this happens (buffer 100% full)
-       * as it is write_pointer == read_pointer can be either
-       * 100% full or 100% empty. My solution: never fill
-       * the buffer to 100% */
-      assert(pheader->write_pointer != pheader->read_pointer);
+      /* pack all events into one array, per call since several threads may send events */
+      packed = (char *) malloc(total_size);
+      if (packed == NULL) {
+         cm_msg(MERROR, "bm_send_events", "not enough memory to allocate %d bytes", total_size);
+         return BM_NO_MEMORY;
+      }
 
-      /* check which clients have a request for this event */
-      for (i = 0; i < pheader->max_client_index; i++)
-         if (pclient[i].pid) {
-            prequest = pclient[i].event_request;
-            num_requests_client = 0;
-            request_id = -1;
+      for (i = 0, p = packed; i < n_events; i++) {
+         memcpy(p, events[i], events[i]->data_size + sizeof(EVENT_HEADER));
+         p += ALIGN8(events[i]->data_size + sizeof(EVENT_HEADER));
+      }
 
-            for (j = 0; j < pclient[i].max_request_index; j++, prequest++)
-               if (prequest->valid && bm_match_event(prequest->event_id, prequest->trigger_mask, pevent)) {
-                  if (prequest->sampling_type & GET_ALL)
-                     pclient[i].num_waiting_events++;
+      status = rpc_call(RPC_BM_SEND_EVENTS, buffer_handle, packed, total_size, async_flag);
+      free(packed);
 
-                  num_requests_client++;
-                  request_id = prequest->id;
-               }
+      return status;
+   }
+#ifdef LOCAL_ROUTINES
+   {
+      BUFFER *pbuf;
+      BUFFER_HEADER *pheader;
+      INT j, status, first, chunk_size, max_chunk_size;
+      INT my_client_index;
+      INT old_write_pointer, write_pointer;
 
-            /* if that client has a request and is suspended, wake it up */
-            if (num_requests_client && pclient[i].read_wait) {
-               char str[80];
-#ifdef DEBUG_MSG
-               cm_msg(MDEBUG, "Send wake: rp=%d, wp=%d", pheader->read_pointer, pheader->write_pointer);
-#endif
-               sprintf(str, "B %s %d", pheader->name, request_id);
-               ss_resume(pclient[i].port, str);
-            }
+      if (buffer_handle > _buffer_entries || buffer_handle <= 0) {
+         cm_msg(MERROR, "bm_send_events", "invalid buffer handle %d", buffer_handle);
+         return BM_INVALID_HANDLE;
+      }
+
+      pbuf = &_buffer[buffer_handle - 1];
+
+      if (!pbuf->attached) {
+         cm_msg(MERROR, "bm_send_events", "invalid buffer handle %d", buffer_handle);
+         return BM_INVALID_HANDLE;
+      }
+
+      /* events in the write cache go first */
+      status = bm_flush_cache(buffer_handle, async_flag);
+      if (status != BM_SUCCESS)
+         return status;
+
+      /* lock the buffer */
+      bm_lock_buffer(buffer_handle);
 
-            /* if that client has no request, shift its read pointer */
-            if (num_requests_client == 0 && pclient[i].read_pointer == old_write_pointer)
-               pclient[i].read_pointer = pheader->write_pointer;
+      /* calculate some shorthands */
+      pheader = pbuf->buffer_header;
+      my_client_index = bm_validate_client_index(pbuf, TRUE);
+
+      /* do not wait for more than half of the buffer to become free,
+         in BM_NO_WAIT mode all events are written at once or none of them */
+      max_chunk_size = async_flag == BM_NO_WAIT ? total_size : pheader->size / 2;
+
+      for (first = 0; first < n_events; first += i) {
+
+         /* collect as many events as fit into the chunk, but at least one */
+         chunk_size = 0;
+         for (i = 0; first + i < n_events; i++) {
+            size = ALIGN8(events[first + i]->data_size + sizeof(EVENT_HEADER));
+            if (i > 0 && chunk_size + size > max_chunk_size)
+               break;
+            chunk_size += size;
          }
 
-      /* shift read pointer of own client */
-      if (pclient[my_client_index].read_pointer == old_write_pointer)
-         pclient[my_client_index].read_pointer = pheader->write_pointer;
+         /* check if buffer is large enough */
+         if (chunk_size >= pheader->size) {
+            bm_unlock_buffer(buffer_handle);
+            cm_msg(MERROR, "bm_send_events",
+                   "total event size (%d) larger than size (%d) of buffer \'%s\'", chunk_size, pheader->size,
+                   pheader->name);
+            return BM_NO_MEMORY;
+         }
 
-      /* calculate global read pointer as "minimum" of client read pointers */
+         status = bm_wait_for_free_space(buffer_handle, pbuf, async_flag, chunk_size);
+         if (status != BM_SUCCESS) {
+            bm_unlock_buffer(buffer_handle);
+            return status;
+         }
 
-      bm_update_read_pointer("bm_send_event", pheader);
+         /* we have space, so let's copy the events */
+         old_write_pointer = write_pointer = pheader->write_pointer;
 
-      /* update statistics */
-      pheader->num_in_events++;
+         for (j = first; j < first + i; j++)
+            write_pointer = bm_copy_to_buffer(pheader, write_pointer, events[j],
+                                              ALIGN8(events[j]->data_size + sizeof(EVENT_HEADER)));
+
+         /* publish the new write pointer to lock-free readers only after all events are complete */
+         SS_ATOMIC_STORE(&pheader->write_pointer, write_pointer);
+         SS_ATOMIC_FENCE();
+
+         bm_notify_events("bm_send_events", pheader, my_client_index, events + first, i, old_write_pointer);
+      }
 
       /* unlock the buffer */
       bm_unlock_buffer(buffer_handle);
@@ -7850,6 +8570,310 @@ INT bm_send_event(INT buffer_handle, const void *source, INT buf_size, INT async
    return BM_SUCCESS;
 }
 
+/**dox***************************************************************/
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+/********************************************************************/
+INT bm_send_packed_events(INT buffer_handle, char *data, INT size, INT async_flag, INT convert_flags)
+/********************************************************************\
+
+  Routine: bm_send_packed_events
+
+  Purpose: Send events which are packed one after the other into a
+           single array, each aligned to eight bytes, via bm_send_events.
+           Used by the server for event batches from remote clients.
+
+  Input:
+    INT   buffer_handle      Buffer handle
+    char  *data              Packed events
+    INT   size               Size of packed events in bytes
+    INT   async_flag         BM_WAIT / BM_NO_WAIT
+    INT   convert_flags      Convert flags for the event headers
+
+  Output:
+    none
+
+  Function value:
+    BM_SUCCESS, BM_INVALID_PARAM or status of bm_send_events
+
+\********************************************************************/
+{
+   /* the server calls this from one thread per client, so the event list
+      is kept per call, on the stack for up to 64 events */
+   const EVENT_HEADER *events_local[64];
+   const EVENT_HEADER **events = events_local;
+   const EVENT_HEADER **p;
+   INT max_events = 64;
+   EVENT_HEADER *pevent;
+   INT n, offset, status;
+
+   for (n = 0, offset = 0; offset < size; n++) {
+      pevent = (EVENT_HEADER *) (data + offset);
+
+      if (size - offset < (INT) sizeof(EVENT_HEADER)) {
+         cm_msg(MERROR, "bm_send_packed_events", "truncated event header at offset %d", offset);
+         status = BM_INVALID_PARAM;
+         goto error;
+      }
+
+      if (convert_flags) {
+         rpc_convert_single(&pevent->event_id, TID_SHORT, 0, convert_flags);
+         rpc_convert_single(&pevent->trigger_mask, TID_SHORT, 0, convert_flags);
+         rpc_convert_single(&pevent->serial_number, TID_DWORD, 0, convert_flags);
+         rpc_convert_single(&pevent->time_stamp, TID_DWORD, 0, convert_flags);
+         rpc_convert_single(&pevent->data_size, TID_DWORD, 0, convert_flags);
+      }
+
+      if (pevent->data_size > (DWORD) (size - offset - sizeof(EVENT_HEADER))) {
+         cm_msg(MERROR, "bm_send_packed_events", "event size %d at offset %d exceeds packed size %d",
+                (INT) pevent->data_size, offset, size);
+         status = BM_INVALID_PARAM;
+         goto error;
+      }
+
+      if (n == max_events) {
+         p = (const EVENT_HEADER **) malloc(2 * max_events * sizeof(EVENT_HEADER *));
+         if (p == NULL) {
+            cm_msg(MERROR, "bm_send_packed_events", "not enough memory for %d events", n);
+            status = BM_NO_MEMORY;
+            goto error;
+         }
+         memcpy(p, events, n * sizeof(EVENT_HEADER *));
+         if (events != events_local)
+            free(events);
+         events = p;
+         max_events *= 2;
+      }
+
+      events[n] = pevent;
+      offset += ALIGN8(pevent->data_size + sizeof(EVENT_HEADER));
+   }
+
+   status = bm_send_events(buffer_handle, events, n, async_flag);
+
+ error:
+   if (events != events_local)
+      free(events);
+
+   return status;
+}
+
+/**dox***************************************************************/
+#endif                          /* DOXYGEN_SHOULD_SKIP_THIS */
+
+/********************************************************************/
+/**
+Reserves space for an event directly in a buffer.
+The event can then be composed in place and is made visible to the consumers
+with bm_commit_event(). This avoids copying large events into the buffer.
+
+The buffer is not locked while the event is composed, so consumers keep
+reading events. Other producers of the buffer wait in bm_send_event() and
+bm_flush_cache() until the event is committed, and the reserving thread
+must not send other events to the buffer in between. The event should
+therefore be committed right after it has been composed, without waiting
+for anything else than its data. There is no timeout, the reservation is
+only dropped when the reserving client is removed from the buffer, e.g.
+by the watchdog after it died. Events which do not
+fit into the buffer or would wrap around its end, and events of remote
+buffers, are composed in private memory and sent with bm_send_event()
+on commit. Events in the write cache are flushed before the space is
+reserved.
+\code
+  EVENT_HEADER *pevent;
+  ...
+  status = bm_reserve_event(hbuf, max_event_size, (void **) &pevent);
+  if (status == BM_SUCCESS) {
+    bm_compose_event(pevent, 1, 0, 0, serial++);
+    pevent->data_size = read_my_digitizer((char *) (pevent + 1));
+    bm_commit_event(hbuf, pevent, sizeof(EVENT_HEADER) + pevent->data_size);
+  }
+\endcode
+@param buffer_handle Buffer handle obtained via bm_open_buffer()
+@param max_size Maximum size of the event including its header in bytes
+@param ppevent Returns pointer where the event has to be composed
+@return BM_SUCCESS, BM_INVALID_HANDLE, BM_INVALID_PARAM, BM_NO_MEMORY
+*/
+INT bm_reserve_event(INT buffer_handle, INT max_size, void **ppevent)
+{
+   INT total_size, status;
+   char *p;
+
+   if (max_size < (INT) sizeof(EVENT_HEADER)) {
+      cm_msg(MERROR, "bm_reserve_event", "event size (%d) it too small", max_size);
+      return BM_INVALID_PARAM;
+   }
+
+   total_size = ALIGN8(max_size);
+
+   if (!rpc_is_remote()) {
+#ifdef LOCAL_ROUTINES
+      BUFFER *pbuf;
+      BUFFER_HEADER *pheader;
+      INT my_client_index;
+
+      if (buffer_handle > _buffer_entries || buffer_handle <= 0) {
+         cm_msg(MERROR, "bm_reserve_event", "invalid buffer handle %d", buffer_handle);
+         return BM_INVALID_HANDLE;
+      }
+
+      pbuf = &_buffer[buffer_handle - 1];
+
+      if (!pbuf->attached) {
+         cm_msg(MERROR, "bm_reserve_event", "invalid buffer handle %d", buffer_handle);
+         return BM_INVALID_HANDLE;
+      }
+
+      /* events in the write cache go first */
+      status = bm_flush_cache(buffer_handle, BM_WAIT);
+      if (status != BM_SUCCESS)
+         return status;
+
+      bm_lock_buffer(buffer_handle);
+
+      pheader = pbuf->buffer_header;
+      my_client_index = bm_validate_client_index(pbuf, TRUE);
+
+      /* same limit as in bm_wait_for_free_space() */
+      if (total_size + 100 < pheader->size) {
+         status = bm_wait_for_free_space(buffer_handle, pbuf, BM_WAIT, total_size);
+         if (status != BM_SUCCESS) {
+            bm_unlock_buffer(buffer_handle);
+            return status;
+         }
+
+         /* hand out space in the data area if the event cannot wrap around */
+         if (pheader->write_pointer + total_size <= pheader->size) {
+            pheader->reserved_client = my_client_index + 1;
+            pheader->reserved_size = total_size;
+            *ppevent = (char *) (pheader + 1) + pheader->write_pointer;
+            bm_unlock_buffer(buffer_handle);
+            return BM_SUCCESS;
+         }
+      }
+
+      bm_unlock_buffer(buffer_handle);
+#endif                          /* LOCAL_ROUTINES */
+   }
+
+   /* private memory, prefixed by the reserved size */
+   p = (char *) malloc(total_size + 8);
+   if (p == NULL) {
+      cm_msg(MERROR, "bm_reserve_event", "not enough memory to allocate %d bytes", total_size);
+      return BM_NO_MEMORY;
+   }
+
+   *((INT *) p) = total_size;
+   *ppevent = p + 8;
+
+   return BM_SUCCESS;
+}
+
+/********************************************************************/
+/**
+Makes an event composed in space obtained with bm_reserve_event() visible
+to the consumers and releases the reservation.
+@param buffer_handle Buffer handle obtained via bm_open_buffer()
+@param pevent Pointer returned by bm_reserve_event()
+@param buf_size Size of the event including its header in bytes, must not
+exceed the reserved size. If zero, the reservation is dropped without
+sending an event.
+@return BM_SUCCESS, BM_INVALID_HANDLE, BM_INVALID_PARAM
+*/
+INT bm_commit_event(INT buffer_handle, void *pevent, INT buf_size)
+{
+   INT status, reserved_size;
+   BOOL in_buffer;
+
+   in_buffer = FALSE;
+   reserved_size = 0;
+
+#ifdef LOCAL_ROUTINES
+   if (!rpc_is_remote()) {
+      BUFFER_HEADER *pheader;
+
+      if (buffer_handle > _buffer_entries || buffer_handle <= 0 || !_buffer[buffer_handle - 1].attached) {
+         cm_msg(MERROR, "bm_commit_event", "invalid buffer handle %d", buffer_handle);
+         return BM_INVALID_HANDLE;
+      }
+
+      pheader = _buffer[buffer_handle - 1].buffer_header;
+      in_buffer = (char *) pevent >= (char *) (pheader + 1) && (char *) pevent < (char *) (pheader + 1) + pheader->size;
+
+      if (in_buffer) {
+         bm_lock_buffer(buffer_handle);
+         if (pheader->reserved_client == 0 || (char *) pevent != (char *) (pheader + 1) + pheader->write_pointer) {
+            bm_unlock_buffer(buffer_handle);
+            cm_msg(MERROR, "bm_commit_event", "no event has been reserved");
+            return BM_INVALID_PARAM;
+         }
+         if (pheader->reserved_client != bm_validate_client_index(&_buffer[buffer_handle - 1], TRUE) + 1) {
+            bm_unlock_buffer(buffer_handle);
+            cm_msg(MERROR, "bm_commit_event", "event has been reserved by another client");
+            return BM_INVALID_PARAM;
+         }
+         reserved_size = pheader->reserved_size;
+      }
+   }
+#endif                          /* LOCAL_ROUTINES */
+
+   if (!in_buffer)
+      reserved_size = *((INT *) ((char *) pevent - 8));
+
+   status = BM_SUCCESS;
+
+   if (buf_size != 0) {
+      /* check if event size is invalid */
+      if (buf_size < (INT) sizeof(EVENT_HEADER) || ALIGN8(buf_size) > reserved_size) {
+         cm_msg(MERROR, "bm_commit_event", "event size (%d) outside of reserved size (%d)", buf_size, reserved_size);
+         status = BM_INVALID_PARAM;
+      }
+
+      /* check if event size defined in header matches buf_size */
+      else if (ALIGN8(buf_size) != (INT) ALIGN8(((EVENT_HEADER *) pevent)->data_size + sizeof(EVENT_HEADER))) {
+         cm_msg(MERROR, "bm_commit_event", "event size (%d) mismatch in header (%d)",
+                ALIGN8(buf_size), (INT) ALIGN8(((EVENT_HEADER *) pevent)->data_size + sizeof(EVENT_HEADER)));
+         status = BM_INVALID_PARAM;
+      }
+   }
+
+   if (!in_buffer) {
+      if (buf_size != 0 && status == BM_SUCCESS)
+         status = bm_send_event(buffer_handle, pevent, buf_size, BM_WAIT);
+      free((char *) pevent - 8);
+      return status;
+   }
+#ifdef LOCAL_ROUTINES
+   {
+      BUFFER *pbuf = &_buffer[buffer_handle - 1];
+      BUFFER_HEADER *pheader = pbuf->buffer_header;
+      INT i, my_client_index = bm_validate_client_index(pbuf, TRUE);
+
+      if (buf_size != 0 && status == BM_SUCCESS) {
+         INT old_write_pointer = pheader->write_pointer;
+
+         /* publish the new write pointer to lock-free readers only after the event is complete */
+         SS_ATOMIC_STORE(&pheader->write_pointer, bm_copy_to_buffer(pheader, old_write_pointer, pevent, ALIGN8(buf_size)));
+         SS_ATOMIC_FENCE();
+
+         bm_notify_event("bm_commit_event", pheader, my_client_index, (EVENT_HEADER *) pevent, old_write_pointer);
+      }
+
+      pheader->reserved_client = 0;
+      pheader->reserved_size = 0;
+
+      /* producers waiting for the reservation can go on */
+      for (i = 0; i < pheader->max_client_index; i++)
+         if (pheader->client[i].pid && pheader->client[i].write_wait)
+            bm_wakeup_client(pheader->client + i, "B  ");
+
+      bm_unlock_buffer(buffer_handle);
+   }
+#endif                          /* LOCAL_ROUTINES */
+
+   return status;
+}
+
 /********************************************************************/
 /**
 Empty write cache.
@@ -7880,10 +8904,9 @@ INT bm_flush_cache(INT buffer_handle, INT async_flag)
       BUFFER_HEADER *pheader;
       BUFFER_CLIENT *pclient;
       EVENT_HEADER *pevent;
-      INT i, size, total_size, status;
+      INT i, total_size, status;
       INT my_client_index;
-      INT old_write_pointer;
-      char *pdata;
+      INT old_write_pointer, write_pointer;
 
       pbuf = &_buffer[buffer_handle - 1];
 
@@ -7909,7 +8932,6 @@ INT bm_flush_cache(INT buffer_handle, INT async_flag)
 
       /* calculate some shorthands */
       pheader = _buffer[buffer_handle - 1].buffer_header;
-      pdata = (char *) (pheader + 1);
       my_client_index = bm_validate_client_index(pbuf, TRUE);
       pclient = pheader->client;
       pevent = (EVENT_HEADER *) (pbuf->write_cache + pbuf->write_cache_rp);
@@ -7925,7 +8947,7 @@ INT bm_flush_cache(INT buffer_handle, INT async_flag)
       }
 
       /* we have space, so let's copy the event */
-      old_write_pointer = pheader->write_pointer;
+      old_write_pointer = write_pointer = pheader->write_pointer;
 
 #ifdef DEBUG_MSG
       cm_msg(MDEBUG, "bm_flush_cache: found space rp=%d, wp=%d", pheader->read_pointer,
@@ -7947,24 +8969,11 @@ INT bm_flush_cache(INT buffer_handle, INT async_flag)
          /* correct size for DWORD boundary */
          total_size = ALIGN8(total_size);
 
-         if (pheader->write_pointer + total_size <= pheader->size) {
-            memcpy(pdata + pheader->write_pointer, pevent, total_size);
-            pheader->write_pointer = (pheader->write_pointer + total_size) % pheader->size;
-            if (pheader->write_pointer > pheader->size - (int) sizeof(EVENT_HEADER))
-               pheader->write_pointer = 0;
-         } else {
-            /* split event */
-            size = pheader->size - pheader->write_pointer;
-
-            memcpy(pdata + pheader->write_pointer, pevent, size);
-            memcpy(pdata, (char *) pevent + size, total_size - size);
-
-            pheader->write_pointer = total_size - size;
-         }
+         write_pointer = bm_copy_to_buffer(pheader, write_pointer, pevent, total_size);
 
          /* see comment for the same code in bm_send_event().
           * We make sure the buffer is nevere 100% full */
-         assert(pheader->write_pointer != pheader->read_pointer);
+         assert(write_pointer != pheader->read_pointer);
 
          /* this loop does not loop forever because write_cache_rp
           * is monotonously incremented here. write_cache_wp does
@@ -7975,6 +8984,10 @@ INT bm_flush_cache(INT buffer_handle, INT async_flag)
 
       pbuf->write_cache_rp = pbuf->write_cache_wp = 0;
 
+      /* publish all events of the cache at once */
+      SS_ATOMIC_STORE(&pheader->write_pointer, write_pointer);
+      SS_ATOMIC_FENCE();
+
       /* check which clients are waiting */
       for (i = 0; i < pheader->max_client_index; i++)
          if (pclient[i].pid && pclient[i].read_wait) {
@@ -7983,16 +8996,17 @@ INT bm_flush_cache(INT buffer_handle, INT async_flag)
             cm_msg(MDEBUG, "Send wake: rp=%d, wp=%d", pheader->read_pointer, pheader->write_pointer);
 #endif
             sprintf(str, "B %s %d", pheader->name, -1);
-            ss_resume(pclient[i].port, str);
+            bm_wakeup_client(pclient + i, str);
          }
 
       /* shift read pointer of own client */
-      if (pclient[my_client_index].read_pointer == old_write_pointer)
-         pclient[my_client_index].read_pointer = pheader->write_pointer;
+      SS_ATOMIC_CAS(&pclient[my_client_index].read_pointer, old_write_pointer, pheader->write_pointer);
 
-      /* calculate global read pointer as "minimum" of client read pointers */
+      /* calculate global read pointer as "minimum" of client read pointers,
+         only the read pointers of clients at the old write pointer have moved */
 
-      bm_update_read_pointer("bm_flush_cache", pheader);
+      if (pheader->read_pointer == old_write_pointer)
+         bm_update_read_pointer("bm_flush_cache", pheader);
 
       /* update statistics */
       pheader->num_in_events++;
@@ -8089,14 +9103,11 @@ INT bm_receive_event(INT buffer_handle, void *destination, INT * buf_size, INT a
       BUFFER *pbuf;
       BUFFER_HEADER *pheader;
       BUFFER_CLIENT *pc;
-      char *pdata;
       INT convert_flags;
-      INT i, size, max_size;
+      INT max_size;
       INT status = 0;
-      INT my_client_index;
-      BOOL cache_is_full = FALSE;
+      INT my_client_index, old_read_pointer;
       BOOL use_event_buffer = FALSE;
-      int cycle = 0;
 
       pbuf = &_buffer[buffer_handle - 1];
 
@@ -8127,221 +9138,271 @@ INT bm_receive_event(INT buffer_handle, void *destination, INT * buf_size, INT a
 
       /* calculate some shorthands */
       pheader = pbuf->buffer_header;
-      pdata = (char *) (pheader + 1);
       my_client_index = bm_validate_client_index(pbuf, TRUE);
       pc = pheader->client + my_client_index;
 
-      /* first do a quick check without locking the buffer */
-      if (async_flag == BM_NO_WAIT && pheader->write_pointer == pc->read_pointer)
-         return BM_ASYNC_RETURN;
+      status = bm_wait_for_more_events(buffer_handle, pbuf, pc, async_flag);
+      if (status != BM_SUCCESS)
+         return status;
 
-      /* lock the buffer */
-      bm_lock_buffer(buffer_handle);
+      old_read_pointer = pc->read_pointer;
+
+      /* check if events at current read pointer match a request */
+
+      use_event_buffer = bm_read_events(pbuf, pc, &destination, &max_size, FALSE, buf_size, &status);
+
+      if (use_event_buffer)
+         bm_convert_event_header((EVENT_HEADER *) destination, convert_flags);
+
+      /* calculate global read pointer as "minimum" of client read pointers,
+         for lock-free buffers this is done by the producers */
 
-      while (pheader->write_pointer == pc->read_pointer) {
+      if (!pheader->lockfree)
+         bm_reader_moved("bm_receive_event", pheader, old_read_pointer);
+
+      /*
+         If read pointer has been changed, it may have freed up some space
+         for waiting producers. So check if free space is now more than 50%
+         of the buffer size and wake waiting producers.
+       */
+
+      bm_wakeup_producers(pheader, pc);
+
+      if (!pheader->lockfree)
+         bm_unlock_buffer(buffer_handle);
+
+      if (pbuf->read_cache_wp > pbuf->read_cache_rp) {
+         assert(!use_event_buffer);     /* events only go into the _event_buffer when read cache is empty */
+         return bm_copy_from_cache(pbuf, destination, max_size, buf_size, convert_flags);
+      }
+
+      if (use_event_buffer)
+         return status;
+
+      goto LOOP;
+   }
+#else                           /* LOCAL_ROUTINES */
 
-         bm_unlock_buffer(buffer_handle);
+   return SS_SUCCESS;
+#endif
+}
 
-         /* return now in ASYNC mode */
-         if (async_flag == BM_NO_WAIT)
-            return BM_ASYNC_RETURN;
+/********************************************************************/
+/**
+Receives the next requested event without copying it out of the buffer.
+The returned event must not be modified and has to be released with
+bm_release_event() before any other buffer manager function gets called
+on that buffer.
+
+Events matching a GET_ALL request are held in shared memory, producers
+cannot overwrite them until they are released. Events matching only
+GET_NONBLOCKING or GET_RECENT requests and events which wrap around the
+end of the buffer are copied once into private memory. This function is
+only available for buffers on the local host.
+\code
+  const EVENT_HEADER *pevent;
 
-         pc->read_wait = TRUE;
+  while (bm_peek_event(hbuf, &pevent, BM_WAIT) == BM_SUCCESS) {
+    write(fd, pevent, sizeof(EVENT_HEADER) + pevent->data_size);
+    bm_release_event(hbuf);
+  }
+\endcode
+@param buffer_handle buffer handle
+@param ppevent Returns pointer to the event
+@param async_flag BM_WAIT or BM_NO_WAIT flag
+@return BM_SUCCESS, BM_INVALID_HANDLE, BM_INVALID_PARAM <br>
+BM_ASYNC_RETURN No event available in BM_NO_WAIT mode
+*/
+INT bm_peek_event(INT buffer_handle, const EVENT_HEADER ** ppevent, INT async_flag)
+{
+   if (rpc_is_remote()) {
+      cm_msg(MERROR, "bm_peek_event", "only available for local buffers");
+      return BM_INVALID_HANDLE;
+   }
+#ifdef LOCAL_ROUTINES
+   {
+      BUFFER *pbuf;
+      BUFFER_HEADER *pheader;
+      BUFFER_CLIENT *pc;
+      EVENT_HEADER *pevent = NULL;
+      INT status, total_size = 0, read_pointer, old_read_pointer;
+      BOOL found, get_all;
 
-         /* check again pointers (may have moved in between) */
-         if (pheader->write_pointer == pc->read_pointer) {
-#ifdef DEBUG_MSG
-            cm_msg(MDEBUG, "Receive sleep: grp=%d, rp=%d wp=%d",
-                   pheader->read_pointer, pc->read_pointer, pheader->write_pointer);
-#endif
+      if (buffer_handle > _buffer_entries || buffer_handle <= 0) {
+         cm_msg(MERROR, "bm_peek_event", "invalid buffer handle %d", buffer_handle);
+         return BM_INVALID_HANDLE;
+      }
 
-            status = ss_suspend(1000, MSG_BM);
+      pbuf = &_buffer[buffer_handle - 1];
 
-#ifdef DEBUG_MSG
-            cm_msg(MDEBUG, "Receive woke up: rp=%d, wp=%d", pheader->read_pointer, pheader->write_pointer);
-#endif
+      if (!pbuf->attached) {
+         cm_msg(MERROR, "bm_peek_event", "invalid buffer handle %d", buffer_handle);
+         return BM_INVALID_HANDLE;
+      }
 
-            /* return if TCP connection broken */
-            if (status == SS_ABORT)
-               return SS_ABORT;
-         }
+      if (pbuf->peek_size) {
+         cm_msg(MERROR, "bm_peek_event", "previous event has not been released");
+         return BM_INVALID_PARAM;
+      }
 
-         pc->read_wait = FALSE;
+      /* events already in the read cache go first */
+      if (bm_read_cache_has_events(pbuf)) {
+         pevent = (EVENT_HEADER *) (pbuf->read_cache + pbuf->read_cache_rp);
+         total_size = ALIGN8(pevent->data_size + sizeof(EVENT_HEADER));
 
-         /* validate client_index: somebody may have disconnected us from the buffer */
-         bm_validate_client_index(pbuf, TRUE);
+         pbuf->read_cache_rp += total_size;
+         if (pbuf->read_cache_rp == pbuf->read_cache_wp)
+            pbuf->read_cache_rp = pbuf->read_cache_wp = 0;
 
-         bm_lock_buffer(buffer_handle);
+         pbuf->peek_size = total_size;
+         pbuf->peek_read_pointer = -1;
+         *ppevent = pevent;
+         return BM_SUCCESS;
       }
 
-      /* check if event at current read pointer matches a request */
+      pheader = pbuf->buffer_header;
+      pc = pheader->client + bm_validate_client_index(pbuf, TRUE);
 
       do {
-         int new_read_pointer;
-         int total_size;        /* size of the event */
-         EVENT_REQUEST *prequest;
-         EVENT_HEADER *pevent = (EVENT_HEADER *) (pdata + pc->read_pointer);
-
-         assert(pc->read_pointer >= 0);
-         assert(pc->read_pointer <= pheader->size);
+         status = bm_wait_for_more_events(buffer_handle, pbuf, pc, async_flag);
+         if (status != BM_SUCCESS)
+            return status;
 
-         total_size = pevent->data_size + sizeof(EVENT_HEADER);
-         total_size = ALIGN8(total_size);
+         old_read_pointer = pc->read_pointer;
+         found = FALSE;
 
-         assert(total_size > 0);
-         assert(total_size <= pheader->size);
+         while ((read_pointer = SS_ATOMIC_LOAD(&pc->read_pointer)) != SS_ATOMIC_LOAD(&pheader->write_pointer)) {
+            pevent = (EVENT_HEADER *) ((char *) (pheader + 1) + read_pointer);
+            total_size = ALIGN8(pevent->data_size + sizeof(EVENT_HEADER));
 
-         prequest = pc->event_request;
+            /* a lock-free reader can see a header which is being overwritten,
+               start again from the current read pointer */
+            if (total_size <= 0 || total_size > pheader->size) {
+               if (pheader->lockfree)
+                  continue;
 
-         /* loop over all requests: if this event matches a request,
-          * copy it to the read cache */
+               assert(total_size > 0);
+               assert(total_size <= pheader->size);
+            }
 
-         for (i = 0; i < pc->max_request_index; i++, prequest++)
-            if (prequest->valid && bm_match_event(prequest->event_id, prequest->trigger_mask, pevent)) {
+            if (bm_match_requests(pc, pevent, &get_all)) {
+               found = TRUE;
 
-               /* check if this is a recent event */
-               if (prequest->sampling_type == GET_RECENT) {
-                  if (ss_time() - pevent->time_stamp > 1) {
-                     /* skip that event */
+               /* producers wait for events we have a GET_ALL request for, so keep them in place.
+                  The header is only valid if it was not skipped while we looked at it */
+               if (get_all && read_pointer + total_size <= pheader->size) {
+                  if (SS_ATOMIC_LOAD(&pc->read_pointer) != read_pointer) {
+                     found = FALSE;
                      continue;
                   }
+                  pbuf->peek_read_pointer = read_pointer;
+                  break;
                }
-               
-               /* we found a request for this event, so copy it */
 
-               if (pbuf->read_cache_size > 0 && total_size < pbuf->read_cache_size) {
-
-                  /* copy event to cache, if there is room */
-
-                  if (pbuf->read_cache_wp + total_size >= pbuf->read_cache_size) {
-                     cache_is_full = TRUE;
-                     break;     /* exit loop over requests */
-                  }
-
-                  if (pc->read_pointer + total_size <= pheader->size) {
-                     /* copy event to cache */
-                     memcpy(pbuf->read_cache + pbuf->read_cache_wp, pevent, total_size);
-                  } else {
-                     /* event is splitted */
-                     size = pheader->size - pc->read_pointer;
-                     memcpy(pbuf->read_cache + pbuf->read_cache_wp, pevent, size);
-                     memcpy((char *) pbuf->read_cache + pbuf->read_cache_wp + size, pdata, total_size - size);
-                  }
-
-                  pbuf->read_cache_wp += total_size;
-
-               } else {
-                  int copy_size = total_size;
-
-                  /* if there are events in the read cache,
-                   * we should dispatch them before we
-                   * despatch this oversize event */
-
-                  if (bm_read_cache_has_events(pbuf)) {
-                     cache_is_full = TRUE;
-                     break;     /* exit loop over requests */
-                  }
-
-                  use_event_buffer = TRUE;
+               if (total_size > pbuf->peek_buffer_size) {
+                  pbuf->peek_buffer = (char *) realloc(pbuf->peek_buffer, total_size);
+                  pbuf->peek_buffer_size = total_size;
+               }
 
-                  status = BM_SUCCESS;
-                  if (copy_size > max_size) {
-                     copy_size = max_size;
-                     cm_msg(MERROR, "bm_receive_event",
-                            "event size %d larger than buffer size %d", total_size, max_size);
-                     status = BM_TRUNCATED;
-                  }
+               bm_copy_from_buffer(pheader, read_pointer, pbuf->peek_buffer, total_size);
+               pevent = (EVENT_HEADER *) pbuf->peek_buffer;
+               pbuf->peek_read_pointer = -1;
+            }
 
-                  if (pc->read_pointer + total_size <= pheader->size) {
-                     /* event is not splitted */
-                     memcpy(destination, pevent, copy_size);
-                  } else {
-                     /* event is splitted */
-                     size = pheader->size - pc->read_pointer;
-
-                     if (size > max_size)
-                        memcpy(destination, pevent, max_size);
-                     else
-                        memcpy(destination, pevent, size);
-
-                     if (total_size > max_size) {
-                        if (size <= max_size)
-                           memcpy((char *) destination + size, pdata, max_size - size);
-                     } else
-                        memcpy((char *) destination + size, pdata, total_size - size);
-                  }
+            /* an event was skipped by a producer while we copied it */
+            if (!SS_ATOMIC_CAS(&pc->read_pointer, read_pointer, bm_next_read_pointer(pheader, read_pointer, total_size))) {
+               found = FALSE;
+               continue;
+            }
 
-                  *buf_size = copy_size;
+            if (found)
+               break;
+         }
 
-                  bm_convert_event_header((EVENT_HEADER *) destination, convert_flags);
-               }
+         if (found)
+            SS_ATOMIC_ADD(&pheader->num_out_events, 1);
 
-               /* update statistics */
-               pheader->num_out_events++;
-               break;           /* stop looping over requests */
-            }
+         /* calculate global read pointer as "minimum" of client read pointers,
+            for lock-free buffers this is done by the producers */
+         if (!pheader->lockfree)
+            bm_reader_moved("bm_peek_event", pheader, old_read_pointer);
 
-         if (cache_is_full)
-            break;              /* exit from loop over events in data buffer, leaving the current event untouched */
+         bm_wakeup_producers(pheader, pc);
 
-         /* shift read pointer */
+         if (!pheader->lockfree)
+            bm_unlock_buffer(buffer_handle);
 
-         assert(total_size > 0);
-         assert(total_size <= pheader->size);
+      } while (!found);
 
-         new_read_pointer = pc->read_pointer + total_size;
-         if (new_read_pointer >= pheader->size) {
-            new_read_pointer = new_read_pointer % pheader->size;
+      pbuf->peek_size = total_size;
+      *ppevent = pevent;
+   }
+#endif                          /* LOCAL_ROUTINES */
 
-            /* make sure we loop over the data buffer no more than once */
-            cycle++;
-            assert(cycle < 2);
-         }
+   return BM_SUCCESS;
+}
 
-         /* make sure we do not split the event header at the end of the buffer */
-         if (new_read_pointer > pheader->size - (int) sizeof(EVENT_HEADER))
-            new_read_pointer = 0;
+/********************************************************************/
+/**
+Releases an event obtained with bm_peek_event(). Its space in the buffer
+may then be reused by producers.
+@param buffer_handle buffer handle
+@return BM_SUCCESS, BM_INVALID_HANDLE, BM_INVALID_PARAM
+*/
+INT bm_release_event(INT buffer_handle)
+{
+   if (rpc_is_remote()) {
+      cm_msg(MERROR, "bm_release_event", "only available for local buffers");
+      return BM_INVALID_HANDLE;
+   }
+#ifdef LOCAL_ROUTINES
+   {
+      BUFFER *pbuf;
+      BUFFER_HEADER *pheader;
+      BUFFER_CLIENT *pc;
 
-#ifdef DEBUG_MSG
-         cm_msg(MDEBUG, "bm_receive_event -> wp=%d, rp %d -> %d (found=%d,size=%d)",
-                pheader->write_pointer, pc->read_pointer, new_read_pointer, found, total_size);
-#endif
+      if (buffer_handle > _buffer_entries || buffer_handle <= 0) {
+         cm_msg(MERROR, "bm_release_event", "invalid buffer handle %d", buffer_handle);
+         return BM_INVALID_HANDLE;
+      }
 
-         pc->read_pointer = new_read_pointer;
+      pbuf = &_buffer[buffer_handle - 1];
 
-         if (use_event_buffer)
-            break;              /* exit from loop over events in data buffer */
+      if (!pbuf->attached) {
+         cm_msg(MERROR, "bm_release_event", "invalid buffer handle %d", buffer_handle);
+         return BM_INVALID_HANDLE;
+      }
 
-      } while (pheader->write_pointer != pc->read_pointer);
+      if (pbuf->peek_size == 0) {
+         cm_msg(MERROR, "bm_release_event", "no event to release");
+         return BM_INVALID_PARAM;
+      }
 
-      /* calculate global read pointer as "minimum" of client read pointers */
+      /* events held in the buffer are released by moving our read pointer */
+      if (pbuf->peek_read_pointer >= 0) {
+         pheader = pbuf->buffer_header;
+         pc = pheader->client + bm_validate_client_index(pbuf, TRUE);
 
-      bm_update_read_pointer("bm_receive_event", pheader);
+         if (!pheader->lockfree)
+            bm_lock_buffer(buffer_handle);
 
-      /*
-         If read pointer has been changed, it may have freed up some space
-         for waiting producers. So check if free space is now more than 50%
-         of the buffer size and wake waiting producers.
-       */
+         SS_ATOMIC_CAS(&pc->read_pointer, pbuf->peek_read_pointer,
+                       bm_next_read_pointer(pheader, pbuf->peek_read_pointer, pbuf->peek_size));
 
-      bm_wakeup_producers(pheader, pc);
+         if (!pheader->lockfree)
+            bm_reader_moved("bm_release_event", pheader, pbuf->peek_read_pointer);
 
-      bm_unlock_buffer(buffer_handle);
+         bm_wakeup_producers(pheader, pc);
 
-      if (bm_read_cache_has_events(pbuf)) {
-         assert(!use_event_buffer);     /* events only go into the _event_buffer when read cache is empty */
-         return bm_copy_from_cache(pbuf, destination, max_size, buf_size, convert_flags);
+         if (!pheader->lockfree)
+            bm_unlock_buffer(buffer_handle);
       }
 
-      if (use_event_buffer)
-         return status;
-
-      goto LOOP;
+      pbuf->peek_size = 0;
    }
-#else                           /* LOCAL_ROUTINES */
+#endif                          /* LOCAL_ROUTINES */
 
-   return SS_SUCCESS;
-#endif
+   return BM_SUCCESS;
 }
 
 /********************************************************************/
@@ -8385,7 +9446,7 @@ INT bm_skip_event(INT buffer_handle)
 
       /* forward read pointer to global write pointer */
       pclient = pheader->client + bm_validate_client_index(pbuf, TRUE);
-      pclient->read_pointer = pheader->write_pointer;
+      SS_ATOMIC_STORE(&pclient->read_pointer, pheader->write_pointer);
 
       bm_unlock_buffer(buffer_handle);
    }
@@ -8408,12 +9469,10 @@ INT bm_push_event(char *buffer_name)
       BUFFER *pbuf;
       BUFFER_HEADER *pheader;
       BUFFER_CLIENT *pc;
-      char *pdata;
-      INT i, size, buffer_handle;
+      INT i, size, status, buffer_handle, old_read_pointer;
       INT my_client_index;
       BOOL use_event_buffer = 0;
-      BOOL cache_is_full = 0;
-      int cycle = 0;
+      void *event_buffer;
 
       for (i = 0; i < _buffer_entries; i++)
          if (strcmp(buffer_name, _buffer[i].buffer_header->name) == 0)
@@ -8440,162 +9499,61 @@ INT bm_push_event(char *buffer_name)
          _event_buffer_size = 1000;
       }
 
+      /* requests with GET_IN_PLACE get the event directly in shared memory */
+      for (i = 0; i < _request_list_entries; i++)
+         if (_request_list[i].buffer_handle == buffer_handle && _request_list[i].in_place)
+            break;
+
+      if (i < _request_list_entries) {
+         const EVENT_HEADER *pevent;
+
+         status = bm_peek_event(buffer_handle, &pevent, BM_NO_WAIT);
+         if (status == BM_ASYNC_RETURN)
+            return BM_SUCCESS;
+         if (status != BM_SUCCESS)
+            return status;
+
+         bm_dispatch_event(buffer_handle, (EVENT_HEADER *) pevent, TRUE);
+
+         /* the callback might have closed the buffer */
+         if (buffer_handle <= _buffer_entries && _buffer[buffer_handle - 1].attached &&
+             _buffer[buffer_handle - 1].peek_size)
+            bm_release_event(buffer_handle);
+
+         return BM_MORE_EVENTS;
+      }
+
       /* look if there is anything in the cache */
-      if (bm_read_cache_has_events(pbuf)) {
+      if (pbuf->read_cache_wp > pbuf->read_cache_rp) {
          bm_dispatch_from_cache(pbuf, buffer_handle);
          return BM_MORE_EVENTS;
       }
 
       /* calculate some shorthands */
       pheader = pbuf->buffer_header;
-      pdata = (char *) (pheader + 1);
       my_client_index = bm_validate_client_index(pbuf, TRUE);
       pc = pheader->client + my_client_index;
 
       /* first do a quick check without locking the buffer */
-      if (pheader->write_pointer == pc->read_pointer)
+      if (SS_ATOMIC_LOAD(&pheader->write_pointer) == SS_ATOMIC_LOAD(&pc->read_pointer))
          return BM_SUCCESS;
 
-      /* lock the buffer */
-      bm_lock_buffer(buffer_handle);
-
-      if (pheader->write_pointer == pc->read_pointer) {
-
-         bm_unlock_buffer(buffer_handle);
-
-         /* return if no event available */
-         return BM_SUCCESS;
-      }
+      /* lock the buffer, lock-free readers only use the atomic read and write pointers */
+      if (!pheader->lockfree)
+         bm_lock_buffer(buffer_handle);
 
       /* loop over all events in the buffer */
 
-      do {
-         int new_read_pointer;
-         int total_size;        /* size of the event */
-         EVENT_REQUEST *prequest;
-         EVENT_HEADER *pevent = (EVENT_HEADER *) (pdata + pc->read_pointer);
-
-         assert(pc->read_pointer >= 0);
-         assert(pc->read_pointer <= pheader->size);
-
-         total_size = pevent->data_size + sizeof(EVENT_HEADER);
-         total_size = ALIGN8(total_size);
-
-         assert(total_size > 0);
-         assert(total_size <= pheader->size);
-
-         prequest = pc->event_request;
-
-         /* loop over all requests: if this event matches a request,
-          * copy it to the read cache */
-
-         for (i = 0; i < pc->max_request_index; i++, prequest++)
-            if (prequest->valid && bm_match_event(prequest->event_id, prequest->trigger_mask, pevent)) {
-
-               /* check if this is a recent event */
-               if (prequest->sampling_type == GET_RECENT) {
-                  if (ss_time() - pevent->time_stamp > 1) {
-                     /* skip that event */
-                     continue;
-                  }
-               }
-
-               /* we found a request for this event, so copy it */
-
-               if (pbuf->read_cache_size > 0 && total_size < pbuf->read_cache_size) {
-
-                  /* copy event to cache, if there is room */
-
-                  if (pbuf->read_cache_wp + total_size >= pbuf->read_cache_size) {
-                     cache_is_full = TRUE;
-                     break;     /* exit loop over requests */
-                  }
-
-                  if (pc->read_pointer + total_size <= pheader->size) {
-                     /* copy event to cache */
-                     memcpy(pbuf->read_cache + pbuf->read_cache_wp, pevent, total_size);
-                  } else {
-                     /* event is splitted */
-                     size = pheader->size - pc->read_pointer;
-                     memcpy(pbuf->read_cache + pbuf->read_cache_wp, pevent, size);
-                     memcpy((char *) pbuf->read_cache + pbuf->read_cache_wp + size, pdata, total_size - size);
-                  }
-
-                  pbuf->read_cache_wp += total_size;
-
-               } else {
-                  /* copy event to copy buffer */
-
-                  /* if there are events in the read cache,
-                   * we should dispatch them before we
-                   * despatch this oversize event */
-
-                  if (bm_read_cache_has_events(pbuf)) {
-                     cache_is_full = TRUE;
-                     break;     /* exit loop over requests */
-                  }
-
-                  use_event_buffer = TRUE;
-
-                  if (total_size > _event_buffer_size) {
-                     //printf("realloc event buffer %d -> %d\n", _event_buffer_size, total_size);
-                     _event_buffer = (EVENT_HEADER *) realloc(_event_buffer, total_size);
-                     _event_buffer_size = total_size;
-                  }
-
-                  if (pc->read_pointer + total_size <= pheader->size) {
-                     memcpy(_event_buffer, pevent, total_size);
-                  } else {
-                     /* event is splitted */
-                     size = pheader->size - pc->read_pointer;
-
-                     memcpy(_event_buffer, pevent, size);
-                     memcpy((char *) _event_buffer + size, pdata, total_size - size);
-                  }
-               }
-
-               /* update statistics */
-               pheader->num_out_events++;
-               break;           /* exit loop over event requests */
-
-            }
-         /* end of loop over event requests */
-         if (cache_is_full)
-            break;              /* exit from loop over events in data buffer, leaving the current event untouched */
-
-         /* shift read pointer */
-
-         assert(total_size > 0);
-         assert(total_size <= pheader->size);
-
-         new_read_pointer = pc->read_pointer + total_size;
-         if (new_read_pointer >= pheader->size) {
-            new_read_pointer = new_read_pointer % pheader->size;
+      old_read_pointer = pc->read_pointer;
+      event_buffer = _event_buffer;
+      use_event_buffer = bm_read_events(pbuf, pc, &event_buffer, &_event_buffer_size, TRUE, &size, &status);
+      _event_buffer = (EVENT_HEADER *) event_buffer;
 
-            /* make sure we loop over the data buffer no more than once */
-            cycle++;
-            assert(cycle < 2);
-         }
-
-         /* make sure we do not split the event header at the end of the buffer */
-         if (new_read_pointer > pheader->size - (int) sizeof(EVENT_HEADER))
-            new_read_pointer = 0;
-
-#ifdef DEBUG_MSG
-         cm_msg(MDEBUG, "bm_push_event -> wp=%d, rp %d -> %d (found=%d,size=%d)",
-                pheader->write_pointer, pc->read_pointer, new_read_pointer, found, total_size);
-#endif
-
-         pc->read_pointer = new_read_pointer;
-
-         if (use_event_buffer)
-            break;              /* exit from loop over events in data buffer */
-
-      } while (pheader->write_pointer != pc->read_pointer);
+      /* calculate global read pointer as "minimum" of client read pointers,
+         for lock-free buffers this is done by the producers */
 
-      /* calculate global read pointer as "minimum" of client read pointers */
-
-      bm_update_read_pointer("bm_push_event", pheader);
+      if (!pheader->lockfree)
+         bm_reader_moved("bm_push_event", pheader, old_read_pointer);
 
       /*
          If read pointer has been changed, it may have freed up some space
@@ -8605,16 +9563,17 @@ INT bm_push_event(char *buffer_name)
 
       bm_wakeup_producers(pheader, pc);
 
-      bm_unlock_buffer(buffer_handle);
+      if (!pheader->lockfree)
+         bm_unlock_buffer(buffer_handle);
 
-      if (bm_read_cache_has_events(pbuf)) {
+      if (pbuf->read_cache_wp > pbuf->read_cache_rp) {
          assert(!use_event_buffer);     /* events only go into the _event_buffer when read cache is empty */
          bm_dispatch_from_cache(pbuf, buffer_handle);
          return BM_MORE_EVENTS;
       }
 
       if (use_event_buffer) {
-         bm_dispatch_event(buffer_handle, _event_buffer);
+         bm_dispatch_event(buffer_handle, _event_buffer, FALSE);
          return BM_MORE_EVENTS;
       }
 
@@ -8992,7 +9951,7 @@ INT bm_empty_buffers()
 
          /* set read pointer to write pointer */
          pclient = (pbuf->buffer_header)->client + bm_validate_client_index(pbuf, TRUE);
-         pclient->read_pointer = (pbuf->buffer_header)->write_pointer;
+         SS_ATOMIC_STORE(&pclient->read_pointer, (pbuf->buffer_header)->write_pointer);
 
          bm_unlock_buffer(idx + 1);
       }
@@ -9956,7 +10915,7 @@ INT rpc_server_connect(const char *host_name, const char *exp_name)
    struct sockaddr_in bind_addr;
    INT sock, lsock1, lsock2, lsock3;
    INT listen_port1, listen_port2, listen_port3;
-   INT remote_hw_type, hw_type;
+   INT remote_hw_type, hw_type, send_events;
    unsigned int size;
    char str[200], version[32], v1[32];
    char local_prog_name[NAME_LENGTH];
@@ -10218,8 +11177,11 @@ INT rpc_server_connect(const char *host_name, const char *exp_name)
       return RPC_NET_ERROR;
    }
 
-   sscanf(str, "%d", &remote_hw_type);
+   /* older servers only send their hardware type and reject RPC_BM_SEND_EVENTS */
+   send_events = 0;
+   sscanf(str, "%d %d", &remote_hw_type, &send_events);
    _server_connection.remote_hw_type = remote_hw_type;
+   _server_connection.send_events = send_events;
 
    /* set dispatcher which receives database updates */
    ss_suspend_set_dispatch(CH_CLIENT, &_server_connection, (int (*)(void)) rpc_client_dispatch);
@@ -11538,6 +12500,9 @@ INT rpc_send_event(INT buffer_handle, void *source, INT buf_size, INT async_flag
       if (_tcp_rp == _tcp_wp)
          _tcp_rp = _tcp_wp = 0;
 
+      /* events cannot be added any more to a command which is (partially) sent */
+      _tcp_batch = -1;
+
       if (i < 0 && !would_block) {
          cm_msg(MERROR, "rpc_send_event", "send_tcp() failed, return code = %d", i);
          return RPC_NET_ERROR;
@@ -11548,7 +12513,27 @@ INT rpc_send_event(INT buffer_handle, void *source, INT buf_size, INT async_flag
          return BM_ASYNC_RETURN;
    }
 
-   if (mode == 0) {
+   if (mode == 0 && _tcp_batch >= 0 &&
+       *((INT *) (&((NET_COMMAND *) (_tcp_buffer + _tcp_batch))->param[0])) == buffer_handle) {
+      DWORD batch_size;
+
+      /* append event to the RPC_BM_SEND_EVENTS command at the end of the TCP buffer,
+         so that the server writes all of them to the buffer at once */
+      nc = (NET_COMMAND *) (_tcp_buffer + _tcp_batch);
+      batch_size = *((INT *) (&nc->param[8]));
+
+      memcpy(&nc->param[16 + batch_size], source, buf_size);
+      batch_size += aligned_buf_size;
+
+      /* size of event array and last two parameters (size and async_flag) */
+      *((INT *) (&nc->param[8])) = batch_size;
+      *((INT *) (&nc->param[16 + batch_size])) = batch_size;
+      *((INT *) (&nc->param[24 + batch_size])) = 0;
+
+      nc->header.param_size = 4 * 8 + batch_size;
+      _tcp_wp = _tcp_batch + nc->header.param_size + sizeof(NET_COMMAND_HEADER);
+
+   } else if (mode == 0) {
       nc = (NET_COMMAND *) (_tcp_buffer + _tcp_wp);
       nc->header.routine_id = RPC_BM_SEND_EVENT | TCP_FAST;
       nc->header.param_size = 4 * 8 + aligned_buf_size;
@@ -11581,11 +12566,25 @@ INT rpc_send_event(INT buffer_handle, void *source, INT buf_size, INT async_flag
             cm_msg(MERROR, "rpc_send_event", "send_tcp() failed, return code = %d", i);
             return RPC_NET_ERROR;
          }
+      } else if (_server_connection.send_events) {
+         /* further events for the same buffer get appended to this command */
+         nc->header.routine_id = RPC_BM_SEND_EVENTS | TCP_FAST;
+         *((INT *) (&nc->param[8])) = aligned_buf_size;
+         _tcp_batch = _tcp_wp;
+
+         /* copy event */
+         memcpy(&nc->param[16], source, buf_size);
+
+         /* last two parameters (size of event array and async_flag) */
+         *((INT *) (&nc->param[16 + aligned_buf_size])) = aligned_buf_size;
+         *((INT *) (&nc->param[24 + aligned_buf_size])) = 0;
+
+         _tcp_wp += nc->header.param_size + sizeof(NET_COMMAND_HEADER);
       } else {
          /* copy event */
          memcpy(&nc->param[16], source, buf_size);
 
-         /* last two parameters (buf_size and async_flag */
+         /* last two parameters (buf_size and async_flag) */
          *((INT *) (&nc->param[16 + aligned_buf_size])) = buf_size;
          *((INT *) (&nc->param[24 + aligned_buf_size])) = 0;
 
@@ -11706,6 +12705,7 @@ INT rpc_flush_event()
    }
 
    _tcp_rp = _tcp_wp = 0;
+   _tcp_batch = -1;
 
    return RPC_SUCCESS;
 }
@@ -13822,9 +14822,9 @@ INT rpc_server_callback(struct callback_addr * pcallback)
    _server_acception[idx].last_activity = ss_millitime();
    _server_acception[idx].watchdog_timeout = 0;
 
-   /* send my own computer id */
+   /* send my own computer id, followed by 1 to tell that RPC_BM_SEND_EVENTS is known */
    hw_type = rpc_get_option(0, RPC_OHW_TYPE);
-   sprintf(str, "%d", hw_type);
+   sprintf(str, "%d 1", hw_type);
    send(recv_sock, str, strlen(str) + 1, 0);
 
    rpc_set_server_acception(idx + 1);
@@ -13871,7 +14871,7 @@ INT rpc_server_thread(void *pointer)
 \********************************************************************/
 {
    struct callback_addr callback;
-   int status, semaphore_alarm, semaphore_elog, semaphore_history, semaphore_msg;
+   int status, millisec, semaphore_alarm, semaphore_elog, semaphore_history, semaphore_msg;
    static DWORD last_checked = 0;
 
    memcpy(&callback, pointer, sizeof(callback));
@@ -13889,7 +14889,11 @@ INT rpc_server_thread(void *pointer)
    cm_set_experiment_semaphore(semaphore_alarm, semaphore_elog, semaphore_history, semaphore_msg);
 
    do {
-      status = ss_suspend(5000, 0);
+      /* return in time to send hot-link notifications held back by the notify window */
+      millisec = 5000;
+      db_flush_notify(&millisec);
+
+      status = ss_suspend(millisec, 0);
 
       if (rpc_check_channels() == RPC_NET_ERROR)
          break;
@@ -13902,6 +14906,9 @@ INT rpc_server_thread(void *pointer)
 
       cm_msg_flush_buffer();
 
+      /* send hot-link notifications which became due while waiting */
+      db_flush_notify(NULL);
+
    } while (status != SS_ABORT && status != SS_EXIT);
 
    /* delete entry in suspend table for this thread */
@@ -13941,6 +14948,7 @@ INT rpc_server_receive(INT idx, int sock, BOOL check)
 {
    INT status, n_received;
    INT remaining, *pbh, start_time;
+   INT event_size, batch_size = 0, batch_handle = 0;
    char test_buffer[256], str[80];
    EVENT_HEADER *pevent;
 
@@ -14062,16 +15070,35 @@ INT rpc_server_receive(INT idx, int sock, BOOL check)
                goto error;
             }
 
-            /* send event to buffer */
             pbh = (INT *) _net_recv_buffer;
             pevent = (EVENT_HEADER *) (pbh + 1);
+            event_size = ALIGN8(pevent->data_size + sizeof(EVENT_HEADER));
+
+            /* send collected events if they go to another buffer */
+            if (batch_size > 0 && batch_handle != *pbh) {
+               status = bm_send_packed_events(batch_handle, _event_batch, batch_size, BM_WAIT, 0);
+               if (status != BM_SUCCESS)
+                  cm_msg(MERROR, "rpc_server_receive", "bm_send_packed_events() returned %d", status);
+               batch_size = 0;
+            }
 
-            status = bm_send_event(*pbh, pevent, pevent->data_size + sizeof(EVENT_HEADER), BM_WAIT);
-            if (status != BM_SUCCESS)
-               cm_msg(MERROR, "rpc_server_receive", "bm_send_event() returned %d", status);
+            /* collect events which are already in the network buffer */
+            if (batch_size + event_size > _event_batch_size) {
+               _event_batch = (char *) realloc(_event_batch, batch_size + event_size);
+               _event_batch_size = batch_size + event_size;
+            }
+
+            memcpy(_event_batch + batch_size, pevent, event_size);
+            batch_size += event_size;
+            batch_handle = *pbh;
 
             /* repeat for maximum 0.5 sec */
          } while (ss_millitime() - start_time < 500 && remaining);
+
+         /* send events to buffer with a single lock */
+         status = bm_send_packed_events(batch_handle, _event_batch, batch_size, BM_WAIT, 0);
+         if (status != BM_SUCCESS)
+            cm_msg(MERROR, "rpc_server_receive", "bm_send_packed_events() returned %d", status);
       }
    }
 
@@ -15005,13 +16032,27 @@ INT bk_swap(void *event, BOOL force)
 *                                                                    *
 \********************************************************************/
 
+#define RB_CACHE_LINE 64
+
+/* rp and wp are written by different threads, so they are kept on
+   separate cache lines together with the futex words the other side
+   waits on. Everything the producer writes for each event (wp, wp_count)
+   lives on one line, everything the consumer writes (rp, rp_count) on
+   the other one. */
 typedef struct {
    unsigned char *buffer;
    unsigned int size;
    unsigned int max_event_size;
-   unsigned char *rp;
-   unsigned char *wp;
    unsigned char *ep;
+   char pad0[RB_CACHE_LINE];
+   unsigned char *rp;           /* written by consumer */
+   INT rp_count;                /* incremented on each rp change, producer waits on it */
+   INT writer_waiting;          /* set by producer while waiting for free space */
+   char pad1[RB_CACHE_LINE];
+   unsigned char *wp;           /* written by producer */
+   INT wp_count;                /* incremented on each wp change, consumer waits on it */
+   INT reader_waiting;          /* set by consumer while waiting for data */
+   char pad2[RB_CACHE_LINE];
 } RING_BUFFER;
 
 #define MAX_RING_BUFFER 100
@@ -15020,6 +16061,37 @@ RING_BUFFER rb[MAX_RING_BUFFER];
 
 volatile int _rb_nonblocking = 0;
 
+/*------------------------------------------------------------------*/
+
+static void rb_wait(INT * count, INT * waiting, INT value, int millisec)
+/* wait until the other side changes *count away from value */
+{
+   SS_ATOMIC_STORE(waiting, 1);
+   SS_ATOMIC_FENCE();
+
+#ifdef HAVE_SS_FUTEX
+   if (SS_ATOMIC_LOAD(count) == value)
+      ss_futex_wait(count, value, millisec);
+#else
+   if (SS_ATOMIC_LOAD(count) == value)
+      ss_sleep(millisec < 10 ? millisec : 10);
+#endif
+
+   SS_ATOMIC_STORE(waiting, 0);
+}
+
+static void rb_wakeup(INT * count, INT * waiting)
+/* tell the other side that *count has changed */
+{
+   SS_ATOMIC_ADD(count, 1);
+   SS_ATOMIC_FENCE();
+
+#ifdef HAVE_SS_FUTEX
+   if (SS_ATOMIC_LOAD(waiting))
+      ss_futex_wake(count);
+#endif
+}
+
 /**dox***************************************************************/
 #endif                          /* DOXYGEN_SHOULD_SKIP_THIS */
 
@@ -15048,8 +16120,17 @@ int rb_set_nonblocking()
 
 \********************************************************************/
 {
+   int i;
+
    _rb_nonblocking = 1;
 
+   /* release threads currently waiting in rb_get_wp or rb_get_rp */
+   for (i = 0; i < MAX_RING_BUFFER; i++)
+      if (rb[i].buffer != NULL) {
+         rb_wakeup(&rb[i].rp_count, &rb[i].writer_waiting);
+         rb_wakeup(&rb[i].wp_count, &rb[i].reader_waiting);
+      }
+
    return DB_SUCCESS;
 }
 
@@ -15141,7 +16222,7 @@ int rb_delete(int handle)
 
 \********************************************************************/
 {
-   if (handle < 0 || handle >= MAX_RING_BUFFER || rb[handle - 1].buffer == NULL)
+   if (handle < 1 || handle > MAX_RING_BUFFER || rb[handle - 1].buffer == NULL)
       return DB_INVALID_HANDLE;
 
    M_FREE(rb[handle - 1].buffer);
@@ -15182,34 +16263,40 @@ Routine: rb_get_wp
 
 \********************************************************************/
 {
-   int h, i;
-   unsigned char *rp;
+   int h, count;
+   DWORD start, elapsed;
+   unsigned char *rp, *wp;
 
    if (handle < 1 || handle > MAX_RING_BUFFER || rb[handle - 1].buffer == NULL)
       return DB_INVALID_HANDLE;
 
    h = handle - 1;
+   wp = rb[h].wp;               // only changed by this thread
+   start = ss_millitime();
 
-   for (i = 0; i <= millisec / 10; i++) {
+   do {
+      /* read count before rp, so that a change in between lets rb_wait return */
+      count = SS_ATOMIC_LOAD(&rb[h].rp_count);
 
-      rp = rb[h].rp;            // keep local copy, rb[h].rp might be changed by other thread
+      /* keep local copy, rb[h].rp might be changed by other thread, acquire
+         makes sure the consumer is done with the data before we overwrite it */
+      rp = SS_ATOMIC_LOAD(&rb[h].rp);
 
       /* check if enough size for wp >= rp without wrap-around */
-      if (rb[h].wp >= rp
-          && rb[h].wp + rb[h].max_event_size <= rb[h].buffer + rb[h].size - rb[h].max_event_size) {
-         *p = rb[h].wp;
+      if (wp >= rp && wp + rb[h].max_event_size <= rb[h].buffer + rb[h].size - rb[h].max_event_size) {
+         *p = wp;
          return DB_SUCCESS;
       }
 
       /* check if enough size for wp >= rp with wrap-around */
-      if (rb[h].wp >= rp && rb[h].wp + rb[h].max_event_size > rb[h].buffer + rb[h].size - rb[h].max_event_size && rb[h].rp > rb[h].buffer) {    // next increment of wp wraps around, so need space at beginning
-         *p = rb[h].wp;
+      if (wp >= rp && wp + rb[h].max_event_size > rb[h].buffer + rb[h].size - rb[h].max_event_size && rp > rb[h].buffer) {       // next increment of wp wraps around, so need space at beginning
+         *p = wp;
          return DB_SUCCESS;
       }
 
       /* check if enough size for wp < rp */
-      if (rb[h].wp < rp && rb[h].wp + rb[h].max_event_size < rp) {
-         *p = rb[h].wp;
+      if (wp < rp && wp + rb[h].max_event_size < rp) {
+         *p = wp;
          return DB_SUCCESS;
       }
 
@@ -15219,9 +16306,12 @@ Routine: rb_get_wp
       if (_rb_nonblocking)
          return DB_TIMEOUT;
 
-      /* wait one time slice */
-      ss_sleep(10);
-   }
+      /* wait until consumer has moved the read pointer */
+      elapsed = ss_millitime() - start;
+      if (elapsed < (DWORD) millisec)
+         rb_wait(&rb[h].rp_count, &rb[h].writer_waiting, count, millisec - elapsed);
+
+   } while (ss_millitime() - start < (DWORD) millisec);
 
    return DB_TIMEOUT;
 }
@@ -15270,12 +16360,14 @@ int rb_increment_wp(int handle, int size)
 
    /* wrap around wp if not enough space */
    if (new_wp > rb[h].buffer + rb[h].size - rb[h].max_event_size) {
-      rb[h].ep = new_wp;
+      SS_ATOMIC_STORE(&rb[h].ep, new_wp);
       new_wp = rb[h].buffer;
-      assert(rb[h].rp != rb[h].buffer);
+      assert(SS_ATOMIC_LOAD(&rb[h].rp) != rb[h].buffer);
    }
 
-   rb[h].wp = new_wp;
+   /* release makes the event data visible before the new wp */
+   SS_ATOMIC_STORE(&rb[h].wp, new_wp);
+   rb_wakeup(&rb[h].wp_count, &rb[h].reader_waiting);
 
    return DB_SUCCESS;
 }
@@ -15320,18 +16412,23 @@ int rb_get_rp(int handle, void **p, int millisec)
 
 \********************************************************************/
 {
-   int i, h;
+   int h, count;
+   DWORD start, elapsed;
 
    if (handle < 1 || handle > MAX_RING_BUFFER || rb[handle - 1].buffer == NULL)
       return DB_INVALID_HANDLE;
 
    h = handle - 1;
+   start = ss_millitime();
 
-   for (i = 0; i <= millisec / 10; i++) {
+   do {
+      /* read count before wp, so that a change in between lets rb_wait return */
+      count = SS_ATOMIC_LOAD(&rb[h].wp_count);
 
-      if (rb[h].wp != rb[h].rp) {
+      /* acquire makes the event data written by the producer visible */
+      if (SS_ATOMIC_LOAD(&rb[h].wp) != rb[h].rp) {
          if (p != NULL)
-            *p = rb[handle - 1].rp;
+            *p = rb[h].rp;
          return DB_SUCCESS;
       }
 
@@ -15341,9 +16438,12 @@ int rb_get_rp(int handle, void **p, int millisec)
       if (_rb_nonblocking)
          return DB_TIMEOUT;
 
-      /* wait one time slice */
-      ss_sleep(10);
-   }
+      /* wait until producer has moved the write pointer */
+      elapsed = ss_millitime() - start;
+      if (elapsed < (DWORD) millisec)
+         rb_wait(&rb[h].wp_count, &rb[h].reader_waiting, count, millisec - elapsed);
+
+   } while (ss_millitime() - start < (DWORD) millisec);
 
    return DB_TIMEOUT;
 }
@@ -15398,7 +16498,9 @@ int rb_increment_rp(int handle, int size)
    if (new_rp + rb[h].max_event_size > rb[h].buffer + rb[h].size)
       new_rp = rb[h].buffer;
 
-   rb[handle - 1].rp = new_rp;
+   /* release makes sure we are done with the data before the producer sees the new rp */
+   SS_ATOMIC_STORE(&rb[h].rp, new_rp);
+   rb_wakeup(&rb[h].rp_count, &rb[h].writer_waiting);
 
    return DB_SUCCESS;
 }
@@ -15431,17 +16533,22 @@ int rb_get_buffer_level(int handle, int *n_bytes)
 \********************************************************************/
 {
    int h;
+   unsigned char *rp, *wp;
 
    if (handle < 1 || handle > MAX_RING_BUFFER || rb[handle - 1].buffer == NULL)
       return DB_INVALID_HANDLE;
 
    h = handle - 1;
 
-   if (rb[h].wp >= rb[h].rp)
-      *n_bytes = (POINTER_T) rb[h].wp - (POINTER_T) rb[h].rp;
+   /* can be called from any thread, so take a snapshot of both pointers */
+   rp = SS_ATOMIC_LOAD(&rb[h].rp);
+   wp = SS_ATOMIC_LOAD(&rb[h].wp);
+
+   if (wp >= rp)
+      *n_bytes = (POINTER_T) wp - (POINTER_T) rp;
    else
       *n_bytes =
-          (POINTER_T) rb[h].ep - (POINTER_T) rb[h].rp + (POINTER_T) rb[h].wp - (POINTER_T) rb[h].buffer;
+          (POINTER_T) SS_ATOMIC_LOAD(&rb[h].ep) - (POINTER_T) rp + (POINTER_T) wp - (POINTER_T) rb[h].buffer;
 
    return DB_SUCCESS;
 }
@@ -590,6 +590,10 @@ static MJsonNode* js_db_get_values(const MJsonNode* params)
    HNDLE hDB;
    cm_get_experiment_database(&hDB, NULL);
 
+   /* one JSON buffer for all paths, it only grows once to the largest subtree */
+   char* buf = NULL;
+   int bufsize = 0;
+
    for (unsigned i=0; i<paths->size(); i++) {
       int status = 0;
       HNDLE hkey;
@@ -631,8 +635,6 @@ static MJsonNode* js_db_get_values(const MJsonNode* params)
             MJsonNode *ssresult = MJsonNode::MakeArray();
 
             for (unsigned i=0; i<list.size(); i++) {
-               char* buf = NULL;
-               int bufsize = 0;
                int end = 0;
                
                status = db_copy_json_index(hDB, hkey, list[i], &buf, &bufsize, &end);
@@ -643,9 +645,6 @@ static MJsonNode* js_db_get_values(const MJsonNode* params)
                   ddresult->AddToArray(MJsonNode::MakeNull());
                   ssresult->AddToArray(MJsonNode::MakeInt(status));
                }
-
-               if (buf)
-                  free(buf);
             }
 
             dresult->AddToArray(ddresult);
@@ -654,8 +653,6 @@ static MJsonNode* js_db_get_values(const MJsonNode* params)
             lwresult->AddToArray(MJsonNode::MakeInt(key.last_written));
 
          } else {
-            char* buf = NULL;
-            int bufsize = 0;
             int end = 0;
             
             status = db_copy_json_index(hDB, hkey, list[0], &buf, &bufsize, &end);
@@ -670,13 +667,8 @@ static MJsonNode* js_db_get_values(const MJsonNode* params)
                tresult->AddToArray(MJsonNode::MakeInt(key.type));
                lwresult->AddToArray(MJsonNode::MakeInt(key.last_written));
             }
-            
-            if (buf)
-               free(buf);
          }
       } else {
-         char* buf = NULL;
-         int bufsize = 0;
          int end = 0;
 
          status = db_copy_json_values(hDB, hkey, &buf, &bufsize, &end, omit_names, omit_last_written, omit_old_timestamp);
@@ -692,9 +684,6 @@ static MJsonNode* js_db_get_values(const MJsonNode* params)
             tresult->AddToArray(MJsonNode::MakeInt(key.type));
             lwresult->AddToArray(MJsonNode::MakeInt(key.last_written));
          }
-
-         if (buf)
-            free(buf);
       }
    }
 
@@ -711,6 +700,9 @@ static MJsonNode* js_db_get_values(const MJsonNode* params)
    else
       delete lwresult;
 
+   if (buf)
+      free(buf);
+
    return mjsonrpc_make_result(result);
 }
 
@@ -735,6 +727,10 @@ static MJsonNode* js_db_ls(const MJsonNode* params)
    HNDLE hDB;
    cm_get_experiment_database(&hDB, NULL);
 
+   /* one JSON buffer for all paths, it only grows once to the largest subtree */
+   char* buf = NULL;
+   int bufsize = 0;
+
    for (unsigned i=0; i<paths->size(); i++) {
       int status = 0;
       HNDLE hkey;
@@ -747,8 +743,6 @@ static MJsonNode* js_db_ls(const MJsonNode* params)
          continue;
       }
 
-      char* buf = NULL;
-      int bufsize = 0;
       int end = 0;
 
       status = db_copy_json_ls(hDB, hkey, &buf, &bufsize, &end);
@@ -760,11 +754,11 @@ static MJsonNode* js_db_ls(const MJsonNode* params)
          dresult->AddToArray(MJsonNode::MakeNull());
          sresult->AddToArray(MJsonNode::MakeInt(status));
       }
-
-      if (buf)
-         free(buf);
    }
 
+   if (buf)
+      free(buf);
+
    return mjsonrpc_make_result("data", dresult, "status", sresult);
 }
 
@@ -789,6 +783,10 @@ static MJsonNode* js_db_copy(const MJsonNode* params)
    HNDLE hDB;
    cm_get_experiment_database(&hDB, NULL);
 
+   /* one JSON buffer for all paths, it only grows once to the largest subtree */
+   char* buf = NULL;
+   int bufsize = 0;
+
    for (unsigned i=0; i<paths->size(); i++) {
       int status = 0;
       HNDLE hkey;
@@ -801,8 +799,6 @@ static MJsonNode* js_db_copy(const MJsonNode* params)
          continue;
       }
 
-      char* buf = NULL;
-      int bufsize = 0;
       int end = 0;
 
       status = db_copy_json_save(hDB, hkey, &buf, &bufsize, &end);
@@ -814,11 +810,11 @@ static MJsonNode* js_db_copy(const MJsonNode* params)
          dresult->AddToArray(MJsonNode::MakeNull());
          sresult->AddToArray(MJsonNode::MakeInt(status));
       }
-
-      if (buf)
-         free(buf);
    }
 
+   if (buf)
+      free(buf);
+
    return mjsonrpc_make_result("data", dresult, "status", sresult);
 }
 
@@ -80,6 +80,9 @@ void create_runlog_ascii_tree();
 "File checksum = STRING : [256]",\
 "Compress = STRING : [256]",\
 "Output = STRING : [256]",\
+"Writer queue size = INT : 33554432",\
+"Compression threads = INT : 0",\
+"Compression level = INT : 0",\
 "",\
 "[Statistics]",\
 "Events written = DOUBLE : 0",\
@@ -89,6 +92,9 @@ void create_runlog_ascii_tree();
 "Bytes written subrun = DOUBLE : 0",\
 "Files written = DOUBLE : 0",\
 "Disk level = DOUBLE : 0",\
+"Writer queue level = DOUBLE : 0",\
+"Writer queue full = DOUBLE : 0",\
+"Writer wait time = DOUBLE : 0",\
 "",\
 NULL}
 #define CHN_TREE_STR(_name) const char *_name[] = {\
@@ -113,6 +119,9 @@ NULL}
 "File checksum = STRING : [256]",\
 "Compress = STRING : [256]",\
 "Output = STRING : [256]",\
+"Writer queue size = INT : 33554432",\
+"Compression threads = INT : 0",\
+"Compression level = INT : 0",\
 "",\
 "[Statistics]",\
 "Events written = DOUBLE : 0",\
@@ -122,6 +131,9 @@ NULL}
 "Bytes written subrun = DOUBLE : 0",\
 "Files written = DOUBLE : 0",\
 "Disk level = DOUBLE : 0",\
+"Writer queue level = DOUBLE : 0",\
+"Writer queue full = DOUBLE : 0",\
+"Writer wait time = DOUBLE : 0",\
 "",\
 NULL}
 
@@ -146,6 +158,9 @@ typedef struct {
    char file_checksum[256];
    char compress[256];
    char output[256];
+   INT writer_queue_size;
+   INT compression_threads;
+   INT compression_level;
 } CHN_SETTINGS;
 
 #define CHN_SETTINGS_STR(_name) const char *_name[] = {\
@@ -169,6 +184,9 @@ typedef struct {
 "File checksum = STRING : [256]",\
 "Compress = STRING : [256]",\
 "Output = STRING : [256]",\
+"Writer queue size = INT : 33554432",\
+"Compression threads = INT : 0",\
+"Compression level = INT : 0",\
 "",\
 NULL}
 
@@ -180,6 +198,9 @@ typedef struct {
    double bytes_written_subrun; /* count bytes written out (compressed), reset in tr_start() and on subrun increment */
    double files_written;  /* incremented in log_close(), reset in log_callback(RPC_LOG_REWIND) */
    double disk_level;
+   double writer_queue_level; /* fill level of the writer thread queue, 0..1 */
+   double writer_queue_full;  /* how often log_write() had to wait for the writer thread */
+   double writer_wait_time;   /* total time in seconds log_write() waited for the writer thread */
 } CHN_STATISTICS;
 
 #define CHN_STATISTICS_STR(_name) const char *_name[] = {\
@@ -190,6 +211,9 @@ typedef struct {
 "Bytes written subrun = DOUBLE : 0",\
 "Files written = DOUBLE : 0",\
 "Disk level = DOUBLE : 0",\
+"Writer queue level = DOUBLE : 0",\
+"Writer queue full = DOUBLE : 0",\
+"Writer wait time = DOUBLE : 0",\
 "",\
 NULL}
 
@@ -225,6 +249,16 @@ typedef struct {
    int compression_module;   // COMPRESS_xxx
    int post_checksum_module; // CHECKSUM_xxx
    int output_module;        // OUTPUT_xxx
+   int writer_rbh;           // ring buffer to the writer thread, 0 if writing synchronously
+   int writer_max_event_size;
+   int writer_status;        // first error returned by the writer chain in the writer thread
+   int writer_stop;
+   int writer_active;
+   MUTEX_T *writer_mutex;    // protects the counters below, which the writer thread updates
+   double writer_events;     // events written since last log_update_writer_statistics()
+   double writer_bytes;      // uncompressed bytes written since last log_update_writer_statistics()
+   double writer_bytes_out;  // output bytes written since last log_update_writer_statistics()
+   double writer_last_out;   // fBytesOut of the writer chain when last counted
 } LOG_CHN;
 
 /*---- globals -----------------------------------------------------*/
@@ -244,6 +278,15 @@ BOOL start_requested = FALSE;
 DWORD auto_restart = 0;
 DWORD run_start_time, subrun_start_time;
 
+/* ODB values needed for every event, kept up to date by hot-links */
+DWORD run_duration = 0;
+DWORD subrun_duration = 0;
+BOOL next_subrun = FALSE;
+INT current_run_number = 0;
+
+/* number of events passed to log_write(), to compute ODB locks per event */
+double events_logged = 0;
+
 LOG_CHN log_chn[MAX_CHANNELS];
 
 struct hist_log_s {
@@ -281,6 +324,9 @@ void receive_event(HNDLE hBuf, HNDLE request_id, EVENT_HEADER * pheader, void *p
 INT log_write(LOG_CHN * log_chn, EVENT_HEADER * pheader);
 void log_system_history(HNDLE hDB, HNDLE hKey, void *info);
 int log_generate_file_name(LOG_CHN *log_chn);
+void log_drain_writer(LOG_CHN *log_chn);
+void log_update_writer_statistics(LOG_CHN *log_chn);
+void log_set_writer_bytes_out(LOG_CHN *log_chn, double bytes_out);
 
 /*== common code FAL/MLOGGER start =================================*/
 
@@ -502,6 +548,288 @@ private:
    int fFileno;
 };
 
+/*---- waiting for writer threads ----------------------------------*/
+
+/* Wait until *addr differs from val, at most millisec. Without futexes
+   ss_futex_wait() sleeps for the whole timeout, which would stall the
+   writer chain, so poll with short sleeps instead. */
+
+static void writer_wait(INT* addr, INT val, INT millisec)
+{
+#ifdef HAVE_SS_FUTEX
+   ss_futex_wait(addr, val, millisec);
+#else
+   if (SS_ATOMIC_LOAD(addr) == val)
+      ss_sleep(1);
+#endif
+}
+
+/*---- direct i/o file writer --------------------------------------*/
+
+/* Writes the file with O_DIRECT, bypassing the page cache, from two
+   large aligned buffers. While wr_write() fills one buffer, a helper
+   thread writes the other one to disk. The unaligned tail of the file
+   is written without O_DIRECT in wr_close(). */
+
+#ifndef O_DIRECT
+#define O_DIRECT 0
+#endif
+
+#define DIRECT_BUFFER_SIZE (16*1024*1024)
+#define DIRECT_ALIGNMENT   4096
+
+class WriterDirect : public WriterInterface
+{
+public:
+   WriterDirect(LOG_CHN* log_chn) // ctor
+   {
+      if (fTrace)
+         printf("WriterDirect: path [%s]\n", log_chn->path);
+      fFileno = -1;
+      fBuffer[0] = fBuffer[1] = NULL;
+      fFill = 0;
+      fFillSize = 0;
+      fPending = 0;
+      fPendingSize = 0;
+      fStop = 0;
+      fRunning = 0;
+      fStatus = SUCCESS;
+   }
+
+   ~WriterDirect() // dtor
+   {
+      if (fTrace)
+         printf("WriterDirect: destructor\n");
+      StopThread();
+      FreeBuffers();
+      if (fFileno >= 0)
+         close(fFileno);
+      fFileno = -1;
+   }
+
+   int wr_open(LOG_CHN* log_chn, int run_number)
+   {
+      fBytesIn = 0;
+      fBytesOut = 0;
+
+      if (fTrace)
+         printf("WriterDirect: open path [%s]\n", log_chn->path);
+
+      assert(fFileno < 0);
+
+      fFileno = open(log_chn->path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY | O_LARGEFILE | O_DIRECT, 0644);
+      if (fFileno < 0 && errno == EINVAL) {
+         /* file system does not support direct i/o */
+         cm_msg(MINFO, "WriterDirect::wr_open", "File system of \'%s\' does not support O_DIRECT, writing through the page cache", log_chn->path);
+         fFileno = open(log_chn->path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY | O_LARGEFILE, 0644);
+      }
+      if (fFileno < 0) {
+         cm_msg(MERROR, "WriterDirect::wr_open", "Cannot write to file \'%s\', open() errno %d (%s)", log_chn->path, errno, strerror(errno));
+         return SS_FILE_ERROR;
+      }
+
+      for (int i = 0; i < 2; i++) {
+         if (posix_memalign((void**)&fBuffer[i], DIRECT_ALIGNMENT, DIRECT_BUFFER_SIZE) != 0) {
+            fBuffer[i] = NULL;
+            cm_msg(MERROR, "WriterDirect::wr_open", "Cannot allocate two aligned buffers of %d bytes", DIRECT_BUFFER_SIZE);
+            FreeBuffers();
+            close(fFileno);
+            fFileno = -1;
+            return SS_NO_MEMORY;
+         }
+      }
+
+      fFill = 0;
+      fFillSize = 0;
+      fPending = 0;
+      fStop = 0;
+      fStatus = SUCCESS;
+
+      fRunning = 1;
+      if (ss_thread_create(WriteThread, this) == 0) {
+         fRunning = 0;
+         cm_msg(MERROR, "WriterDirect::wr_open", "Cannot create writer thread for file \'%s\'", log_chn->path);
+         FreeBuffers();
+         close(fFileno);
+         fFileno = -1;
+         return SS_NO_THREAD;
+      }
+
+      log_chn->handle = fFileno;
+
+      fFilename = log_chn->path;
+      return SUCCESS;
+   }
+
+   int wr_write(LOG_CHN* log_chn, const void* data, const int size)
+   {
+      const char* ptr = (const char*)data;
+      int remaining = size;
+
+      if (fTrace)
+         printf("WriterDirect: write path [%s], size %d\n", log_chn->path, size);
+
+      assert(fFileno >= 0);
+
+      while (remaining > 0) {
+         int n = DIRECT_BUFFER_SIZE - fFillSize;
+         if (n > remaining)
+            n = remaining;
+
+         memcpy(fBuffer[fFill] + fFillSize, ptr, n);
+         fFillSize += n;
+         ptr += n;
+         remaining -= n;
+
+         if (fFillSize == DIRECT_BUFFER_SIZE) {
+            /* hand the full buffer to the writer thread and continue with the other one */
+            int status = WaitIdle();
+            if (status != SUCCESS) {
+               cm_msg(MERROR, "WriterDirect::wr_write", "Cannot write to file \'%s\', errno: %d (%s)", log_chn->path, status, strerror(status));
+               return SS_FILE_ERROR;
+            }
+            fPendingSize = fFillSize;
+            SS_ATOMIC_STORE(&fPending, fFill + 1);
+            ss_futex_wake(&fPending);
+            fFill = 1 - fFill;
+            fFillSize = 0;
+         }
+      }
+
+      fBytesIn += size;
+      fBytesOut += size;
+
+      return SUCCESS;
+   }
+
+   int wr_close(LOG_CHN* log_chn, int run_number)
+   {
+      int status, err;
+
+      if (fTrace)
+         printf("WriterDirect: close path [%s]\n", log_chn->path);
+
+      assert(fFileno >= 0);
+
+      log_chn->handle = 0;
+
+      status = WaitIdle();
+      StopThread();
+
+      if (status == SUCCESS && fFillSize > 0) {
+         /* O_DIRECT needs aligned sizes, write the tail through the page cache */
+         int aligned = fFillSize & ~(DIRECT_ALIGNMENT - 1);
+         status = WriteBuffer(fBuffer[fFill], aligned);
+         if (status == SUCCESS && fFillSize > aligned) {
+            int flags = fcntl(fFileno, F_GETFL);
+            if (flags < 0 || fcntl(fFileno, F_SETFL, flags & ~O_DIRECT) < 0) {
+               status = errno;
+               cm_msg(MERROR, "WriterDirect::wr_close", "Cannot clear O_DIRECT on file \'%s\' to write the last %d bytes, fcntl() errno %d (%s)", log_chn->path, fFillSize - aligned, errno, strerror(errno));
+            } else
+               status = WriteBuffer(fBuffer[fFill] + aligned, fFillSize - aligned);
+         }
+         fFillSize = 0;
+      }
+
+      FreeBuffers();
+
+      if (status != SUCCESS)
+         cm_msg(MERROR, "WriterDirect::wr_close", "Cannot write to file \'%s\', errno: %d (%s)", log_chn->path, status, strerror(status));
+
+      err = close(fFileno);
+      fFileno = -1;
+
+      if (err != 0) {
+         cm_msg(MERROR, "WriterDirect::wr_close", "Cannot write to file \'%s\', close() errno %d (%s)", log_chn->path, errno, strerror(errno));
+         return SS_FILE_ERROR;
+      }
+
+      return status == SUCCESS ? SUCCESS : SS_FILE_ERROR;
+   }
+
+   std::string wr_get_chain()
+   {
+      return ">" + fFilename + " (O_DIRECT)";
+   }
+
+private:
+   /* write all of buf, returns SUCCESS or errno */
+   int WriteBuffer(const char* buf, int size)
+   {
+      while (size > 0) {
+         int wr = write(fFileno, buf, size);
+         if (wr < 0 && errno == EINTR)
+            continue;
+         if (wr <= 0)
+            return wr < 0 ? errno : ENOSPC;
+         buf += wr;
+         size -= wr;
+      }
+      return SUCCESS;
+   }
+
+   /* wait until the writer thread has written the pending buffer, returns SUCCESS or errno */
+   int WaitIdle()
+   {
+      INT pending;
+      while ((pending = SS_ATOMIC_LOAD(&fPending)) != 0)
+         writer_wait(&fPending, pending, 100);
+      return SS_ATOMIC_LOAD(&fStatus);
+   }
+
+   static INT WriteThread(void* param)
+   {
+      WriterDirect* wr = (WriterDirect*)param;
+
+      while (1) {
+         INT pending = SS_ATOMIC_LOAD(&wr->fPending);
+
+         if (pending == 0) {
+            if (SS_ATOMIC_LOAD(&wr->fStop))
+               break;
+            writer_wait(&wr->fPending, 0, 100);
+            continue;
+         }
+
+         int status = wr->WriteBuffer(wr->fBuffer[pending - 1], wr->fPendingSize);
+         if (status != SUCCESS)
+            SS_ATOMIC_STORE(&wr->fStatus, status);
+
+         SS_ATOMIC_STORE(&wr->fPending, 0);
+         ss_futex_wake(&wr->fPending);
+      }
+
+      SS_ATOMIC_STORE(&wr->fRunning, 0);
+
+      return 0;
+   }
+
+   void StopThread()
+   {
+      SS_ATOMIC_STORE(&fStop, 1);
+      ss_futex_wake(&fPending);
+      while (SS_ATOMIC_LOAD(&fRunning))
+         ss_sleep(1);
+   }
+
+   void FreeBuffers()
+   {
+      FREE(fBuffer[0]);
+      FREE(fBuffer[1]);
+   }
+
+   std::string fFilename;
+   int   fFileno;
+   char* fBuffer[2];
+   int   fFill;        // buffer filled by wr_write()
+   int   fFillSize;
+   INT   fPending;     // buffer being written by the writer thread plus one, 0 if idle
+   int   fPendingSize;
+   INT   fStop;
+   INT   fRunning;
+   INT   fStatus;      // errno of the first failed write in the writer thread
+};
+
 /*---- gzip writer -------------------------------------------------*/
 
 #ifdef HAVE_ZLIB
@@ -1385,12 +1713,593 @@ public:
          return SS_FILE_ERROR;
       }
 
-      status = fWr->wr_write(log_chn, fBuffer, headerSize);
+      status = fWr->wr_write(log_chn, fBuffer, headerSize);
+
+      fBytesIn += 0;
+      fBytesOut = fWr->fBytesOut;
+
+      if (status != SUCCESS) {
+         return SS_FILE_ERROR;
+      }
+
+      log_chn->handle = 9999;
+
+      return SUCCESS;
+   }
+
+   int wr_write(LOG_CHN* log_chn, const void* data, const int size)
+   {
+      const char* ptr = (const char*)data;
+      int remaining = size;
+
+      if (fTrace)
+         printf("WriterLZ4: write path [%s], size %d\n", log_chn->path, size);
+
+      while (remaining > 0) {
+         int wsize = remaining;
+
+         if (wsize > fBlockSize)
+            wsize = fBlockSize;
+
+         size_t outSize = LZ4F_compressUpdate(fContext, fBuffer, fBufferSize, ptr, wsize, NULL);
+
+         if (LZ4F_isError(outSize)) {
+            int errorCode = outSize;
+            cm_msg(MERROR, "WriterLZ4::wr_write", "LZ4F_compressUpdate() with %d bytes, block size %d, buffer size %d, write size %d, remaining %d bytes, error %d (%s)", wsize, fBlockSize, fBufferSize, size, remaining, (int)errorCode, LZ4F_getErrorName(errorCode));
+            return SS_FILE_ERROR;
+         }
+
+         if (outSize > 0) {
+            int status = fWr->wr_write(log_chn, fBuffer, outSize);
+ 
+            fBytesIn += wsize;
+            fBytesOut = fWr->fBytesOut;
+            
+            if (status != SUCCESS) {
+               return SS_FILE_ERROR;
+            }
+         }
+
+         ptr += wsize;
+         remaining -= wsize;
+      }
+
+      return SUCCESS;
+   }
+
+   int wr_close(LOG_CHN* log_chn, int run_number)
+   {
+      int xstatus = SUCCESS;
+      LZ4F_errorCode_t errorCode;
+
+      if (fTrace)
+         printf("WriterLZ4: close path [%s]\n", log_chn->path);
+
+      log_chn->handle = 0;
+
+      /* write End of Stream mark */
+      size_t headerSize = LZ4F_compressEnd(fContext, fBuffer, fBufferSize, NULL);
+
+      if (LZ4F_isError(headerSize)) {
+         errorCode = headerSize;
+         cm_msg(MERROR, "WriterLZ4::wr_close", "LZ4F_compressEnd() error %d (%s)", (int)errorCode, LZ4F_getErrorName(errorCode));
+         return SS_FILE_ERROR;
+      }
+
+      int status = fWr->wr_write(log_chn, fBuffer, headerSize);
+
+      fBytesIn += 0;
+      fBytesOut = fWr->fBytesOut;
+
+      if (status != SUCCESS) {
+         if (xstatus == SUCCESS)
+            xstatus = status;
+      }
+
+      /* close downstream writer */
+
+      status = fWr->wr_close(log_chn, run_number);
+
+      if (status != SUCCESS) {
+         if (xstatus == SUCCESS)
+            xstatus = status;
+      }
+
+      /* free resources */
+
+      free(fBuffer);
+      fBuffer = NULL;
+      fBufferSize = 0;
+
+      errorCode = LZ4F_freeCompressionContext(fContext);
+      if (LZ4F_isError(errorCode)) {
+         cm_msg(MERROR, "WriterLZ4::wr_close", "LZ4F_freeCompressionContext() error %d (%s)", (int)errorCode, LZ4F_getErrorName(errorCode));
+         if (xstatus == SUCCESS)
+            xstatus = SS_FILE_ERROR;
+      }
+
+      return xstatus;
+   }
+
+   std::string wr_get_file_ext() {
+      return ".lz4" + fWr->wr_get_file_ext();
+   }
+
+   std::string wr_get_chain() {
+      return "lz4 | " + fWr->wr_get_chain();
+   }
+
+private:
+   WriterInterface *fWr;
+   LZ4F_compressionContext_t fContext;
+   LZ4F_preferences_t fPrefs;
+   char* fBuffer;
+   int   fBufferSize;
+   int   fBlockSize;
+};
+
+/*---- parallel block compression writer ---------------------------*/
+
+/* The data stream is cut into blocks which are compressed independently
+   by a pool of threads. Each block becomes a complete LZ4 frame or gzip
+   member, so the files can be read by the standard "lz4 -d" and "gunzip"
+   tools. Compressed blocks are passed downstream in their original order
+   by the thread calling wr_write() and wr_close(). */
+
+#define PAR_LZ4  1
+#define PAR_GZIP 2
+
+#define PAR_MAX_THREADS 64
+#define PAR_BLOCK_SIZE  (1024*1024)
+
+#define PAR_BLOCK_EMPTY 0 /* being filled by wr_write() */
+#define PAR_BLOCK_FULL  1 /* waiting for or being compressed by a thread */
+#define PAR_BLOCK_DONE  2 /* compressed, waiting to be written downstream */
+#define PAR_BLOCK_ERROR 3 /* compression failed */
+
+typedef struct {
+   char* in;
+   int   in_size;
+   char* out;
+   int   out_size;
+   INT   state;
+} PAR_BLOCK;
+
+/* number of compression threads, the default 0 means one per CPU */
+static int get_num_threads(int num_threads)
+{
+#ifdef OS_UNIX
+   if (num_threads <= 0)
+      num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+   if (num_threads <= 0)
+      num_threads = 1;
+   if (num_threads > PAR_MAX_THREADS)
+      num_threads = PAR_MAX_THREADS;
+   return num_threads;
+}
+
+class WriterParallel : public WriterInterface
+{
+public:
+   WriterParallel(LOG_CHN* log_chn, int type, int num_threads, WriterInterface* wr) // ctor
+   {
+      if (fTrace)
+         printf("WriterParallel: path [%s], type %d, threads %d\n", log_chn->path, type, num_threads);
+
+      assert(wr != NULL);
+
+      fWr = wr;
+      fType = type;
+
+      fNumThreads = get_num_threads(num_threads);
+
+      /* two blocks per thread keep all threads busy while blocks are written out */
+      fNumBlocks = 2 * fNumThreads;
+      fBlocks = NULL;
+      fBlockSize = PAR_BLOCK_SIZE;
+
+      MEMZERO(fPrefs);
+      fPrefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+      fPrefs.frameInfo.blockSizeID = LZ4F_max1MB;
+
+      if (fType == PAR_LZ4)
+         fOutSize = LZ4F_compressFrameBound(fBlockSize, &fPrefs);
+#ifdef HAVE_ZLIB
+      else
+         fOutSize = compressBound(fBlockSize) + 32; // plus gzip header and trailer
+#endif
+
+      fFillSeq = 0;
+      fWriteSeq = 0;
+      fQueued = 0;
+      fNextCompress = 0;
+      fStop = 0;
+      fRunning = 0;
+   }
+
+   ~WriterParallel() // dtor
+   {
+      if (fTrace)
+         printf("WriterParallel: destructor\n");
+
+      StopThreads();
+      FreeBlocks();
+      DELETE(fWr);
+   }
+
+   int wr_open(LOG_CHN* log_chn, int run_number)
+   {
+      int i, status;
+
+      if (fTrace)
+         printf("WriterParallel: open path [%s]\n", log_chn->path);
+
+      fBytesIn = 0;
+      fBytesOut = 0;
+
+      status = fWr->wr_open(log_chn, run_number);
+      if (status != SUCCESS)
+         return status;
+
+      fBlocks = (PAR_BLOCK*)calloc(fNumBlocks, sizeof(PAR_BLOCK));
+      if (fBlocks == NULL) {
+         cm_msg(MERROR, "WriterParallel::wr_open", "Cannot malloc() %d compression blocks", fNumBlocks);
+         return SS_NO_MEMORY;
+      }
+
+      for (i = 0; i < fNumBlocks; i++) {
+         fBlocks[i].in = (char*)malloc(fBlockSize);
+         fBlocks[i].out = (char*)malloc(fOutSize);
+         if (fBlocks[i].in == NULL || fBlocks[i].out == NULL) {
+            cm_msg(MERROR, "WriterParallel::wr_open", "Cannot malloc() %d compression blocks of %d bytes, errno %d (%s)", fNumBlocks, fBlockSize + fOutSize, errno, strerror(errno));
+            FreeBlocks();
+            return SS_NO_MEMORY;
+         }
+      }
+
+      fFillSeq = 0;
+      fWriteSeq = 0;
+      fQueued = 0;
+      fNextCompress = 0;
+      fStop = 0;
+
+      for (i = 0; i < fNumThreads; i++) {
+         SS_ATOMIC_ADD(&fRunning, 1);
+         if (ss_thread_create(CompressThread, this) == 0) {
+            SS_ATOMIC_ADD(&fRunning, -1);
+            cm_msg(MERROR, "WriterParallel::wr_open", "Cannot create compression thread %d of %d", i + 1, fNumThreads);
+            break;
+         }
+      }
+
+      if (SS_ATOMIC_LOAD(&fRunning) == 0) {
+         FreeBlocks();
+         return SS_NO_THREAD;
+      }
+
+      log_chn->handle = 9999;
+
+      return SUCCESS;
+   }
+
+   int wr_write(LOG_CHN* log_chn, const void* data, const int size)
+   {
+      const char* ptr = (const char*)data;
+      int remaining = size;
+
+      if (fTrace)
+         printf("WriterParallel: write path [%s], size %d\n", log_chn->path, size);
+
+      fBytesIn += size;
+
+      while (remaining > 0) {
+         PAR_BLOCK* b = &fBlocks[fFillSeq % fNumBlocks];
+         int n = fBlockSize - b->in_size;
+
+         if (n > remaining)
+            n = remaining;
+
+         memcpy(b->in + b->in_size, ptr, n);
+         b->in_size += n;
+         ptr += n;
+         remaining -= n;
+
+         if (b->in_size == fBlockSize) {
+            int status = QueueBlock(log_chn);
+            if (status != SUCCESS)
+               return status;
+         }
+      }
+
+      return SUCCESS;
+   }
+
+   int wr_close(LOG_CHN* log_chn, int run_number)
+   {
+      int status, xstatus = SUCCESS;
+
+      if (fTrace)
+         printf("WriterParallel: close path [%s]\n", log_chn->path);
+
+      log_chn->handle = 0;
+
+      if (fBlocks) {
+         /* compress the last partial block, an empty file still gets one (empty) frame */
+         if (fBlocks[fFillSeq % fNumBlocks].in_size > 0 || fFillSeq == 0)
+            xstatus = QueueBlock(log_chn);
+
+         if (xstatus == SUCCESS)
+            xstatus = WriteBlocks(log_chn, 0);
+      }
+
+      StopThreads();
+      FreeBlocks();
+
+      /* close downstream writer */
+
+      status = fWr->wr_close(log_chn, run_number);
+
+      fBytesOut = fWr->fBytesOut;
+
+      if (status != SUCCESS && xstatus == SUCCESS)
+         xstatus = status;
+
+      return xstatus;
+   }
+
+   std::string wr_get_file_ext()
+   {
+      if (fType == PAR_LZ4)
+         return ".lz4" + fWr->wr_get_file_ext();
+      return ".gz" + fWr->wr_get_file_ext();
+   }
+
+   std::string wr_get_chain()
+   {
+      char str[256];
+      sprintf(str, "%s(%d threads) | ", fType == PAR_LZ4 ? "plz4" : "pgzip", fNumThreads);
+      return str + fWr->wr_get_chain();
+   }
+
+private:
+   /* hand the block being filled to the compression threads */
+   int QueueBlock(LOG_CHN* log_chn)
+   {
+      SS_ATOMIC_STORE(&fBlocks[fFillSeq % fNumBlocks].state, PAR_BLOCK_FULL);
+      fFillSeq++;
+      SS_ATOMIC_STORE(&fQueued, fFillSeq);
+      ss_futex_wake(&fQueued);
+
+      /* make sure the next block is free for wr_write() */
+      return WriteBlocks(log_chn, fNumBlocks - 1);
+   }
+
+   /* write compressed blocks downstream in order, wait until at most max_queued blocks are left */
+   int WriteBlocks(LOG_CHN* log_chn, int max_queued)
+   {
+      while (fWriteSeq < fFillSeq) {
+         PAR_BLOCK* b = &fBlocks[fWriteSeq % fNumBlocks];
+         INT state = SS_ATOMIC_LOAD(&b->state);
+
+         if (state == PAR_BLOCK_FULL) {
+            if (fFillSeq - fWriteSeq <= max_queued)
+               break;
+            writer_wait(&b->state, PAR_BLOCK_FULL, 100);
+            continue;
+         }
+
+         if (state == PAR_BLOCK_ERROR)
+            return SS_FILE_ERROR;
+
+         int status = fWr->wr_write(log_chn, b->out, b->out_size);
+
+         fBytesOut = fWr->fBytesOut;
+
+         if (status != SUCCESS)
+            return status;
+
+         b->in_size = 0;
+         SS_ATOMIC_STORE(&b->state, PAR_BLOCK_EMPTY);
+         fWriteSeq++;
+      }
+
+      return SUCCESS;
+   }
+
+   int Compress(PAR_BLOCK* b)
+   {
+      if (fType == PAR_LZ4) {
+         size_t outSize = LZ4F_compressFrame(b->out, fOutSize, b->in, b->in_size, &fPrefs);
+         if (LZ4F_isError(outSize)) {
+            cm_msg(MERROR, "WriterParallel::Compress", "LZ4F_compressFrame() with %d bytes, error %d (%s)", b->in_size, (int)outSize, LZ4F_getErrorName(outSize));
+            return SS_FILE_ERROR;
+         }
+         b->out_size = outSize;
+         return SUCCESS;
+      }
+
+#ifdef HAVE_ZLIB
+      z_stream zs;
+      int zerror;
+
+      memset(&zs, 0, sizeof(zs));
+
+      /* windowBits 15+16 writes a gzip header and trailer */
+      zerror = deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+      if (zerror != Z_OK) {
+         cm_msg(MERROR, "WriterParallel::Compress", "deflateInit2() zerror %d", zerror);
+         return SS_FILE_ERROR;
+      }
+
+      zs.next_in = (Bytef*)b->in;
+      zs.avail_in = b->in_size;
+      zs.next_out = (Bytef*)b->out;
+      zs.avail_out = fOutSize;
+
+      zerror = deflate(&zs, Z_FINISH);
+      b->out_size = zs.total_out;
+      deflateEnd(&zs);
+
+      if (zerror != Z_STREAM_END) {
+         cm_msg(MERROR, "WriterParallel::Compress", "deflate() with %d bytes, zerror %d", b->in_size, zerror);
+         return SS_FILE_ERROR;
+      }
+
+      return SUCCESS;
+#else
+      return SS_FILE_ERROR;
+#endif
+   }
+
+   static INT CompressThread(void* param)
+   {
+      WriterParallel* wr = (WriterParallel*)param;
+
+      while (1) {
+         INT queued = SS_ATOMIC_LOAD(&wr->fQueued);
+         INT next = SS_ATOMIC_LOAD(&wr->fNextCompress);
+
+         if (next == queued) {
+            if (SS_ATOMIC_LOAD(&wr->fStop))
+               break;
+            writer_wait(&wr->fQueued, queued, 100);
+            continue;
+         }
+
+         /* claim the next block */
+         if (!SS_ATOMIC_CAS(&wr->fNextCompress, next, next + 1))
+            continue;
+
+         PAR_BLOCK* b = &wr->fBlocks[next % wr->fNumBlocks];
+         int status = wr->Compress(b);
+
+         SS_ATOMIC_STORE(&b->state, status == SUCCESS ? PAR_BLOCK_DONE : PAR_BLOCK_ERROR);
+         ss_futex_wake(&b->state);
+      }
+
+      SS_ATOMIC_ADD(&wr->fRunning, -1);
+
+      return 0;
+   }
+
+   void StopThreads()
+   {
+      SS_ATOMIC_STORE(&fStop, 1);
+      ss_futex_wake(&fQueued);
+
+      /* threads finish the blocks already queued before they exit */
+      while (SS_ATOMIC_LOAD(&fRunning) > 0)
+         ss_sleep(1);
+   }
+
+   void FreeBlocks()
+   {
+      if (fBlocks == NULL)
+         return;
+
+      for (int i = 0; i < fNumBlocks; i++) {
+         FREE(fBlocks[i].in);
+         FREE(fBlocks[i].out);
+      }
+      FREE(fBlocks);
+   }
+
+   WriterInterface *fWr;
+   int   fType;
+   int   fNumThreads;
+   int   fNumBlocks;
+   int   fBlockSize;
+   int   fOutSize;
+   LZ4F_preferences_t fPrefs;
+   PAR_BLOCK* fBlocks;
+   INT   fFillSeq;      // block being filled by wr_write()
+   INT   fWriteSeq;     // next block to be written downstream
+   INT   fQueued;       // number of blocks handed to the threads
+   INT   fNextCompress; // next block to be picked up by a thread
+   INT   fStop;
+   INT   fRunning;      // number of running threads
+};
+
+/*---- Zstandard compressed writer  --------------------------------*/
+
+#ifdef HAVE_ZSTD
+
+#include <zstd.h>
+
+class WriterZstd : public WriterInterface
+{
+public:
+   WriterZstd(LOG_CHN* log_chn, int level, int num_threads, WriterInterface* wr) // ctor
+   {
+      if (fTrace)
+         printf("WriterZstd: path [%s], level %d, threads %d\n", log_chn->path, level, num_threads);
+
+      assert(wr != NULL);
+
+      fWr = wr;
+      fLevel = level;
+      fNumThreads = get_num_threads(num_threads);
+      fCctx = NULL;
+      fBuffer = NULL;
+      fBufferSize = 0;
+   }
+
+   ~WriterZstd() // dtor
+   {
+      if (fTrace)
+         printf("WriterZstd: destructor\n");
+
+      if (fCctx)
+         ZSTD_freeCCtx(fCctx);
+      fCctx = NULL;
+      FREE(fBuffer);
+      DELETE(fWr);
+   }
+
+   int wr_open(LOG_CHN* log_chn, int run_number)
+   {
+      int status;
+      size_t err;
+
+      if (fTrace)
+         printf("WriterZstd: open path [%s]\n", log_chn->path);
+
+      fBytesIn = 0;
+      fBytesOut = 0;
+
+      status = fWr->wr_open(log_chn, run_number);
+      if (status != SUCCESS)
+         return status;
+
+      fCctx = ZSTD_createCCtx();
+      if (fCctx == NULL) {
+         cm_msg(MERROR, "WriterZstd::wr_open", "ZSTD_createCCtx() failed");
+         return SS_FILE_ERROR;
+      }
+
+      /* level 0 selects the zstd default level */
+      err = ZSTD_CCtx_setParameter(fCctx, ZSTD_c_compressionLevel, fLevel);
+      if (ZSTD_isError(err)) {
+         cm_msg(MERROR, "WriterZstd::wr_open", "Cannot set compression level %d, error: %s", fLevel, ZSTD_getErrorName(err));
+         return SS_FILE_ERROR;
+      }
+
+      ZSTD_CCtx_setParameter(fCctx, ZSTD_c_checksumFlag, 1);
 
-      fBytesIn += 0;
-      fBytesOut = fWr->fBytesOut;
+      /* with workers, zstd compresses the frame in parallel jobs */
+      if (fNumThreads > 1) {
+         err = ZSTD_CCtx_setParameter(fCctx, ZSTD_c_nbWorkers, fNumThreads);
+         if (ZSTD_isError(err)) {
+            cm_msg(MINFO, "WriterZstd::wr_open", "zstd library without multithreading support, compressing with one thread");
+            fNumThreads = 1;
+         }
+      }
 
-      if (status != SUCCESS) {
+      fBufferSize = ZSTD_CStreamOutSize();
+      fBuffer = (char*)malloc(fBufferSize);
+      if (fBuffer == NULL) {
+         cm_msg(MERROR, "WriterZstd::wr_open", "Cannot malloc() %d bytes for a zstd compression buffer, errno %d (%s)", fBufferSize, errno, strerror(errno));
          return SS_FILE_ERROR;
       }
 
@@ -1401,39 +2310,17 @@ public:
 
    int wr_write(LOG_CHN* log_chn, const void* data, const int size)
    {
-      const char* ptr = (const char*)data;
-      int remaining = size;
-
       if (fTrace)
-         printf("WriterLZ4: write path [%s], size %d\n", log_chn->path, size);
-
-      while (remaining > 0) {
-         int wsize = remaining;
-
-         if (wsize > fBlockSize)
-            wsize = fBlockSize;
+         printf("WriterZstd: write path [%s], size %d\n", log_chn->path, size);
 
-         size_t outSize = LZ4F_compressUpdate(fContext, fBuffer, fBufferSize, ptr, wsize, NULL);
-
-         if (LZ4F_isError(outSize)) {
-            int errorCode = outSize;
-            cm_msg(MERROR, "WriterLZ4::wr_write", "LZ4F_compressUpdate() with %d bytes, block size %d, buffer size %d, write size %d, remaining %d bytes, error %d (%s)", wsize, fBlockSize, fBufferSize, size, remaining, (int)errorCode, LZ4F_getErrorName(errorCode));
-            return SS_FILE_ERROR;
-         }
+      fBytesIn += size;
 
-         if (outSize > 0) {
-            int status = fWr->wr_write(log_chn, fBuffer, outSize);
- 
-            fBytesIn += wsize;
-            fBytesOut = fWr->fBytesOut;
-            
-            if (status != SUCCESS) {
-               return SS_FILE_ERROR;
-            }
-         }
+      ZSTD_inBuffer in = { data, (size_t)size, 0 };
 
-         ptr += wsize;
-         remaining -= wsize;
+      while (in.pos < in.size) {
+         int status = Compress(log_chn, &in, ZSTD_e_continue, NULL);
+         if (status != SUCCESS)
+            return status;
       }
 
       return SUCCESS;
@@ -1441,77 +2328,103 @@ public:
 
    int wr_close(LOG_CHN* log_chn, int run_number)
    {
-      int xstatus = SUCCESS;
-      LZ4F_errorCode_t errorCode;
+      int status, xstatus = SUCCESS;
 
       if (fTrace)
-         printf("WriterLZ4: close path [%s]\n", log_chn->path);
+         printf("WriterZstd: close path [%s]\n", log_chn->path);
 
       log_chn->handle = 0;
 
-      /* write End of Stream mark */
-      size_t headerSize = LZ4F_compressEnd(fContext, fBuffer, fBufferSize, NULL);
-
-      if (LZ4F_isError(headerSize)) {
-         errorCode = headerSize;
-         cm_msg(MERROR, "WriterLZ4::wr_close", "LZ4F_compressEnd() error %d (%s)", (int)errorCode, LZ4F_getErrorName(errorCode));
-         return SS_FILE_ERROR;
-      }
-
-      int status = fWr->wr_write(log_chn, fBuffer, headerSize);
-
-      fBytesIn += 0;
-      fBytesOut = fWr->fBytesOut;
-
-      if (status != SUCCESS) {
-         if (xstatus == SUCCESS)
-            xstatus = status;
+      /* finish the frame */
+      if (fCctx && fBuffer) {
+         ZSTD_inBuffer in = { NULL, 0, 0 };
+         size_t remaining;
+         do {
+            xstatus = Compress(log_chn, &in, ZSTD_e_end, &remaining);
+         } while (xstatus == SUCCESS && remaining > 0);
       }
 
       /* close downstream writer */
 
       status = fWr->wr_close(log_chn, run_number);
 
-      if (status != SUCCESS) {
-         if (xstatus == SUCCESS)
-            xstatus = status;
-      }
+      fBytesOut = fWr->fBytesOut;
+
+      if (status != SUCCESS && xstatus == SUCCESS)
+         xstatus = status;
 
       /* free resources */
 
-      free(fBuffer);
-      fBuffer = NULL;
+      if (fCctx)
+         ZSTD_freeCCtx(fCctx);
+      fCctx = NULL;
+      FREE(fBuffer);
       fBufferSize = 0;
 
-      errorCode = LZ4F_freeCompressionContext(fContext);
-      if (LZ4F_isError(errorCode)) {
-         cm_msg(MERROR, "WriterLZ4::wr_close", "LZ4F_freeCompressionContext() error %d (%s)", (int)errorCode, LZ4F_getErrorName(errorCode));
-         if (xstatus == SUCCESS)
-            xstatus = SS_FILE_ERROR;
-      }
-
       return xstatus;
    }
 
    std::string wr_get_file_ext() {
-      return ".lz4" + fWr->wr_get_file_ext();
+      return ".zst" + fWr->wr_get_file_ext();
    }
 
    std::string wr_get_chain() {
-      return "lz4 | " + fWr->wr_get_chain();
+      char str[256];
+      sprintf(str, "zstd(level %d, %d threads) | ", fLevel, fNumThreads);
+      return str + fWr->wr_get_chain();
    }
 
 private:
+   /* run the compressor once and pass its output downstream */
+   int Compress(LOG_CHN* log_chn, ZSTD_inBuffer* in, ZSTD_EndDirective mode, size_t* remaining)
+   {
+      ZSTD_outBuffer out = { fBuffer, (size_t)fBufferSize, 0 };
+
+      size_t r = ZSTD_compressStream2(fCctx, &out, in, mode);
+      if (ZSTD_isError(r)) {
+         cm_msg(MERROR, "WriterZstd::wr_write", "ZSTD_compressStream2() error: %s", ZSTD_getErrorName(r));
+         return SS_FILE_ERROR;
+      }
+
+      if (remaining)
+         *remaining = r;
+
+      if (out.pos > 0) {
+         int status = fWr->wr_write(log_chn, fBuffer, out.pos);
+         fBytesOut = fWr->fBytesOut;
+         if (status != SUCCESS)
+            return SS_FILE_ERROR;
+      }
+
+      return SUCCESS;
+   }
+
    WriterInterface *fWr;
-   LZ4F_compressionContext_t fContext;
-   LZ4F_preferences_t fPrefs;
+   int   fLevel;
+   int   fNumThreads;
+   ZSTD_CCtx* fCctx;
    char* fBuffer;
    int   fBufferSize;
-   int   fBlockSize;
 };
 
+#endif
+
 /*---- Logging initialization --------------------------------------*/
 
+static void hotlink_value(const char *name, void *data, INT size, DWORD type)
+{
+   INT status;
+   HNDLE hKey;
+
+   status = db_get_value(hDB, 0, name, data, &size, type, TRUE);
+   if (status == DB_SUCCESS)
+      status = db_find_key(hDB, 0, name, &hKey);
+   if (status == DB_SUCCESS)
+      status = db_open_record(hDB, hKey, data, size, MODE_READ, NULL, NULL);
+   if (status != DB_SUCCESS)
+      cm_msg(MERROR, "logger_init", "Cannot hot-link \"%s\", db_open_record() status %d", name, status);
+}
+
 void logger_init()
 {
    INT size, status, delay, index;
@@ -1537,6 +2450,9 @@ void logger_init()
    flag = FALSE;
    db_get_value(hDB, 0, "/Logger/ODB Dump", &flag, &size, TID_BOOL, TRUE);
 
+   flag = FALSE;
+   db_get_value(hDB, 0, "/Logger/ODB Dump Binary", &flag, &size, TID_BOOL, TRUE);
+
    strcpy(str, "run%05d.odb");
    size = sizeof(str);
    db_get_value(hDB, 0, "/Logger/ODB Dump File", str, &size, TID_STRING, TRUE);
@@ -1552,6 +2468,12 @@ void logger_init()
    flag = TRUE;
    db_get_value(hDB, 0, "/Logger/Tape message", &flag, &size, TID_BOOL, TRUE);
 
+   /* log_write() reads these for every event from local copies */
+   hotlink_value("/Logger/Run duration", &run_duration, sizeof(run_duration), TID_DWORD);
+   hotlink_value("/Logger/Subrun duration", &subrun_duration, sizeof(subrun_duration), TID_DWORD);
+   hotlink_value("/Logger/Next subrun", &next_subrun, sizeof(next_subrun), TID_BOOL);
+   hotlink_value("/Runinfo/Run number", &current_run_number, sizeof(current_run_number), TID_INT);
+
    /* create at least one logging channel */
    status = db_find_key(hDB, 0, "/Logger/Channels/0", &hKey);
    if (status != DB_SUCCESS) {
@@ -1589,6 +2511,12 @@ void log_odb_dump(LOG_CHN * log_chn, short int event_id, INT run_number)
 {
    INT status, buffer_size, size;
    EVENT_HEADER *pevent;
+   BOOL binary;
+
+   /* binary snapshots are much faster, but not understood by older analyzers */
+   binary = FALSE;
+   size = sizeof(binary);
+   db_get_value(hDB, 0, "/Logger/ODB Dump Binary", &binary, &size, TID_BOOL, TRUE);
 
    /* write ODB dump */
    buffer_size = 100000;
@@ -1600,7 +2528,12 @@ void log_odb_dump(LOG_CHN * log_chn, short int event_id, INT run_number)
       }
 
       size = buffer_size - sizeof(EVENT_HEADER);
-      status = db_copy_xml(hDB, 0, (char *) (pevent + 1), &size);
+      if (binary) {
+         status = db_copy_binary(hDB, 0, (char *) (pevent + 1), &size);
+         /* make size the remaining space like db_copy_xml() */
+         size = buffer_size - sizeof(EVENT_HEADER) - size + 1;
+      } else
+         status = db_copy_xml(hDB, 0, (char *) (pevent + 1), &size);
 
       /* following line would dump ODB in old ASCII format instead of XML */
       //status = db_copy(hDB, 0, (char *) (pevent + 1), &size, "");
@@ -3586,6 +4519,9 @@ WriterInterface* NewChecksum(LOG_CHN* log_chn, int code, int level, WriterInterf
 #define COMPRESS_LZ4    2
 #define COMPRESS_BZIP2  3
 #define COMPRESS_PBZIP2 4
+#define COMPRESS_PLZ4   5
+#define COMPRESS_PGZIP  6
+#define COMPRESS_ZSTD   7
 
 WriterInterface* NewCompression(LOG_CHN* log_chn, int code, WriterInterface* chained)
 {
@@ -3593,6 +4529,22 @@ WriterInterface* NewCompression(LOG_CHN* log_chn, int code, WriterInterface* cha
       return chained;
    } else if (code == COMPRESS_LZ4) {
       return new WriterLZ4(log_chn, chained);
+   } else if (code == COMPRESS_PLZ4) {
+      return new WriterParallel(log_chn, PAR_LZ4, log_chn->settings.compression_threads, chained);
+   } else if (code == COMPRESS_PGZIP) {
+#ifdef HAVE_ZLIB
+      return new WriterParallel(log_chn, PAR_GZIP, log_chn->settings.compression_threads, chained);
+#else
+      cm_msg(MERROR, "log_create_writer", "channel %s requested parallel GZIP compression, but ZLIB is not available", log_chn->path);
+      return chained;
+#endif
+   } else if (code == COMPRESS_ZSTD) {
+#ifdef HAVE_ZSTD
+      return new WriterZstd(log_chn, log_chn->settings.compression_level, log_chn->settings.compression_threads, chained);
+#else
+      cm_msg(MERROR, "log_create_writer", "channel %s requested ZSTD compression, but ZSTD is not available", log_chn->path);
+      return chained;
+#endif
    } else {
       cm_msg(MERROR, "log_create_writer", "channel %s unknown compression code %d", log_chn->path, code);
       return chained;
@@ -3605,6 +4557,7 @@ WriterInterface* NewCompression(LOG_CHN* log_chn, int code, WriterInterface* cha
 #define OUTPUT_FTP    3
 #define OUTPUT_ROOT   4
 #define OUTPUT_PIPE   5
+#define OUTPUT_DIRECT 6
 
 std::string get_value(HNDLE hDB, HNDLE hDir, const char* name)
 {
@@ -3665,6 +4618,9 @@ int select_compression_module(HNDLE hDB, HNDLE hSet, const char* name)
    s = check_add(s, COMPRESS_LZ4,    val, "lz4",    false, &def, &sel);
    s = check_add(s, COMPRESS_BZIP2,  val, "bzip2",  false, &def, &sel);
    s = check_add(s, COMPRESS_PBZIP2, val, "pbzip2", false, &def, &sel);
+   s = check_add(s, COMPRESS_PLZ4,   val, "plz4",   false, &def, &sel);
+   s = check_add(s, COMPRESS_PGZIP,  val, "pgzip",  false, &def, &sel);
+   s = check_add(s, COMPRESS_ZSTD,   val, "zstd",   false, &def, &sel);
    if (sel == "")
       sel = "gzip";
    set_value(hDB, hSet, name, sel, def);
@@ -3682,6 +4638,7 @@ int select_output_module(HNDLE hDB, HNDLE hSet, const char* name)
    s = check_add(s, OUTPUT_FTP,  val, "FTP",  false, &def, &sel);
    s = check_add(s, OUTPUT_ROOT, val, "ROOT", false, &def, &sel);
    s = check_add(s, OUTPUT_PIPE, val, "PIPE", false, &def, &sel);
+   s = check_add(s, OUTPUT_DIRECT, val, "DIRECT", false, &def, &sel);
    if (sel == "")
       sel = "NULL";
    set_value(hDB, hSet, name, sel, def);
@@ -3741,6 +4698,11 @@ int log_create_writer(LOG_CHN *log_chn)
          log_chn->writer = NewCompression(log_chn, log_chn->compression_module, NewChecksum(log_chn, log_chn->post_checksum_module, 0, new WriterFile(log_chn)));
          log_chn->do_disk_level = TRUE;
       }
+      else if (log_chn->output_module == OUTPUT_DIRECT) {
+
+         log_chn->writer = NewCompression(log_chn, log_chn->compression_module, NewChecksum(log_chn, log_chn->post_checksum_module, 0, new WriterDirect(log_chn)));
+         log_chn->do_disk_level = TRUE;
+      }
       else if (log_chn->output_module == OUTPUT_FTP) {
 
          log_chn->writer = NewCompression(log_chn, log_chn->compression_module, NewChecksum(log_chn, log_chn->post_checksum_module, 0, new WriterFtp(log_chn)));
@@ -3855,10 +4817,6 @@ INT log_open(LOG_CHN * log_chn, INT run_number)
       WriterInterface* wr = log_chn->writer;
       int status = wr->wr_open(log_chn, run_number);
       if (status == SUCCESS) {
-         /* write ODB dump */
-         if (log_chn->settings.odb_dump)
-            log_odb_dump(log_chn, EVENTID_BOR, run_number);
-
          /* update statistics */
          double incr = wr->fBytesOut - log_chn->statistics.bytes_written_subrun;
          if (incr < 0)
@@ -3869,6 +4827,13 @@ INT log_open(LOG_CHN * log_chn, INT run_number)
          log_chn->statistics.bytes_written += incr;
          log_chn->statistics.bytes_written_subrun = wr->fBytesOut;
          log_chn->statistics.bytes_written_total += incr;
+
+         /* events from now on are counted by log_write_writer() */
+         log_set_writer_bytes_out(log_chn, wr->fBytesOut);
+
+         /* write ODB dump */
+         if (log_chn->settings.odb_dump)
+            log_odb_dump(log_chn, EVENTID_BOR, run_number);
       }
    } else if (equal_ustring(log_chn->settings.format, "ROOT")) {
 #ifdef HAVE_ROOT
@@ -3896,7 +4861,11 @@ INT log_close(LOG_CHN * log_chn, INT run_number)
       /* write ODB dump */
       if (log_chn->settings.odb_dump)
          log_odb_dump(log_chn, EVENTID_EOR, run_number);
-      
+
+      /* wait until the writer thread has written all events */
+      log_drain_writer(log_chn);
+      log_update_writer_statistics(log_chn);
+
       WriterInterface* wr = log_chn->writer;
 
       int status = wr->wr_close(log_chn, run_number);
@@ -3912,6 +4881,8 @@ INT log_close(LOG_CHN * log_chn, INT run_number)
          log_chn->statistics.bytes_written += incr;
          log_chn->statistics.bytes_written_subrun = wr->fBytesOut;
          log_chn->statistics.bytes_written_total += incr;
+
+         log_set_writer_bytes_out(log_chn, wr->fBytesOut);
       }
 #ifdef HAVE_ROOT
    } else if (log_chn->format == FORMAT_ROOT) {
@@ -4117,37 +5088,257 @@ int start_the_run()
    return status;
 }
 
+/*---- writer thread -----------------------------------------------*/
+
+/* Each channel with a writer chain gets a writer thread, fed through a
+   ring buffer by log_write(). The writer chain (compression, checksums,
+   file i/o) then runs in the writer thread, while open, close and all
+   ODB access stay in the main thread. The main thread only touches the
+   writer chain after log_drain_writer() has emptied the ring buffer.
+   The statistics record is hot-linked to the ODB, so the writer thread
+   counts into the writer_xxx fields of the channel, which the main
+   thread moves to the statistics in log_update_writer_statistics(). */
+
+static INT log_write_writer(LOG_CHN * log_chn, const EVENT_HEADER * pevent)
+{
+   int evt_size = pevent->data_size + sizeof(EVENT_HEADER);
+
+   WriterInterface* wr = log_chn->writer;
+   int status = wr->wr_write(log_chn, pevent, evt_size);
+
+   if (log_chn->writer_mutex)
+      ss_mutex_wait_for(log_chn->writer_mutex, 0);
+
+   if (status == SUCCESS) {
+      log_chn->writer_events++;
+      log_chn->writer_bytes += evt_size;
+   }
+
+   double incr = wr->fBytesOut - log_chn->writer_last_out;
+   if (incr < 0)
+      incr = 0;
+
+   //printf("events %.0f, bytes out %.0f, incr %.0f, last %.0f\n", log_chn->writer_events, wr->fBytesOut, incr, log_chn->writer_last_out);
+
+   log_chn->writer_bytes_out += incr;
+   log_chn->writer_last_out = wr->fBytesOut;
+
+   if (log_chn->writer_mutex)
+      ss_mutex_release(log_chn->writer_mutex);
+
+   return status;
+}
+
+void log_update_writer_statistics(LOG_CHN * log_chn)
+{
+   if (log_chn->writer_mutex)
+      ss_mutex_wait_for(log_chn->writer_mutex, 0);
+
+   log_chn->statistics.events_written += log_chn->writer_events;
+   log_chn->statistics.bytes_written_uncompressed += log_chn->writer_bytes;
+   log_chn->statistics.bytes_written += log_chn->writer_bytes_out;
+   log_chn->statistics.bytes_written_subrun += log_chn->writer_bytes_out;
+   log_chn->statistics.bytes_written_total += log_chn->writer_bytes_out;
+
+   log_chn->writer_events = 0;
+   log_chn->writer_bytes = 0;
+   log_chn->writer_bytes_out = 0;
+
+   if (log_chn->writer_mutex)
+      ss_mutex_release(log_chn->writer_mutex);
+}
+
+void log_set_writer_bytes_out(LOG_CHN * log_chn, double bytes_out)
+{
+   /* called after open and close, when the writer thread is idle */
+   if (log_chn->writer_mutex)
+      ss_mutex_wait_for(log_chn->writer_mutex, 0);
+
+   log_chn->writer_last_out = bytes_out;
+
+   if (log_chn->writer_mutex)
+      ss_mutex_release(log_chn->writer_mutex);
+}
+
+static INT log_writer_thread(void *param)
+{
+   LOG_CHN *log_chn = (LOG_CHN *) param;
+   void *p;
+
+   while (!SS_ATOMIC_LOAD(&log_chn->writer_stop)) {
+      int status = rb_get_rp(log_chn->writer_rbh, &p, 100);
+      if (status == DB_TIMEOUT)
+         continue;
+      if (status != DB_SUCCESS)
+         break;
+
+      EVENT_HEADER *pevent = (EVENT_HEADER *) p;
+      int size = ALIGN8(pevent->data_size + sizeof(EVENT_HEADER));
+
+      /* after an error, drop events until the main thread has stopped the run */
+      if (SS_ATOMIC_LOAD(&log_chn->writer_status) == SUCCESS) {
+         status = log_write_writer(log_chn, pevent);
+         if (status != SUCCESS)
+            SS_ATOMIC_STORE(&log_chn->writer_status, status);
+      }
+
+      rb_increment_rp(log_chn->writer_rbh, size);
+   }
+
+   SS_ATOMIC_STORE(&log_chn->writer_active, 0);
+
+   return 0;
+}
+
+int log_start_writer(LOG_CHN * log_chn)
+{
+   int status, size, queue_size, max_event_size;
+
+   if (log_chn->writer == NULL || log_chn->writer_rbh || log_chn->settings.writer_queue_size <= 0)
+      return SUCCESS;
+
+   max_event_size = DEFAULT_MAX_EVENT_SIZE;
+   size = sizeof(max_event_size);
+   db_get_value(hDB, 0, "/Experiment/MAX_EVENT_SIZE", &max_event_size, &size, TID_DWORD, TRUE);
+
+   /* larger events, like big ODB dumps, bypass the queue */
+   if (log_chn->writer_mutex == NULL) {
+      status = ss_mutex_create(&log_chn->writer_mutex);
+      if (status != SS_SUCCESS && status != SS_CREATED) {
+         cm_msg(MERROR, "log_start_writer", "Cannot create writer mutex for channel %s, writing synchronously, ss_mutex_create() status %d", log_chn->name.c_str(), status);
+         log_chn->writer_mutex = NULL;
+         return status;
+      }
+   }
+
+   queue_size = log_chn->settings.writer_queue_size;
+   max_event_size = ALIGN8(max_event_size + sizeof(EVENT_HEADER));
+   if (max_event_size > queue_size / 4)
+      max_event_size = ALIGN8(queue_size / 4 - 7);
+
+   status = rb_create(queue_size, max_event_size, &log_chn->writer_rbh);
+   if (status != DB_SUCCESS) {
+      cm_msg(MERROR, "log_start_writer", "Cannot create writer queue of %d bytes for channel %s, writing synchronously, rb_create() status %d", queue_size, log_chn->name.c_str(), status);
+      log_chn->writer_rbh = 0;
+      return status;
+   }
+
+   log_chn->writer_max_event_size = max_event_size;
+   log_chn->writer_status = SUCCESS;
+   log_chn->writer_stop = 0;
+   log_chn->writer_active = 1;
+
+   if (ss_thread_create(log_writer_thread, log_chn) == 0) {
+      cm_msg(MERROR, "log_start_writer", "Cannot create writer thread for channel %s, writing synchronously", log_chn->name.c_str());
+      rb_delete(log_chn->writer_rbh);
+      log_chn->writer_rbh = 0;
+      log_chn->writer_active = 0;
+      return SS_NO_THREAD;
+   }
+
+   return SUCCESS;
+}
+
+void log_drain_writer(LOG_CHN * log_chn)
+{
+   int n_bytes;
+
+   if (!log_chn->writer_rbh)
+      return;
+
+   /* the writer thread only moves the read pointer after an event has been written */
+   do {
+      rb_get_buffer_level(log_chn->writer_rbh, &n_bytes);
+      if (n_bytes > 0)
+         ss_sleep(1);
+   } while (n_bytes > 0 && SS_ATOMIC_LOAD(&log_chn->writer_active));
+}
+
+void log_stop_writer(LOG_CHN * log_chn)
+{
+   if (!log_chn->writer_rbh)
+      return;
+
+   log_drain_writer(log_chn);
+
+   SS_ATOMIC_STORE(&log_chn->writer_stop, 1);
+   while (SS_ATOMIC_LOAD(&log_chn->writer_active))
+      ss_sleep(10);
+
+   rb_delete(log_chn->writer_rbh);
+   log_chn->writer_rbh = 0;
+   log_chn->statistics.writer_queue_level = 0;
+}
+
+static INT log_queue_event(LOG_CHN * log_chn, const EVENT_HEADER * pevent)
+{
+   int status, size;
+   void *p;
+
+   /* report errors from the writer thread */
+   status = SS_ATOMIC_LOAD(&log_chn->writer_status);
+   if (status != SUCCESS)
+      return status;
+
+   size = ALIGN8(pevent->data_size + sizeof(EVENT_HEADER));
+
+   status = rb_get_wp(log_chn->writer_rbh, &p, 0);
+   if (status == DB_TIMEOUT) {
+      /* writer thread cannot keep up, wait for it */
+      DWORD start_time = ss_millitime();
+      log_chn->statistics.writer_queue_full++;
+      do {
+         status = rb_get_wp(log_chn->writer_rbh, &p, 1000);
+      } while (status == DB_TIMEOUT && SS_ATOMIC_LOAD(&log_chn->writer_status) == SUCCESS);
+      log_chn->statistics.writer_wait_time += (ss_millitime() - start_time) / 1000.0;
+   }
+
+   if (status != DB_SUCCESS)
+      return SS_ATOMIC_LOAD(&log_chn->writer_status) != SUCCESS ? SS_ATOMIC_LOAD(&log_chn->writer_status) : status;
+
+   memcpy(p, pevent, pevent->data_size + sizeof(EVENT_HEADER));
+   rb_increment_wp(log_chn->writer_rbh, size);
+
+   return SUCCESS;
+}
+
+static void log_next_subrun(LOG_CHN * log_chn)
+{
+   stop_requested = TRUE; // avoid recursive call thourgh log_odb_dump
+   log_close(log_chn, current_run_number);
+   log_chn->subrun_number++;
+   log_chn->statistics.bytes_written_subrun = 0;
+   log_create_writer(log_chn);
+   log_generate_file_name(log_chn);
+   log_open(log_chn, current_run_number);
+   subrun_start_time = ss_time();
+   stop_requested = FALSE;
+}
+
 INT log_write(LOG_CHN * log_chn, EVENT_HEADER * pevent)
 {
-   INT status = 0, size;
-   DWORD actual_time, start_time, duration;
-   BOOL next_subrun;
+   INT status = 0;
+   DWORD actual_time, start_time;
 
    //printf("log_write %d\n", pevent->data_size + sizeof(EVENT_HEADER));
 
    start_time = ss_millitime();
+   events_logged++;
 
    if (log_chn->writer) {
-      int evt_size = pevent->data_size + sizeof(EVENT_HEADER);
-
-      WriterInterface* wr = log_chn->writer;
-      status = wr->wr_write(log_chn, pevent, evt_size);
-
-      if (status == SUCCESS) {
-         /* update statistics */
-         log_chn->statistics.events_written++;
-         log_chn->statistics.bytes_written_uncompressed += evt_size;
+      if (log_chn->writer_rbh && ALIGN8(pevent->data_size + sizeof(EVENT_HEADER)) <= (DWORD) log_chn->writer_max_event_size) {
+         status = log_queue_event(log_chn, pevent);
+      } else {
+         status = SUCCESS;
+         if (log_chn->writer_rbh) {
+            log_drain_writer(log_chn);
+            status = SS_ATOMIC_LOAD(&log_chn->writer_status);
+         }
+         if (status == SUCCESS)
+            status = log_write_writer(log_chn, pevent);
       }
 
-      double incr = wr->fBytesOut - log_chn->statistics.bytes_written_subrun;
-      if (incr < 0)
-         incr = 0;
-
-      //printf("events %.0f, bytes out %.0f, incr %.0f, subrun %.0f, written %.0f, total %.0f\n", log_chn->statistics.events_written, wr->fBytesOut, incr, log_chn->statistics.bytes_written_subrun, log_chn->statistics.bytes_written, log_chn->statistics.bytes_written_total);
-      
-      log_chn->statistics.bytes_written += incr;
-      log_chn->statistics.bytes_written_subrun = wr->fBytesOut;
-      log_chn->statistics.bytes_written_total += incr;
+      log_update_writer_statistics(log_chn);
    } else if (log_chn->format == FORMAT_MIDAS) {
       status = midas_write(log_chn, pevent, pevent->data_size + sizeof(EVENT_HEADER));
 #ifdef HAVE_ROOT
@@ -4182,73 +5373,22 @@ INT log_write(LOG_CHN * log_chn, EVENT_HEADER * pevent)
    }
 
    /* check if duration is reached for subrun */
-   duration = 0;
-   size = sizeof(duration);
-   db_get_value(hDB, 0, "/Logger/Subrun duration", &duration, &size, TID_DWORD, TRUE);
-   if (!stop_requested && duration > 0 && ss_time() >= subrun_start_time + duration) {
-      int run_number;
-
-      // cm_msg(MTALK, "main", "stopping subrun after %d seconds", duration);
-
-      size = sizeof(run_number);
-      status = db_get_value(hDB, 0, "Runinfo/Run number", &run_number, &size, TID_INT, TRUE);
-      assert(status == SUCCESS);
-
-      stop_requested = TRUE; // avoid recursive call thourgh log_odb_dump
-      log_close(log_chn, run_number);
-      log_chn->subrun_number++;
-      log_chn->statistics.bytes_written_subrun = 0;
-      log_create_writer(log_chn);
-      log_generate_file_name(log_chn);
-      log_open(log_chn, run_number);
-      subrun_start_time = ss_time();
-      stop_requested = FALSE;
+   if (!stop_requested && subrun_duration > 0 && ss_time() >= subrun_start_time + subrun_duration) {
+      // cm_msg(MTALK, "main", "stopping subrun after %d seconds", subrun_duration);
+      log_next_subrun(log_chn);
    }
 
    /* check if byte limit is reached for subrun */
    if (!stop_requested && log_chn->settings.subrun_byte_limit > 0 &&
        log_chn->statistics.bytes_written_subrun >= log_chn->settings.subrun_byte_limit) {
-      int run_number;
-
       // cm_msg(MTALK, "main", "stopping subrun after %1.0lf bytes", log_chn->settings.subrun_byte_limit);
-
-      size = sizeof(run_number);
-      status = db_get_value(hDB, 0, "Runinfo/Run number", &run_number, &size, TID_INT, TRUE);
-      assert(status == SUCCESS);
-
-      stop_requested = TRUE; // avoid recursive call thourgh log_odb_dump
-      log_close(log_chn, run_number);
-      log_chn->subrun_number++;
-      log_chn->statistics.bytes_written_subrun = 0;
-      log_create_writer(log_chn);
-      log_generate_file_name(log_chn);
-      log_open(log_chn, run_number);
-      subrun_start_time = ss_time();
-      stop_requested = FALSE;
+      log_next_subrun(log_chn);
    }
 
    /* check if new subrun is requested manually */
-   next_subrun = FALSE;
-   size = sizeof(next_subrun);
-   db_get_value(hDB, 0, "/Logger/Next subrun", &next_subrun, &size, TID_BOOL, true);
    if (!stop_requested && next_subrun) {
-      int run_number;
-
       // cm_msg(MTALK, "main", "stopping subrun by user request");
-
-      size = sizeof(run_number);
-      status = db_get_value(hDB, 0, "Runinfo/Run number", &run_number, &size, TID_INT, TRUE);
-      assert(status == SUCCESS);
-
-      stop_requested = TRUE; // avoid recursive call thourgh log_odb_dump
-      log_close(log_chn, run_number);
-      log_chn->subrun_number++;
-      log_chn->statistics.bytes_written_subrun = 0;
-      log_create_writer(log_chn);
-      log_generate_file_name(log_chn);
-      log_open(log_chn, run_number);
-      subrun_start_time = ss_time();
-      stop_requested = FALSE;
+      log_next_subrun(log_chn);
 
       next_subrun = FALSE;
       db_set_value(hDB, 0, "/Logger/Next subrun", &next_subrun, sizeof(next_subrun), 1, TID_BOOL);
@@ -5353,6 +6493,7 @@ int close_channels(int run_number, BOOL* p_tape_flag)
 
          /* close logging channel */
          log_close(&log_chn[i], run_number);
+         log_stop_writer(&log_chn[i]);
 
          /* close statistics record */
          db_set_record(hDB, log_chn[i].stats_hkey, &log_chn[i].statistics, sizeof(CHN_STATISTICS), 0);
@@ -5445,7 +6586,7 @@ INT tr_start(INT run_number, char *error)
 
 \********************************************************************/
 {
-   INT size, index, status;
+   INT size, index, status, sampling_type;
    HNDLE hKeyRoot, hKeyChannel;
    CHN_SETTINGS *chn_settings;
    KEY key;
@@ -5467,6 +6608,9 @@ INT tr_start(INT run_number, char *error)
 
    in_stop_transition = FALSE;
 
+   /* the hot-link on the run number might not have been dispatched yet */
+   current_run_number = run_number;
+
    run_start_time = subrun_start_time = ss_time();
 
    /* read global logging flag */
@@ -5479,8 +6623,8 @@ INT tr_start(INT run_number, char *error)
    db_get_value(hDB, 0, "/Logger/Tape message", &tape_message, &size, TID_BOOL, TRUE);
 
    /* reset next subrun flag */
-   status = FALSE;
-   db_set_value(hDB, 0, "/Logger/Next subrun", &status, sizeof(status), 1, TID_BOOL);
+   next_subrun = FALSE;
+   db_set_value(hDB, 0, "/Logger/Next subrun", &next_subrun, sizeof(next_subrun), 1, TID_BOOL);
 
    /* loop over all channels */
    status = db_find_key(hDB, 0, "/Logger/Channels", &hKeyRoot);
@@ -5657,6 +6801,9 @@ INT tr_start(INT run_number, char *error)
          if (status != DB_SUCCESS)
             cm_msg(MERROR, "tr_start", "db_watch() status %d, cannot open channel settings record, probably other logger is using it", status);
 
+         /* move the writer chain to its own thread */
+         log_start_writer(&log_chn[index]);
+
 #ifndef FAL_MAIN
          /* open buffer */
          status = bm_open_buffer(chn_settings->buffer, DEFAULT_BUFFER_SIZE, &log_chn[index].buffer_handle);
@@ -5667,11 +6814,17 @@ INT tr_start(INT run_number, char *error)
          }
          bm_set_cache_size(log_chn[index].buffer_handle, 100000, 0);
 
+         /* writers only read the event, so it can stay in the buffer,
+            except for ROOT which byte-swaps the banks in place */
+         sampling_type = GET_ALL;
+         if (!equal_ustring(chn_settings->format, "ROOT"))
+            sampling_type |= GET_IN_PLACE;
+
          /* place event request */
          status = bm_request_event(log_chn[index].buffer_handle,
                                    (short) chn_settings->event_id,
                                    (short) chn_settings->trigger_mask,
-                                   GET_ALL, &log_chn[index].request_id, receive_event);
+                                   sampling_type, &log_chn[index].request_id, receive_event);
 
          if (status != BM_SUCCESS) {
             sprintf(error, "Cannot place event request");
@@ -5692,7 +6845,7 @@ INT tr_start(INT run_number, char *error)
             status = bm_request_event(log_chn[index].msg_buffer_handle,
                                       (short) EVENTID_MESSAGE,
                                       (short) chn_settings->log_messages,
-                                      GET_ALL, &log_chn[index].msg_request_id, receive_event);
+                                      sampling_type, &log_chn[index].msg_request_id, receive_event);
 
             if (status != BM_SUCCESS) {
                sprintf(error, "Cannot place event request");
@@ -5901,7 +7054,7 @@ int main(int argc, char *argv[])
    BOOL debug, daemon, save_mode;
    DWORD last_time_kb = 0;
    DWORD last_time_stat = 0;
-   DWORD duration;
+   double last_num_locks = 0, last_events_logged = 0;
    HNDLE hktemp;
 
 #ifdef HAVE_ROOT
@@ -6078,6 +7231,8 @@ int main(int argc, char *argv[])
    /* initialize ss_getchar() */
    ss_getchar(0);
 
+   last_num_locks = db_get_num_locks(hDB);
+
    do {
       msg = cm_yield(1000);
 
@@ -6087,6 +7242,25 @@ int main(int argc, char *argv[])
       /* update channel statistics once every second */
       if (ss_millitime() - last_time_stat > 1000) {
          last_time_stat = ss_millitime();
+
+         for (i = 0; i < MAX_CHANNELS; i++)
+            if (log_chn[i].writer_rbh) {
+               log_update_writer_statistics(&log_chn[i]);
+
+               int n_bytes;
+               rb_get_buffer_level(log_chn[i].writer_rbh, &n_bytes);
+               log_chn[i].statistics.writer_queue_level = (double) n_bytes / log_chn[i].settings.writer_queue_size;
+            }
+
+         /* database locks of this process per logged event, including the statistics update */
+         if (events_logged > last_events_logged) {
+            double num_locks = db_get_num_locks(hDB);
+            double locks_per_event = (num_locks - last_num_locks) / (events_logged - last_events_logged);
+            db_set_value(hDB, 0, "/Logger/ODB locks per event", &locks_per_event, sizeof(double), 1, TID_DOUBLE);
+            last_num_locks = num_locks;
+            last_events_logged = events_logged;
+         }
+
          /*
          printf("update statistics!\n");
          //LOG_CHN* log_chn = log_chn[0];
@@ -6107,12 +7281,9 @@ int main(int argc, char *argv[])
       }
 
       /* check if time is reached to stop run */
-      duration = 0;
-      size = sizeof(duration);
-      db_get_value(hDB, 0, "/Logger/Run duration", &duration, &size, TID_DWORD, true);
       if (!stop_requested && !in_stop_transition && local_state != STATE_STOPPED &&
-          duration > 0 && ss_time() >= run_start_time + duration) {
-         cm_msg(MTALK, "main", "stopping run after %d seconds", duration);
+          run_duration > 0 && ss_time() >= run_start_time + run_duration) {
+         cm_msg(MTALK, "main", "stopping run after %d seconds", run_duration);
          status = stop_the_run(1);
       }
 
@@ -6136,6 +7307,10 @@ int main(int argc, char *argv[])
    /* reset terminal */
    ss_getchar(TRUE);
 
+   /* do not lose events still queued for the writer threads */
+   for (i = 0; i < MAX_CHANNELS; i++)
+      log_stop_writer(&log_chn[i]);
+
    /* close history logging */
    close_history();
 
@@ -216,6 +216,20 @@ static RPC_LIST rpc_list_library[] = {
     }
    ,
 
+   {RPC_BM_SEND_EVENTS, "bm_send_events",
+    {{TID_INT, RPC_IN}
+     ,
+     {TID_ARRAY, RPC_IN | RPC_VARARRAY}
+     ,
+     {TID_INT, RPC_IN}
+     ,
+     {TID_INT, RPC_IN}
+     ,
+     {0}
+     }
+    }
+   ,
+
    {RPC_BM_FLUSH_CACHE, "bm_flush_cache",
     {{TID_INT, RPC_IN}
      ,
@@ -670,6 +684,36 @@ static RPC_LIST rpc_list_library[] = {
     }
    ,
 
+   {RPC_DB_BEGIN_BATCH, "db_begin_batch",
+    {{TID_INT, RPC_IN}
+     ,
+     {0}
+     }
+    }
+   ,
+
+   {RPC_DB_END_BATCH, "db_end_batch",
+    {{TID_INT, RPC_IN}
+     ,
+     {0}
+     }
+    }
+   ,
+
+   {RPC_DB_COPY_BINARY, "db_copy_binary",
+    {{TID_INT, RPC_IN}
+     ,
+     {TID_INT, RPC_IN}
+     ,
+     {TID_ARRAY, RPC_OUT | RPC_VARARRAY}
+     ,
+     {TID_INT, RPC_IN | RPC_OUT}
+     ,
+     {0}
+     }
+    }
+   ,
+
    {RPC_DB_SET_DATA_INDEX2, "db_set_data_index2",
     {{TID_INT, RPC_IN}
      ,
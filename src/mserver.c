@@ -629,6 +629,10 @@ INT rpc_server_dispatch(INT index, void *prpc_param[])
       status = bm_send_event(CINT(0), CARRAY(1), CINT(2), CINT(3));
       break;
 
+   case RPC_BM_SEND_EVENTS:
+      status = bm_send_packed_events(CINT(0), (char *) CARRAY(1), CINT(2), CINT(3), convert_flags);
+      break;
+
    case RPC_BM_RECEIVE_EVENT:
       status = bm_receive_event(CINT(0), CARRAY(1), CPINT(2), CINT(3));
       break;
@@ -667,6 +671,15 @@ INT rpc_server_dispatch(INT index, void *prpc_param[])
       LeaveCriticalSection(&buffer_critial_section);
 #endif
 
+      /* hot-links are notified by this process, so use the notify window of the experiment */
+      if (status == DB_SUCCESS || status == DB_CREATED) {
+         INT notify_window = 20;
+         INT size = sizeof(notify_window);
+
+         db_get_value(*CPHNDLE(2), 0, "/Experiment/Notify window", &notify_window, &size, TID_INT, TRUE);
+         db_set_notify_window(notify_window);
+      }
+
       break;
 
    case RPC_DB_CLOSE_DATABASE:
@@ -850,6 +863,18 @@ INT rpc_server_dispatch(INT index, void *prpc_param[])
       status = db_set_link_data_index(CHNDLE(0), CHNDLE(1), CARRAY(2), CINT(3), CINT(4), CDWORD(5));
       break;
 
+   case RPC_DB_BEGIN_BATCH:
+      status = db_begin_batch(CHNDLE(0));
+      break;
+
+   case RPC_DB_END_BATCH:
+      status = db_end_batch(CHNDLE(0));
+      break;
+
+   case RPC_DB_COPY_BINARY:
+      status = db_copy_binary(CHNDLE(0), CHNDLE(1), CARRAY(2), CPINT(3));
+      break;
+
    case RPC_DB_SET_DATA_INDEX2:
       rpc_convert_single(CARRAY(2), CDWORD(5), 0, convert_flags);
       status = db_set_data_index2(CHNDLE(0), CHNDLE(1), CARRAY(2), CINT(3), CINT(4), CDWORD(5), CBOOL(6));
@@ -65,6 +65,11 @@ static INT _watch_list_entries = 0;
 
 INT db_save_xml_key(HNDLE hDB, HNDLE hKey, INT level, MXML_WRITER * writer);
 
+#ifdef LOCAL_ROUTINES
+static void db_flush_pending(HNDLE hDB, BOOL all);
+static void db_free_notify(HNDLE hDB);
+#endif
+
 /*------------------------------------------------------------------*/
 
 /********************************************************************\
@@ -74,18 +79,43 @@ INT db_save_xml_key(HNDLE hDB, HNDLE hKey, INT level, MXML_WRITER * writer);
 \********************************************************************/
 
 /*------------------------------------------------------------------*/
-void *malloc_key(DATABASE_HEADER * pheader, INT size)
+
+/*
+  Free memory of the key and of the data area is kept in two places:
+  freed blocks are pushed onto the free list of their size class in
+  the database header, which holds blocks of exactly 8, 16, ... up to
+  ODB_SLAB_MAX bytes, or for larger blocks a bin covering 1/8 of a
+  power of two. Allocations pop a block from these lists in O(1) and
+  return the unused part of a larger block to its list. Memory
+  which was never used and blocks of more than 2 MB live in the
+  address sorted free list starting at first_free_key/first_free_data,
+  where adjacent blocks are melted together. Size class blocks are
+  returned to the sorted list if an allocation cannot be satisfied
+  otherwise, or by db_compact().
+*/
+
+typedef struct {
+   INT offset;                  /* offset of block from header */
+   INT size;                    /* size of block in bytes      */
+   KEY *pkey;                   /* owning key of data block    */
+} MEM_BLOCK;
+
+static int mem_block_compare(const void *a, const void *b)
+{
+   return ((const MEM_BLOCK *) a)->offset - ((const MEM_BLOCK *) b)->offset;
+}
+
+/*------------------------------------------------------------------*/
+static void *malloc_first_fit(DATABASE_HEADER * pheader, INT * first_free, INT size)
 {
    FREE_DESCRIP *pfree, *pfound, *pprev = NULL;
 
-   if (size == 0)
+   /* list may be empty if all memory is used or in size class lists */
+   if (*first_free == 0)
       return NULL;
 
-   /* quadword alignment for alpha CPU */
-   size = ALIGN8(size);
-
    /* search for free block */
-   pfree = (FREE_DESCRIP *) ((char *) pheader + pheader->first_free_key);
+   pfree = (FREE_DESCRIP *) ((char *) pheader + *first_free);
 
    while (pfree->size < size && pfree->next_free) {
       pprev = pfree;
@@ -94,22 +124,22 @@ void *malloc_key(DATABASE_HEADER * pheader, INT size)
 
    /* return if not enough memory */
    if (pfree->size < size)
-      return 0;
+      return NULL;
 
    pfound = pfree;
 
    /* if found block is first in list, correct pheader */
-   if (pfree == (FREE_DESCRIP *) ((char *) pheader + pheader->first_free_key)) {
+   if (pfree == (FREE_DESCRIP *) ((char *) pheader + *first_free)) {
       if (size < pfree->size) {
          /* free block is only used partially */
-         pheader->first_free_key += size;
-         pfree = (FREE_DESCRIP *) ((char *) pheader + pheader->first_free_key);
+         *first_free += size;
+         pfree = (FREE_DESCRIP *) ((char *) pheader + *first_free);
 
          pfree->size = pfound->size - size;
          pfree->next_free = pfound->next_free;
       } else {
          /* free block is used totally */
-         pheader->first_free_key = pfree->next_free;
+         *first_free = pfree->next_free;
       }
    } else {
       /* check if free block is used totally */
@@ -127,43 +157,29 @@ void *malloc_key(DATABASE_HEADER * pheader, INT size)
       }
    }
 
-
-   memset(pfound, 0, size);
-
    return pfound;
 }
 
 /*------------------------------------------------------------------*/
-void free_key(DATABASE_HEADER * pheader, void *address, INT size)
+static void free_first_fit(DATABASE_HEADER * pheader, INT * first_free, void *address, INT size, const char *routine)
 {
    FREE_DESCRIP *pfree, *pprev, *pnext;
 
-   if (size == 0)
-      return;
-
-   assert(address != pheader);
-
-   /* quadword alignment for alpha CPU */
-   size = ALIGN8(size);
-
    pfree = (FREE_DESCRIP *) address;
    pprev = NULL;
 
-   /* clear current block */
-   memset(address, 0, size);
-
-   /* if key comes before first free block, adjust pheader */
-   if ((POINTER_T) address - (POINTER_T) pheader < pheader->first_free_key) {
+   /* if block comes before first free block, adjust pheader */
+   if (*first_free == 0 || (POINTER_T) address - (POINTER_T) pheader < *first_free) {
       pfree->size = size;
-      pfree->next_free = pheader->first_free_key;
-      pheader->first_free_key = (POINTER_T) address - (POINTER_T) pheader;
+      pfree->next_free = *first_free;
+      *first_free = (POINTER_T) address - (POINTER_T) pheader;
    } else {
       /* find last free block before current block */
-      pprev = (FREE_DESCRIP *) ((char *) pheader + pheader->first_free_key);
+      pprev = (FREE_DESCRIP *) ((char *) pheader + *first_free);
 
       while (pprev->next_free < (POINTER_T) address - (POINTER_T) pheader) {
          if (pprev->next_free <= 0) {
-            cm_msg(MERROR, "free_key",
+            cm_msg(MERROR, routine,
                    "database is corrupted: pprev=%p, pprev->next_free=%d", pprev, pprev->next_free);
             return;
          }
@@ -178,11 +194,11 @@ void free_key(DATABASE_HEADER * pheader, void *address, INT size)
 
    /* try to melt adjacent free blocks after current block */
    pnext = (FREE_DESCRIP *) ((char *) pheader + pfree->next_free);
-   if ((POINTER_T) pnext == (POINTER_T) pfree + pfree->size) {
+   if (pfree->next_free && (POINTER_T) pnext == (POINTER_T) pfree + pfree->size) {
       pfree->size += pnext->size;
       pfree->next_free = pnext->next_free;
 
-      memset(pnext, 0, pnext->size);
+      memset(pnext, 0, sizeof(FREE_DESCRIP));
    }
 
    /* try to melt adjacent free blocks before current block */
@@ -190,130 +206,236 @@ void free_key(DATABASE_HEADER * pheader, void *address, INT size)
       pprev->size += pfree->size;
       pprev->next_free = pfree->next_free;
 
-      memset(pfree, 0, pfree->size);
+      memset(pfree, 0, sizeof(FREE_DESCRIP));
    }
 }
 
 /*------------------------------------------------------------------*/
-void *malloc_data(DATABASE_HEADER * pheader, INT size)
+static INT free_class_index(INT size)
+/* size class list of an aligned free block, -1 for the sorted list */
 {
-   FREE_DESCRIP *pfree, *pfound, *pprev = NULL;
+   INT i, lo;
 
-   if (size == 0)
-      return NULL;
+   if (size <= ODB_SLAB_MAX)
+      return size / 8 - 1;
 
-   /* quadword alignment for alpha CPU */
-   size = ALIGN8(size);
+   /* bins of lo/ODB_FREE_SUBBINS bytes between lo and 2*lo */
+   for (i = 0, lo = ODB_SLAB_MAX; i < ODB_FREE_BINS; i += ODB_FREE_SUBBINS, lo *= 2)
+      if (size <= 2 * lo)
+         return ODB_SLAB_CLASSES + i + (size - lo - 1) / (lo / ODB_FREE_SUBBINS);
 
-   /* search for free block */
-   pfree = (FREE_DESCRIP *) ((char *) pheader + pheader->first_free_data);
+   return -1;
+}
 
-   while (pfree->size < size && pfree->next_free) {
-      pprev = pfree;
-      pfree = (FREE_DESCRIP *) ((char *) pheader + pfree->next_free);
-   }
+/*------------------------------------------------------------------*/
+static INT free_class_limit(INT i)
+/* size of the largest block in size class list i */
+{
+   INT lo;
 
-   /* return if not enough memory */
-   if (pfree->size < size)
+   if (i < ODB_SLAB_CLASSES)
+      return (i + 1) * 8;
+
+   i -= ODB_SLAB_CLASSES;
+   lo = ODB_SLAB_MAX << (i / ODB_FREE_SUBBINS);
+   return lo + (i % ODB_FREE_SUBBINS + 1) * (lo / ODB_FREE_SUBBINS);
+}
+
+/*------------------------------------------------------------------*/
+static INT merge_free_classes(DATABASE_HEADER * pheader, INT * first_free, INT * free_class)
+/* move all blocks of the size class lists back to the sorted free
+   list and melt adjacent blocks, returns number of blocks moved */
+{
+   INT i, n, num_class;
+   INT offset;
+   MEM_BLOCK *block;
+   FREE_DESCRIP *pfree, *pprev;
+
+   n = 0;
+   for (i = 0; i < ODB_FREE_CLASSES; i++)
+      for (offset = free_class[i]; offset; offset = ((FREE_DESCRIP *) ((char *) pheader + offset))->next_free)
+         n++;
+
+   if (n == 0)
       return 0;
 
-   pfound = pfree;
+   num_class = n;
+   for (offset = *first_free; offset; offset = ((FREE_DESCRIP *) ((char *) pheader + offset))->next_free)
+      n++;
 
-   /* if found block is first in list, correct pheader */
-   if (pfree == (FREE_DESCRIP *) ((char *) pheader + pheader->first_free_data)) {
-      if (size < pfree->size) {
-         /* free block is only used partially */
-         pheader->first_free_data += size;
-         pfree = (FREE_DESCRIP *) ((char *) pheader + pheader->first_free_data);
+   block = (MEM_BLOCK *) malloc(n * sizeof(MEM_BLOCK));
+   if (block == NULL)
+      return 0;
 
-         pfree->size = pfound->size - size;
-         pfree->next_free = pfound->next_free;
-      } else {
-         /* free block is used totally */
-         pheader->first_free_data = pfree->next_free;
+   n = 0;
+   for (i = 0; i < ODB_FREE_CLASSES; i++) {
+      for (offset = free_class[i]; offset; offset = ((FREE_DESCRIP *) ((char *) pheader + offset))->next_free) {
+         block[n].offset = offset;
+         block[n++].size = ((FREE_DESCRIP *) ((char *) pheader + offset))->size;
       }
-   } else {
-      /* check if free block is used totally */
-      if (pfound->size - size < (int) sizeof(FREE_DESCRIP)) {
-         /* skip block totally */
-         pprev->next_free = pfound->next_free;
-      } else {
-         /* decrease free block */
-         pfree = (FREE_DESCRIP *) ((char *) pfound + size);
+      free_class[i] = 0;
+   }
+   for (offset = *first_free; offset; offset = ((FREE_DESCRIP *) ((char *) pheader + offset))->next_free) {
+      block[n].offset = offset;
+      block[n++].size = ((FREE_DESCRIP *) ((char *) pheader + offset))->size;
+   }
 
-         pfree->size = pfound->size - size;
-         pfree->next_free = pfound->next_free;
+   qsort(block, n, sizeof(MEM_BLOCK), mem_block_compare);
 
-         pprev->next_free = (POINTER_T) pfree - (POINTER_T) pheader;
+   /* rebuild sorted list */
+   *first_free = 0;
+   pprev = NULL;
+   for (i = 0; i < n; i++) {
+      pfree = (FREE_DESCRIP *) ((char *) pheader + block[i].offset);
+
+      if (pprev && (char *) pprev + pprev->size == (char *) pfree) {
+         pprev->size += block[i].size;
+         memset(pfree, 0, sizeof(FREE_DESCRIP));
+         continue;
       }
+
+      pfree->size = block[i].size;
+      pfree->next_free = 0;
+      if (pprev)
+         pprev->next_free = block[i].offset;
+      else
+         *first_free = block[i].offset;
+      pprev = pfree;
    }
 
-   /* zero memeory */
-   memset(pfound, 0, size);
+   free(block);
 
-   return pfound;
+   return num_class;
 }
 
 /*------------------------------------------------------------------*/
-void free_data(DATABASE_HEADER * pheader, void *address, INT size)
+static void push_free_class(DATABASE_HEADER * pheader, INT * first_free, INT * free_class, void *address, INT size, const char *routine)
+/* put zeroed block onto its size class list or into the sorted list */
 {
-   FREE_DESCRIP *pfree, *pprev, *pnext;
+   FREE_DESCRIP *pfree;
+   INT i;
 
-   if (size == 0)
+   i = free_class_index(size);
+   if (i < 0) {
+      free_first_fit(pheader, first_free, address, size, routine);
       return;
+   }
 
-   assert(address != pheader);
+   pfree = (FREE_DESCRIP *) address;
+   pfree->size = size;
+   pfree->next_free = free_class[i];
+   free_class[i] = (POINTER_T) address - (POINTER_T) pheader;
+}
+
+/*------------------------------------------------------------------*/
+static FREE_DESCRIP *pop_free_class(DATABASE_HEADER * pheader, INT * free_class, INT size)
+/* take a block of at least size bytes from the size class lists */
+{
+   FREE_DESCRIP *pfree;
+   INT i, j;
+
+   i = free_class_index(size);
+   if (i < 0)
+      return NULL;
+
+   /* blocks of an exact size class fit always, those of a bin maybe */
+   if (free_class[i]) {
+      pfree = (FREE_DESCRIP *) ((char *) pheader + free_class[i]);
+      if (pfree->size >= size) {
+         free_class[i] = pfree->next_free;
+         return pfree;
+      }
+   }
+
+   if (i < ODB_SLAB_CLASSES)
+      return NULL;
+
+   /* any block of the following bins is large enough, but split
+      at most blocks of twice the size */
+   for (j = i + 1; j < ODB_FREE_CLASSES && j <= i + ODB_FREE_SUBBINS; j++)
+      if (free_class[j]) {
+         pfree = (FREE_DESCRIP *) ((char *) pheader + free_class[j]);
+         free_class[j] = pfree->next_free;
+         return pfree;
+      }
+
+   return NULL;
+}
+
+/*------------------------------------------------------------------*/
+static void *malloc_block(DATABASE_HEADER * pheader, INT * first_free, INT * free_class, INT size, const char *routine)
+{
+   FREE_DESCRIP *pfree;
+   INT rest;
+
+   if (size == 0)
+      return NULL;
 
    /* quadword alignment for alpha CPU */
    size = ALIGN8(size);
 
-   pfree = (FREE_DESCRIP *) address;
-   pprev = NULL;
+   pfree = pop_free_class(pheader, free_class, size);
+   if (pfree) {
+      /* return unused part of a larger block */
+      rest = pfree->size - size;
+      if (rest > 0)
+         push_free_class(pheader, first_free, free_class, (char *) pfree + size, rest, routine);
+   } else {
+      pfree = (FREE_DESCRIP *) malloc_first_fit(pheader, first_free, size);
 
-   /* clear current block */
-   memset(address, 0, size);
+      /* last resort: collect blocks of all size classes */
+      if (pfree == NULL && merge_free_classes(pheader, first_free, free_class) > 0)
+         pfree = (FREE_DESCRIP *) malloc_first_fit(pheader, first_free, size);
 
-   /* if data comes before first free block, adjust pheader */
-   if ((POINTER_T) address - (POINTER_T) pheader < pheader->first_free_data) {
-      pfree->size = size;
-      pfree->next_free = pheader->first_free_data;
-      pheader->first_free_data = (POINTER_T) address - (POINTER_T) pheader;
-   } else {
-      /* find last free block before current block */
-      pprev = (FREE_DESCRIP *) ((char *) pheader + pheader->first_free_data);
+      if (pfree == NULL)
+         return NULL;
+   }
 
-      while (pprev->next_free < (POINTER_T) address - (POINTER_T) pheader) {
-         if (pprev->next_free <= 0) {
-            cm_msg(MERROR, "free_data",
-                   "database is corrupted: pprev=%p, pprev->next_free=%d", pprev, pprev->next_free);
-            return;
-         }
+   /* zero memory */
+   memset(pfree, 0, size);
 
-         pprev = (FREE_DESCRIP *) ((char *) pheader + pprev->next_free);
-      }
+   return pfree;
+}
 
-      pfree->size = size;
-      pfree->next_free = pprev->next_free;
+/*------------------------------------------------------------------*/
+static void free_block(DATABASE_HEADER * pheader, INT * first_free, INT * free_class, void *address, INT size, const char *routine)
+{
+   if (size == 0)
+      return;
 
-      pprev->next_free = (POINTER_T) pfree - (POINTER_T) pheader;
-   }
+   assert(address != pheader);
 
-   /* try to melt adjacent free blocks after current block */
-   pnext = (FREE_DESCRIP *) ((char *) pheader + pfree->next_free);
-   if ((POINTER_T) pnext == (POINTER_T) pfree + pfree->size) {
-      pfree->size += pnext->size;
-      pfree->next_free = pnext->next_free;
+   /* quadword alignment for alpha CPU */
+   size = ALIGN8(size);
 
-      memset(pnext, 0, pnext->size);
-   }
+   /* clear current block */
+   memset(address, 0, size);
 
-   /* try to melt adjacent free blocks before current block */
-   if (pprev && pprev->next_free == (POINTER_T) pprev - (POINTER_T) pheader + pprev->size) {
-      pprev->size += pfree->size;
-      pprev->next_free = pfree->next_free;
+   push_free_class(pheader, first_free, free_class, address, size, routine);
+}
 
-      memset(pfree, 0, pfree->size);
-   }
+/*------------------------------------------------------------------*/
+void *malloc_key(DATABASE_HEADER * pheader, INT size)
+{
+   return malloc_block(pheader, &pheader->first_free_key, pheader->free_key_class, size, "malloc_key");
+}
+
+/*------------------------------------------------------------------*/
+void free_key(DATABASE_HEADER * pheader, void *address, INT size)
+{
+   free_block(pheader, &pheader->first_free_key, pheader->free_key_class, address, size, "free_key");
+}
+
+/*------------------------------------------------------------------*/
+void *malloc_data(DATABASE_HEADER * pheader, INT size)
+{
+   return malloc_block(pheader, &pheader->first_free_data, pheader->free_data_class, size, "malloc_data");
+}
+
+/*------------------------------------------------------------------*/
+void free_data(DATABASE_HEADER * pheader, void *address, INT size)
+{
+   free_block(pheader, &pheader->first_free_data, pheader->free_data_class, address, size, "free_data");
 }
 
 /*------------------------------------------------------------------*/
@@ -321,6 +443,23 @@ void *realloc_data(DATABASE_HEADER * pheader, void *address, INT old_size, INT n
 {
    void *tmp = NULL, *pnew;
 
+   /* keep block if size does not change after alignment */
+   if (old_size && new_size && ALIGN8(old_size) == ALIGN8(new_size)) {
+      if (new_size < old_size)
+         memset((char *) address + new_size, 0, old_size - new_size);
+      return address;
+   }
+
+   /* copy directly if old and new block fit at the same time */
+   if (old_size && new_size) {
+      pnew = malloc_data(pheader, new_size);
+      if (pnew) {
+         memcpy(pnew, address, old_size < new_size ? old_size : new_size);
+         free_data(pheader, address, old_size);
+         return pnew;
+      }
+   }
+
    if (old_size) {
       tmp = malloc(old_size);
       if (tmp == NULL)
@@ -332,13 +471,204 @@ void *realloc_data(DATABASE_HEADER * pheader, void *address, INT old_size, INT n
 
    pnew = malloc_data(pheader, new_size);
 
-   if (pnew && old_size)
-      memcpy(pnew, tmp, old_size < new_size ? old_size : new_size);
+   if (pnew && old_size)
+      memcpy(pnew, tmp, old_size < new_size ? old_size : new_size);
+
+   if (old_size)
+      free(tmp);
+
+   return pnew;
+}
+
+/********************************************************************\
+*                                                                    *
+*            Key name hash index                                     *
+*                                                                    *
+\********************************************************************/
+
+/* Keylists with at least KEYHASH_MIN_KEYS keys get a hash table of
+   their key names in the key area, so db_find_key() and friends do not
+   have to walk the linked list. The table uses open addressing with
+   linear probing and is rebuilt when it gets 3/4 full. If there is no
+   space for it, the keylist is searched as before. */
+
+#define KEYHASH_MIN_KEYS 32
+#define KEYHASH_DELETED  -1
+#define KEYHASH_SIZE(n)  ((INT) (sizeof(KEYHASH) + ((n) - 1) * sizeof(INT)))
+
+/*------------------------------------------------------------------*/
+static DWORD db_hash_name(const char *name)
+/* case insensitive FNV-1a hash, consistent with equal_ustring() */
+{
+   DWORD h = 2166136261u;
+
+   for (; *name; name++) {
+      h ^= (unsigned char) toupper((unsigned char) *name);
+      h *= 16777619u;
+   }
+
+   return h;
+}
+
+/*------------------------------------------------------------------*/
+static void db_hash_put(DATABASE_HEADER * pheader, KEYHASH * phash, KEY * pkey)
+{
+   DWORD i, mask;
+
+   mask = phash->size - 1;
+   i = db_hash_name(pkey->name) & mask;
+
+   while (phash->slot[i] > 0)
+      i = (i + 1) & mask;
+
+   if (phash->slot[i] == 0)
+      phash->num_used++;
+
+   phash->slot[i] = (POINTER_T) pkey - (POINTER_T) pheader;
+}
+
+/*------------------------------------------------------------------*/
+static void db_hash_free(DATABASE_HEADER * pheader, KEYLIST * pkeylist)
+{
+   KEYHASH *phash;
+
+   if (!pkeylist->hash)
+      return;
+
+   phash = (KEYHASH *) ((char *) pheader + pkeylist->hash);
+   free_key(pheader, phash, KEYHASH_SIZE(phash->size));
+   pkeylist->hash = 0;
+}
+
+/*------------------------------------------------------------------*/
+static void db_hash_build(DATABASE_HEADER * pheader, KEYLIST * pkeylist)
+/* (re)build the hash index of a keylist */
+{
+   KEYHASH *phash;
+   KEY *pkey;
+   INT i, size;
+
+   db_hash_free(pheader, pkeylist);
+
+   if (pkeylist->num_keys < KEYHASH_MIN_KEYS)
+      return;
+
+   for (size = 2 * KEYHASH_MIN_KEYS; size < 2 * pkeylist->num_keys; size *= 2);
+
+   phash = (KEYHASH *) malloc_key(pheader, KEYHASH_SIZE(size));
+   if (phash == NULL)
+      return;
+
+   phash->size = size;
+
+   pkey = (KEY *) ((char *) pheader + pkeylist->first_key);
+   for (i = 0; i < pkeylist->num_keys; i++) {
+      db_hash_put(pheader, phash, pkey);
+      phash->last_key = (POINTER_T) pkey - (POINTER_T) pheader;
+      pkey = (KEY *) ((char *) pheader + pkey->next_key);
+   }
+
+   pkeylist->hash = (POINTER_T) phash - (POINTER_T) pheader;
+}
+
+/*------------------------------------------------------------------*/
+static void db_hash_add(DATABASE_HEADER * pheader, KEYLIST * pkeylist, KEY * pkey)
+/* add key which has just been appended to the keylist or renamed */
+{
+   KEYHASH *phash;
+
+   if (!pkeylist->hash) {
+      if (pkeylist->num_keys >= KEYHASH_MIN_KEYS)
+         db_hash_build(pheader, pkeylist);
+      return;
+   }
+
+   phash = (KEYHASH *) ((char *) pheader + pkeylist->hash);
+
+   if (4 * (phash->num_used + 1) > 3 * phash->size) {
+      db_hash_build(pheader, pkeylist);
+      return;
+   }
+
+   db_hash_put(pheader, phash, pkey);
+   if (pkey->next_key == 0)
+      phash->last_key = (POINTER_T) pkey - (POINTER_T) pheader;
+}
+
+/*------------------------------------------------------------------*/
+static void db_hash_remove(DATABASE_HEADER * pheader, KEYLIST * pkeylist, KEY * pkey, KEY * pprev)
+/* remove key from the hash index, has to be called before the key name
+   changes. If pkey was the last key, pprev becomes the last key. */
+{
+   KEYHASH *phash;
+   DWORD i, mask;
+   INT n, offset;
+
+   if (!pkeylist->hash)
+      return;
+
+   phash = (KEYHASH *) ((char *) pheader + pkeylist->hash);
+   offset = (POINTER_T) pkey - (POINTER_T) pheader;
+
+   if (phash->last_key == offset)
+      phash->last_key = pprev ? (POINTER_T) pprev - (POINTER_T) pheader : 0;
+
+   mask = phash->size - 1;
+   i = db_hash_name(pkey->name) & mask;
+
+   for (n = 0; n < phash->size && phash->slot[i] != 0; n++) {
+      if (phash->slot[i] == offset) {
+         phash->slot[i] = KEYHASH_DELETED;
+         return;
+      }
+      i = (i + 1) & mask;
+   }
+}
+
+/*------------------------------------------------------------------*/
+static void db_hash_update_last(DATABASE_HEADER * pheader, KEYLIST * pkeylist)
+/* find the last key after the keylist has been reordered */
+{
+   KEYHASH *phash;
+   KEY *pkey;
+   INT i;
+
+   if (!pkeylist->hash)
+      return;
+
+   phash = (KEYHASH *) ((char *) pheader + pkeylist->hash);
+   phash->last_key = 0;
+
+   pkey = (KEY *) ((char *) pheader + pkeylist->first_key);
+   for (i = 0; i < pkeylist->num_keys; i++) {
+      phash->last_key = (POINTER_T) pkey - (POINTER_T) pheader;
+      pkey = (KEY *) ((char *) pheader + pkey->next_key);
+   }
+}
+
+/*------------------------------------------------------------------*/
+static KEY *db_hash_find(DATABASE_HEADER * pheader, const KEYLIST * pkeylist, const char *name)
+/* return the key called "name" in a keylist with hash index, NULL if not found */
+{
+   KEYHASH *phash;
+   KEY *pkey;
+   DWORD i, mask;
+   INT n;
+
+   phash = (KEYHASH *) ((char *) pheader + pkeylist->hash);
+   mask = phash->size - 1;
+   i = db_hash_name(name) & mask;
 
-   if (old_size)
-      free(tmp);
+   for (n = 0; n < phash->size && phash->slot[i] != 0; n++) {
+      if (phash->slot[i] != KEYHASH_DELETED) {
+         pkey = (KEY *) ((char *) pheader + phash->slot[i]);
+         if (equal_ustring(name, pkey->name))
+            return pkey;
+      }
+      i = (i + 1) & mask;
+   }
 
-   return pnew;
+   return NULL;
 }
 
 /*------------------------------------------------------------------*/
@@ -388,6 +718,58 @@ INT print_key_info(HNDLE hDB, HNDLE hKey, KEY * pkey, INT level, void *info)
    return SUCCESS;
 }
 
+/*------------------------------------------------------------------*/
+static INT show_free_stats(DATABASE_HEADER * pheader, INT first_free, const INT * free_class, char *result)
+/* append fragmentation statistics of key or data area, return free bytes */
+{
+   INT i, n, offset, num_list, size_list, largest, num_class, size_class;
+   FREE_DESCRIP *pfree;
+
+   num_list = size_list = largest = 0;
+   for (offset = first_free; offset; offset = pfree->next_free) {
+      pfree = (FREE_DESCRIP *) ((char *) pheader + offset);
+      num_list++;
+      size_list += pfree->size;
+      if (pfree->size > largest)
+         largest = pfree->size;
+   }
+
+   num_class = size_class = 0;
+   for (i = 0; i < ODB_FREE_CLASSES; i++)
+      for (offset = free_class[i]; offset; offset = pfree->next_free) {
+         pfree = (FREE_DESCRIP *) ((char *) pheader + offset);
+         num_class++;
+         size_class += pfree->size;
+         if (pfree->size > largest)
+            largest = pfree->size;
+      }
+
+   sprintf(result + strlen(result), "Free list: %d blocks, %d bytes\n", num_list, size_list);
+   sprintf(result + strlen(result), "Size classes: %d blocks, %d bytes\n", num_class, size_class);
+
+   for (i = 0, n = 0; i < ODB_FREE_CLASSES; i++) {
+      INT count = 0;
+
+      for (offset = free_class[i]; offset; offset = ((FREE_DESCRIP *) ((char *) pheader + offset))->next_free)
+         count++;
+      if (count == 0)
+         continue;
+      sprintf(result + strlen(result), "%s%s%7d: %6d", n % 5 == 0 ? "" : "   ",
+              i < ODB_SLAB_CLASSES ? "  " : "<=", free_class_limit(i), count);
+      if (++n % 5 == 0)
+         strcat(result, "\n");
+   }
+   if (n % 5)
+      strcat(result, "\n");
+
+   sprintf(result + strlen(result), "Largest free block: %d bytes\n", largest);
+   if (size_list + size_class > 0)
+      sprintf(result + strlen(result), "Fragmentation: %1.1lf%% of free memory outside largest block\n",
+              100 * (1 - (double) largest / (size_list + size_class)));
+
+   return size_list + size_class;
+}
+
 INT db_show_mem(HNDLE hDB, char *result, INT buf_size, BOOL verbose)
 {
    DATABASE_HEADER *pheader;
@@ -397,7 +779,7 @@ INT db_show_mem(HNDLE hDB, char *result, INT buf_size, BOOL verbose)
    /* avoid compiler warning */
    total_size_data = buf_size;
 
-   db_lock_database(hDB);
+   db_lock_database_read(hDB);
 
    pheader = _database[hDB - 1].database_header;
 
@@ -420,6 +802,9 @@ INT db_show_mem(HNDLE hDB, char *result, INT buf_size, BOOL verbose)
       pfree = (FREE_DESCRIP *) ((char *) pheader + pfree->next_free);
    }
 
+   strcat(result, "\n");
+   total_size_key = show_free_stats(pheader, pheader->first_free_key, pheader->free_key_class, result);
+
    sprintf(result + strlen(result), "\nFree Key area: %d bytes out of %d bytes\n", total_size_key, pheader->key_size);
 
    strcat(result, "\nData:\n");
@@ -436,6 +821,9 @@ INT db_show_mem(HNDLE hDB, char *result, INT buf_size, BOOL verbose)
       pfree = (FREE_DESCRIP *) ((char *) pheader + pfree->next_free);
    }
 
+   strcat(result, "\n");
+   total_size_data = show_free_stats(pheader, pheader->first_free_data, pheader->free_data_class, result);
+
    sprintf(result + strlen(result), "\nFree Data area: %d bytes out of %d bytes\n", total_size_data, pheader->data_size);
 
    sprintf(result + strlen(result),
@@ -456,6 +844,145 @@ INT db_show_mem(HNDLE hDB, char *result, INT buf_size, BOOL verbose)
    return DB_SUCCESS;
 }
 
+/*------------------------------------------------------------------*/
+static BOOL db_collect_data(DATABASE_HEADER * pheader, KEY * pkey, MEM_BLOCK ** block, INT * n, INT * max)
+/* collect data blocks of all keys below pkey */
+{
+   KEYLIST *pkeylist;
+   INT i;
+
+   if (pkey->type != TID_KEY) {
+      if (pkey->data == 0 || pkey->total_size == 0)
+         return TRUE;
+
+      if (*n == *max) {
+         *max = *max ? 2 * *max : 1024;
+         *block = (MEM_BLOCK *) realloc(*block, *max * sizeof(MEM_BLOCK));
+         if (*block == NULL)
+            return FALSE;
+      }
+
+      (*block)[*n].offset = pkey->data;
+      (*block)[*n].size = ALIGN8(pkey->total_size);
+      (*block)[*n].pkey = pkey;
+      (*n)++;
+      return TRUE;
+   }
+
+   pkeylist = (KEYLIST *) ((char *) pheader + pkey->data);
+   pkey = (KEY *) ((char *) pheader + pkeylist->first_key);
+   for (i = 0; i < pkeylist->num_keys; i++) {
+      if (!db_collect_data(pheader, pkey, block, n, max))
+         return FALSE;
+      pkey = (KEY *) ((char *) pheader + pkey->next_key);
+   }
+
+   return TRUE;
+}
+
+/*------------------------------------------------------------------*/
+INT db_compact(HNDLE hDB, INT * moved)
+/********************************************************************\
+
+  Routine: db_compact
+
+  Purpose: Defragment the free memory of a database. Blocks in the
+           size class lists of the key area are melted back into its
+           free list. Keys cannot be moved since their offsets are used
+           as handles, but data blocks are only referenced by their key,
+           so all data is moved to the start of the data area, leaving
+           a single free block at its end. Works only locally.
+
+  Input:
+    HNDLE  hDB              Handle to the database
+
+  Output:
+    INT    *moved           Number of data bytes moved, may be NULL
+
+  Function value:
+    DB_SUCCESS              Successful completion
+    DB_INVALID_HANDLE       Database handle is invalid
+    DB_NO_MEMORY            Cannot allocate block list
+    DB_CORRUPTED            Data blocks overlap, nothing was moved
+
+\********************************************************************/
+{
+   DATABASE_HEADER *pheader;
+   MEM_BLOCK *block = NULL;
+   FREE_DESCRIP *pfree;
+   INT i, n, max, cursor, end, old_end;
+
+   if (moved)
+      *moved = 0;
+
+   if (hDB > _database_entries || hDB <= 0) {
+      cm_msg(MERROR, "db_compact", "invalid database handle");
+      return DB_INVALID_HANDLE;
+   }
+
+   db_lock_database(hDB);
+
+   pheader = _database[hDB - 1].database_header;
+
+   merge_free_classes(pheader, &pheader->first_free_key, pheader->free_key_class);
+
+   n = max = 0;
+   if (!db_collect_data(pheader, (KEY *) ((char *) pheader + pheader->root_key), &block, &n, &max)) {
+      db_unlock_database(hDB);
+      cm_msg(MERROR, "db_compact", "cannot allocate list of %d data blocks", max);
+      return DB_NO_MEMORY;
+   }
+
+   qsort(block, n, sizeof(MEM_BLOCK), mem_block_compare);
+
+   cursor = sizeof(DATABASE_HEADER) + pheader->key_size;
+   end = cursor + pheader->data_size;
+
+   /* check blocks before touching anything */
+   old_end = cursor;
+   for (i = 0; i < n; i++) {
+      if (block[i].offset < old_end || block[i].offset + block[i].size > end) {
+         cm_msg(MERROR, "db_compact", "database is corrupted: data block of key \"%s\" at 0x%08X, size %d",
+                block[i].pkey->name, block[i].offset - (int)sizeof(DATABASE_HEADER), block[i].size);
+         free(block);
+         db_unlock_database(hDB);
+         return DB_CORRUPTED;
+      }
+      old_end = block[i].offset + block[i].size;
+   }
+
+   /* slide all data blocks down, in address order they never overlap */
+   for (i = 0; i < n; i++) {
+      if (block[i].offset != cursor) {
+         memmove((char *) pheader + cursor, (char *) pheader + block[i].offset, block[i].size);
+         block[i].pkey->data = cursor;
+         if (moved)
+            *moved += block[i].size;
+      }
+      cursor += block[i].size;
+   }
+
+   free(block);
+
+   /* free memory is kept zero, except for the descriptors */
+   memset((char *) pheader + cursor, 0, old_end - cursor);
+   if (old_end < end)
+      memset((char *) pheader + old_end, 0, sizeof(FREE_DESCRIP));
+
+   memset(pheader->free_data_class, 0, sizeof(pheader->free_data_class));
+   if (cursor < end) {
+      pheader->first_free_data = cursor;
+      pfree = (FREE_DESCRIP *) ((char *) pheader + cursor);
+      pfree->size = end - cursor;
+      pfree->next_free = 0;
+   } else
+      pheader->first_free_data = 0;
+
+   db_unlock_database(hDB);
+
+   return DB_SUCCESS;
+}
+
 
 // Method to check if a given string is valid UTF-8.  Returns 1 if it is.
 // This method was taken from stackoverflow user Christoph, specifically
@@ -633,6 +1160,58 @@ static int db_validate_pkey(DATABASE_HEADER * pheader, KEY* pkey)
    return 1;
 }
 
+static int db_validate_hash(DATABASE_HEADER * pheader, const char *path, KEYLIST * pkeylist)
+/* check the name hash index of a keylist, returns 0 if it has to be rebuilt */
+{
+   KEYHASH *phash;
+   KEY *pkey;
+   INT i, n, offset, last_key;
+
+   if (!pkeylist->hash)
+      return 1;
+
+   if (!db_validate_key_offset(pheader, pkeylist->hash)) {
+      cm_msg(MERROR, "db_validate_key", "Warning: database corruption, key \"%s\", hash index 0x%08X is invalid", path, pkeylist->hash - (int)sizeof(DATABASE_HEADER));
+      pkeylist->hash = 0;
+      return 0;
+   }
+
+   phash = (KEYHASH *) ((char *) pheader + pkeylist->hash);
+
+   if (phash->size < 2 * KEYHASH_MIN_KEYS || (phash->size & (phash->size - 1)) ||
+       !db_validate_key_offset(pheader, pkeylist->hash + KEYHASH_SIZE(phash->size))) {
+      cm_msg(MERROR, "db_validate_key", "Warning: database corruption, key \"%s\", hash index size %d is invalid", path, phash->size);
+      pkeylist->hash = 0;
+      return 0;
+   }
+
+   /* every slot points to a key of this keylist */
+   for (i = n = 0; i < phash->size; i++) {
+      offset = phash->slot[i];
+      if (offset == 0 || offset == KEYHASH_DELETED)
+         continue;
+      if (!db_validate_key_offset(pheader, offset) ||
+          ((KEY *) ((char *) pheader + offset))->parent_keylist != (POINTER_T) pkeylist - (POINTER_T) pheader)
+         return 0;
+      n++;
+   }
+
+   if (n != pkeylist->num_keys)
+      return 0;
+
+   /* every key of this keylist is found */
+   pkey = (KEY *) ((char *) pheader + pkeylist->first_key);
+   last_key = 0;
+   for (i = 0; i < pkeylist->num_keys; i++) {
+      if (db_hash_find(pheader, pkeylist, pkey->name) != pkey)
+         return 0;
+      last_key = (POINTER_T) pkey - (POINTER_T) pheader;
+      pkey = (KEY *) ((char *) pheader + pkey->next_key);
+   }
+
+   return phash->last_key == last_key;
+}
+
 static int db_validate_key(DATABASE_HEADER * pheader, int recurse, const char *path, KEY * pkey)
 {
    KEYLIST *pkeylist;
@@ -742,6 +1321,14 @@ static int db_validate_key(DATABASE_HEADER * pheader, int recurse, const char *p
 
          pkey = (KEY *) ((char *) pheader + pkey->next_key);
       }
+
+      /* also adds the index to keylists of a database saved without it */
+      if (!pkeylist->hash)
+         db_hash_build(pheader, pkeylist);
+      else if (!db_validate_hash(pheader, path, pkeylist)) {
+         cm_msg(MINFO, "db_validate_key", "Warning: rebuilt name hash index of key \"%s\"", path);
+         db_hash_build(pheader, pkeylist);
+      }
    }
 
    return 1;
@@ -779,6 +1366,7 @@ static void db_validate_sizes()
       // ODB shared memory structures
       S(KEY);
       S(KEYLIST);
+      S(KEYHASH);
       S(OPEN_RECORD);
       S(DATABASE_CLIENT);
       S(DATABASE_HEADER);
@@ -812,16 +1400,17 @@ static void db_validate_sizes()
 #ifdef OS_LINUX
    assert(sizeof(EVENT_REQUEST) == 16); // ODB v3
    assert(sizeof(BUFFER_CLIENT) == 256);
-   assert(sizeof(BUFFER_HEADER) == 16444);
+   assert(sizeof(BUFFER_HEADER) == 24148);
    assert(sizeof(HIST_RECORD) == 20);
    assert(sizeof(DEF_RECORD) == 40);
    assert(sizeof(INDEX_RECORD) == 12);
    assert(sizeof(TAG) == 40);
    assert(sizeof(KEY) == 68);
-   assert(sizeof(KEYLIST) == 12);
+   assert(sizeof(KEYLIST) == 16); // ODB v4
+   assert(sizeof(KEYHASH) == 16);
    assert(sizeof(OPEN_RECORD) == 8);
    assert(sizeof(DATABASE_CLIENT) == 2112);
-   assert(sizeof(DATABASE_HEADER) == 135232);
+   assert(sizeof(DATABASE_HEADER) == 136524); // ODB v4
    assert(sizeof(EVENT_HEADER) == 16);
    //assert(sizeof(EQUIPMENT_INFO) == 696); has been moved to dynamic checking inside mhttpd.c
    assert(sizeof(EQUIPMENT_STATS) == 24);
@@ -983,11 +1572,43 @@ static int db_validate_open_records(HNDLE hDB)
    return DB_SUCCESS;
 }
 
+/*------------------------------------------------------------------*/
+static int db_validate_free_class(DATABASE_HEADER * pheader, const INT * free_class, BOOL data)
+/* check size class lists of key or data area, return free bytes or -1 */
+{
+   int i, n, offset, total_size = 0;
+   FREE_DESCRIP *pfree;
+
+   for (i = 0; i < ODB_FREE_CLASSES; i++) {
+      n = 0;
+      for (offset = free_class[i]; offset; offset = pfree->next_free) {
+         if (!(data ? db_validate_data_offset(pheader, offset) : db_validate_key_offset(pheader, offset))) {
+            cm_msg(MERROR, "db_validate_db", "Warning: database corruption, %s area size class %d offset 0x%08X",
+                   data ? "data" : "key", i, offset - (int)sizeof(DATABASE_HEADER));
+            return -1;
+         }
+
+         pfree = (FREE_DESCRIP *) ((char *) pheader + offset);
+         if (pfree->size <= 0 || pfree->size % 8 || free_class_index(pfree->size) != i ||
+             ++n > (data ? pheader->data_size : pheader->key_size) / 8) {
+            cm_msg(MERROR, "db_validate_db", "Warning: database corruption, %s area size class %d block 0x%08X has size %d",
+                   data ? "data" : "key", i, offset - (int)sizeof(DATABASE_HEADER), pfree->size);
+            return -1;
+         }
+
+         total_size += pfree->size;
+      }
+   }
+
+   return total_size;
+}
+
 /*------------------------------------------------------------------*/
 static int db_validate_db(DATABASE_HEADER * pheader)
 {
    int total_size_key = 0;
    int total_size_data = 0;
+   int size_class;
    double ratio;
    FREE_DESCRIP *pfree;
 
@@ -1023,6 +1644,11 @@ static int db_validate_db(DATABASE_HEADER * pheader)
       pfree = nextpfree;
    }
 
+   size_class = db_validate_free_class(pheader, pheader->free_key_class, FALSE);
+   if (size_class < 0)
+      return 0;
+   total_size_key += size_class;
+
    ratio = ((double) (pheader->key_size - total_size_key)) / ((double) pheader->key_size);
    if (ratio > 0.9)
       cm_msg(MERROR, "db_validate_db", "Warning: database key area is %.0f%% full", ratio * 100.0);
@@ -1060,6 +1686,11 @@ static int db_validate_db(DATABASE_HEADER * pheader)
       pfree = nextpfree;
    }
 
+   size_class = db_validate_free_class(pheader, pheader->free_data_class, TRUE);
+   if (size_class < 0)
+      return 0;
+   total_size_data += size_class;
+
    ratio = ((double) (pheader->data_size - total_size_data)) / ((double) pheader->data_size);
    if (ratio > 0.9)
       cm_msg(MERROR, "db_validate_db", "Warning: database data area is %.0f%% full", ratio * 100.0);
@@ -1299,6 +1930,7 @@ INT db_open_database(const char *xdatabase_name, INT database_size, HNDLE * hDB,
       return DB_NO_SEMAPHORE;
    }
    _database[handle].lock_cnt = 0;
+   _database[handle].num_locks = 0;
 
    /* first lock database */
    status = db_lock_database(handle + 1);
@@ -1411,6 +2043,7 @@ INT db_open_database(const char *xdatabase_name, INT database_size, HNDLE * hDB,
    _database[handle].attached = TRUE;
    _database[handle].shm_handle = shm_handle;
    _database[handle].protect = FALSE;
+   _database[handle].notify_serial = -1;
 
    /* remember to which connection acutal buffer belongs */
    if (rpc_get_server_option(RPC_OSERVER_TYPE) == ST_SINGLE)
@@ -1523,6 +2156,16 @@ INT db_close_database(HNDLE hDB)
 
       strlcpy(xname, pheader->name, sizeof(xname));
 
+      /* send notifications held back by the notify window */
+      db_flush_pending(hDB, TRUE);
+      db_free_notify(hDB);
+
+#ifdef HAVE_SS_FUTEX
+      /* db_unlock_database() below cannot access the header anymore */
+      SS_ATOMIC_STORE(&pheader->writer, FALSE);
+      ss_futex_wake(&pheader->writer);
+#endif
+
       /* unmap shared memory, delete it if we are the last */
       ss_shm_close(xname, pheader, _database[hDB - 1].shm_handle, destroy_flag);
 
@@ -1723,16 +2366,119 @@ INT db_set_client_name(HNDLE hDB, const char *client_name)
 /**dox***************************************************************/
 #endif                          /* DOXYGEN_SHOULD_SKIP_THIS */
 
-/********************************************************************/
-/**
-Lock a database for exclusive access via system semaphore calls.
-@param hDB   Handle to the database to lock
-@return DB_SUCCESS, DB_INVALID_HANDLE, DB_TIMEOUT
-*/
+/*------------------------------------------------------------------*/
 
-INT db_lock_database(HNDLE hDB)
+/* The ODB semaphore serializes the writers. A writer which holds it sets
+   pheader->writer and waits until pheader->num_readers drops to zero.
+   Readers do not take the semaphore. They increment num_readers and back
+   off while a writer is active, so writers are not starved. Each client
+   also counts its read locks in its DATABASE_CLIENT entry. If a reader
+   process dies, a waiting writer can then correct num_readers. Waiting
+   relies on futexes, without them all locks are exclusive. */
+
+#ifdef HAVE_SS_FUTEX
+
+static void db_correct_readers(DATABASE_HEADER * pheader)
+/* remove the read locks of processes which do not exist anymore */
+{
+   INT i, num_locks, excess;
+
+   /* a live process increments its read_locks before num_readers and
+      decrements it afterwards, so it never counts more in num_readers */
+   for (i = num_locks = 0; i < pheader->max_client_index; i++) {
+      if (pheader->client[i].pid == 0 || pheader->client[i].read_locks <= 0)
+         continue;
+#ifdef OS_UNIX
+#ifdef ESRCH
+      errno = 0;
+      kill(pheader->client[i].pid, 0);
+      if (errno == ESRCH)
+         continue;
+#endif
+#endif
+      num_locks += pheader->client[i].read_locks;
+   }
+
+   excess = SS_ATOMIC_LOAD(&pheader->num_readers) - num_locks;
+   if (excess > 0) {
+      SS_ATOMIC_ADD(&pheader->num_readers, -excess);
+      cm_msg(MINFO, "db_lock_database", "Removed %d read lock(s) of processes which do not exist anymore", excess);
+   }
+}
+
+static void db_wait_readers(HNDLE hDB)
+/* called by the writer with the semaphore held */
+{
+   DATABASE_HEADER *pheader;
+   DWORD start;
+   INT n;
+
+   pheader = _database[hDB - 1].database_header;
+   SS_ATOMIC_STORE(&pheader->writer, TRUE);
+   SS_ATOMIC_FENCE();
+
+   start = ss_millitime();
+   while ((n = SS_ATOMIC_LOAD(&pheader->num_readers)) > 0) {
+      if (ss_futex_wait(&pheader->num_readers, n, 1000) == SS_TIMEOUT) {
+         db_correct_readers(pheader);
+
+         /* same limit as for the semaphore */
+         if (ss_millitime() - start > 5 * 60 * 1000) {
+            cm_msg(MERROR, "db_lock_database", "timeout waiting for %d reader(s) of database, exiting...", n);
+            abort();
+         }
+      }
+   }
+}
+
+static void db_wait_writer(HNDLE hDB)
+/* obtain a read lock */
+{
+   DATABASE_HEADER *pheader;
+   DATABASE_CLIENT *pclient;
+   DWORD start;
+
+   pheader = _database[hDB - 1].database_header;
+   pclient = &pheader->client[_database[hDB - 1].client_index];
+
+   start = ss_millitime();
+   do {
+      pclient->read_locks++;
+      SS_ATOMIC_ADD(&pheader->num_readers, 1);
+      SS_ATOMIC_FENCE();
+
+      if (!SS_ATOMIC_LOAD(&pheader->writer))
+         return;
+
+      /* back off until the writer is done */
+      if (SS_ATOMIC_ADD(&pheader->num_readers, -1) == 0)
+         ss_futex_wake(&pheader->num_readers);
+      pclient->read_locks--;
+
+      while (SS_ATOMIC_LOAD(&pheader->writer)) {
+         if (ss_futex_wait(&pheader->writer, TRUE, 1000) != SS_TIMEOUT)
+            continue;
+
+         /* a writer which died leaves the flag set, but not the semaphore */
+         if (ss_semaphore_wait_for(_database[hDB - 1].semaphore, 1) == SS_SUCCESS) {
+            SS_ATOMIC_STORE(&pheader->writer, FALSE);
+            ss_futex_wake(&pheader->writer);
+            ss_semaphore_release(_database[hDB - 1].semaphore);
+         }
+
+         if (ss_millitime() - start > 5 * 60 * 1000) {
+            cm_msg(MERROR, "db_lock_database_read", "timeout obtaining read lock for database, exiting...");
+            abort();
+         }
+      }
+   } while (TRUE);
+}
+
+#endif                          /* HAVE_SS_FUTEX */
+
+/*------------------------------------------------------------------*/
+static INT db_lock(HNDLE hDB, BOOL read_only)
 {
-#ifdef LOCAL_ROUTINES
    int status;
    void *p;
 
@@ -1755,8 +2501,13 @@ INT db_lock_database(HNDLE hDB)
    }
 #endif
 
+#ifndef HAVE_SS_FUTEX
+   read_only = FALSE;
+#endif
+
    if (_database[hDB - 1].lock_cnt == 0) {
       _database[hDB - 1].lock_cnt = 1;
+      _database[hDB - 1].read_lock = read_only;
 
 #ifdef MULTI_THREAD_ENABLE
       ss_mutex_release(_database[hDB - 1].am);
@@ -1768,41 +2519,111 @@ INT db_lock_database(HNDLE hDB)
       }
 #endif
 
-
-      /* wait max. 5 minutes for semaphore (required if locking process is being debugged) */
-      status = ss_semaphore_wait_for(_database[hDB - 1].semaphore, 5 * 60 * 1000);
-      if (status == SS_TIMEOUT) {
-         cm_msg(MERROR, "db_lock_database", "timeout obtaining lock for database, exiting...");
-         abort();
-      }
-      if (status != SS_SUCCESS) {
-         cm_msg(MERROR, "db_lock_database", "cannot lock database, ss_semaphore_wait_for() status %d, aborting...", status);
-         abort();
+      if (!read_only) {
+         /* wait max. 5 minutes for semaphore (required if locking process is being debugged) */
+         status = ss_semaphore_wait_for(_database[hDB - 1].semaphore, 5 * 60 * 1000);
+         if (status == SS_TIMEOUT) {
+            cm_msg(MERROR, "db_lock_database", "timeout obtaining lock for database, exiting...");
+            abort();
+         }
+         if (status != SS_SUCCESS) {
+            cm_msg(MERROR, "db_lock_database", "cannot lock database, ss_semaphore_wait_for() status %d, aborting...", status);
+            abort();
+         }
       }
+
+      _database[hDB - 1].num_locks++;
    } else {
       _database[hDB - 1].lock_cnt++; // we have already the lock (recursive call), so just increase counter
+
+      /* a write lock inside a read lock has to wait for the other readers.
+         Other writers may get in between, so read-only functions should not
+         call functions which modify the database while they hold the lock. */
+      if (_database[hDB - 1].read_lock && !read_only) {
+         _database[hDB - 1].read_lock = FALSE;
+#ifdef HAVE_SS_FUTEX
+         {
+            DATABASE_HEADER *pheader = _database[hDB - 1].database_header;
+            if (SS_ATOMIC_ADD(&pheader->num_readers, -1) == 0)
+               ss_futex_wake(&pheader->num_readers);
+            pheader->client[_database[hDB - 1].client_index].read_locks--;
+         }
+#endif
+         status = ss_semaphore_wait_for(_database[hDB - 1].semaphore, 5 * 60 * 1000);
+         if (status != SS_SUCCESS) {
+            cm_msg(MERROR, "db_lock_database", "cannot lock database, ss_semaphore_wait_for() status %d, aborting...", status);
+            abort();
+         }
+#ifdef HAVE_SS_FUTEX
+         db_wait_readers(hDB);
+#endif
+      }
 #ifdef MULTI_THREAD_ENABLE
       ss_mutex_release(_database[hDB - 1].am);
 #endif
+      return DB_SUCCESS;
    }
 
 #ifdef CHECK_LOCK_COUNT
    {
       char str[256];
 
-      sprintf(str, "db_lock_database, lock_cnt=%d", _database[hDB - 1].lock_cnt);
-      ss_stack_history_entry(str);
-   }
-#endif
+      sprintf(str, "db_lock_database, lock_cnt=%d", _database[hDB - 1].lock_cnt);
+      ss_stack_history_entry(str);
+   }
+#endif
+
+   if (_database[hDB - 1].protect) {
+      if (_database[hDB - 1].database_header == NULL) {
+         ss_shm_unprotect(_database[hDB - 1].shm_handle, &p);
+         _database[hDB - 1].database_header = (DATABASE_HEADER *) p;
+      }
+   }
+
+#ifdef HAVE_SS_FUTEX
+   if (read_only)
+      db_wait_writer(hDB);
+   else
+      db_wait_readers(hDB);
+#endif
+
+   return DB_SUCCESS;
+}
+
+/********************************************************************/
+/**
+Lock a database for exclusive access via system semaphore calls.
+@param hDB   Handle to the database to lock
+@return DB_SUCCESS, DB_INVALID_HANDLE, DB_TIMEOUT
+*/
+
+INT db_lock_database(HNDLE hDB)
+{
+#ifdef LOCAL_ROUTINES
+   return db_lock(hDB, FALSE);
+#else
+   return DB_SUCCESS;
+#endif                          /* LOCAL_ROUTINES */
+}
+
+/********************************************************************/
+/**
+Lock a database for reading. Several processes can hold a read lock
+at the same time, while db_lock_database() waits until all of them
+have released it. A read lock inside a write lock is just counted,
+like a recursive write lock. Functions which hold a read lock must
+not modify the database.
+@param hDB   Handle to the database to lock
+@return DB_SUCCESS, DB_INVALID_HANDLE
+*/
 
-   if (_database[hDB - 1].protect) {
-      if (_database[hDB - 1].database_header == NULL) {
-         ss_shm_unprotect(_database[hDB - 1].shm_handle, &p);
-         _database[hDB - 1].database_header = (DATABASE_HEADER *) p;
-      }
-   }
-#endif                          /* LOCAL_ROUTINES */
+INT db_lock_database_read(HNDLE hDB)
+{
+#ifdef LOCAL_ROUTINES
+   return db_lock(hDB, TRUE);
+#else
    return DB_SUCCESS;
+#endif                          /* LOCAL_ROUTINES */
 }
 
 /********************************************************************/
@@ -1836,8 +2657,26 @@ INT db_unlock_database(HNDLE hDB)
    }
 #endif
 
-   if (_database[hDB - 1].lock_cnt == 1)
-      ss_semaphore_release(_database[hDB - 1].semaphore);
+   if (_database[hDB - 1].lock_cnt == 1) {
+#ifdef HAVE_SS_FUTEX
+      DATABASE_HEADER *pheader = _database[hDB - 1].database_header;
+
+      /* db_close_database() has unmapped the header already */
+      if (!_database[hDB - 1].attached)
+         ;
+      else if (_database[hDB - 1].read_lock) {
+         if (SS_ATOMIC_ADD(&pheader->num_readers, -1) == 0)
+            ss_futex_wake(&pheader->num_readers);
+         pheader->client[_database[hDB - 1].client_index].read_locks--;
+      } else {
+         SS_ATOMIC_STORE(&pheader->writer, FALSE);
+         ss_futex_wake(&pheader->writer);
+      }
+#endif
+      if (!_database[hDB - 1].read_lock)
+         ss_semaphore_release(_database[hDB - 1].semaphore);
+      _database[hDB - 1].read_lock = FALSE;
+   }
 
    if (_database[hDB - 1].protect) {
       ss_shm_protect(_database[hDB - 1].shm_handle, _database[hDB - 1].database_header);
@@ -1881,6 +2720,27 @@ INT db_get_lock_cnt(HNDLE hDB)
 #endif
 }
 
+/********************************************************************/
+
+double db_get_num_locks(HNDLE hDB)
+{
+#ifdef LOCAL_ROUTINES
+
+   /* return zero if no ODB is open or we run remotely */
+   if (_database_entries == 0)
+      return 0;
+
+   if (hDB > _database_entries || hDB <= 0) {
+      cm_msg(MERROR, "db_get_num_locks", "invalid database handle");
+      return 0;
+   }
+
+   return _database[hDB - 1].num_locks;
+#else
+   return 0;
+#endif
+}
+
 /********************************************************************/
 /**
 Protect a database for read/write access outside of the \b db_xxx functions
@@ -2042,18 +2902,31 @@ INT db_create_key(HNDLE hDB, HNDLE hKey, const char *key_name, DWORD type)
          pkey = (KEY *) ((char *) pheader + pkeylist->first_key);
          pprev_key = NULL;
 
-         for (i = 0; i < pkeylist->num_keys; i++) {
-            if (!db_validate_key_offset(pheader, pkey->next_key)) {
-               db_unlock_database(hDB);
-               cm_msg(MERROR, "db_create_key", "Warning: database corruption, key \"%s\", next_key 0x%08X", key_name, pkey->next_key - (int)sizeof(DATABASE_HEADER));
-               return DB_CORRUPTED;
+         if (pkeylist->hash) {
+            KEYHASH *phash = (KEYHASH *) ((char *) pheader + pkeylist->hash);
+
+            pkey = db_hash_find(pheader, pkeylist, str);
+            if (pkey) {
+               i = 0;
+            } else {
+               i = pkeylist->num_keys;
+               if (phash->last_key)
+                  pprev_key = (KEY *) ((char *) pheader + phash->last_key);
             }
+         } else {
+            for (i = 0; i < pkeylist->num_keys; i++) {
+               if (!db_validate_key_offset(pheader, pkey->next_key)) {
+                  db_unlock_database(hDB);
+                  cm_msg(MERROR, "db_create_key", "Warning: database corruption, key \"%s\", next_key 0x%08X", key_name, pkey->next_key - (int)sizeof(DATABASE_HEADER));
+                  return DB_CORRUPTED;
+               }
 
-            if (equal_ustring(str, pkey->name))
-               break;
+               if (equal_ustring(str, pkey->name))
+                  break;
 
-            pprev_key = pkey;
-            pkey = (KEY *) ((char *) pheader + pkey->next_key);
+               pprev_key = pkey;
+               pkey = (KEY *) ((char *) pheader + pkey->next_key);
+            }
          }
 
          if (i == pkeylist->num_keys) {
@@ -2066,8 +2939,6 @@ INT db_create_key(HNDLE hDB, HNDLE hKey, const char *key_name, DWORD type)
                return DB_NO_ACCESS;
             }
 
-            pkeylist->num_keys++;
-
             if (*pkey_name == '/' || type == TID_KEY) {
                /* create new key with keylist */
                pkey = (KEY *) malloc_key(pheader, sizeof(KEY));
@@ -2083,6 +2954,7 @@ INT db_create_key(HNDLE hDB, HNDLE hKey, const char *key_name, DWORD type)
                   pprev_key->next_key = (POINTER_T) pkey - (POINTER_T) pheader;
                else
                   pkeylist->first_key = (POINTER_T) pkey - (POINTER_T) pheader;
+               pkeylist->num_keys++;
 
                /* set key properties */
                pkey->type = TID_KEY;
@@ -2090,6 +2962,7 @@ INT db_create_key(HNDLE hDB, HNDLE hKey, const char *key_name, DWORD type)
                pkey->access_mode = MODE_READ | MODE_WRITE | MODE_DELETE;
                strlcpy(pkey->name, str, sizeof(pkey->name));
                pkey->parent_keylist = (POINTER_T) pkeylist - (POINTER_T) pheader;
+               db_hash_add(pheader, pkeylist, pkey);
 
                /* find space for new keylist */
                pkeylist = (KEYLIST *) malloc_key(pheader, sizeof(KEYLIST));
@@ -2123,12 +2996,14 @@ INT db_create_key(HNDLE hDB, HNDLE hKey, const char *key_name, DWORD type)
                   pprev_key->next_key = (POINTER_T) pkey - (POINTER_T) pheader;
                else
                   pkeylist->first_key = (POINTER_T) pkey - (POINTER_T) pheader;
+               pkeylist->num_keys++;
 
                pkey->type = type;
                pkey->num_values = 1;
                pkey->access_mode = MODE_READ | MODE_WRITE | MODE_DELETE;
                strlcpy(pkey->name, str, sizeof(pkey->name));
                pkey->parent_keylist = (POINTER_T) pkeylist - (POINTER_T) pheader;
+               db_hash_add(pheader, pkeylist, pkey);
 
                /* zero data */
                if (type != TID_STRING && type != TID_LINK) {
@@ -2363,9 +3238,10 @@ INT db_delete_key1(HNDLE hDB, HNDLE hKey, INT level, BOOL follow_links)
          }
 #endif
          /* delete key data */
-         if (pkey->type == TID_KEY)
+         if (pkey->type == TID_KEY) {
+            db_hash_free(pheader, (KEYLIST *) ((char *) pheader + pkey->data));
             free_key(pheader, (char *) pheader + pkey->data, pkey->total_size);
-         else
+         } else
             free_data(pheader, (char *) pheader + pkey->data, pkey->total_size);
 
          /* unlink key from list */
@@ -2375,12 +3251,14 @@ INT db_delete_key1(HNDLE hDB, HNDLE hKey, INT level, BOOL follow_links)
          if ((KEY *) ((char *) pheader + pkeylist->first_key) == pkey) {
             /* key is first in list */
             pkeylist->first_key = (POINTER_T) pnext_key;
+            db_hash_remove(pheader, pkeylist, pkey, NULL);
          } else {
             /* find predecessor */
             pkey_tmp = (KEY *) ((char *) pheader + pkeylist->first_key);
             while ((KEY *) ((char *) pheader + pkey_tmp->next_key) != pkey)
                pkey_tmp = (KEY *) ((char *) pheader + pkey_tmp->next_key);
             pkey_tmp->next_key = (POINTER_T) pnext_key;
+            db_hash_remove(pheader, pkeylist, pkey, pkey_tmp);
          }
 
          /* delete key */
@@ -2479,7 +3357,7 @@ INT db_find_key(HNDLE hDB, HNDLE hKey, const char *key_name, HNDLE * subhKey)
          return DB_INVALID_HANDLE;
       }
 
-      db_lock_database(hDB);
+      db_lock_database_read(hDB);
 
       pheader = _database[hDB - 1].database_header;
 
@@ -2549,18 +3427,23 @@ INT db_find_key(HNDLE hDB, HNDLE hKey, const char *key_name, HNDLE * subhKey)
          /* check if key is in keylist */
          pkey = (KEY *) ((char *) pheader + pkeylist->first_key);
 
-         for (i = 0; i < pkeylist->num_keys; i++) {
-            if (pkey->name[0] == 0 || !db_validate_key_offset(pheader, pkey->next_key)) {
-               db_unlock_database(hDB);
-               cm_msg(MERROR, "db_find_key", "Warning: database corruption, key \"%s\", next_key 0x%08X is invalid", key_name, pkey->next_key - (int)sizeof(DATABASE_HEADER));
-               *subhKey = 0;
-               return DB_CORRUPTED;
-            }
+         if (pkeylist->hash) {
+            pkey = db_hash_find(pheader, pkeylist, str);
+            i = pkey ? 0 : pkeylist->num_keys;
+         } else {
+            for (i = 0; i < pkeylist->num_keys; i++) {
+               if (pkey->name[0] == 0 || !db_validate_key_offset(pheader, pkey->next_key)) {
+                  db_unlock_database(hDB);
+                  cm_msg(MERROR, "db_find_key", "Warning: database corruption, key \"%s\", next_key 0x%08X is invalid", key_name, pkey->next_key - (int)sizeof(DATABASE_HEADER));
+                  *subhKey = 0;
+                  return DB_CORRUPTED;
+               }
 
-            if (equal_ustring(str, pkey->name))
-               break;
+               if (equal_ustring(str, pkey->name))
+                  break;
 
-            pkey = (KEY *) ((char *) pheader + pkey->next_key);
+               pkey = (KEY *) ((char *) pheader + pkey->next_key);
+            }
          }
 
          if (i == pkeylist->num_keys) {
@@ -2717,11 +3600,16 @@ INT db_find_key1(HNDLE hDB, HNDLE hKey, const char *key_name, HNDLE * subhKey)
          /* check if key is in keylist */
          pkey = (KEY *) ((char *) pheader + pkeylist->first_key);
 
-         for (i = 0; i < pkeylist->num_keys; i++) {
-            if (equal_ustring(str, pkey->name))
-               break;
+         if (pkeylist->hash) {
+            pkey = db_hash_find(pheader, pkeylist, str);
+            i = pkey ? 0 : pkeylist->num_keys;
+         } else {
+            for (i = 0; i < pkeylist->num_keys; i++) {
+               if (equal_ustring(str, pkey->name))
+                  break;
 
-            pkey = (KEY *) ((char *) pheader + pkey->next_key);
+               pkey = (KEY *) ((char *) pheader + pkey->next_key);
+            }
          }
 
          if (i == pkeylist->num_keys) {
@@ -2817,7 +3705,7 @@ INT db_find_link(HNDLE hDB, HNDLE hKey, const char *key_name, HNDLE * subhKey)
          return DB_INVALID_HANDLE;
       }
 
-      db_lock_database(hDB);
+      db_lock_database_read(hDB);
 
       pheader = _database[hDB - 1].database_header;
       if (!hKey)
@@ -2871,18 +3759,23 @@ INT db_find_link(HNDLE hDB, HNDLE hKey, const char *key_name, HNDLE * subhKey)
          /* check if key is in keylist */
          pkey = (KEY *) ((char *) pheader + pkeylist->first_key);
 
-         for (i = 0; i < pkeylist->num_keys; i++) {
-            if (!db_validate_key_offset(pheader, pkey->next_key)) {
-               db_unlock_database(hDB);
-               cm_msg(MERROR, "db_find_link", "Warning: database corruption, key \"%s\", next_key 0x%08X is invalid", key_name, pkey->next_key - (int)sizeof(DATABASE_HEADER));
-               *subhKey = 0;
-               return DB_CORRUPTED;
-            }
+         if (pkeylist->hash) {
+            pkey = db_hash_find(pheader, pkeylist, str);
+            i = pkey ? 0 : pkeylist->num_keys;
+         } else {
+            for (i = 0; i < pkeylist->num_keys; i++) {
+               if (!db_validate_key_offset(pheader, pkey->next_key)) {
+                  db_unlock_database(hDB);
+                  cm_msg(MERROR, "db_find_link", "Warning: database corruption, key \"%s\", next_key 0x%08X is invalid", key_name, pkey->next_key - (int)sizeof(DATABASE_HEADER));
+                  *subhKey = 0;
+                  return DB_CORRUPTED;
+               }
 
-            if (equal_ustring(str, pkey->name))
-               break;
+               if (equal_ustring(str, pkey->name))
+                  break;
 
-            pkey = (KEY *) ((char *) pheader + pkey->next_key);
+               pkey = (KEY *) ((char *) pheader + pkey->next_key);
+            }
          }
 
          if (i == pkeylist->num_keys) {
@@ -3021,17 +3914,22 @@ INT db_find_link1(HNDLE hDB, HNDLE hKey, const char *key_name, HNDLE * subhKey)
          /* check if key is in keylist */
          pkey = (KEY *) ((char *) pheader + pkeylist->first_key);
 
-         for (i = 0; i < pkeylist->num_keys; i++) {
-            if (!db_validate_key_offset(pheader, pkey->next_key)) {
-               cm_msg(MERROR, "db_find_link1", "Warning: database corruption, key \"%s\", next_key 0x%08X is invalid", key_name, pkey->next_key - (int)sizeof(DATABASE_HEADER));
-               *subhKey = 0;
-               return DB_CORRUPTED;
-            }
+         if (pkeylist->hash) {
+            pkey = db_hash_find(pheader, pkeylist, str);
+            i = pkey ? 0 : pkeylist->num_keys;
+         } else {
+            for (i = 0; i < pkeylist->num_keys; i++) {
+               if (!db_validate_key_offset(pheader, pkey->next_key)) {
+                  cm_msg(MERROR, "db_find_link1", "Warning: database corruption, key \"%s\", next_key 0x%08X is invalid", key_name, pkey->next_key - (int)sizeof(DATABASE_HEADER));
+                  *subhKey = 0;
+                  return DB_CORRUPTED;
+               }
 
-            if (equal_ustring(str, pkey->name))
-               break;
+               if (equal_ustring(str, pkey->name))
+                  break;
 
-            pkey = (KEY *) ((char *) pheader + pkey->next_key);
+               pkey = (KEY *) ((char *) pheader + pkey->next_key);
+            }
          }
 
          if (i == pkeylist->num_keys) {
@@ -3225,7 +4123,7 @@ INT db_get_path(HNDLE hDB, HNDLE hKey, char *path, INT buf_size)
          return DB_INVALID_HANDLE;
       }
 
-      db_lock_database(hDB);
+      db_lock_database_read(hDB);
 
       pheader = _database[hDB - 1].database_header;
       if (!hKey)
@@ -3300,7 +4198,7 @@ void db_find_open_records(HNDLE hDB, HNDLE hKey, KEY * key, INT level, void *res
       db_get_path(hDB, hKey, path, sizeof(path));
       sprintf(line, "%s open %d times by ", path, key->notify_count);
 
-      db_lock_database(hDB);
+      db_lock_database_read(hDB);
       pheader = _database[hDB - 1].database_header;
 
       for (i = 0; i < pheader->max_client_index; i++) {
@@ -3420,6 +4318,12 @@ INT level1;
   db_set_value(hDB, 0, "/Equipment/Trigger/Settings/Level1",
                           &level1, sizeof(level1), 1, TID_INT);
 \endcode
+Clients with a hot-link on the key get the first change at once. Further
+changes within the notify window (see db_set_notify_window()) are held
+back and sent by the next cm_yield() or the next ODB write of this
+process after the window has passed. A program which changes the ODB
+should therefore call cm_yield() regularly, otherwise the last changes
+can stay unsent.
 @param hDB          ODB handle obtained via cm_get_experiment_database().
 @param hKeyRoot Handle for key where search starts, zero for root.
 @param key_name Name of key to search, can contain directories.
@@ -3670,7 +4574,7 @@ INT db_get_value(HNDLE hDB, HNDLE hKeyRoot, const char *key_name, void *data, IN
          return status;
 
       /* now lock database */
-      db_lock_database(hDB);
+      db_lock_database_read(hDB);
       pheader = _database[hDB - 1].database_header;
 
       /* get address from handle */
@@ -3785,7 +4689,7 @@ INT db_enum_key(HNDLE hDB, HNDLE hKey, INT idx, HNDLE * subkey_handle)
       *subkey_handle = 0;
 
       /* first lock database */
-      db_lock_database(hDB);
+      db_lock_database_read(hDB);
 
       pheader = _database[hDB - 1].database_header;
       if (!hKey)
@@ -3905,7 +4809,7 @@ INT db_enum_link(HNDLE hDB, HNDLE hKey, INT idx, HNDLE * subkey_handle)
       *subkey_handle = 0;
 
       /* first lock database */
-      db_lock_database(hDB);
+      db_lock_database_read(hDB);
 
       pheader = _database[hDB - 1].database_header;
       if (!hKey)
@@ -3988,7 +4892,7 @@ INT db_get_next_link(HNDLE hDB, HNDLE hKey, HNDLE * subkey_handle)
       *subkey_handle = 0;
 
       /* first lock database */
-      db_lock_database(hDB);
+      db_lock_database_read(hDB);
 
       pheader = _database[hDB - 1].database_header;
       if (!hKey)
@@ -4124,7 +5028,7 @@ INT db_get_key(HNDLE hDB, HNDLE hKey, KEY * key)
          return DB_INVALID_HANDLE;
       }
 
-      db_lock_database(hDB);
+      db_lock_database_read(hDB);
 
       pheader = _database[hDB - 1].database_header;
 
@@ -4203,7 +5107,7 @@ INT db_get_link(HNDLE hDB, HNDLE hKey, KEY * key)
          return DB_INVALID_HANDLE;
       }
 
-      db_lock_database(hDB);
+      db_lock_database_read(hDB);
 
       pheader = _database[hDB - 1].database_header;
 
@@ -4267,7 +5171,7 @@ INT db_get_key_time(HNDLE hDB, HNDLE hKey, DWORD * delta)
          return DB_INVALID_HANDLE;
       }
 
-      db_lock_database(hDB);
+      db_lock_database_read(hDB);
 
       pheader = _database[hDB - 1].database_header;
       pkey = (KEY *) ((char *) pheader + hKey);
@@ -4326,7 +5230,7 @@ INT db_get_key_info(HNDLE hDB, HNDLE hKey, char *name, INT name_size, INT * type
          return DB_INVALID_HANDLE;
       }
 
-      db_lock_database(hDB);
+      db_lock_database_read(hDB);
 
       pheader = _database[hDB - 1].database_header;
       pkey = (KEY *) ((char *) pheader + hKey);
@@ -4398,6 +5302,7 @@ INT db_rename_key(HNDLE hDB, HNDLE hKey, const char *name)
    {
       DATABASE_HEADER *pheader;
       KEY *pkey;
+      KEYLIST *pkeylist;
       int status;
 
       if (hDB > _database_entries || hDB <= 0) {
@@ -4451,7 +5356,13 @@ INT db_rename_key(HNDLE hDB, HNDLE hKey, const char *name)
          return DB_INVALID_HANDLE;
       }
 
-      strlcpy(pkey->name, name, NAME_LENGTH);
+      if (pkey->parent_keylist) {
+         pkeylist = (KEYLIST *) ((char *) pheader + pkey->parent_keylist);
+         db_hash_remove(pheader, pkeylist, pkey, NULL);
+         strlcpy(pkey->name, name, NAME_LENGTH);
+         db_hash_add(pheader, pkeylist, pkey);
+      } else
+         strlcpy(pkey->name, name, NAME_LENGTH);
 
       db_unlock_database(hDB);
 
@@ -4592,6 +5503,9 @@ INT db_reorder_key(HNDLE hDB, HNDLE hKey, INT idx)
          }
       }
 
+      /* the hash index only has to know the new last key */
+      db_hash_update_last(pheader, pkeylist);
+
       db_unlock_database(hDB);
 
    }
@@ -4654,7 +5568,7 @@ INT db_get_data(HNDLE hDB, HNDLE hKey, void *data, INT * buf_size, DWORD type)
          return DB_INVALID_HANDLE;
       }
 
-      db_lock_database(hDB);
+      db_lock_database_read(hDB);
 
       pheader = _database[hDB - 1].database_header;
       pkey = (KEY *) ((char *) pheader + hKey);
@@ -4779,7 +5693,7 @@ INT db_get_link_data(HNDLE hDB, HNDLE hKey, void *data, INT * buf_size, DWORD ty
          return DB_INVALID_HANDLE;
       }
 
-      db_lock_database(hDB);
+      db_lock_database_read(hDB);
 
       pheader = _database[hDB - 1].database_header;
       pkey = (KEY *) ((char *) pheader + hKey);
@@ -4897,7 +5811,7 @@ INT db_get_data1(HNDLE hDB, HNDLE hKey, void *data, INT * buf_size, DWORD type,
          return DB_INVALID_HANDLE;
       }
 
-      db_lock_database(hDB);
+      db_lock_database_read(hDB);
 
       pheader = _database[hDB - 1].database_header;
       pkey = (KEY *) ((char *) pheader + hKey);
@@ -5005,7 +5919,7 @@ INT db_get_data_index(HNDLE hDB, HNDLE hKey, void *data, INT * buf_size, INT idx
          return DB_INVALID_HANDLE;
       }
 
-      db_lock_database(hDB);
+      db_lock_database_read(hDB);
 
       pheader = _database[hDB - 1].database_header;
       pkey = (KEY *) ((char *) pheader + hKey);
@@ -6026,8 +6940,8 @@ INT db_load(HNDLE hDB, HNDLE hKeyRoot, const char *filename, BOOL bRemote)
    if (rpc_is_remote() && bRemote)
       return rpc_call(RPC_DB_LOAD, hDB, hKeyRoot, filename);
 
-   /* open file */
-   hfile = open(filename, O_RDONLY | O_TEXT, 0644);
+   /* open file, binary since it may hold a snapshot */
+   hfile = open(filename, O_RDONLY | O_BINARY, 0644);
    if (hfile == -1) {
       cm_msg(MERROR, "db_load", "file \"%s\" not found", filename);
       return DB_FILE_ERROR;
@@ -6055,7 +6969,11 @@ INT db_load(HNDLE hDB, HNDLE hKeyRoot, const char *filename, BOOL bRemote)
 
    buffer[n] = 0;
 
-   if (strncmp(buffer, "<?xml version=\"1.0\"", 19) == 0) {
+   if (strncmp(buffer, ODB_SNAPSHOT_MAGIC, 8) == 0) {
+      status = db_paste_binary(hDB, hKeyRoot, buffer, n);
+      if (status != DB_SUCCESS)
+         printf("Error in file \"%s\"\n", filename);
+   } else if (strncmp(buffer, "<?xml version=\"1.0\"", 19) == 0) {
       status = db_paste_xml(hDB, hKeyRoot, buffer);
       if (status != DB_SUCCESS)
          printf("Error in file \"%s\"\n", filename);
@@ -6388,6 +7306,10 @@ INT db_paste(HNDLE hDB, HNDLE hKeyRoot, const char *buffer)
    HNDLE hKey;
    KEY root_key;
 
+   /* binary snapshot carries its own size */
+   if (strncmp(buffer, ODB_SNAPSHOT_MAGIC, 8) == 0)
+      return db_paste_binary(hDB, hKeyRoot, buffer, ((const ODB_SNAPSHOT_HEADER *) buffer)->total_size);
+
    title[0] = 0;
 
    if (hKeyRoot == 0)
@@ -6834,104 +7756,444 @@ int db_paste_node(HNDLE hDB, HNDLE hKeyRoot, PMXML_NODE node)
          }
       }
 
-      if (buf) {
-         free(buf);
-         buf = NULL;
+      if (buf) {
+         free(buf);
+         buf = NULL;
+      }
+   }
+
+   return DB_SUCCESS;
+}
+
+/********************************************************************/
+/**
+Paste an ODB subtree in XML format from a buffer
+@param hDB          ODB handle obtained via cm_get_experiment_database().
+@param hKeyRoot Handle for key where search starts, zero for root.
+@param buffer NULL-terminated buffer
+@return DB_SUCCESS, DB_INVALID_PARAM, DB_NO_MEMORY, DB_TYPE_MISMATCH
+*/
+INT db_paste_xml(HNDLE hDB, HNDLE hKeyRoot, const char *buffer)
+{
+   char error[256];
+   INT status;
+   PMXML_NODE tree, node;
+
+   if (hKeyRoot == 0)
+      db_find_key(hDB, hKeyRoot, "", &hKeyRoot);
+
+   /* parse XML buffer */
+   tree = mxml_parse_buffer(buffer, error, sizeof(error), NULL);
+   if (tree == NULL) {
+      puts(error);
+      return DB_TYPE_MISMATCH;
+   }
+
+   node = mxml_find_node(tree, "odb");
+   if (node == NULL) {
+      puts("Cannot find element \"odb\" in XML data");
+      return DB_TYPE_MISMATCH;
+   }
+
+   status = db_paste_node(hDB, hKeyRoot, node);
+
+   mxml_free_tree(tree);
+
+   return status;
+}
+
+/********************************************************************/
+/**
+Copy an ODB subtree in XML format to a buffer
+
+@param hDB          ODB handle obtained via cm_get_experiment_database().
+@param hKey Handle for key where search starts, zero for root.
+@param buffer ASCII buffer which receives ODB contents.
+@param buffer_size Size of buffer, returns remaining space in buffer.
+@return DB_SUCCESS, DB_TRUNCATED, DB_NO_MEMORY
+*/
+INT db_copy_xml(HNDLE hDB, HNDLE hKey, char *buffer, INT * buffer_size)
+{
+#ifdef LOCAL_ROUTINES
+   {
+      INT len;
+      char *p, str[256];
+      MXML_WRITER *writer;
+
+      /* open file */
+      writer = mxml_open_buffer();
+      if (writer == NULL) {
+         cm_msg(MERROR, "db_copy_xml", "Cannot allocate buffer");
+         return DB_NO_MEMORY;
+      }
+
+      db_get_path(hDB, hKey, str, sizeof(str));
+
+      /* write XML header */
+      mxml_start_element(writer, "odb");
+      mxml_write_attribute(writer, "root", str);
+      mxml_write_attribute(writer, "xmlns:xsi", "http://www.w3.org/2001/XMLSchema-instance");
+      mxml_write_attribute(writer, "xsi:noNamespaceSchemaLocation", "http://midas.psi.ch/odb.xsd");
+
+      db_save_xml_key(hDB, hKey, 0, writer);
+
+      mxml_end_element(writer); // "odb"
+      p = mxml_close_buffer(writer);
+
+      strlcpy(buffer, p, *buffer_size);
+      len = strlen(p);
+      free(p);
+      p = NULL;
+      if (len > *buffer_size) {
+         *buffer_size = 0;
+         return DB_TRUNCATED;
+      }
+
+      *buffer_size -= len;
+   }
+#endif                          /* LOCAL_ROUTINES */
+
+   return DB_SUCCESS;
+}
+
+/**dox***************************************************************/
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+#ifdef LOCAL_ROUTINES
+
+typedef struct {
+   ODB_SNAPSHOT_KEY *key;       /* key array, NULL while counting */
+   char *strings;               /* string table                   */
+   char *data;                  /* data section                   */
+   INT num_keys;
+   INT strings_size;
+   INT data_size;
+} SNAPSHOT_WRITER;
+
+static void db_snapshot_key(DATABASE_HEADER * pheader, const KEY * pkey, INT parent, SNAPSHOT_WRITER * w)
+/* append pkey and its subkeys to snapshot, or only count them */
+{
+   const KEYLIST *pkeylist;
+   ODB_SNAPSHOT_KEY *pskey;
+   INT i, index, len, size;
+
+   index = w->num_keys++;
+   len = strlen(pkey->name) + 1;
+   size = 0;
+   if (pkey->type != TID_KEY && pkey->data)
+      size = pkey->item_size * pkey->num_values;
+
+   if (w->key) {
+      pskey = w->key + index;
+      pskey->parent = parent;
+      pskey->type = pkey->type;
+      pskey->num_values = pkey->num_values;
+      pskey->item_size = pkey->item_size;
+      pskey->name = w->strings_size;
+      pskey->data = w->data_size;
+      pskey->access_mode = pkey->access_mode;
+      pskey->reserved = 0;
+      pskey->last_written = pkey->last_written;
+
+      memcpy(w->strings + w->strings_size, pkey->name, len);
+      if (size > 0)
+         memcpy(w->data + w->data_size, (char *) pheader + pkey->data, size);
+   }
+
+   w->strings_size += len;
+   w->data_size += ALIGN8(size);
+
+   if (pkey->type == TID_KEY) {
+      pkeylist = (const KEYLIST *) ((char *) pheader + pkey->data);
+      pkey = (const KEY *) ((char *) pheader + pkeylist->first_key);
+      for (i = 0; i < pkeylist->num_keys; i++) {
+         db_snapshot_key(pheader, pkey, index, w);
+         pkey = (const KEY *) ((char *) pheader + pkey->next_key);
+      }
+   }
+}
+
+#endif                          /* LOCAL_ROUTINES */
+
+static BOOL db_snapshot_system_clients(const ODB_SNAPSHOT_HEADER * ph, const ODB_SNAPSHOT_KEY * pskey,
+                                       const char *strings, INT index)
+/* check if a snapshot key is /System/Clients, which is never pasted */
+{
+   char path[MAX_ODB_PATH], str[MAX_ODB_PATH];
+
+   if (index > 0 && !equal_ustring(strings + pskey[index].name, "Clients"))
+      return FALSE;
+
+   /* build path from the back */
+   path[0] = 0;
+   for (; index > 0; index = pskey[index].parent) {
+      strlcpy(str, "/", sizeof(str));
+      strlcat(str, strings + pskey[index].name, sizeof(str));
+      strlcat(str, path, sizeof(str));
+      strlcpy(path, str, sizeof(path));
+   }
+   strlcpy(str, strings + ph->path, sizeof(str));
+   if (strcmp(str, "/") == 0)
+      str[0] = 0;
+   strlcat(str, path, sizeof(str));
+
+   str[15] = 0;
+   return equal_ustring(str, "/System/Clients");
+}
+
+/**dox***************************************************************/
+#endif                          /* DOXYGEN_SHOULD_SKIP_THIS */
+
+/********************************************************************/
+/**
+Copy an ODB subtree to a buffer as binary snapshot
+
+The snapshot contains the keys of the subtree in pre-order together
+with their names and data, see ODB_SNAPSHOT_HEADER. It is taken while
+the database is locked, so it is consistent. The function db_paste_binary()
+restores it, db_paste() and db_load() recognize it as well. db_save()
+writes snapshots for file names ending in ".bin". Snapshots use the byte
+order of the machine which wrote them.
+@param hDB          ODB handle obtained via cm_get_experiment_database().
+@param hKey Handle for key where search starts, zero for root.
+@param buffer Buffer which receives the snapshot.
+@param buffer_size Size of buffer, returns number of bytes used.
+@return DB_SUCCESS, DB_TRUNCATED, DB_INVALID_HANDLE
+*/
+INT db_copy_binary(HNDLE hDB, HNDLE hKey, char *buffer, INT * buffer_size)
+{
+   if (rpc_is_remote())
+      return rpc_call(RPC_DB_COPY_BINARY, hDB, hKey, buffer, buffer_size);
+
+#ifdef LOCAL_ROUTINES
+   {
+      DATABASE_HEADER *pheader;
+      ODB_SNAPSHOT_HEADER *ph;
+      SNAPSHOT_WRITER w;
+      KEY *pkey;
+      INT size, status;
+      char path[MAX_ODB_PATH];
+
+      if (hDB > _database_entries || hDB <= 0) {
+         cm_msg(MERROR, "db_copy_binary", "invalid database handle");
+         return DB_INVALID_HANDLE;
+      }
+
+      strlcpy(path, "/", sizeof(path));
+      if (hKey) {
+         status = db_get_path(hDB, hKey, path, sizeof(path));
+         if (status != DB_SUCCESS)
+            return status;
+      }
+
+      db_lock_database_read(hDB);
+
+      pheader = _database[hDB - 1].database_header;
+      if (!hKey)
+         hKey = pheader->root_key;
+
+      if (!db_validate_hkey(pheader, hKey)) {
+         db_unlock_database(hDB);
+         return DB_INVALID_HANDLE;
+      }
+
+      pkey = (KEY *) ((char *) pheader + hKey);
+
+      /* count keys and sizes first */
+      memset(&w, 0, sizeof(w));
+      w.strings_size = strlen(path) + 1;
+      db_snapshot_key(pheader, pkey, -1, &w);
+
+      size = sizeof(ODB_SNAPSHOT_HEADER) + w.num_keys * sizeof(ODB_SNAPSHOT_KEY) + ALIGN8(w.strings_size) + w.data_size;
+      if (size > *buffer_size) {
+         db_unlock_database(hDB);
+         return DB_TRUNCATED;
       }
+
+      memset(buffer, 0, size);
+      ph = (ODB_SNAPSHOT_HEADER *) buffer;
+      memcpy(ph->magic, ODB_SNAPSHOT_MAGIC, sizeof(ph->magic));
+      ph->version = ODB_SNAPSHOT_VERSION;
+      ph->byte_order = ODB_SNAPSHOT_ORDER;
+      ph->total_size = size;
+      ph->num_keys = w.num_keys;
+      ph->strings_size = ALIGN8(w.strings_size);
+      ph->data_size = w.data_size;
+      ph->path = 0;
+
+      w.key = (ODB_SNAPSHOT_KEY *) (ph + 1);
+      w.strings = (char *) (w.key + w.num_keys);
+      w.data = w.strings + ph->strings_size;
+      strcpy(w.strings, path);
+      w.num_keys = 0;
+      w.strings_size = strlen(path) + 1;
+      w.data_size = 0;
+      db_snapshot_key(pheader, pkey, -1, &w);
+
+      db_unlock_database(hDB);
+
+      *buffer_size = size;
    }
+#endif                          /* LOCAL_ROUTINES */
 
    return DB_SUCCESS;
 }
 
 /********************************************************************/
 /**
-Paste an ODB subtree in XML format from a buffer
+Restore an ODB subtree from a binary snapshot
+
+The first key of the snapshot is restored at the path it was copied
+from, relative to hKeyRoot like the [/path] sections of db_paste().
+Keys missing in the ODB are
+created, existing keys keep their place and get the data of the
+snapshot, so pasting into an empty subtree gives an exact copy of the
+original. Like db_paste(), access modes of the ODB are obeyed and not
+changed, and /System/Clients is skipped.
 @param hDB          ODB handle obtained via cm_get_experiment_database().
-@param hKeyRoot Handle for key where search starts, zero for root.
-@param buffer NULL-terminated buffer
-@return DB_SUCCESS, DB_INVALID_PARAM, DB_NO_MEMORY, DB_TYPE_MISMATCH
+@param hKeyRoot Handle for key below which the snapshot is restored, zero for the root.
+@param buffer Snapshot from db_copy_binary().
+@param buffer_size Number of valid bytes in buffer.
+@return DB_SUCCESS, DB_INVALID_PARAM, DB_VERSION_MISMATCH, DB_TYPE_MISMATCH, DB_NO_MEMORY,
+or the first error of db_create_key() or db_set_link_data()
 */
-INT db_paste_xml(HNDLE hDB, HNDLE hKeyRoot, const char *buffer)
+INT db_paste_binary(HNDLE hDB, HNDLE hKeyRoot, const char *buffer, INT buffer_size)
 {
-   char error[256];
-   INT status;
-   PMXML_NODE tree, node;
+   const ODB_SNAPSHOT_HEADER *ph;
+   const ODB_SNAPSHOT_KEY *pskey;
+   const char *strings, *data, *name;
+   HNDLE hKey, *hkey;
+   KEY key;
+   INT i, size, status, first_error;
 
-   if (hKeyRoot == 0)
-      db_find_key(hDB, hKeyRoot, "", &hKeyRoot);
+   ph = (const ODB_SNAPSHOT_HEADER *) buffer;
+   if (buffer_size < (int) sizeof(ODB_SNAPSHOT_HEADER) || memcmp(ph->magic, ODB_SNAPSHOT_MAGIC, sizeof(ph->magic)) != 0) {
+      cm_msg(MERROR, "db_paste_binary", "buffer does not contain an ODB snapshot");
+      return DB_INVALID_PARAM;
+   }
 
-   /* parse XML buffer */
-   tree = mxml_parse_buffer(buffer, error, sizeof(error), NULL);
-   if (tree == NULL) {
-      puts(error);
-      return DB_TYPE_MISMATCH;
+   if (ph->byte_order != ODB_SNAPSHOT_ORDER || ph->version != ODB_SNAPSHOT_VERSION) {
+      cm_msg(MERROR, "db_paste_binary", "ODB snapshot version %d, byte order 0x%08X is not supported",
+             ph->version, ph->byte_order);
+      return DB_VERSION_MISMATCH;
    }
 
-   node = mxml_find_node(tree, "odb");
-   if (node == NULL) {
-      puts("Cannot find element \"odb\" in XML data");
-      return DB_TYPE_MISMATCH;
+   if (ph->total_size > buffer_size || ph->num_keys < 1 || ph->strings_size < 1 || ph->data_size < 0 ||
+       ph->total_size != (int) sizeof(ODB_SNAPSHOT_HEADER) + ph->num_keys * (int) sizeof(ODB_SNAPSHOT_KEY) +
+       ph->strings_size + ph->data_size) {
+      cm_msg(MERROR, "db_paste_binary", "ODB snapshot is truncated or corrupted");
+      return DB_INVALID_PARAM;
    }
 
-   status = db_paste_node(hDB, hKeyRoot, node);
+   pskey = (const ODB_SNAPSHOT_KEY *) (ph + 1);
+   strings = (const char *) (pskey + ph->num_keys);
+   data = strings + ph->strings_size;
 
-   mxml_free_tree(tree);
+   /* check all offsets before touching the ODB */
+   if (strings[ph->strings_size - 1] != 0 || ph->path < 0 || ph->path >= ph->strings_size) {
+      cm_msg(MERROR, "db_paste_binary", "ODB snapshot has corrupted string table");
+      return DB_INVALID_PARAM;
+   }
+   for (i = 0; i < ph->num_keys; i++) {
+      size = pskey[i].type == TID_KEY ? 0 : pskey[i].item_size * pskey[i].num_values;
+      if (pskey[i].parent < (i == 0 ? -1 : 0) || pskey[i].parent >= i ||
+          pskey[i].name < 0 || pskey[i].name >= ph->strings_size || (i > 0 && strings[pskey[i].name] == 0) ||
+          pskey[i].type == 0 || pskey[i].type >= TID_LAST ||
+          (pskey[i].type != TID_KEY &&
+           (pskey[i].num_values < 0 || pskey[i].item_size < 0 ||
+            (pskey[i].num_values > 0 && pskey[i].item_size > ph->data_size / pskey[i].num_values) ||
+            pskey[i].data < 0 || pskey[i].data > ph->data_size - size))) {
+         cm_msg(MERROR, "db_paste_binary", "ODB snapshot has corrupted key %d", i);
+         return DB_INVALID_PARAM;
+      }
+   }
 
-   return status;
-}
+   hkey = (HNDLE *) malloc(ph->num_keys * sizeof(HNDLE));
+   if (hkey == NULL) {
+      cm_msg(MERROR, "db_paste_binary", "cannot allocate handle list for %d keys", ph->num_keys);
+      return DB_NO_MEMORY;
+   }
 
-/********************************************************************/
-/**
-Copy an ODB subtree in XML format to a buffer
+   /* destination of first key is its saved path below hKeyRoot,
+      like the [/path] sections of db_paste() */
+   status = db_find_link(hDB, hKeyRoot, strings + ph->path, &hKey);
+   if (status == DB_NO_KEY) {
+      status = db_create_key(hDB, hKeyRoot, strings + ph->path, pskey[0].type);
+      if (status == DB_SUCCESS)
+         status = db_find_link(hDB, hKeyRoot, strings + ph->path, &hKey);
+   }
+   if (status != DB_SUCCESS) {
+      free(hkey);
+      return status;
+   }
+   hKeyRoot = hKey;
 
-@param hDB          ODB handle obtained via cm_get_experiment_database().
-@param hKey Handle for key where search starts, zero for root.
-@param buffer ASCII buffer which receives ODB contents.
-@param buffer_size Size of buffer, returns remaining space in buffer.
-@return DB_SUCCESS, DB_TRUNCATED, DB_NO_MEMORY
-*/
-INT db_copy_xml(HNDLE hDB, HNDLE hKey, char *buffer, INT * buffer_size)
-{
-#ifdef LOCAL_ROUTINES
-   {
-      INT len;
-      char *p, str[256];
-      MXML_WRITER *writer;
+   status = db_get_link(hDB, hKeyRoot, &key);
+   if (status != DB_SUCCESS) {
+      free(hkey);
+      return status;
+   }
 
-      /* open file */
-      writer = mxml_open_buffer();
-      if (writer == NULL) {
-         cm_msg(MERROR, "db_copy_xml", "Cannot allocate buffer");
-         return DB_NO_MEMORY;
-      }
+   if ((key.type == TID_KEY) != (pskey[0].type == TID_KEY)) {
+      cm_msg(MERROR, "db_paste_binary", "cannot paste snapshot of %s \"%s\" into %s \"%s\"",
+             rpc_tid_name(pskey[0].type), strings + pskey[0].name, rpc_tid_name(key.type), key.name);
+      free(hkey);
+      return DB_TYPE_MISMATCH;
+   }
 
-      db_get_path(hDB, hKey, str, sizeof(str));
+   first_error = DB_SUCCESS;
 
-      /* write XML header */
-      mxml_start_element(writer, "odb");
-      mxml_write_attribute(writer, "root", str);
-      mxml_write_attribute(writer, "xmlns:xsi", "http://www.w3.org/2001/XMLSchema-instance");
-      mxml_write_attribute(writer, "xsi:noNamespaceSchemaLocation", "http://midas.psi.ch/odb.xsd");
+   db_begin_batch(hDB);
 
-      db_save_xml_key(hDB, hKey, 0, writer);
+#ifdef LOCAL_ROUTINES
+   /* hold the lock across the whole paste, so that the per-key calls
+      below only increment the lock counter instead of taking the semaphore */
+   if (!rpc_is_remote())
+      db_lock_database(hDB);
+#endif
 
-      mxml_end_element(writer); // "odb"
-      p = mxml_close_buffer(writer);
+   for (i = 0; i < ph->num_keys; i++) {
+      name = strings + pskey[i].name;
 
-      strlcpy(buffer, p, *buffer_size);
-      len = strlen(p);
-      free(p);
-      p = NULL;
-      if (len > *buffer_size) {
-         *buffer_size = 0;
-         return DB_TRUNCATED;
+      if (db_snapshot_system_clients(ph, pskey, strings, i))
+         hkey[i] = 0;
+      else if (i == 0)
+         hkey[i] = hKeyRoot;
+      else if (hkey[pskey[i].parent] == 0)
+         hkey[i] = 0;
+      else {
+         status = db_find_link(hDB, hkey[pskey[i].parent], name, &hkey[i]);
+         if (status == DB_NO_KEY) {
+            status = db_create_key(hDB, hkey[pskey[i].parent], name, pskey[i].type);
+            if (status == DB_SUCCESS)
+               status = db_find_link(hDB, hkey[pskey[i].parent], name, &hkey[i]);
+         }
+         if (status != DB_SUCCESS) {
+            hkey[i] = 0;
+            if (first_error == DB_SUCCESS)
+               first_error = status;
+         }
       }
 
-      *buffer_size -= len;
+      /* set key data if created sucessfully */
+      if (hkey[i] && pskey[i].type != TID_KEY && pskey[i].num_values > 0) {
+         status = db_set_link_data(hDB, hkey[i], data + pskey[i].data, pskey[i].item_size * pskey[i].num_values,
+                                   pskey[i].num_values, pskey[i].type);
+         if (status != DB_SUCCESS && first_error == DB_SUCCESS)
+            first_error = status;
+      }
    }
-#endif                          /* LOCAL_ROUTINES */
 
-   return DB_SUCCESS;
+#ifdef LOCAL_ROUTINES
+   if (!rpc_is_remote())
+      db_unlock_database(hDB);
+#endif
+
+   db_end_batch(hDB);
+
+   free(hkey);
+
+   return first_error;
 }
 
 /**dox***************************************************************/
@@ -7079,7 +8341,8 @@ Save a branch of a database to an .ODB file
 
 This function is used by the ODBEdit command save. For a
 description of the ASCII format, see db_copy(). Data of the whole ODB can
-be saved (hkey equal zero) or only a sub-tree.
+be saved (hkey equal zero) or only a sub-tree. If the file name ends
+in ".bin", a binary snapshot is written instead, see db_copy_binary().
 @param hDB          ODB handle obtained via cm_get_experiment_database().
 @param hKey Handle for key where search starts, zero for root.
 @param filename Filename of .ODB file.
@@ -7095,9 +8358,12 @@ INT db_save(HNDLE hDB, HNDLE hKey, const char *filename, BOOL bRemote)
    {
       INT hfile, size, buffer_size, n, status;
       char *buffer, path[256];
+      BOOL binary;
+
+      binary = strlen(filename) > 4 && strcmp(filename + strlen(filename) - 4, ".bin") == 0;
 
       /* open file */
-      hfile = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_TEXT, 0644);
+      hfile = open(filename, O_WRONLY | O_CREAT | O_TRUNC | (binary ? O_BINARY : O_TEXT), 0644);
       if (hfile == -1) {
          cm_msg(MERROR, "db_save", "Cannot open file \"%s\"", filename);
          return DB_FILE_ERROR;
@@ -7114,7 +8380,12 @@ INT db_save(HNDLE hDB, HNDLE hKey, const char *filename, BOOL bRemote)
          }
 
          size = buffer_size;
-         status = db_copy(hDB, hKey, buffer, &size, path);
+         if (binary) {
+            status = db_copy_binary(hDB, hKey, buffer, &size);
+            /* number of bytes used, like remaining space of db_copy() */
+            size = buffer_size - size;
+         } else
+            status = db_copy(hDB, hKey, buffer, &size, path);
          if (status != DB_TRUNCATED) {
             n = write(hfile, buffer, buffer_size - size);
             free(buffer);
@@ -7368,256 +8639,284 @@ INT db_save_xml(HNDLE hDB, HNDLE hKey, const char *filename)
 
 /*------------------------------------------------------------------*/
 
-static void json_write(char **buffer, int* buffer_size, int* buffer_end, int level, const char* s, int quoted)
+/* JSON output is collected in a buffer which grows geometrically. If the
+   sink has a file descriptor, the buffer is written out whenever it is
+   full, so a large subtree is streamed in chunks of JSON_CHUNK_SIZE
+   instead of being built up in memory first. While the database is
+   locked ("hold"), the buffer grows instead, so that no ODB writer has to
+   wait for the disk. */
+
+#define JSON_CHUNK_SIZE (64*1024)
+
+typedef struct {
+   char **buffer;               /* output buffer, may be reallocated */
+   int *buffer_size;            /* allocated size of buffer */
+   int *buffer_end;             /* number of bytes in buffer, excluding NUL */
+   int fd;                      /* file or socket to flush into, -1 for none */
+   int status;                  /* DB_FILE_ERROR if a flush failed */
+   BOOL hold;                   /* database is locked, do not flush */
+} JSON_SINK;
+
+static void json_sink_init(JSON_SINK *js, char **buffer, int *buffer_size, int *buffer_end, int fd)
 {
-   int len, remain, xlevel;
+   js->buffer = buffer;
+   js->buffer_size = buffer_size;
+   js->buffer_end = buffer_end;
+   js->fd = fd;
+   js->status = DB_SUCCESS;
+   js->hold = FALSE;
+}
 
-   len = strlen(s);
-   remain = *buffer_size - *buffer_end;
-   assert(remain >= 0);
+static void json_flush(JSON_SINK *js)
+{
+   int n, offset;
 
-   xlevel = 2*level;
+   if (js->fd < 0 || *js->buffer_end == 0)
+      return;
 
-   while (10 + xlevel + 3*len > remain) {
-      // reallocate the buffer
-      int new_buffer_size = 2*(*buffer_size);
-      if (new_buffer_size < 4*1024)
-         new_buffer_size = 4*1024;
-      //printf("reallocate: len %d, size %d, remain %d, allocate %d\n", len, *buffer_size, remain, new_buffer_size);
-      *buffer = (char *)realloc(*buffer, new_buffer_size);
-      assert(*buffer);
-      *buffer_size = new_buffer_size;
-      remain = *buffer_size - *buffer_end;
-      assert(remain >= 0);
+   for (offset = 0; offset < *js->buffer_end; offset += n) {
+      n = write(js->fd, *js->buffer + offset, *js->buffer_end - offset);
+      if (n <= 0) {
+         if (js->status == DB_SUCCESS)
+            cm_msg(MERROR, "json_flush", "cannot write %d bytes, errno %d (%s)", *js->buffer_end - offset, errno, strerror(errno));
+         js->status = DB_FILE_ERROR;
+         break;
+      }
    }
 
-   if (xlevel) {
-      int i;
-      for (i=0; i<xlevel; i++)
-         (*buffer)[(*buffer_end)++] = ' ';
-   }
+   *js->buffer_end = 0;
+   (*js->buffer)[0] = 0;
+}
 
-   if (!quoted) {
-      memcpy(*buffer + *buffer_end, s, len);
-      *buffer_end += len;
-      (*buffer)[*buffer_end] = 0; // NUL-terminate the buffer
+static void json_reserve(JSON_SINK *js, int len)
+{
+   int new_buffer_size;
+
+   if (*js->buffer_end + len < *js->buffer_size)
       return;
-   }
 
-   (*buffer)[(*buffer_end)++] = '"';
+   if (!js->hold)
+      json_flush(js);
 
-   while (*s) {
-      switch (*s) {
-      case '\"':
-         (*buffer)[(*buffer_end)++] = '\\';
-         (*buffer)[(*buffer_end)++] = '\"';
-         s++;
-         break;
-      case '\\':
-         (*buffer)[(*buffer_end)++] = '\\';
-         (*buffer)[(*buffer_end)++] = '\\';
-         s++;
-         break;
-#if 0
-      case '/':
-         (*buffer)[(*buffer_end)++] = '\\';
-         (*buffer)[(*buffer_end)++] = '/';
-         s++;
-         break;
-#endif
-      case '\b':
-         (*buffer)[(*buffer_end)++] = '\\';
-         (*buffer)[(*buffer_end)++] = 'b';
-         s++;
-         break;
-      case '\f':
-         (*buffer)[(*buffer_end)++] = '\\';
-         (*buffer)[(*buffer_end)++] = 'f';
-         s++;
-         break;
-      case '\n':
-         (*buffer)[(*buffer_end)++] = '\\';
-         (*buffer)[(*buffer_end)++] = 'n';
-         s++;
-         break;
-      case '\r':
-         (*buffer)[(*buffer_end)++] = '\\';
-         (*buffer)[(*buffer_end)++] = 'r';
-         s++;
-         break;
-      case '\t':
-         (*buffer)[(*buffer_end)++] = '\\';
-         (*buffer)[(*buffer_end)++] = 't';
-         s++;
-         break;
-      default:
-         (*buffer)[(*buffer_end)++] = *s++;
+   if (*js->buffer_end + len < *js->buffer_size)
+      return;
+
+   new_buffer_size = *js->buffer_size;
+   if (new_buffer_size < 4*1024)
+      new_buffer_size = js->fd < 0 ? 4*1024 : JSON_CHUNK_SIZE;
+   while (*js->buffer_end + len >= new_buffer_size)
+      new_buffer_size *= 2;
+
+   *js->buffer = (char *)realloc(*js->buffer, new_buffer_size);
+   assert(*js->buffer);
+   *js->buffer_size = new_buffer_size;
+}
+
+static void json_write(JSON_SINK *js, int level, const char* s, int quoted)
+{
+   int len, n;
+   char *p;
+
+   len = strlen(s);
+
+   /* worst case: indentation, every character escaped, quotes and NUL */
+   json_reserve(js, 2*level + 2*len + 3);
+
+   p = *js->buffer + *js->buffer_end;
+
+   memset(p, ' ', 2*level);
+   p += 2*level;
+
+   if (!quoted) {
+      memcpy(p, s, len);
+      p += len;
+   } else {
+      *p++ = '"';
+
+      while (*s) {
+         /* copy runs of characters which need no escape in one go */
+         n = strcspn(s, "\"\\\b\f\n\r\t");
+         memcpy(p, s, n);
+         p += n;
+         s += n;
+         if (*s == 0)
+            break;
+
+         *p++ = '\\';
+         switch (*s++) {
+         case '\"': *p++ = '\"'; break;
+         case '\\': *p++ = '\\'; break;
+         case '\b': *p++ = 'b'; break;
+         case '\f': *p++ = 'f'; break;
+         case '\n': *p++ = 'n'; break;
+         case '\r': *p++ = 'r'; break;
+         case '\t': *p++ = 't'; break;
+         }
       }
-   }
 
-   (*buffer)[(*buffer_end)++] = '"';
-   (*buffer)[*buffer_end] = 0; // NUL-terminate the buffer
+      *p++ = '"';
+   }
 
-   remain = *buffer_size - *buffer_end;
-   assert(remain > 0);
+   *p = 0; // NUL-terminate the buffer
+   *js->buffer_end = p - *js->buffer;
 }
 
-static void json_write_data(char **buffer, int* buffer_size, int* buffer_end, int level, const KEY* key, const char* p)
+static void json_write_data(JSON_SINK *js, int level, const KEY* key, const char* p)
 {
    char str[256];
    switch (key->type) {
    case TID_BYTE:
       sprintf(str, "%u", *(unsigned char*)p);
-      json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+      json_write(js, 0, str, 0);
       break;
    case TID_SBYTE:
       sprintf(str, "%d", *(char*)p);
-      json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+      json_write(js, 0, str, 0);
       break;
    case TID_CHAR:
       sprintf(str, "%c", *(char*)p);
-      json_write(buffer, buffer_size, buffer_end, 0, str, 1);
+      json_write(js, 0, str, 1);
       break;
    case TID_WORD:
       sprintf(str, "\"0x%04x\"", *(WORD*)p);
-      json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+      json_write(js, 0, str, 0);
       break;
    case TID_SHORT:
       sprintf(str, "%d", *(short*)p);
-      json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+      json_write(js, 0, str, 0);
       break;
    case TID_DWORD:
       sprintf(str, "\"0x%08x\"", *(DWORD*)p);
-      json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+      json_write(js, 0, str, 0);
       break;
    case TID_INT:
       sprintf(str, "%d", *(int*)p);
-      json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+      json_write(js, 0, str, 0);
       break;
    case TID_BOOL:
       if (*(int*)p)
-         json_write(buffer, buffer_size, buffer_end, 0, "true", 0);
+         json_write(js, 0, "true", 0);
       else
-         json_write(buffer, buffer_size, buffer_end, 0, "false", 0);
+         json_write(js, 0, "false", 0);
       break;
    case TID_FLOAT: {
       float flt = (*(float*)p);
       if (isnan(flt))
-         json_write(buffer, buffer_size, buffer_end, 0, "\"NaN\"", 0);
+         json_write(js, 0, "\"NaN\"", 0);
       else if (isinf(flt)) {
          if (flt > 0)
-            json_write(buffer, buffer_size, buffer_end, 0, "\"Infinity\"", 0);
+            json_write(js, 0, "\"Infinity\"", 0);
          else
-            json_write(buffer, buffer_size, buffer_end, 0, "\"-Infinity\"", 0);
+            json_write(js, 0, "\"-Infinity\"", 0);
       } else if (flt == 0)
-         json_write(buffer, buffer_size, buffer_end, 0, "0", 0);
+         json_write(js, 0, "0", 0);
       else if (flt == (int)flt) {
          sprintf(str, "%.0f", flt);
-         json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+         json_write(js, 0, str, 0);
       } else {
          sprintf(str, "%.7e", flt);
-         json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+         json_write(js, 0, str, 0);
       }
       break;
    }
    case TID_DOUBLE: {
       double dbl = (*(double*)p);
       if (isnan(dbl))
-         json_write(buffer, buffer_size, buffer_end, 0, "\"NaN\"", 0);
+         json_write(js, 0, "\"NaN\"", 0);
       else if (isinf(dbl)) {
          if (dbl > 0)
-            json_write(buffer, buffer_size, buffer_end, 0, "\"Infinity\"", 0);
+            json_write(js, 0, "\"Infinity\"", 0);
          else
-            json_write(buffer, buffer_size, buffer_end, 0, "\"-Infinity\"", 0);
+            json_write(js, 0, "\"-Infinity\"", 0);
       } else if (dbl == 0)
-         json_write(buffer, buffer_size, buffer_end, 0, "0", 0);
+         json_write(js, 0, "0", 0);
       else if (dbl == (int)dbl) {
          sprintf(str, "%.0f", dbl);
-         json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+         json_write(js, 0, str, 0);
       } else {
          sprintf(str, "%.16e", dbl);
-         json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+         json_write(js, 0, str, 0);
       }
       break;
    }
    case TID_BITFIELD:
-      json_write(buffer, buffer_size, buffer_end, 0, "(TID_BITFIELD value)", 1);
+      json_write(js, 0, "(TID_BITFIELD value)", 1);
       break;
    case TID_STRING:
       // data is already NUL terminated // p[key.item_size-1] = 0;  // make sure string is NUL terminated!
-      json_write(buffer, buffer_size, buffer_end, 0, p, 1);
+      json_write(js, 0, p, 1);
       break;
    case TID_ARRAY:
-      json_write(buffer, buffer_size, buffer_end, 0, "(TID_ARRAY value)", 1);
+      json_write(js, 0, "(TID_ARRAY value)", 1);
       break;
    case TID_STRUCT:
-      json_write(buffer, buffer_size, buffer_end, 0, "(TID_STRUCT value)", 1);
+      json_write(js, 0, "(TID_STRUCT value)", 1);
       break;
    case TID_KEY:
-      json_write(buffer, buffer_size, buffer_end, 0, "{ }", 0);
+      json_write(js, 0, "{ }", 0);
       break;
    case TID_LINK:
       // data is already NUL terminated // p[key.item_size-1] = 0;  // make sure string is NUL terminated!
-      json_write(buffer, buffer_size, buffer_end, 0, p, 1);
+      json_write(js, 0, p, 1);
       break;
    default:
-      json_write(buffer, buffer_size, buffer_end, 0, "(TID_UNKNOWN value)", 1);
+      json_write(js, 0, "(TID_UNKNOWN value)", 1);
    }
 }
 
-static void json_write_key(HNDLE hDB, HNDLE hKey, const KEY* key, const char* link_path, char **buffer, int* buffer_size, int* buffer_end)
+static void json_write_key(HNDLE hDB, HNDLE hKey, const KEY* key, const char* link_path, JSON_SINK *js)
 {
    char str[256]; // not used to store anything long, only numeric values like: "item_size: 100"
 
-   json_write(buffer, buffer_size, buffer_end, 0, "{ ", 0);
+   json_write(js, 0, "{ ", 0);
 
    sprintf(str, "\"type\" : %d", key->type);
-   json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+   json_write(js, 0, str, 0);
 
    if (link_path) {
-      json_write(buffer, buffer_size, buffer_end, 0, ", ", 0);
-      json_write(buffer, buffer_size, buffer_end, 0, "link", 1);
-      json_write(buffer, buffer_size, buffer_end, 0, ": ", 0);
-      json_write(buffer, buffer_size, buffer_end, 0, link_path, 1);
+      json_write(js, 0, ", ", 0);
+      json_write(js, 0, "link", 1);
+      json_write(js, 0, ": ", 0);
+      json_write(js, 0, link_path, 1);
    }
 
    if (key->num_values > 1) {
-      json_write(buffer, buffer_size, buffer_end, 0, ", ", 0);
+      json_write(js, 0, ", ", 0);
 
       sprintf(str, "\"num_values\" : %d", key->num_values);
-      json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+      json_write(js, 0, str, 0);
    }
 
    if (key->type == TID_STRING) {
-      json_write(buffer, buffer_size, buffer_end, 0, ", ", 0);
+      json_write(js, 0, ", ", 0);
 
       sprintf(str, "\"item_size\" : %d", key->item_size);
-      json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+      json_write(js, 0, str, 0);
    }
 
    if (key->notify_count > 0) {
-      json_write(buffer, buffer_size, buffer_end, 0, ", ", 0);
+      json_write(js, 0, ", ", 0);
 
       sprintf(str, "\"notify_count\" : %d", key->notify_count);
-      json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+      json_write(js, 0, str, 0);
    }
 
-   json_write(buffer, buffer_size, buffer_end, 0, ", ", 0);
+   json_write(js, 0, ", ", 0);
 
    sprintf(str, "\"access_mode\" : %d", key->access_mode);
-   json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+   json_write(js, 0, str, 0);
 
-   json_write(buffer, buffer_size, buffer_end, 0, ", ", 0);
+   json_write(js, 0, ", ", 0);
 
    sprintf(str, "\"last_written\" : %d", key->last_written);
-   json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+   json_write(js, 0, str, 0);
 
-   json_write(buffer, buffer_size, buffer_end, 0, " ", 0);
+   json_write(js, 0, " ", 0);
 
-   json_write(buffer, buffer_size, buffer_end, 0, "}", 0);
+   json_write(js, 0, "}", 0);
 }
 
-static int db_save_json_key_obsolete(HNDLE hDB, HNDLE hKey, INT level, char **buffer, int* buffer_size, int* buffer_end, int save_keys, int follow_links, int recurse)
+static int db_save_json_key_obsolete(HNDLE hDB, HNDLE hKey, INT level, JSON_SINK *js, int save_keys, int follow_links, int recurse)
 {
    INT i, size, status;
    char *data;
@@ -7667,12 +8966,12 @@ static int db_save_json_key_obsolete(HNDLE hDB, HNDLE hKey, INT level, char **bu
       int do_close_curly_bracket = 0;
 
       if (level == 0 && !omit_top_level_braces) {
-         json_write(buffer, buffer_size, buffer_end, 0, "{\n", 0);
+         json_write(js, 0, "{\n", 0);
          do_close_curly_bracket = 1;
       }
       else if (level > 0) {
-         json_write(buffer, buffer_size, buffer_end, level, link_key.name, 1);
-         json_write(buffer, buffer_size, buffer_end, 0, " : {\n", 0);
+         json_write(js, level, link_key.name, 1);
+         json_write(js, 0, " : {\n", 0);
          do_close_curly_bracket = 1;
       }
 
@@ -7682,9 +8981,9 @@ static int db_save_json_key_obsolete(HNDLE hDB, HNDLE hKey, INT level, char **bu
          if (status != DB_SUCCESS)
             strlcpy(path, "(path unknown)", sizeof(path));
 
-         json_write(buffer, buffer_size, buffer_end, 0, "/error", 1);
-         json_write(buffer, buffer_size, buffer_end, 0, " : ", 0);
-         json_write(buffer, buffer_size, buffer_end, 0, "max nesting level exceed", 1);
+         json_write(js, 0, "/error", 1);
+         json_write(js, 0, " : ", 0);
+         json_write(js, 0, "max nesting level exceed", 1);
 
          cm_msg(MERROR, "db_save_json_key", "max nesting level exceeded at \"%s\", check for symlink loops in this subtree", path);
 
@@ -7698,11 +8997,11 @@ static int db_save_json_key_obsolete(HNDLE hDB, HNDLE hKey, INT level, char **bu
                break;
 
             if (idx != 0) {
-               json_write(buffer, buffer_size, buffer_end, 0, ",\n", 0);
+               json_write(js, 0, ",\n", 0);
             }
 
             /* save subtree */
-            status = db_save_json_key_obsolete(hDB, hSubkey, level + 1, buffer, buffer_size, buffer_end, save_keys, follow_links, recurse);
+            status = db_save_json_key_obsolete(hDB, hSubkey, level + 1, js, save_keys, follow_links, recurse);
             if (status != DB_SUCCESS)
                return status;
          }
@@ -7710,14 +9009,14 @@ static int db_save_json_key_obsolete(HNDLE hDB, HNDLE hKey, INT level, char **bu
 
       if (do_close_curly_bracket) {
          if (idx > 0)
-            json_write(buffer, buffer_size, buffer_end, 0, "\n", 0);
-         json_write(buffer, buffer_size, buffer_end, level, "}", 0);
+            json_write(js, 0, "\n", 0);
+         json_write(js, level, "}", 0);
       }
 
    } else {
 
       if (save_keys && level == 0) {
-         json_write(buffer, buffer_size, buffer_end, 0, "{\n", 0);
+         json_write(js, 0, "{\n", 0);
       }
 
       /* save key value */
@@ -7726,76 +9025,76 @@ static int db_save_json_key_obsolete(HNDLE hDB, HNDLE hKey, INT level, char **bu
          char str[NAME_LENGTH+15];
          sprintf(str, "%s/key", link_key.name);
 
-         json_write(buffer, buffer_size, buffer_end, level, str, 1);
-         json_write(buffer, buffer_size, buffer_end, 0, " : { ", 0);
+         json_write(js, level, str, 1);
+         json_write(js, 0, " : { ", 0);
 
          sprintf(str, "\"type\" : %d", key.type);
-         json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+         json_write(js, 0, str, 0);
 
          if (link_key.type == TID_LINK && follow_links) {
-            json_write(buffer, buffer_size, buffer_end, 0, ", ", 0);
-            json_write(buffer, buffer_size, buffer_end, 0, "link", 1);
-            json_write(buffer, buffer_size, buffer_end, 0, ": ", 0);
-            json_write(buffer, buffer_size, buffer_end, 0, link_path, 1);
+            json_write(js, 0, ", ", 0);
+            json_write(js, 0, "link", 1);
+            json_write(js, 0, ": ", 0);
+            json_write(js, 0, link_path, 1);
          }
 
          if (key.num_values > 1) {
-            json_write(buffer, buffer_size, buffer_end, 0, ", ", 0);
+            json_write(js, 0, ", ", 0);
 
             sprintf(str, "\"num_values\" : %d", key.num_values);
-            json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+            json_write(js, 0, str, 0);
          }
 
          if (key.type == TID_STRING || key.type == TID_LINK) {
-            json_write(buffer, buffer_size, buffer_end, 0, ", ", 0);
+            json_write(js, 0, ", ", 0);
 
             sprintf(str, "\"item_size\" : %d", key.item_size);
-            json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+            json_write(js, 0, str, 0);
          }
 
          if (key.notify_count > 0) {
-            json_write(buffer, buffer_size, buffer_end, 0, ", ", 0);
+            json_write(js, 0, ", ", 0);
 
             sprintf(str, "\"notify_count\" : %d", key.notify_count);
-            json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+            json_write(js, 0, str, 0);
          }
 
-         json_write(buffer, buffer_size, buffer_end, 0, ", ", 0);
+         json_write(js, 0, ", ", 0);
 
          sprintf(str, "\"access_mode\" : %d", key.access_mode);
-         json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+         json_write(js, 0, str, 0);
 
-         json_write(buffer, buffer_size, buffer_end, 0, ", ", 0);
+         json_write(js, 0, ", ", 0);
 
          sprintf(str, "\"last_written\" : %d", key.last_written);
-         json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+         json_write(js, 0, str, 0);
 
-         json_write(buffer, buffer_size, buffer_end, 0, " ", 0);
+         json_write(js, 0, " ", 0);
 
-         json_write(buffer, buffer_size, buffer_end, 0, "}", 0);
+         json_write(js, 0, "}", 0);
 
-         json_write(buffer, buffer_size, buffer_end, 0, ",\n", 0);
+         json_write(js, 0, ",\n", 0);
       }
 
       if (save_keys == 2) {
          char str[NAME_LENGTH+15];
          sprintf(str, "%s/last_written", link_key.name);
 
-         json_write(buffer, buffer_size, buffer_end, level, str, 1);
+         json_write(js, level, str, 1);
 
          sprintf(str, " : %d", key.last_written);
-         json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+         json_write(js, 0, str, 0);
 
-         json_write(buffer, buffer_size, buffer_end, 0, ",\n", 0);
+         json_write(js, 0, ",\n", 0);
       }
 
       if (save_keys) {
-         json_write(buffer, buffer_size, buffer_end, level, link_key.name, 1);
-         json_write(buffer, buffer_size, buffer_end, 0, " : ", 0);
+         json_write(js, level, link_key.name, 1);
+         json_write(js, 0, " : ", 0);
       }
 
       if (key.num_values > 1) {
-         json_write(buffer, buffer_size, buffer_end, 0, "[ ", 0);
+         json_write(js, 0, "[ ", 0);
       }
 
       size = key.total_size;
@@ -7820,126 +9119,129 @@ static int db_save_json_key_obsolete(HNDLE hDB, HNDLE hKey, INT level, char **bu
          char *p = data + key.item_size*i;
 
          if (i != 0)
-            json_write(buffer, buffer_size, buffer_end, 0, ", ", 0);
+            json_write(js, 0, ", ", 0);
 
          switch (key.type) {
          case TID_BYTE:
             sprintf(str, "%u", *(unsigned char*)p);
-            json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+            json_write(js, 0, str, 0);
             break;
          case TID_SBYTE:
             sprintf(str, "%d", *(char*)p);
-            json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+            json_write(js, 0, str, 0);
             break;
          case TID_CHAR:
             sprintf(str, "%c", *(char*)p);
-            json_write(buffer, buffer_size, buffer_end, 0, str, 1);
+            json_write(js, 0, str, 1);
             break;
          case TID_WORD:
             sprintf(str, "\"0x%04x\"", *(WORD*)p);
-            json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+            json_write(js, 0, str, 0);
             break;
          case TID_SHORT:
             sprintf(str, "%d", *(short*)p);
-            json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+            json_write(js, 0, str, 0);
             break;
          case TID_DWORD:
             sprintf(str, "\"0x%08x\"", *(DWORD*)p);
-            json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+            json_write(js, 0, str, 0);
             break;
          case TID_INT:
             sprintf(str, "%d", *(int*)p);
-            json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+            json_write(js, 0, str, 0);
             break;
          case TID_BOOL:
             if (*(int*)p)
-               json_write(buffer, buffer_size, buffer_end, 0, "true", 0);
+               json_write(js, 0, "true", 0);
             else
-               json_write(buffer, buffer_size, buffer_end, 0, "false", 0);
+               json_write(js, 0, "false", 0);
             break;
          case TID_FLOAT: {
             float flt = (*(float*)p);
             if (isnan(flt))
-               json_write(buffer, buffer_size, buffer_end, 0, "\"NaN\"", 0);
+               json_write(js, 0, "\"NaN\"", 0);
             else if (isinf(flt)) {
                if (flt > 0)
-                  json_write(buffer, buffer_size, buffer_end, 0, "\"Infinity\"", 0);
+                  json_write(js, 0, "\"Infinity\"", 0);
                else
-                  json_write(buffer, buffer_size, buffer_end, 0, "\"-Infinity\"", 0);
+                  json_write(js, 0, "\"-Infinity\"", 0);
             } else if (flt == 0)
-               json_write(buffer, buffer_size, buffer_end, 0, "0", 0);
+               json_write(js, 0, "0", 0);
             else if (flt == (int)flt) {
                sprintf(str, "%.0f", flt);
-               json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+               json_write(js, 0, str, 0);
             } else {
                sprintf(str, "%.7e", flt);
-               json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+               json_write(js, 0, str, 0);
             }
             break;
          }
          case TID_DOUBLE: {
             double dbl = (*(double*)p);
             if (isnan(dbl))
-               json_write(buffer, buffer_size, buffer_end, 0, "\"NaN\"", 0);
+               json_write(js, 0, "\"NaN\"", 0);
             else if (isinf(dbl)) {
                if (dbl > 0)
-                  json_write(buffer, buffer_size, buffer_end, 0, "\"Infinity\"", 0);
+                  json_write(js, 0, "\"Infinity\"", 0);
                else
-                  json_write(buffer, buffer_size, buffer_end, 0, "\"-Infinity\"", 0);
+                  json_write(js, 0, "\"-Infinity\"", 0);
             } else if (dbl == 0)
-               json_write(buffer, buffer_size, buffer_end, 0, "0", 0);
+               json_write(js, 0, "0", 0);
             else if (dbl == (int)dbl) {
                sprintf(str, "%.0f", dbl);
-               json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+               json_write(js, 0, str, 0);
             } else {
                sprintf(str, "%.16e", dbl);
-               json_write(buffer, buffer_size, buffer_end, 0, str, 0);
+               json_write(js, 0, str, 0);
             }
             break;
          }
          case TID_BITFIELD:
-            json_write(buffer, buffer_size, buffer_end, 0, "(TID_BITFIELD value)", 1);
+            json_write(js, 0, "(TID_BITFIELD value)", 1);
             break;
          case TID_STRING:
             p[key.item_size-1] = 0;  // make sure string is NUL terminated!
-            json_write(buffer, buffer_size, buffer_end, 0, p, 1);
+            json_write(js, 0, p, 1);
             break;
          case TID_ARRAY:
-            json_write(buffer, buffer_size, buffer_end, 0, "(TID_ARRAY value)", 1);
+            json_write(js, 0, "(TID_ARRAY value)", 1);
             break;
          case TID_STRUCT:
-            json_write(buffer, buffer_size, buffer_end, 0, "(TID_STRUCT value)", 1);
+            json_write(js, 0, "(TID_STRUCT value)", 1);
             break;
          case TID_KEY:
-            json_write(buffer, buffer_size, buffer_end, 0, "{ }", 0);
+            json_write(js, 0, "{ }", 0);
             break;
          case TID_LINK:
             p[key.item_size-1] = 0;  // make sure string is NUL terminated!
-            json_write(buffer, buffer_size, buffer_end, 0, p, 1);
+            json_write(js, 0, p, 1);
             break;
          default:
-            json_write(buffer, buffer_size, buffer_end, 0, "(TID_UNKNOWN value)", 1);
+            json_write(js, 0, "(TID_UNKNOWN value)", 1);
          }
 
       }
 
       if (key.num_values > 1) {
-         json_write(buffer, buffer_size, buffer_end, 0, " ]", 0);
+         json_write(js, 0, " ]", 0);
       } else {
-         json_write(buffer, buffer_size, buffer_end, 0, "", 0);
+         json_write(js, 0, "", 0);
       }
 
       free(data);
       data = NULL;
 
       if (save_keys && level == 0) {
-         json_write(buffer, buffer_size, buffer_end, 0, "\n}", 0);
+         json_write(js, 0, "\n}", 0);
       }
    }
 
    return DB_SUCCESS;
 }
 
+static int json_write_array(HNDLE hDB, HNDLE hKey, JSON_SINK *js);
+static int json_write_index(HNDLE hDB, HNDLE hKey, int index, JSON_SINK *js);
+
 /********************************************************************/
 /**
 Copy an ODB array in JSON format to a buffer
@@ -7952,10 +9254,39 @@ Copy an ODB array in JSON format to a buffer
 @return DB_SUCCESS, DB_NO_MEMORY
 */
 INT db_copy_json_array(HNDLE hDB, HNDLE hKey, char **buffer, int* buffer_size, int* buffer_end)
+{
+   JSON_SINK js;
+   json_sink_init(&js, buffer, buffer_size, buffer_end, -1);
+   return json_write_array(hDB, hKey, &js);
+}
+
+/********************************************************************/
+/**
+Copy an ODB array element in JSON format to a buffer
+
+@param hDB          ODB handle obtained via cm_get_experiment_database().
+@param hKey Handle for key
+@param index Array index
+@param buffer returns pointer to ASCII buffer with ODB contents
+@param buffer_size returns size of ASCII buffer
+@param buffer_end returns number of bytes contained in buffer
+@return DB_SUCCESS, DB_NO_MEMORY
+*/
+INT db_copy_json_index(HNDLE hDB, HNDLE hKey, int index, char **buffer, int* buffer_size, int* buffer_end)
+{
+   JSON_SINK js;
+   json_sink_init(&js, buffer, buffer_size, buffer_end, -1);
+   return json_write_index(hDB, hKey, index, &js);
+}
+
+/*------------------------------------------------------------------*/
+
+static int json_write_array(HNDLE hDB, HNDLE hKey, JSON_SINK *js)
 {
    int size, asize;
    int status;
    char* data;
+   char sbuf[1024];
    int i;
    KEY key;
 
@@ -7966,26 +9297,30 @@ INT db_copy_json_array(HNDLE hDB, HNDLE hKey, char **buffer, int* buffer_size, i
    assert(key.type != TID_KEY);
 
    if (key.num_values > 1) {
-      json_write(buffer, buffer_size, buffer_end, 0, "[ ", 0);
+      json_write(js, 0, "[ ", 0);
    }
 
    size = key.total_size;
 
+   /* most keys fit on the stack, avoid a malloc() per key */
    asize = size;
-   if (asize < 1024)
-      asize = 1024;
-   
-   data = (char *) malloc(asize);
-   if (data == NULL) {
-      cm_msg(MERROR, "db_save_json_key_data", "cannot allocate data buffer for %d bytes", asize);
-      return DB_NO_MEMORY;
+   if (asize <= (int) sizeof(sbuf)) {
+      asize = sizeof(sbuf);
+      data = sbuf;
+   } else {
+      data = (char *) malloc(asize);
+      if (data == NULL) {
+         cm_msg(MERROR, "db_save_json_key_data", "cannot allocate data buffer for %d bytes", asize);
+         return DB_NO_MEMORY;
+      }
    }
 
    data[0] = 0; // protect against TID_STRING that has key.total_size == 0.
 
    status = db_get_data(hDB, hKey, data, &size, key.type);
    if (status != DB_SUCCESS) {
-      free(data);
+      if (data != sbuf)
+         free(data);
       return status;
    }
 
@@ -7993,34 +9328,23 @@ INT db_copy_json_array(HNDLE hDB, HNDLE hKey, char **buffer, int* buffer_size, i
       char *p = data + key.item_size*i;
 
       if (i != 0)
-         json_write(buffer, buffer_size, buffer_end, 0, ", ", 0);
+         json_write(js, 0, ", ", 0);
       
-      json_write_data(buffer, buffer_size, buffer_end, 0, &key, p);
+      json_write_data(js, 0, &key, p);
    }
    
    if (key.num_values > 1) {
-      json_write(buffer, buffer_size, buffer_end, 0, " ]", 0);
+      json_write(js, 0, " ]", 0);
    }
    
-   free(data);
+   if (data != sbuf)
+      free(data);
    data = NULL;
 
    return DB_SUCCESS;
 }
 
-/********************************************************************/
-/**
-Copy an ODB array element in JSON format to a buffer
-
-@param hDB          ODB handle obtained via cm_get_experiment_database().
-@param hKey Handle for key
-@param index Array index
-@param buffer returns pointer to ASCII buffer with ODB contents
-@param buffer_size returns size of ASCII buffer
-@param buffer_end returns number of bytes contained in buffer
-@return DB_SUCCESS, DB_NO_MEMORY
-*/
-INT db_copy_json_index(HNDLE hDB, HNDLE hKey, int index, char **buffer, int* buffer_size, int* buffer_end)
+static int json_write_index(HNDLE hDB, HNDLE hKey, int index, JSON_SINK *js)
 {
    int status;
    KEY key;
@@ -8044,7 +9368,7 @@ INT db_copy_json_index(HNDLE hDB, HNDLE hKey, int index, char **buffer, int* buf
    assert(size <= key.item_size);
    data[key.item_size] = 0; // make sure data is NUL terminated, in case of strings.
 
-   json_write_data(buffer, buffer_size, buffer_end, 0, &key, data);
+   json_write_data(js, 0, &key, data);
 
    free(data);
 
@@ -8062,21 +9386,53 @@ INT db_copy_json_index(HNDLE hDB, HNDLE hKey, int index, char **buffer, int* buf
 #define JSFLAG_OMIT_LAST_WRITTEN (1<<6)
 #define JSFLAG_OMIT_OLD          (1<<7)
 
-static int json_write_anything(HNDLE hDB, HNDLE hKey, char **buffer, int *buffer_size, int *buffer_end, int level, int must_be_subdir, int flags, time_t timestamp);
+static int json_write_anything(HNDLE hDB, HNDLE hKey, JSON_SINK *js, int level, int must_be_subdir, int flags, time_t timestamp);
+static void json_lock(HNDLE hDB, BOOL lock);
+
+/* db_enum_link() walks the keylist from the start on every call, which
+   makes writing a directory quadratic in its number of subkeys. Locally
+   we hold the database lock and can follow next_key from the previous
+   subkey instead. */
+static INT json_enum_link(HNDLE hDB, HNDLE hKey, INT idx, HNDLE hPrev, HNDLE * subkey_handle)
+{
+#ifdef LOCAL_ROUTINES
+   if (idx > 0 && hPrev && !rpc_is_remote()) {
+      DATABASE_HEADER *pheader;
+      KEY *pkey;
+
+      *subkey_handle = 0;
+
+      db_lock_database_read(hDB);
+      pheader = _database[hDB - 1].database_header;
+      if (!db_validate_hkey(pheader, hPrev)) {
+         db_unlock_database(hDB);
+         return DB_INVALID_HANDLE;
+      }
+      pkey = (KEY *) ((char *) pheader + hPrev);
+      *subkey_handle = pkey->next_key;
+      db_unlock_database(hDB);
+
+      return *subkey_handle ? DB_SUCCESS : DB_NO_MORE_SUBKEYS;
+   }
+#endif
+
+   return db_enum_link(hDB, hKey, idx, subkey_handle);
+}
 
-static int json_write_bare_subdir(HNDLE hDB, HNDLE hKey, char **buffer, int *buffer_size, int *buffer_end, int level, int flags, time_t timestamp)
+static int json_write_bare_subdir(HNDLE hDB, HNDLE hKey, JSON_SINK *js, int level, int flags, time_t timestamp)
 {
    int status;
    int i;
+   HNDLE hLink = 0;
 
    for (i=0; ; i++) {
-      HNDLE hLink, hLinkTarget;
+      HNDLE hLinkTarget;
       KEY link, link_target;
       char* link_path = NULL;
       char link_buf[MAX_ODB_PATH];
       char link_name[MAX_ODB_PATH];
 
-      status = db_enum_link(hDB, hKey, i, &hLink);
+      status = json_enum_link(hDB, hKey, i, hLink, &hLink);
       if (status != DB_SUCCESS && !hLink)
          break;
 
@@ -8115,9 +9471,9 @@ static int json_write_bare_subdir(HNDLE hDB, HNDLE hKey, char **buffer, int *buf
       }
 
       if (i != 0) {
-         json_write(buffer, buffer_size, buffer_end, 0, ",\n", 0);
+         json_write(js, 0, ",\n", 0);
       } else {
-         json_write(buffer, buffer_size, buffer_end, 0, "\n", 0);
+         json_write(js, 0, "\n", 0);
       }
 
       strlcpy(link_name, link.name, sizeof(link_name));
@@ -8132,47 +9488,59 @@ static int json_write_bare_subdir(HNDLE hDB, HNDLE hKey, char **buffer, int *buf
          char buf[MAX_ODB_PATH];
          strlcpy(buf, link_name, sizeof(buf));
          strlcat(buf, "/name", sizeof(buf));
-         json_write(buffer, buffer_size, buffer_end, level, buf, 1);
-         json_write(buffer, buffer_size, buffer_end, 0, " : " , 0);
-         json_write(buffer, buffer_size, buffer_end, 0, link.name, 1);
-         json_write(buffer, buffer_size, buffer_end, 0, ",\n", 0);
+         json_write(js, level, buf, 1);
+         json_write(js, 0, " : " , 0);
+         json_write(js, 0, link.name, 1);
+         json_write(js, 0, ",\n", 0);
       }
 
       if (link.type != TID_KEY && (flags & JSFLAG_SAVE_KEYS)) {
          char buf[MAX_ODB_PATH];
          strlcpy(buf, link_name, sizeof(buf));
          strlcat(buf, "/key", sizeof(buf));
-         json_write(buffer, buffer_size, buffer_end, level, buf, 1);
-         json_write(buffer, buffer_size, buffer_end, 0, " : " , 0);
-         json_write_key(hDB, hLink, &link_target, link_path, buffer, buffer_size, buffer_end);
-         json_write(buffer, buffer_size, buffer_end, 0, ",\n", 0);
+         json_write(js, level, buf, 1);
+         json_write(js, 0, " : " , 0);
+         json_write_key(hDB, hLink, &link_target, link_path, js);
+         json_write(js, 0, ",\n", 0);
       } else if ((link_target.type != TID_KEY) && !(flags & JSFLAG_OMIT_LAST_WRITTEN)) {
          char buf[MAX_ODB_PATH];
          strlcpy(buf, link_name, sizeof(buf));
          strlcat(buf, "/last_written", sizeof(buf));
-         json_write(buffer, buffer_size, buffer_end, level, buf, 1);
-         json_write(buffer, buffer_size, buffer_end, 0, " : " , 0);
+         json_write(js, level, buf, 1);
+         json_write(js, 0, " : " , 0);
          sprintf(buf, "%d", link_target.last_written);
-         json_write(buffer, buffer_size, buffer_end, 0, buf, 0);
-         json_write(buffer, buffer_size, buffer_end, 0, ",\n", 0);
+         json_write(js, 0, buf, 0);
+         json_write(js, 0, ",\n", 0);
       }
 
-      json_write(buffer, buffer_size, buffer_end, level, link_name, 1);
-      json_write(buffer, buffer_size, buffer_end, 0, " : " , 0);
+      json_write(js, level, link_name, 1);
+      json_write(js, 0, " : " , 0);
 
       if (link_target.type == TID_KEY && !(flags & JSFLAG_RECURSE)) {
-         json_write(buffer, buffer_size, buffer_end, 0, "{ }" , 0);
+         json_write(js, 0, "{ }" , 0);
       } else {
-         status = json_write_anything(hDB, hLinkTarget, buffer, buffer_size, buffer_end, level, 0, flags, timestamp);
+         status = json_write_anything(hDB, hLinkTarget, js, level, 0, flags, timestamp);
          if (status != DB_SUCCESS)
             return status;
       }
+
+      /* a file is written with one lock per top-level entry, the buffer is
+         flushed in between. The previous key may be gone afterwards, so
+         continue by index */
+      if (js->fd >= 0 && js->hold && level == JS_LEVEL_1) {
+         json_lock(hDB, FALSE);
+         js->hold = FALSE;
+         json_flush(js);
+         json_lock(hDB, TRUE);
+         js->hold = TRUE;
+         hLink = 0;
+      }
    }
 
    return DB_SUCCESS;
 }
 
-static int json_write_anything(HNDLE hDB, HNDLE hKey, char **buffer, int *buffer_size, int *buffer_end, int level, int must_be_subdir, int flags, time_t timestamp)
+static int json_write_anything(HNDLE hDB, HNDLE hKey, JSON_SINK *js, int level, int must_be_subdir, int flags, time_t timestamp)
 {
    int status;
    KEY key;
@@ -8183,20 +9551,20 @@ static int json_write_anything(HNDLE hDB, HNDLE hKey, char **buffer, int *buffer
 
    if (key.type == TID_KEY) {
 
-      json_write(buffer, buffer_size, buffer_end, 0, "{", 0);
+      json_write(js, 0, "{", 0);
 
-      status = json_write_bare_subdir(hDB, hKey, buffer, buffer_size, buffer_end, level+1, flags, timestamp);
+      status = json_write_bare_subdir(hDB, hKey, js, level+1, flags, timestamp);
       if (status != DB_SUCCESS)
          return status;
 
-      json_write(buffer, buffer_size, buffer_end, 0, "\n", 0);
-      json_write(buffer, buffer_size, buffer_end, level, "}", 0);
+      json_write(js, 0, "\n", 0);
+      json_write(js, level, "}", 0);
 
    } else {
       if (must_be_subdir)
          return DB_TYPE_MISMATCH;
 
-      status = db_copy_json_array(hDB, hKey, buffer, buffer_size, buffer_end);
+      status = json_write_array(hDB, hKey, js);
 
       if (status != DB_SUCCESS)
          return status;
@@ -8205,13 +9573,36 @@ static int json_write_anything(HNDLE hDB, HNDLE hKey, char **buffer, int *buffer
    return DB_SUCCESS;
 }
 
+/* hold one read lock while a subtree is written, instead of locking the
+   database in each db_get_key() and db_get_data() call. This also gives
+   a consistent copy of the subtree. */
+static void json_lock(HNDLE hDB, BOOL lock)
+{
+#ifdef LOCAL_ROUTINES
+   if (rpc_is_remote())
+      return;
+   if (lock)
+      db_lock_database_read(hDB);
+   else
+      db_unlock_database(hDB);
+#endif
+}
+
 INT db_copy_json_ls(HNDLE hDB, HNDLE hKey, char **buffer, int* buffer_size, int* buffer_end)
 {
-   return json_write_anything(hDB, hKey, buffer, buffer_size, buffer_end, JS_LEVEL_0, JS_MUST_BE_SUBDIR, JSFLAG_SAVE_KEYS|JSFLAG_FOLLOW_LINKS, 0);
+   int status;
+   JSON_SINK js;
+   json_sink_init(&js, buffer, buffer_size, buffer_end, -1);
+   json_lock(hDB, TRUE);
+   status = json_write_anything(hDB, hKey, &js, JS_LEVEL_0, JS_MUST_BE_SUBDIR, JSFLAG_SAVE_KEYS|JSFLAG_FOLLOW_LINKS, 0);
+   json_lock(hDB, FALSE);
+   return status;
 }
 
 INT db_copy_json_values(HNDLE hDB, HNDLE hKey, char **buffer, int* buffer_size, int* buffer_end, int omit_names, int omit_last_written, time_t omit_old_timestamp)
 {
+   int status;
+   JSON_SINK js;
    int flags = JSFLAG_FOLLOW_LINKS|JSFLAG_RECURSE|JSFLAG_LOWERCASE;
    if (omit_names)
       flags |= JSFLAG_OMIT_NAMES;
@@ -8219,12 +9610,22 @@ INT db_copy_json_values(HNDLE hDB, HNDLE hKey, char **buffer, int* buffer_size,
       flags |= JSFLAG_OMIT_LAST_WRITTEN;
    if (omit_old_timestamp)
       flags |= JSFLAG_OMIT_OLD;
-   return json_write_anything(hDB, hKey, buffer, buffer_size, buffer_end, JS_LEVEL_0, 0, flags, omit_old_timestamp);
+   json_sink_init(&js, buffer, buffer_size, buffer_end, -1);
+   json_lock(hDB, TRUE);
+   status = json_write_anything(hDB, hKey, &js, JS_LEVEL_0, 0, flags, omit_old_timestamp);
+   json_lock(hDB, FALSE);
+   return status;
 }
 
 INT db_copy_json_save(HNDLE hDB, HNDLE hKey, char **buffer, int* buffer_size, int* buffer_end)
 {
-   return json_write_anything(hDB, hKey, buffer, buffer_size, buffer_end, JS_LEVEL_0, JS_MUST_BE_SUBDIR, JSFLAG_SAVE_KEYS|JSFLAG_RECURSE, 0);
+   int status;
+   JSON_SINK js;
+   json_sink_init(&js, buffer, buffer_size, buffer_end, -1);
+   json_lock(hDB, TRUE);
+   status = json_write_anything(hDB, hKey, &js, JS_LEVEL_0, JS_MUST_BE_SUBDIR, JSFLAG_SAVE_KEYS|JSFLAG_RECURSE, 0);
+   json_lock(hDB, FALSE);
+   return status;
 }
 
 /********************************************************************/
@@ -8240,8 +9641,10 @@ Copy an ODB subtree in JSON format to a buffer
 */
 INT db_copy_json_obsolete(HNDLE hDB, HNDLE hKey, char **buffer, int* buffer_size, int* buffer_end, int save_keys, int follow_links, int recurse)
 {
-   db_save_json_key_obsolete(hDB, hKey, 0, buffer, buffer_size, buffer_end, save_keys, follow_links, recurse);
-   json_write(buffer, buffer_size, buffer_end, 0, "\n", 0);
+   JSON_SINK js;
+   json_sink_init(&js, buffer, buffer_size, buffer_end, -1);
+   db_save_json_key_obsolete(hDB, hKey, 0, &js, save_keys, follow_links, recurse);
+   json_write(&js, 0, "\n", 0);
    return DB_SUCCESS;
 }
 
@@ -8261,60 +9664,67 @@ INT db_save_json(HNDLE hDB, HNDLE hKey, const char *filename)
 {
 #ifdef LOCAL_ROUTINES
    {
-      INT status, buffer_size, buffer_end;
+      INT status, buffer_size, buffer_end, fh;
       char path[MAX_ODB_PATH];
-      FILE *fp;
       char *buffer;
+      JSON_SINK js;
 
       /* open file */
-      fp = fopen(filename, "w");
-      if (fp == NULL) {
+      fh = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_TEXT, 0644);
+      if (fh == -1) {
          cm_msg(MERROR, "db_save_json", "Cannot open file \"%s\"", filename);
          return DB_FILE_ERROR;
       }
 
       db_get_path(hDB, hKey, path, sizeof(path));
 
+      /* the JSON text is written to the file in chunks as it is produced */
       buffer = NULL;
       buffer_size = 0;
       buffer_end = 0;
+      json_sink_init(&js, &buffer, &buffer_size, &buffer_end, fh);
 
-      json_write(&buffer, &buffer_size, &buffer_end, 0, "{\n", 0);
+      json_write(&js, 0, "{\n", 0);
 
-      json_write(&buffer, &buffer_size, &buffer_end, 1, "/MIDAS version", 1);
-      json_write(&buffer, &buffer_size, &buffer_end, 0, " : ", 0);
-      json_write(&buffer, &buffer_size, &buffer_end, 0, MIDAS_VERSION, 1);
-      json_write(&buffer, &buffer_size, &buffer_end, 0, ",\n", 0);
+      json_write(&js, 1, "/MIDAS version", 1);
+      json_write(&js, 0, " : ", 0);
+      json_write(&js, 0, MIDAS_VERSION, 1);
+      json_write(&js, 0, ",\n", 0);
 
-      json_write(&buffer, &buffer_size, &buffer_end, 1, "/MIDAS git revision", 1);
-      json_write(&buffer, &buffer_size, &buffer_end, 0, " : ", 0);
-      json_write(&buffer, &buffer_size, &buffer_end, 0, GIT_REVISION, 1);
-      json_write(&buffer, &buffer_size, &buffer_end, 0, ",\n", 0);
+      json_write(&js, 1, "/MIDAS git revision", 1);
+      json_write(&js, 0, " : ", 0);
+      json_write(&js, 0, GIT_REVISION, 1);
+      json_write(&js, 0, ",\n", 0);
 
-      json_write(&buffer, &buffer_size, &buffer_end, 1, "/filename", 1);
-      json_write(&buffer, &buffer_size, &buffer_end, 0, " : ", 0);
-      json_write(&buffer, &buffer_size, &buffer_end, 0, filename, 1);
-      json_write(&buffer, &buffer_size, &buffer_end, 0, ",\n", 0);
+      json_write(&js, 1, "/filename", 1);
+      json_write(&js, 0, " : ", 0);
+      json_write(&js, 0, filename, 1);
+      json_write(&js, 0, ",\n", 0);
 
-      json_write(&buffer, &buffer_size, &buffer_end, 1, "/ODB path", 1);
-      json_write(&buffer, &buffer_size, &buffer_end, 0, " : ", 0);
-      json_write(&buffer, &buffer_size, &buffer_end, 0, path, 1);
-      json_write(&buffer, &buffer_size, &buffer_end, 0, ",\n", 0);
+      json_write(&js, 1, "/ODB path", 1);
+      json_write(&js, 0, " : ", 0);
+      json_write(&js, 0, path, 1);
+      json_write(&js, 0, ",\n", 0);
 
-      //status = db_save_json_key_obsolete(hDB, hKey, -1, &buffer, &buffer_size, &buffer_end, 1, 0, 1);
-      status = json_write_bare_subdir(hDB, hKey, &buffer, &buffer_size, &buffer_end, JS_LEVEL_1, JSFLAG_SAVE_KEYS|JSFLAG_RECURSE, 0);
+      //status = db_save_json_key_obsolete(hDB, hKey, -1, &js, 1, 0, 1);
+      json_lock(hDB, TRUE);
+      js.hold = TRUE;
+      status = json_write_bare_subdir(hDB, hKey, &js, JS_LEVEL_1, JSFLAG_SAVE_KEYS|JSFLAG_RECURSE, 0);
+      js.hold = FALSE;
+      json_lock(hDB, FALSE);
 
-      json_write(&buffer, &buffer_size, &buffer_end, 0, "\n}\n", 0);
-
-      if (status == DB_SUCCESS) {
-         if (buffer)
-            fwrite(buffer, 1, buffer_end, fp);
-      }
+      json_write(&js, 0, "\n}\n", 0);
+      json_flush(&js);
 
       if (buffer)
          free(buffer);
 
-      fclose(fp);
+      close(fh);
+
+      if (status != DB_SUCCESS)
+         return status;
+
+      return js.status;
    }
 #endif                          /* LOCAL_ROUTINES */
 
@@ -9055,7 +10465,7 @@ INT db_get_record_size(HNDLE hDB, HNDLE hKey, INT align, INT * buf_size)
          return DB_SUCCESS;
       }
 
-      db_lock_database(hDB);
+      db_lock_database_read(hDB);
 
       /* determine record size */
       *buf_size = max_align = 0;
@@ -9176,7 +10586,7 @@ INT db_get_record(HNDLE hDB, HNDLE hKey, void *data, INT * buf_size, INT align)
       pdata = data;
       total_size = 0;
 
-      db_lock_database(hDB);
+      db_lock_database_read(hDB);
       db_recurse_record_tree(hDB, hKey, &pdata, &total_size, align, NULL, FALSE, convert_flags);
       db_unlock_database(hDB);
 
@@ -9416,6 +10826,9 @@ INT db_add_open_record(HNDLE hDB, HNDLE hKey, WORD access_mode)
       pclient->open_record[i].handle = hKey;
       pclient->open_record[i].access_mode = access_mode;
 
+      /* invalidate notify index of all clients */
+      pheader->open_record_serial++;
+
       /* increment notify_count */
       pkey = (KEY *) ((char *) pheader + hKey);
 
@@ -9515,6 +10928,178 @@ INT db_remove_open_record(HNDLE hDB, HNDLE hKey, BOOL lock)
 
 #ifdef LOCAL_ROUTINES
 
+/* Hot-link notifications. Each process keeps an index of the open
+   records of all clients sorted by key, which is rebuilt when
+   db_add_open_record() increments open_record_serial. The index entries
+   are checked against the client open_record[] table before use, so
+   records closed since the last rebuild are skipped.
+
+   Notifications are collected per client port and record. The first
+   change of a record is sent at once. Further changes within the notify
+   window, or all changes between db_begin_batch() and db_end_batch(),
+   are sent as one "O hDB hKeyRoot hKey index [hKey index ...]" message
+   with up to NOTIFY_MAX_KEYS changed keys. db_flush_notify() sends the
+   remaining ones after the window has passed, it is called by cm_yield()
+   and by the server loop of the mserver. The next change of any key
+   sends them as well. */
+
+static INT _notify_window = 0;
+
+static int notify_entry_compare(const void *a, const void *b)
+{
+   const NOTIFY_ENTRY *pa = (const NOTIFY_ENTRY *) a;
+   const NOTIFY_ENTRY *pb = (const NOTIFY_ENTRY *) b;
+
+   if (pa->handle != pb->handle)
+      return pa->handle < pb->handle ? -1 : 1;
+   return pa->client - pb->client;
+}
+
+static void db_build_notify_index(HNDLE hDB)
+{
+   DATABASE *pdb;
+   DATABASE_HEADER *pheader;
+   DATABASE_CLIENT *pclient;
+   INT i, j, n;
+
+   pdb = &_database[hDB - 1];
+   pheader = pdb->database_header;
+
+   for (i = n = 0; i < pheader->max_client_index; i++)
+      n += pheader->client[i].max_index;
+
+   free(pdb->notify);
+   pdb->notify = NULL;
+   pdb->num_notify = 0;
+   if (n > 0) {
+      pdb->notify = (NOTIFY_ENTRY *) malloc(n * sizeof(NOTIFY_ENTRY));
+      if (pdb->notify == NULL) {
+         cm_msg(MERROR, "db_notify_clients", "cannot allocate notify index of %d entries", n);
+         return;
+      }
+   }
+
+   for (i = 0; i < pheader->max_client_index; i++) {
+      pclient = &pheader->client[i];
+      for (j = 0; j < pclient->max_index; j++)
+         if (pclient->open_record[j].handle) {
+            pdb->notify[pdb->num_notify].handle = pclient->open_record[j].handle;
+            pdb->notify[pdb->num_notify].client = i;
+            pdb->notify[pdb->num_notify].slot = j;
+            pdb->num_notify++;
+         }
+   }
+
+   qsort(pdb->notify, pdb->num_notify, sizeof(NOTIFY_ENTRY), notify_entry_compare);
+   pdb->notify_serial = pheader->open_record_serial;
+}
+
+static void db_send_notify(HNDLE hDB, NOTIFY_PENDING * pn, DWORD now)
+{
+   char str[IPC_MSG_SIZE];
+   INT i, n;
+
+   if (pn->num_keys > 0) {
+      n = sprintf(str, "O %d %d", hDB, pn->handle);
+      for (i = 0; i < pn->num_keys; i++)
+         n += sprintf(str + n, " %d %d", pn->key[i], pn->index[i]);
+      ss_resume(pn->port, str);
+
+      _database[hDB - 1].pending_keys -= pn->num_keys;
+      pn->num_keys = 0;
+   }
+   pn->last_sent = now;
+}
+
+static void db_queue_notify(HNDLE hDB, INT port, HNDLE hKey, HNDLE hKeyMod, int index)
+{
+   DATABASE *pdb;
+   NOTIFY_PENDING *pn;
+   DWORD now;
+   BOOL is_new;
+   INT i;
+
+   pdb = &_database[hDB - 1];
+   now = ss_millitime();
+
+   for (i = 0; i < pdb->num_pending; i++)
+      if (pdb->pending[i].port == port && pdb->pending[i].handle == hKey)
+         break;
+
+   is_new = (i == pdb->num_pending);
+   if (is_new) {
+      if (pdb->num_pending == pdb->max_pending) {
+         pn = (NOTIFY_PENDING *) realloc(pdb->pending, (2 * pdb->max_pending + 8) * sizeof(NOTIFY_PENDING));
+         if (pn == NULL) {
+            cm_msg(MERROR, "db_notify_clients", "cannot allocate pending notifications");
+            return;
+         }
+         pdb->pending = pn;
+         pdb->max_pending = 2 * pdb->max_pending + 8;
+      }
+      pn = &pdb->pending[pdb->num_pending++];
+      memset(pn, 0, sizeof(NOTIFY_PENDING));
+      pn->handle = hKey;
+      pn->port = port;
+   } else
+      pn = &pdb->pending[i];
+
+   /* add changed key unless already pending */
+   for (i = 0; i < pn->num_keys; i++)
+      if (pn->key[i] == hKeyMod && pn->index[i] == index)
+         break;
+
+   if (i == pn->num_keys) {
+      if (pn->num_keys == NOTIFY_MAX_KEYS)
+         db_send_notify(hDB, pn, now);
+      pn->key[pn->num_keys] = hKeyMod;
+      pn->index[pn->num_keys] = index;
+      pn->num_keys++;
+      pdb->pending_keys++;
+   }
+
+   if (pdb->batch_cnt == 0 && (is_new || now - pn->last_sent >= (DWORD) _notify_window))
+      db_send_notify(hDB, pn, now);
+}
+
+static void db_flush_pending(HNDLE hDB, BOOL all)
+/* send pending notifications, all or those with an expired window */
+{
+   DATABASE *pdb;
+   NOTIFY_PENDING *pn;
+   DWORD now;
+   INT i;
+
+   pdb = &_database[hDB - 1];
+   now = ss_millitime();
+
+   for (i = 0; i < pdb->num_pending;) {
+      pn = &pdb->pending[i];
+      if (now - pn->last_sent >= (DWORD) _notify_window || all) {
+         db_send_notify(hDB, pn, now);
+
+         /* forget records which have been quiet for a window */
+         if (!all) {
+            pdb->pending[i] = pdb->pending[--pdb->num_pending];
+            continue;
+         }
+      }
+      i++;
+   }
+}
+
+static void db_free_notify(HNDLE hDB)
+{
+   DATABASE *pdb = &_database[hDB - 1];
+
+   free(pdb->notify);
+   free(pdb->pending);
+   pdb->notify = NULL;
+   pdb->pending = NULL;
+   pdb->num_notify = pdb->num_pending = pdb->max_pending = pdb->pending_keys = 0;
+   pdb->batch_cnt = 0;
+}
+
 INT db_notify_clients(HNDLE hDB, HNDLE hKeyMod, int index, BOOL bWalk)
 /********************************************************************\
 
@@ -9524,38 +11109,56 @@ INT db_notify_clients(HNDLE hDB, HNDLE hKeyMod, int index, BOOL bWalk)
 
 \********************************************************************/
 {
+   DATABASE *pdb;
    DATABASE_HEADER *pheader;
    DATABASE_CLIENT *pclient;
+   NOTIFY_ENTRY *pe;
    HNDLE hKey;
    KEY *pkey;
    KEYLIST *pkeylist;
-   INT i, j;
-   char str[80];
+   INT lo, hi, mid;
 
    if (hDB > _database_entries || hDB <= 0) {
       cm_msg(MERROR, "db_notify_clients", "invalid database handle");
       return DB_INVALID_HANDLE;
    }
 
-   pheader = _database[hDB - 1].database_header;
+   pdb = &_database[hDB - 1];
+   pheader = pdb->database_header;
    hKey = hKeyMod;
-   
+
+   /* send changes held back for an expired window, in case the process
+      writes without calling cm_yield() */
+   if (pdb->pending_keys > 0 && pdb->batch_cnt == 0)
+      db_flush_pending(hDB, FALSE);
+
    /* check if key or parent has notify_flag set */
    pkey = (KEY *) ((char *) pheader + hKey);
 
    do {
 
       /* check which client has record open */
-      if (pkey->notify_count)
-         for (i = 0; i < pheader->max_client_index; i++) {
-            pclient = &pheader->client[i];
-            for (j = 0; j < pclient->max_index; j++)
-               if (pclient->open_record[j].handle == hKey) {
-                  /* send notification to remote process */
-                  sprintf(str, "O %d %d %d %d", hDB, hKey, hKeyMod, index);
-                  ss_resume(pclient->port, str);
-               }
+      if (pkey->notify_count) {
+         if (pdb->notify_serial != pheader->open_record_serial || pdb->notify == NULL)
+            db_build_notify_index(hDB);
+
+         /* find first index entry for this key */
+         lo = 0;
+         hi = pdb->num_notify;
+         while (lo < hi) {
+            mid = (lo + hi) / 2;
+            if (pdb->notify[mid].handle < hKey)
+               lo = mid + 1;
+            else
+               hi = mid;
+         }
+
+         for (pe = pdb->notify + lo; pe < pdb->notify + pdb->num_notify && pe->handle == hKey; pe++) {
+            pclient = &pheader->client[pe->client];
+            if (pe->slot < pclient->max_index && pclient->open_record[pe->slot].handle == hKey)
+               db_queue_notify(hDB, pclient->port, hKey, hKeyMod, index);
          }
+      }
 
       if (pkey->parent_keylist == 0 || !bWalk)
          return DB_SUCCESS;
@@ -9569,6 +11172,134 @@ INT db_notify_clients(HNDLE hDB, HNDLE hKeyMod, int index, BOOL bWalk)
 
 #endif                          /* LOCAL_ROUTINES */
 
+/*------------------------------------------------------------------*/
+INT db_flush_notify(INT * millisec)
+/********************************************************************\
+
+  Routine: db_flush_notify
+
+  Purpose: Send hot-link notifications which have been held back for
+           the notify window. Gets called by cm_yield() and
+           rpc_server_thread().
+
+  Input:
+    INT    *millisec        Time the caller is going to wait
+
+  Output:
+    INT    *millisec        Reduced to the notify window if some
+                            notifications are still held back
+
+\********************************************************************/
+{
+#ifdef LOCAL_ROUTINES
+   INT i;
+
+   for (i = 0; i < _database_entries; i++)
+      if (_database[i].attached && _database[i].pending_keys > 0 && _database[i].batch_cnt == 0) {
+         db_lock_database_read(i + 1);
+         db_flush_pending(i + 1, FALSE);
+         db_unlock_database(i + 1);
+
+         if (millisec && _database[i].pending_keys > 0 && *millisec > _notify_window)
+            *millisec = _notify_window;
+      }
+#endif                          /* LOCAL_ROUTINES */
+
+   return DB_SUCCESS;
+}
+
+/*------------------------------------------------------------------*/
+INT db_set_notify_window(INT millisec)
+/********************************************************************\
+
+  Routine: db_set_notify_window
+
+  Purpose: Set the time in ms within which further changes of an open
+           record are collected into one notification. Zero sends a
+           notification for every change.
+
+\********************************************************************/
+{
+   if (millisec < 0)
+      millisec = 0;
+
+#ifdef LOCAL_ROUTINES
+   _notify_window = millisec;
+#endif
+
+   return DB_SUCCESS;
+}
+
+/**dox***************************************************************/
+#endif                          /* DOXYGEN_SHOULD_SKIP_THIS */
+
+/********************************************************************/
+/**
+Start a batch of ODB changes. Hot-link notifications for all changes
+until the matching db_end_batch() are held back and sent as one
+notification per open record, which contains the changed keys.
+Calls can be nested. Changes after db_end_batch() fall into the notify
+window and are sent by cm_yield(), so the program should keep calling
+it, see db_set_value().
+
+\code
+db_begin_batch(hDB);
+for (i = 0; i < n_channels; i++)
+   db_set_value_index(hDB, hKeyDemand, &demand[i], sizeof(float), i, TID_FLOAT, FALSE);
+db_end_batch(hDB);
+\endcode
+@param hDB          ODB handle obtained via cm_get_experiment_database().
+@return DB_SUCCESS, DB_INVALID_HANDLE
+*/
+INT db_begin_batch(HNDLE hDB)
+{
+   if (rpc_is_remote())
+      return rpc_call(RPC_DB_BEGIN_BATCH, hDB);
+
+#ifdef LOCAL_ROUTINES
+   if (hDB > _database_entries || hDB <= 0) {
+      cm_msg(MERROR, "db_begin_batch", "invalid database handle");
+      return DB_INVALID_HANDLE;
+   }
+
+   db_lock_database_read(hDB);
+   _database[hDB - 1].batch_cnt++;
+   db_unlock_database(hDB);
+#endif                          /* LOCAL_ROUTINES */
+
+   return DB_SUCCESS;
+}
+
+/********************************************************************/
+/**
+End a batch of ODB changes started with db_begin_batch() and send the
+hot-link notifications which have been held back.
+@param hDB          ODB handle obtained via cm_get_experiment_database().
+@return DB_SUCCESS, DB_INVALID_HANDLE
+*/
+INT db_end_batch(HNDLE hDB)
+{
+   if (rpc_is_remote())
+      return rpc_call(RPC_DB_END_BATCH, hDB);
+
+#ifdef LOCAL_ROUTINES
+   if (hDB > _database_entries || hDB <= 0) {
+      cm_msg(MERROR, "db_end_batch", "invalid database handle");
+      return DB_INVALID_HANDLE;
+   }
+
+   db_lock_database_read(hDB);
+   if (_database[hDB - 1].batch_cnt > 0 && --_database[hDB - 1].batch_cnt == 0)
+      db_flush_pending(hDB, TRUE);
+   db_unlock_database(hDB);
+#endif                          /* LOCAL_ROUTINES */
+
+   return DB_SUCCESS;
+}
+
+/**dox***************************************************************/
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
 /*------------------------------------------------------------------*/
 void merge_records(HNDLE hDB, HNDLE hKey, KEY * pkey, INT level, void *info)
 {
@@ -10114,6 +11845,157 @@ INT db_check_record(HNDLE hDB, HNDLE hKey, const char *keyname, const char *rec_
    return DB_SUCCESS;
 }
 
+/**dox***************************************************************/
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+/*------------------------------------------------------------------*/
+
+/* An open record keeps the offset of each of its keys in the local
+   structure, so that an update notification which names the changed key
+   and array index only fetches that part of the record. The layout
+   follows db_recurse_record_tree(). Records which contain links are
+   always copied as a whole. */
+
+static BOOL db_map_record(HNDLE hDB, HNDLE hKey, RECORD_LIST * prec, INT * total_size, INT base_align, INT * max_align, BOOL bMap)
+{
+   INT i, align, total_size_tmp, status;
+   HNDLE hSubkey;
+   KEY key;
+
+   for (i = 0;; i++) {
+      status = db_enum_link(hDB, hKey, i, &hSubkey);
+      if (status == DB_NO_MORE_SUBKEYS)
+         break;
+      if (status != DB_SUCCESS || db_get_link(hDB, hSubkey, &key) != DB_SUCCESS || key.type == TID_LINK)
+         return FALSE;
+
+      if (key.type != TID_KEY) {
+         align = 1;
+         if (rpc_tid_size(key.type))
+            align = rpc_tid_size(key.type) < base_align ? rpc_tid_size(key.type) : base_align;
+
+         if (max_align && align > *max_align)
+            *max_align = align;
+
+         *total_size = VALIGN(*total_size, align);
+
+         if (bMap) {
+            RECORD_ITEM *pitem = (RECORD_ITEM *) realloc(prec->items, (prec->num_items + 1) * sizeof(RECORD_ITEM));
+            if (pitem == NULL)
+               return FALSE;
+            prec->items = pitem;
+            pitem += prec->num_items++;
+            pitem->handle = hSubkey;
+            pitem->offset = *total_size;
+            pitem->item_size = key.item_size;
+            pitem->num_values = key.num_values;
+            pitem->type = key.type;
+         }
+
+         *total_size += key.item_size * key.num_values;
+      } else {
+         /* align substructure to its largest member */
+         align = 1;
+         total_size_tmp = *total_size;
+         if (!db_map_record(hDB, hSubkey, prec, &total_size_tmp, base_align, &align, FALSE))
+            return FALSE;
+
+         if (max_align && align > *max_align)
+            *max_align = align;
+
+         *total_size = VALIGN(*total_size, align);
+         if (!db_map_record(hDB, hSubkey, prec, total_size, base_align, NULL, bMap))
+            return FALSE;
+         *total_size = VALIGN(*total_size, align);
+      }
+   }
+
+   return TRUE;
+}
+
+static int record_item_compare(const void *a, const void *b)
+{
+   return ((const RECORD_ITEM *) a)->handle - ((const RECORD_ITEM *) b)->handle;
+}
+
+static void db_build_record_items(HNDLE hDB, HNDLE hKey, RECORD_LIST * prec)
+{
+   INT total_size, max_align;
+   KEY key;
+
+   prec->items = NULL;
+   prec->num_items = 0;
+
+   if (db_get_key(hDB, hKey, &key) != DB_SUCCESS)
+      return;
+
+   if (key.type != TID_KEY) {
+      /* record of a single key */
+      prec->items = (RECORD_ITEM *) malloc(sizeof(RECORD_ITEM));
+      if (prec->items == NULL)
+         return;
+      prec->items->handle = hKey;
+      prec->items->offset = 0;
+      prec->items->item_size = key.item_size;
+      prec->items->num_values = key.num_values;
+      prec->items->type = key.type;
+      prec->num_items = 1;
+      total_size = key.item_size * key.num_values;
+   } else {
+      total_size = max_align = 0;
+      if (db_map_record(hDB, hKey, prec, &total_size, ss_get_struct_align(), &max_align, TRUE))
+         total_size = VALIGN(total_size, max_align);
+      else
+         total_size = -1;
+   }
+
+   /* fall back to copying the whole record if the layout does not match */
+   if (total_size != prec->buf_size || prec->num_items == 0) {
+      free(prec->items);
+      prec->items = NULL;
+      prec->num_items = 0;
+      return;
+   }
+
+   qsort(prec->items, prec->num_items, sizeof(RECORD_ITEM), record_item_compare);
+}
+
+static BOOL db_update_record_items(HNDLE hDB, RECORD_LIST * prec, INT num_keys, const INT * hKey, const INT * index)
+/* fetch the changed keys of a record, return FALSE if the whole record has to be copied */
+{
+   RECORD_ITEM *pitem, item;
+   INT k, size, status;
+
+   if (prec->items == NULL)
+      return FALSE;
+
+   for (k = 0; k < num_keys; k++) {
+      item.handle = hKey[k];
+      pitem = (RECORD_ITEM *) bsearch(&item, prec->items, prec->num_items, sizeof(RECORD_ITEM), record_item_compare);
+      if (pitem == NULL)
+         return FALSE;
+
+      if (index[k] >= 0 && index[k] < pitem->num_values) {
+         size = pitem->item_size;
+         status = db_get_data_index(hDB, pitem->handle, (char *) prec->data + pitem->offset + index[k] * pitem->item_size,
+                                    &size, index[k], pitem->type);
+      } else {
+         size = pitem->item_size * pitem->num_values;
+         status = db_get_data(hDB, pitem->handle, (char *) prec->data + pitem->offset, &size, pitem->type);
+         if (status == DB_SUCCESS && size != pitem->item_size * pitem->num_values)
+            return FALSE;
+      }
+
+      if (status != DB_SUCCESS)
+         return FALSE;
+   }
+
+   return TRUE;
+}
+
+/**dox***************************************************************/
+#endif                          /* DOXYGEN_SHOULD_SKIP_THIS */
+
 /********************************************************************/
 /**
 Open a record. Create a local copy and maintain an automatic update.
@@ -10303,6 +12185,10 @@ INT db_open_record(HNDLE hDB, HNDLE hKey, void *ptr, INT rec_size,
    _record_list[idx].dispatcher = dispatcher;
    _record_list[idx].info = info;
 
+   /* map keys to record offsets for partial updates */
+   if ((access_mode & MODE_WRITE) == 0 && data != NULL)
+      db_build_record_items(hDB, hKey, &_record_list[idx]);
+
    /* add record entry in database structure */
    return db_add_open_record(hDB, hKey, (WORD) (access_mode & ~MODE_ALLOC));
 }
@@ -10392,6 +12278,8 @@ INT db_close_record(HNDLE hDB, HNDLE hKey)
          _record_list[i].copy = NULL;
       }
 
+      free(_record_list[i].items);
+
       memset(&_record_list[i], 0, sizeof(RECORD_LIST));
    }
 #endif                          /* LOCAL_ROUTINES */
@@ -10422,6 +12310,8 @@ INT db_close_all_records()
             _record_list[i].data = NULL;
          }
 
+         free(_record_list[i].items);
+
          memset(&_record_list[i], 0, sizeof(RECORD_LIST));
       }
    }
@@ -10449,7 +12339,26 @@ If called from a server, send a network notification to the client.
 */
 INT db_update_record(INT hDB, INT hKeyRoot, INT hKey, int index, int s)
 {
-   INT i, size, convert_flags, status;
+   return db_update_record_list(hDB, hKeyRoot, 1, &hKey, &index, s);
+}
+
+/********************************************************************/
+/**
+Same as db_update_record() for a notification which carries several
+changed keys below hKeyRoot. Open records fetch only the changed keys
+and array elements if their layout is known, otherwise the whole record
+is read once. Watch dispatchers are called for every changed key.
+@param hDB          ODB handle obtained via cm_get_experiment_database().
+@param hKeyRoot     Handle of the open record.
+@param num_keys     Number of changed keys.
+@param hKey         Handles of keys which changed.
+@param index        Indices for array keys.
+@param s            optional server socket.
+@return DB_SUCCESS, DB_INVALID_HANDLE
+*/
+INT db_update_record_list(INT hDB, INT hKeyRoot, INT num_keys, const INT *hKey, const INT *index, int s)
+{
+   INT i, k, size, convert_flags, status;
    char buffer[32];
    NET_COMMAND *nc;
 
@@ -10457,30 +12366,33 @@ INT db_update_record(INT hDB, INT hKeyRoot, INT hKey, int index, int s)
    if (s) {
       convert_flags = rpc_get_server_option(RPC_CONVERT_FLAGS);
 
-      if (convert_flags & CF_ASCII) {
-         sprintf(buffer, "MSG_ODB&%d&%d%d%d", hDB, hKeyRoot, hKey, index);
-         send_tcp(s, buffer, strlen(buffer) + 1, 0);
-      } else {
-         nc = (NET_COMMAND *) buffer;
-
-         nc->header.routine_id = MSG_ODB;
-         nc->header.param_size = 4 * sizeof(INT);
-         *((INT *) nc->param) = hDB;
-         *((INT *) nc->param + 1) = hKeyRoot;
-         *((INT *) nc->param + 2) = hKey;
-         *((INT *) nc->param + 3) = index;
+      /* the client protocol carries one key per message */
+      for (k = 0; k < num_keys; k++) {
+         if (convert_flags & CF_ASCII) {
+            sprintf(buffer, "MSG_ODB&%d&%d%d%d", hDB, hKeyRoot, hKey[k], index[k]);
+            send_tcp(s, buffer, strlen(buffer) + 1, 0);
+         } else {
+            nc = (NET_COMMAND *) buffer;
+
+            nc->header.routine_id = MSG_ODB;
+            nc->header.param_size = 4 * sizeof(INT);
+            *((INT *) nc->param) = hDB;
+            *((INT *) nc->param + 1) = hKeyRoot;
+            *((INT *) nc->param + 2) = hKey[k];
+            *((INT *) nc->param + 3) = index[k];
+
+            if (convert_flags) {
+               rpc_convert_single(&nc->header.routine_id, TID_DWORD, RPC_OUTGOING, convert_flags);
+               rpc_convert_single(&nc->header.param_size, TID_DWORD, RPC_OUTGOING, convert_flags);
+               rpc_convert_single(&nc->param[0], TID_DWORD, RPC_OUTGOING, convert_flags);
+               rpc_convert_single(&nc->param[4], TID_DWORD, RPC_OUTGOING, convert_flags);
+               rpc_convert_single(&nc->param[8], TID_DWORD, RPC_OUTGOING, convert_flags);
+               rpc_convert_single(&nc->param[12], TID_DWORD, RPC_OUTGOING, convert_flags);
+            }
 
-         if (convert_flags) {
-            rpc_convert_single(&nc->header.routine_id, TID_DWORD, RPC_OUTGOING, convert_flags);
-            rpc_convert_single(&nc->header.param_size, TID_DWORD, RPC_OUTGOING, convert_flags);
-            rpc_convert_single(&nc->param[0], TID_DWORD, RPC_OUTGOING, convert_flags);
-            rpc_convert_single(&nc->param[4], TID_DWORD, RPC_OUTGOING, convert_flags);
-            rpc_convert_single(&nc->param[8], TID_DWORD, RPC_OUTGOING, convert_flags);
-            rpc_convert_single(&nc->param[12], TID_DWORD, RPC_OUTGOING, convert_flags);
+            /* send the update notification to the client */
+            send_tcp(s, buffer, sizeof(NET_COMMAND_HEADER) + 4 * sizeof(INT), 0);
          }
-
-         /* send the update notification to the client */
-         send_tcp(s, buffer, sizeof(NET_COMMAND_HEADER) + 4 * sizeof(INT), 0);
       }
 
       return DB_SUCCESS;
@@ -10496,7 +12408,8 @@ INT db_update_record(INT hDB, INT hKeyRoot, INT hKey, int index, int s)
          /* get updated data if record not opened in write mode */
          if ((_record_list[i].access_mode & MODE_WRITE) == 0) {
             size = _record_list[i].buf_size;
-            if (_record_list[i].data != NULL) {
+            if (_record_list[i].data != NULL &&
+                !db_update_record_items(hDB, &_record_list[i], num_keys, hKey, index)) {
                status = db_get_record(hDB, hKeyRoot, _record_list[i].data, &size, 0); // db_open_record() update
                //printf("db_open_record update status %d, size %d %d\n", status, _record_list[i].buf_size, size);
             }
@@ -10513,8 +12426,9 @@ INT db_update_record(INT hDB, INT hKeyRoot, INT hKey, int index, int s)
          status = DB_SUCCESS;
          
          /* call dispatcher if requested */
-         if (_watch_list[i].dispatcher)
-            _watch_list[i].dispatcher(hDB, hKey, index, _watch_list[i].info);
+         for (k = 0; k < num_keys; k++)
+            if (_watch_list[i].dispatcher)
+               _watch_list[i].dispatcher(hDB, hKey[k], index[k], _watch_list[i].info);
       }
 
    return status;
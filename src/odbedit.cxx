@@ -85,6 +85,7 @@ void print_help(char *command)
       printf("chmod <mode> <key>      - change access mode of a key\n");
       printf("                          1=read | 2=write | 4=delete\n");
       printf("cleanup [client] [-f]   - delete hanging clients [force]\n");
+      printf("compact                 - defragment free memory of the database\n");
       printf("copy <src> <dest>       - copy a subtree to a new location\n");
       printf("create <type> <key>     - create a key of a certain type\n");
       printf("create <type> <key>[n]  - create an array of size [n]\n");
@@ -104,7 +105,7 @@ void print_help(char *command)
       printf("jsvalues                - print \"get_values\" encoding of current directory\n");
       printf("ln <source> <linkname>  - create a link to <source> key\n");
       printf
-          ("load <file>             - load database from .ODB file at current position\n");
+          ("load <file>             - load database from .ODB, .xml or .bin file at current position\n");
       printf("-- hit return for more --\r");
       getchar();
       printf("ls/dir [-lhvrp] [<pat>] - show database entries which match pattern\n");
@@ -133,6 +134,7 @@ void print_help(char *command)
       printf("  -s                      as a #define'd string\n");
       printf("  -x                      as an XML file, or use file.xml\n");
       printf("  -j                      as a JSON file, or use file.json\n");
+      printf("  file.bin                as a binary snapshot\n");
       printf("set <key> <value>       - set the value of a key\n");
       printf("set <key>[i] <value>    - set the value of index i\n");
       printf("set <key>[*] <value>    - set the value of all indices of a key\n");
@@ -1629,6 +1631,17 @@ int command_loop(char *host_name, char *exp_name, char *cmd, char *start_dir)
          db_create_link(hDB, 0, str, param[1]);
       }
 
+      /* compact */
+      else if (param[0][0] == 'c' && param[0][1] == 'o' && param[0][2] == 'm') {
+         if (rpc_is_remote())
+            printf("This function works only locally\n");
+         else {
+            status = db_compact(hDB, &i);
+            if (status == DB_SUCCESS)
+               printf("Moved %d bytes of data, use \"mem\" to show free memory\n", i);
+         }
+      }
+
       /* copy */
       else if (param[0][0] == 'c' && (param[0][1] == 'o' || param[0][1] == 'p')) {
          /* test if destination exists */
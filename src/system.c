@@ -35,6 +35,10 @@ The Midas System file
  *
  *  @{  */
 
+#ifdef OS_LINUX
+#define _GNU_SOURCE             /* for pthread_setaffinity_np() */
+#endif
+
 #include <stdio.h>
 #include <math.h>
 
@@ -2154,6 +2158,37 @@ INT ss_thread_kill(midas_thread_t thread_id)
 #endif
 }
 
+/********************************************************************/
+/**
+Bind a thread to a single CPU, so that for example several readout
+threads of a frontend do not compete for the same core.
+The thread id is returned by ss_thread_create() on creation.
+@param thread_id the thread id of the thread to be bound.
+@param cpu number of the CPU starting from zero.
+@return SS_SUCCESS if no error, else SS_NO_THREAD
+*/
+INT ss_thread_set_affinity(midas_thread_t thread_id, INT cpu)
+{
+#if defined(OS_LINUX)
+
+   INT status;
+   cpu_set_t cpu_set;
+
+   if (cpu < 0 || cpu >= CPU_SETSIZE)
+      return SS_NO_THREAD;
+
+   CPU_ZERO(&cpu_set);
+   CPU_SET(cpu, &cpu_set);
+   status = pthread_setaffinity_np(thread_id, sizeof(cpu_set), &cpu_set);
+   return status == 0 ? SS_SUCCESS : SS_NO_THREAD;
+
+#else
+
+   return SS_NO_THREAD;
+
+#endif
+}
+
 /*------------------------------------------------------------------*/
 static INT skip_semaphore_handle = -1;
 static int semaphore_trace = 0;
@@ -3950,7 +3985,7 @@ INT ss_suspend(INT millisec, INT msg)
    INT idx, status, i, return_status;
    unsigned int size;
    struct sockaddr from_addr;
-   char buffer[80], buffer_tmp[80];
+   char buffer[IPC_MSG_SIZE], buffer_tmp[IPC_MSG_SIZE];
 
    /* get index to _suspend_struct for this thread */
    status = ss_suspend_get_index(&idx);
@@ -4164,8 +4199,8 @@ INT ss_suspend(INT millisec, INT msg)
                    recvfrom(_suspend_struct[idx].ipc_recv_socket, buffer_tmp, sizeof(buffer_tmp), 0, &from_addr, &size);
 #endif
 
-               /* don't forward same MSG_BM as above */
-               if (buffer_tmp[0] != 'B' || strcmp(buffer_tmp, buffer) != 0)
+               /* don't forward same MSG_BM or MSG_ODB as above */
+               if ((buffer_tmp[0] != 'B' && buffer_tmp[0] != 'O') || strcmp(buffer_tmp, buffer) != 0)
                   if (_suspend_struct[idx].ipc_dispatch) {
                      _suspend_struct[idx].ipc_dispatch(buffer_tmp, server_socket);
                      // ipc_dispatch actually calls - cm_dispatch_ipc(buffer_tmp, server_socket);
@@ -4246,6 +4281,79 @@ INT ss_resume(INT port, const char *message)
    return SS_SUCCESS;
 }
 
+/*------------------------------------------------------------------*/
+INT ss_futex_wait(INT * address, INT value, INT millisec)
+/********************************************************************\
+
+  Routine: ss_futex_wait
+
+  Purpose: Wait until another process calls ss_futex_wake on the
+     same address in shared memory. Returns immediately if the
+     word at address does not contain value anymore, so the
+     caller has to read value before checking its wait condition.
+     On systems without futexes, this just sleeps for millisec.
+
+  Input:
+    INT    *address         Address of word in shared memory
+    INT    value            Expected value of word
+    INT    millisec         Timeout in milliseconds
+
+  Output:
+    none
+
+  Function value:
+    SS_SUCCESS              Woken up or value has changed
+    SS_TIMEOUT              Timeout expired
+
+\********************************************************************/
+{
+#ifdef HAVE_SS_FUTEX
+   struct timespec timeout;
+   int status;
+
+   timeout.tv_sec = millisec / 1000;
+   timeout.tv_nsec = (millisec % 1000) * 1000000;
+
+   status = syscall(SYS_futex, address, FUTEX_WAIT, value, &timeout, NULL, 0);
+
+   if (status == -1 && errno == ETIMEDOUT)
+      return SS_TIMEOUT;
+
+   /* EAGAIN (value has changed) and EINTR are treated like a wake-up */
+   return SS_SUCCESS;
+#else
+   ss_sleep(millisec);
+   return SS_TIMEOUT;
+#endif
+}
+
+/*------------------------------------------------------------------*/
+INT ss_futex_wake(INT * address)
+/********************************************************************\
+
+  Routine: ss_futex_wake
+
+  Purpose: Wake up all processes waiting in ss_futex_wait on address.
+     The caller has to change the word at address before, otherwise
+     a process which is just about to wait will miss the wake-up.
+
+  Input:
+    INT    *address         Address of word in shared memory
+
+  Output:
+    none
+
+  Function value:
+    SS_SUCCESS              Successful completion
+
+\********************************************************************/
+{
+#ifdef HAVE_SS_FUTEX
+   syscall(SYS_futex, address, FUTEX_WAKE, 0x7FFFFFFF, NULL, NULL, 0);
+#endif
+   return SS_SUCCESS;
+}
+
 /*------------------------------------------------------------------*/
 /********************************************************************\
 *                                                                    *
@@ -590,7 +590,7 @@ int main(int argc, char **argv)
 	data_fmt = FORMAT_MIDAS;
       else if (equal_ustring(pext + 1, "ybs"))
 	data_fmt = FORMAT_YBOS;
-      else if (equal_ustring(pext + 1, "gz")) {
+      else if (equal_ustring(pext + 1, "gz") || equal_ustring(pext + 1, "zst")) {
 	if ((pext = strchr(rep_file, '.')) != 0) {
 	  if (strstr(pext + 1, "mid"))
 	    data_fmt = FORMAT_MIDAS;